@@ -0,0 +1,22 @@
+/**
+ * @file batch.h
+ * @brief 複数の操作をまとめて1度のロックで反映するコマンドに関する宣言と説明。
+ *
+ * stdinから追加、削除、移動、延長、検索の操作を読み込み、データベースを
+ * 1度だけロックして、読み込んだ順番に適用する。\n
+ * 操作はメモリ上のスケジュール群に順番に適用され、後の操作は前の操作の
+ * 結果を見て重複を確認する。データベースへの書き込みは最後の1度だけ行う。
+ */
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+/**
+ * @brief 複数の操作をまとめて1度のロックで反映する。
+ * @param[in] argc argc値
+ * @param[in] argv argv値
+ * @return 成功時は0、失敗時には1、使用方法に誤りがある場合は2、失敗した
+ * 操作がある場合は3を返す。
+ */
+int batch(int argc, char* argv[]);
+
+#endif
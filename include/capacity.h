@@ -0,0 +1,21 @@
+/**
+ * @file capacity.h
+ * @brief データベースのcapacityの設定に関する宣言と説明。
+ *
+ * capacityは、1つのデータベースで同時に重なることができるスケジュールの数です。
+ * 同じ種類の資源を複数まとめて、1つのデータベースで管理できます。\n
+ * 重複の確認や空き時間の検索は、同時に重なっているスケジュールの数が
+ * capacity未満かどうかで行われます。
+ */
+#ifndef _CAPACITY_H_
+#define _CAPACITY_H_
+
+/**
+ * @brief データベースのcapacityを出力、または設定する。
+ * @param[in] argc argc値
+ * @param[in] argv argv値
+ * @return 成功時は0、失敗時には1、使用方法に誤りがある場合は2を返す。
+ */
+int capacity(int argc, char* argv[]);
+
+#endif
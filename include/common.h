@@ -6,13 +6,37 @@
  * データベースは、各プロセスグループのスケジュールを1レコードとして記録した
  * もので、共有メモリ上に記録される。\n
  * スケジュールは、schedule構造体の内容を文字列で表したもので、\n
- * pgid,lock,terminator,start,duration,captionの順に、値をコロン(:)でつなげた書式である。\n
+ * pgid,lock,terminator,start,duration,attrs,captionの順に、値をコロン(:)で
+ * つなげた書式である。\n
+ * attrsは、追加の属性をkey=valueの形でセミコロン(;)でつなげたもので、
+ * 属性がない場合は空文字列となる。\n
  * 記録するスケジュール数の上限は、MAX_NUM_SCHEDULES値で指定される。\n
+ *
+ * - 繰り返しスケジュール\n
+ * rule属性にcrontab形式の時刻指定を持つスケジュールは、start値以降の、
+ * 時刻指定に一致するすべての時刻から、duration秒間のスケジュールを表す。\n
+ * データベースには1レコードとして記録され、重複の確認や空き時間の検索、
+ * 出力の際に、必要な範囲だけ展開される。\n
+ *
+ * - ヘッダ\n
+ * #で始まる行は、#key:valueの書式でデータベース全体の設定を表す。\n
+ * capacityは、同時に重なることができるスケジュールの数で、省略時は1である。\n
+ *
+ * - 資源\n
+ * res属性に資源名をカンマ(,)でつなげた集合を持つスケジュールは、
+ * それらの資源だけを占有する。res属性がないスケジュールは、データベース全体
+ * (すべての資源)を占有する。\n
+ * 重複の確認と空き時間の検索は資源ごとに行われ、capacityは資源ごとの
+ * 同時に重なることができるスケジュールの数となる。複数の資源を持つ
+ * スケジュールは、1レコードとして記録されるので、すべての資源がまとめて
+ * 確保される。\n
  */
 
 #ifndef _COMMON_H_
 #define _COMMON_H_
 
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
 
@@ -76,6 +100,88 @@
  */
 #define MAX_SCHEDULE_STRING_LEN 512
 
+/**
+ * @def MAX_RULE_LEN
+ * @brief schedule構造体のruleの最大文字数(終端文字列含む。)
+ */
+#define MAX_RULE_LEN 128
+
+/**
+ * @def MAX_RESOURCES_LEN
+ * @brief 資源の集合の文字列の最大文字数。(終端文字列を含む。)
+ */
+#define MAX_RESOURCES_LEN 128
+
+/**
+ * @def MAX_NUM_RESOURCES
+ * @brief 1つのスケジュールが持つことができる資源の数の上限。
+ */
+#define MAX_NUM_RESOURCES 8
+
+/**
+ * @def RECUR_HORIZON
+ * @brief 繰り返しスケジュールを追加する際に、重複を確認する期間(sec)
+ */
+#define RECUR_HORIZON (60*60*24*7)
+
+/**
+ * @def DEFAULT_CAPACITY
+ * @brief データベースに同時に重なることができるスケジュール数の初期値。
+ */
+#define DEFAULT_CAPACITY 1
+
+/**
+ * @def MAX_CAPACITY
+ * @brief データベースに同時に重なることができるスケジュール数の上限。
+ */
+#define MAX_CAPACITY 64
+
+/**
+ * @def HEADER_PREFIX
+ * @brief データベースのヘッダ行の先頭文字。
+ */
+#define HEADER_PREFIX '#'
+
+/**
+ * @def CAPACITY_KEY
+ * @brief ヘッダのうち、capacityを表すキー。
+ */
+#define CAPACITY_KEY "capacity"
+
+/**
+ * @def GENERATION_KEY
+ * @brief ヘッダのうち、データベースを書き換えるたびに増える世代番号を表すキー。
+ * 常に共有メモリの先頭の行に置かれる。
+ */
+#define GENERATION_KEY "gen"
+
+/**
+ * @def NEXT_ID_KEY
+ * @brief ヘッダのうち、次に割り当てるスケジュールIDを表すキー。
+ */
+#define NEXT_ID_KEY "next_id"
+
+/**
+ * @def REAPER_KEY
+ * @brief ヘッダのうち、終了したプロセスグループのスケジュールを取り除く
+ * デーモン(reaper)のpid値を表すキー。動いていない場合は0。
+ */
+#define REAPER_KEY "reaper"
+
+/**
+ * @def REAPER_START_KEY
+ * @brief ヘッダのうち、reaperの開始時刻を表すキー。pid値が再利用された
+ * 場合に、別のプロセスをreaperとみなさないために使う。
+ */
+#define REAPER_START_KEY "reaper_st"
+
+/**
+ * @def RESIZE_SIGNO
+ * @brief 伸縮するスケジュールの継続時間を変更したことを、終了機能の
+ * プロセス(terminator)に知らせるシグナル。
+ */
+#define RESIZE_SIGNO SIGUSR1
+
 /**
  * @def MAX_RECORD_STRING_LEN
  * @brief 共有メモリに保存される、スケジュールの内容を含んだレコードの最大文字数。
@@ -83,6 +189,19 @@
  */
 #define MAX_RECORD_STRING_LEN 510
 
+/**
+ * @enum error_code
+ * @brief 共通部分の関数が失敗した理由の種類。\sa report_error()
+ */
+enum error_code {
+  ERROR_NONE = 0,  /**< エラーなし */
+  ERROR_SYSTEM,  /**< システムコールの失敗 */
+  ERROR_MEMORY,  /**< メモリの確保の失敗 */
+  ERROR_INVALID,  /**< 引数や入力の値が不正 */
+  ERROR_FORMAT,  /**< データベースの内容が不正 */
+  ERROR_FULL,  /**< スケジュール数やデータベースの大きさが上限に達した */
+};
+
 /**
  * @struct schedule
  * @brief スケジュールに関する情報を保持する構造体
@@ -94,20 +213,202 @@ struct schedule {
   time_t start;  /**< 開始時刻 */
   unsigned int duration;  /**< 継続時間(sec) */
   char caption[MAX_CAPTION_LEN];  /**< スケジュール内容の簡単な説明(改行混入不可)*/
+  char rule[MAX_RULE_LEN];  /**< 繰り返しの時刻指定(crontab形式)。繰り返さない場合は空文字列 */
+  char resources[MAX_RESOURCES_LEN];  /**< 占有する資源の集合(カンマ区切り)。データベース全体の場合は空文字列 */
+  unsigned int min_duration;  /**< 伸縮する場合の最小の継続時間(sec)。伸縮しない場合は0 */
+  unsigned int max_duration;  /**< 伸縮する場合の最大の継続時間(sec)。伸縮しない場合は0 */
+  int early;  /**< 空きができたら開始時刻より早く開始してよい場合は1 */
+  char after[MAX_CAPTION_LEN];  /**< 先に終わるのを待つスケジュールのpgid値またはcaption。待たない場合は空文字列 */
+  uint64_t id;  /**< スケジュールID。データベースに書き込む時に割り当てられる。未割り当ての場合は0 */
+  uint64_t leader_start;  /**< プロセスグループのリーダーの開始時刻(get_process_start()の値)。スケジュールIDを割り当てる時に1度だけ記録される。不明な場合は0 */
+};
+
+/**
+ * @struct expansion
+ * @brief 繰り返しスケジュールを展開したスケジュール群。
+ * \sa expand_schedules()
+ */
+struct expansion {
+  struct schedule* *scheds;  /**< 展開後のスケジュール群 */
+  size_t len;  /**< schedsの配列数 */
+  struct schedule *occurrences;  /**< 展開で作成したスケジュールの領域 */
+  struct schedule* *ends;  /**< init_gap_iterator()の作業領域 */
+};
+
+/**
+ * @struct probe
+ * @brief 重複を調べる候補の範囲1つ分。\sa probe_schedules()
+ */
+struct probe {
+  time_t start;  /**< 候補の開始時刻 */
+  unsigned int duration;  /**< 候補の継続時間(sec) */
+  struct schedule *conflict;  /**< 重複するスケジュール。重複しない場合はNULL */
+};
+
+/**
+ * @struct gap_iterator
+ * @brief スケジュール群の空き時間を、先頭から順に取得するための状態。
+ * \sa init_gap_iterator(), next_gap()
+ */
+struct gap_iterator {
+  struct schedule* *scheds;  /**< start値で昇順ソートされたスケジュール群 */
+  size_t len;  /**< schedsの配列数 */
+  size_t index;  /**< 次に調べるschedsの添字 */
+  time_t head;  /**< 調べ終わった時刻 */
+  time_t end;  /**< 検索範囲の終了時刻 */
+  unsigned int capacity;  /**< 同時に重なることができるスケジュール数 */
+  const char *resources;  /**< 空きを調べる資源の集合。空文字列の場合はデータベース全体 */
+  struct schedule* *ends;  /**< 終了時刻で昇順ソートしたスケジュール群。capacityが2以上の場合に使う。 */
+  size_t end_index;  /**< 次に調べるendsの添字 */
+  int counts[MAX_NUM_RESOURCES];  /**< 資源ごとの、headで重なっているスケジュール数 */
 };
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+  /**
+   * @brief エラーメッセージの出力先を設定する。
+   *
+   * 初期値はNULLで、何も出力しない。tmコマンドは起動時にstderrを設定する。
+   * libtmから使う場合は出力せず、エラーの種類だけを記録する。
+   *
+   * @param[in] fp 出力先。NULLの場合は出力しない。
+   */
+  void set_error_output(FILE *fp);
+
+  /**
+   * @brief エラーの種類を記録し、出力先が設定されていればメッセージを出力する。
+   *
+   * 共通部分の関数は、エラーをこの関数で報告してから-1を返す。
+   * エラーの種類は、呼び出したスレッドごとに記録される。
+   *
+   * @param[in] code   エラーの種類。
+   * @param[in] format メッセージの書式(printf形式)。
+   */
+  void report_error(enum error_code code, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+  /**
+   * @brief 呼び出したスレッドで、最後に記録したエラーの種類を取得する。
+   * @return エラーの種類。記録がない場合はERROR_NONEを返す。
+   */
+  enum error_code get_last_error();
+
+  /**
+   * @brief 呼び出したスレッドのエラーの記録を消す。
+   */
+  void clear_last_error();
+
+  /**
+   * @brief 早く開始してよいスケジュールの開始時刻を、直前の空き時間の
+   * 始まりまで早める。
+   *
+   * nowから開始時刻までの空き時間のうち、開始時刻まで続いているものがあれば、
+   * その始まりを新しい開始時刻とする。継続時間は変えないので、終了時刻も
+   * 同じだけ早まる。同じpgid値のスケジュールは空きとみなす。繰り返し
+   * スケジュールは早めない。
+   *
+   * @param[in,out] sched    早めるスケジュール
+   * @param[in]     scheds   データベースのスケジュール群
+   * @param[in]     len      scheds配列の個数
+   * @param[in]     capacity 同時に重なることができるスケジュール数
+   * @param[in]     now      現在時刻。これより前には早めない。
+   * @return 早めた場合は1を、早めなかった場合は0を、失敗時には-1を返す。
+   */
+  int advance_early_schedule(struct schedule* sched, struct schedule* *scheds,
+			     size_t len, unsigned int capacity, time_t now);
+
+  /**
+   * @brief スケジュールを、現在時刻以降で継続時間が収まる最も早い時刻に
+   * 置き直す。
+   *
+   * 同じpgid値のスケジュールは空きとみなす。
+   *
+   * @param[in,out] sched    置き直すスケジュール
+   * @param[in]     scheds   データベースのスケジュール群
+   * @param[in]     len      scheds配列の個数
+   * @param[in]     capacity 同時に重なることができるスケジュール数
+   * @param[in]     now      現在時刻
+   * @return 成功時は0を、@link RECUR_HORIZON @endlink 秒以内に収まる時刻が
+   * ない場合は1を、失敗時には-1を返す。
+   */
+  int anchor_schedule(struct schedule* sched, struct schedule* *scheds,
+		      size_t len, unsigned int capacity, time_t now);
+
   /**
    * @brief スケジュールが、スケジュール群の中のスケジュールと重複していないか確認する。
+   *
+   * 繰り返しスケジュールは展開して確認する。schedが繰り返しスケジュールの場合は、
+   * start値から@link RECUR_HORIZON @endlink 秒間の繰り返しを確認する。
+   *
    * @param[in] sched 重複を確認するスケジュール 
    * @param[in] scheds 確認される側のスケジュール群
    * @param[in] len scheds配列の個数
    * @return 重複がない場合は0を、重複がある場合は1を返す。
    */
   int check_sched_conflict(struct schedule* sched, struct schedule* *scheds, size_t len);
+
+  /**
+   * @brief スケジュールを追加すると、同時に重なるスケジュール数がcapacityを
+   * 超えないか確認する。
+   *
+   * 確認はスケジュールの資源ごとに、その資源を占有するスケジュールだけを
+   * 対象に行う。重なるスケジュールの開始、終了時刻を時刻順に走査して、
+   * 同時に重なる数を求める。
+   *
+   * @param[in] sched    確認するスケジュール
+   * @param[in] scheds   確認される側のスケジュール群
+   * @param[in] len      scheds配列の個数
+   * @param[in] capacity 同時に重なることができるスケジュール数
+   * @return 超えない場合は0を、超える場合は1を、失敗時には-1を返す。
+   */
+  int check_sched_capacity(struct schedule* sched, struct schedule* *scheds,
+			   size_t len, unsigned int capacity);
+
+  /**
+   * @brief 資源の集合の書式を確認する。
+   *
+   * 資源名は英数字、'_'、'-'、'.'からなり、カンマ(,)でつなげる。
+   *
+   * @param[in] resources 資源の集合。
+   * @return 正しい場合は0、不正な場合は-1を返す。
+   */
+  int check_resource_set(const char *resources);
+
+  /**
+   * @brief 伸縮するスケジュールを縮めて、スケジュールを追加する空きを作る。
+   *
+   * schedと重なる、伸縮するスケジュールのうち、開始時刻の遅いものから順に、
+   * schedの開始時刻(過去の場合は現在時刻)で終わるように縮める。
+   * 最小の継続時間より短くはしない。空きができた時点で止める。\n
+   * 繰り返しスケジュールは、縮めることも、縮めさせることもしない。
+   *
+   * @param[in]     sched    追加するスケジュール
+   * @param[in,out] scheds   縮められる側のスケジュール群
+   * @param[in]     len      scheds配列の個数
+   * @param[in]     capacity 同時に重なることができるスケジュール数
+   * @param[out]    changed  縮めたスケジュールが反映される。lenの配列数が必要。
+   * @param[out]    nchanged changedの配列数が反映される。
+   * @return 空きができた場合は0を、できない場合は1を、失敗時には-1を返す。
+   * 0以外の場合は、縮めたスケジュールを元に戻す。
+   */
+  int shrink_elastic_schedules(struct schedule* sched,
+			       struct schedule* *scheds, size_t len,
+			       unsigned int capacity,
+			       struct schedule* *changed, size_t *nchanged);
+
+  /**
+   * @brief 範囲内で同時に重なっているスケジュール数の最大値を求める。
+   * @param[in] scheds 対象のスケジュール群。繰り返しスケジュールは含まない。
+   * @param[in] len    schedsの配列数。
+   * @param[in] pgid   このpgid値のスケジュールは数えない。
+   * @param[in] start  範囲の開始時刻。
+   * @param[in] end    範囲の終了時刻。
+   * @return 同時に重なっているスケジュール数の最大値。
+   */
+  unsigned int count_max_overlap(struct schedule* *scheds, size_t len,
+				 pid_t pgid, time_t start, time_t end);
   
   /**
    * @brief スケジュール構造体群のメモリをそれぞれ解放する。
@@ -116,6 +417,29 @@ extern "C" {
    */
   void cleanup_schedules(struct schedule* *scheds, size_t len);
 
+  /**
+   * @brief expand_schedules()で確保したメモリを解放する。
+   * @param[in] ex 解放するexpansion構造体。
+   */
+  void cleanup_expansion(struct expansion *ex);
+
+  /**
+   * @brief after値に一致する、終わっていないスケジュールの終了時刻を求める。
+   *
+   * after値が数字の場合はpgid値、それ以外の場合はcaptionと比べる。
+   * 一致するスケジュールが複数ある場合は、最も遅い終了時刻を求める。
+   *
+   * @param[in]  sched  after値を持つスケジュール。同じpgid値のスケジュールは
+   * 対象にしない。
+   * @param[in]  scheds データベースのスケジュール群
+   * @param[in]  len    scheds配列の個数
+   * @param[in]  now    現在時刻。これ以前に終わったスケジュールは対象にしない。
+   * @param[out] end    終了時刻が反映される。
+   * @return 見つかった場合は1を、見つからない場合は0を返す。
+   */
+  int find_predecessor(const struct schedule* sched, struct schedule* *scheds,
+		       size_t len, time_t now, time_t *end);
+
   /**
    * @brief 引数を元にスケジュール構造体を作成する。
    * @attention 戻り値のスケジュール構造体は、メモリを動的に確保しているので、
@@ -144,6 +468,171 @@ extern "C" {
   void debug_schedule(const char* comment, struct schedule* *scheds,
 		      size_t len);
 
+  /**
+   * @brief 繰り返しスケジュールを、指定された範囲と重なる1回分ずつのスケジュー
+   * ルに展開する。
+   *
+   * 繰り返しでないスケジュールは、そのままex->schedsに含まれる。
+   * 展開したスケジュールのrule値は空文字列となる。
+   *
+   * @attention ex->schedsはschedsの要素を参照しているので、schedsより先に
+   * cleanup_expansion()で解放する必要がある。
+   * @param[in]  scheds 展開するスケジュール群。
+   * @param[in]  len    schedsの配列数。
+   * @param[in]  begin  展開する範囲の開始時刻。
+   * @param[in]  end    展開する範囲の終了時刻。
+   * @param[out] ex     展開したスケジュール群が反映される。
+   * @return 成功時は0、失敗時には-1を返す。
+   */
+  int expand_schedules(struct schedule* *scheds, size_t len, time_t begin,
+		       time_t end, struct expansion *ex);
+
+  /**
+   * @brief 展開したスケジュール群から、空き時間を取得するための状態を初期化する。
+   *
+   * 空き時間は、resourcesのすべての資源で、同時に重なるスケジュール数が
+   * capacity未満の時間である。ex->schedsからpgidのスケジュールを除き、
+   * start値で昇順ソートする。作業領域はexのものを使うので、メモリの確保は
+   * しない。
+   *
+   * @param[out]    it       初期化する状態。
+   * @param[in,out] ex       対象となるスケジュール群。\sa expand_schedules()
+   * @param[in]     pgid     このpgid値のスケジュールは除く。0の場合は除かない。
+   * @param[in]     begin    空き時間を検索する開始時刻。
+   * @param[in]     end      空き時間を検索する終了時刻。
+   * @param[in]     capacity 同時に重なることができるスケジュール数。
+   * @param[in]     resources 空きを調べる資源の集合。NULLまたは空文字列の場合は
+   * データベース全体。itの使用中は保持しておく必要がある。
+   */
+  void init_gap_iterator(struct gap_iterator *it, struct expansion *ex,
+			 pid_t pgid, time_t begin, time_t end,
+			 unsigned int capacity, const char *resources);
+
+  /**
+   * @brief 次の空き時間を取得する。
+   *
+   * メモリの確保はせず、繰り返し呼び出しても、schedsは全体で1度だけ走査される。
+   *
+   * @param[in,out] it    状態。\sa init_gap_iterator()
+   * @param[out]    start 空き時間の開始時刻が反映される。
+   * @param[out]    end   空き時間の終了時刻が反映される。
+   * @return 見つかった場合は0を、検索範囲の終わりに達した場合は-1を返す。
+   */
+  int next_gap(struct gap_iterator *it, time_t *start, time_t *end);
+
+  /**
+   * @brief 複数の候補の範囲について、スケジュール群と重複するか調べる。
+   *
+   * スケジュール群をstart値でソートし、先頭からの終了時刻の最大値を求めて
+   * おき、候補ごとに二分探索する。候補がm個、スケジュールがn個の場合、
+   * O((n+m)log n)で調べられる。\n
+   * capacityが2以上の場合は、重なるスケジュールのある候補だけを、
+   * check_sched_capacity()で確認する。この確認は候補ごとにO(n log n)かかる
+   * ので、多くの候補が重なる場合は、最悪O(m n log n)となる。
+   *
+   * @param[in]     scheds    対象のスケジュール群。繰り返しスケジュールは含まない。
+   * \sa expand_schedules()
+   * @param[in]     len       schedsの配列数。
+   * @param[in]     pgid      このpgid値のスケジュールは調べない。
+   * @param[in]     capacity  同時に重なることができるスケジュール数。
+   * @param[in]     resources 候補が占有する資源の集合。空文字列の場合は
+   * データベース全体。
+   * @param[in,out] probes    候補群。conflictに、重複するスケジュールの1つが
+   * 反映される。schedsの要素を指すので、schedsの解放後は参照できない。
+   * @param[in]     n         probesの配列数。
+   * @return 成功時は0、失敗時には-1を返す。
+   */
+  int probe_schedules(struct schedule* *scheds, size_t len, pid_t pgid,
+		      unsigned int capacity, const char *resources,
+		      struct probe *probes, size_t n);
+
+  /**
+   * @brief スケジュールと重複するスケジュールを1つ探す。
+   *
+   * schedの範囲でschedsを展開し、probe_schedules()で調べる。sched自身の
+   * pgid値のスケジュールは調べない。
+   *
+   * @param[in]  sched    調べるスケジュール。繰り返しスケジュールは、start値
+   * からの1回分だけを調べる。
+   * @param[in]  scheds   対象のスケジュール群。
+   * @param[in]  len      schedsの配列数。
+   * @param[in]  capacity 同時に重なることができるスケジュール数。
+   * @param[out] conflict 重複するスケジュールの複製が反映される。
+   * @return 見つかった場合は0、見つからない場合は1、失敗時には-1を返す。
+   */
+  int find_conflicting_schedule(const struct schedule* sched,
+				struct schedule* *scheds, size_t len,
+				unsigned int capacity,
+				struct schedule *conflict);
+
+  /**
+   * @brief 伸縮するスケジュールを、終了時刻の直後から続く空き時間に、
+   * 最大の継続時間まで延長する。
+   *
+   * 同じpgid値のスケジュールは空きとみなす。
+   *
+   * @param[in,out] sched    延長するスケジュール
+   * @param[in]     scheds   データベースのスケジュール群
+   * @param[in]     len      scheds配列の個数
+   * @param[in]     capacity 同時に重なることができるスケジュール数
+   * @return 延長した場合は1を、しなかった場合は0を、失敗時には-1を返す。
+   */
+  int grow_elastic_schedule(struct schedule* sched, struct schedule* *scheds,
+			    size_t len, unsigned int capacity);
+
+  /**
+   * @brief スケジュールの終了機能にシグナルを送る。
+   *
+   * 終了機能が自身のプロセスグループに属している場合にだけ送るので、
+   * 終了機能が終了し、pid値が再利用されていても、無関係なプロセスには送らない。
+   * @attention データベースをロックしたまま呼び出す必要がある。
+   * @param[in] sched 対象のスケジュール
+   * @param[in] signo 送るシグナル
+   * @return 送った場合は0を、終了機能がない場合や失敗時には-1を返す。
+   */
+  int signal_terminator(const struct schedule* sched, int signo);
+
+  /**
+   * @brief スケジュールを保持するためだけのプロセスグループを作成する。
+   *
+   * 子プロセスは自身をリーダーとするプロセスグループを作成し、標準入出力を
+   * 閉じて、終了時刻まで待機してから終了する。プロセスグループが終了すると、
+   * スケジュールは解放される。
+   *
+   * @param[in]  end  終了時刻。0の場合は、シグナルで終了させられるまで待機する。
+   * @param[out] pgid 作成したプロセスグループのpgid値が反映される。
+   * @return 成功時は0、失敗時には-1を返す。
+   */
+  int spawn_holder(time_t end, pid_t *pgid);
+
+  /**
+   * @brief データベースのヘッダの値を取得する。
+   * @param[in]  shm_path 共有メモリのパス。
+   * @param[in]  key      ヘッダのキー。
+   * @param[out] value    取得した値が反映される。ヘッダがない場合は変更しない。
+   * @return 成功時は0、失敗時には-1を返す。
+   */
+  int get_header_value(const char* shm_path, const char* key, long *value);
+
+  /**
+   * @brief データベースのcapacityを取得する。
+   * @param[in]  shm_path 共有メモリのパス。
+   * @param[out] capacity 取得した値が反映される。設定がない場合は
+   * @link DEFAULT_CAPACITY @endlink 。
+   * @return 成功時は0、失敗時には-1を返す。
+   */
+  int get_capacity(const char* shm_path, unsigned int *capacity);
+
+  /**
+   * @brief 共有メモリの内容から、世代番号を取得する。
+   *
+   * 先頭の行だけを調べるので、内容全体を読まずに変更の有無を確認できる。
+   *
+   * @param[in] addr 共有メモリの内容。
+   * @return 世代番号を返す。世代番号がない場合は0を返す。
+   */
+  unsigned long get_generation(const char* addr);
+
   /**
    * @brief 環境変数を解析する。
    * @param[out] sem_name セマフォ名。環境変数(データベース番号)が反映される。
@@ -154,7 +643,11 @@ extern "C" {
 
   /**
    * @brief 与えられたスケジュール群から、指定されたpgid値を持つスケジュールを見つける。
-   * @attention 同じpgid値を持つスケジュールが複数ある場合の動作は考慮していない。
+   *
+   * 同じpgid値を持つスケジュールが複数ある場合は、schedsの中で最初のもの
+   * (先頭のスケジュール)を返す。2つ目以降は、先頭のスケジュールが終わった
+   * 後に続けて使う予約で、ロック、有効化は先頭のスケジュールで行う。
+   *
    * @param[in]  pgid   見つけるスケジュールのpgid値
    * @param[in]  scheds 対象のスケジュール群
    * @param[in]  len    schedsの配列数
@@ -165,6 +658,61 @@ extern "C" {
 			 struct schedule* *sched);
 
 
+  /**
+   * @brief スケジュール群の、指定されたスケジュールと同じpgid値を持つスケジュ
+   * ールを更新する。見つからない場合は、スケジュール群の末尾に追加する。
+   *
+   * 更新した場合、newのメモリは解放される。追加した場合、newはschedsの要素と
+   * なる。
+   *
+   * @param[in]     new     更新、追加するスケジュール。
+   * @param[in,out] scheds  対象のスケジュール群
+   * @param[in,out] len     schedsの配列数。追加した場合は1増える。
+   * @param[in]     max_len schedsに確保されている配列数。
+   * @return 成功時は0、schedsに空きがない場合は-1を返す。
+   */
+  int update_sched_by_pgid(struct schedule* new, struct schedule* *scheds,
+			   size_t *len, size_t max_len);
+
+  /**
+   * @brief スケジュール群から、指定されたスケジュールの次に予約されている、
+   * 同じpgid値のスケジュールを見つける。
+   * @param[in]  sched  基準のスケジュール。schedsの要素。
+   * @param[in]  scheds 対象のスケジュール群
+   * @param[in]  len    schedsの配列数
+   * @param[out] next   見つかったスケジュール構造体が反映される。
+   * @return 見つかった場合0、見つからない場合-1。
+   */
+  int find_next_sched_by_pgid(const struct schedule* sched,
+			      struct schedule* *scheds, size_t len,
+			      struct schedule* *next);
+
+  /**
+   * @brief スケジュール群から、指定されたスケジュールIDのスケジュールを
+   * 見つける。
+   * @param[in]  id     見つけるスケジュールID。
+   * @param[in]  scheds 対象のスケジュール群
+   * @param[in]  len    schedsの配列数
+   * @param[out] sched  見つかったスケジュール構造体が反映される。
+   * @return 見つかった場合0、見つからない場合-1。
+   */
+  int find_sched_by_id(uint64_t id, struct schedule* *scheds, size_t len,
+		       struct schedule* *sched);
+
+  /**
+   * @brief スケジュール群からスケジュールを取り除き、メモリを解放する。
+   *
+   * ロックを持つスケジュールは、同じpgid値の次のスケジュールにロックを
+   * 引き継ぐ。次のスケジュールがない場合は、ロックのために継続時間0の
+   * レコードとして残す。
+   *
+   * @param[in]     sched  取り除くスケジュール。schedsの要素。
+   * @param[in,out] scheds 対象のスケジュール群
+   * @param[in,out] len    schedsの配列数。取り除いた場合は1減る。
+   */
+  void remove_schedule(struct schedule* sched, struct schedule* *scheds,
+		       size_t *len);
+
   /**
    * @brief 与えられたスケジュール群の中から、空き時間のスケジュール群を作成する。
    * @param[in] scheds  対象となるスケジュール群
@@ -174,6 +722,7 @@ extern "C" {
    * @param[in] max_len     unoccupied_schedsの配列数。
    * @param[in] range_start 空き時間を検索する開始時刻。
    * @param[in] range_dur 空き時間検索範囲。(sec)
+   * @param[in] capacity 同時に重なることができるスケジュール数。
    * @param[in] caption 作成した空きスケジュール群のcaption値にセットされる値。
    * @return 作成した空きスケジュールの数。
    */
@@ -183,10 +732,44 @@ extern "C" {
 						size_t max_len,
 						time_t range_start,
 						unsigned int range_dur,
+						unsigned int capacity,
 						const char* caption);
 
+  /**
+   * @brief プロセスの開始時刻を取得する。
+   *
+   * Linuxでは/proc/[pid]/statのstarttime(起動後のclock tick)を読む。
+   * pid値が再利用されても、開始時刻は同じにならない。
+   *
+   * @param[in]  pid   対象のプロセス。
+   * @param[out] start 開始時刻が反映される。
+   * @return 成功時は0、プロセスが存在しない場合や取得できない環境では-1を
+   * 返す。
+   */
+  int get_process_start(pid_t pid, uint64_t *start);
+
+  /**
+   * @brief スケジュールのプロセスグループが続いているかを調べる。
+   *
+   * leader_start値が記録されていて、リーダーが存在する場合は開始時刻を
+   * 比べる。開始時刻が違う場合は、pgid値が再利用された別のプロセスとみなす。
+   * リーダーが終了している場合や開始時刻が不明な場合は、killpg()で調べる。
+   * 起動を待つジョブ(pgid値が負)は、終了時刻までは続いているとみなす。
+   *
+   * @param[in] sched 調べるスケジュール。
+   * @return 続いている場合は1、それ以外の場合は0を返す。
+   */
+  int is_group_alive(const struct schedule* sched);
+
   /**
    * @brief 共有メモリからスケジュールを読込、スケジュール構造体を作成する。
+   *
+   * reaperが動いていない場合は、is_group_alive()で調べ、終了した
+   * プロセスグループのスケジュールは読み込まない。reaperが動いている場合は、
+   * killpg()で存在しないと分かるプロセスグループのスケジュールだけを
+   * 読み込まない。pgid値の再利用や起動を待つジョブの期限はreaperが調べて
+   * 取り除く。
+   *
    * @param[in]  shm_path   共有メモリのパス。
    * @param[in]  shm_size   共有メモリのサイズ。
    * @param[out] scheds     読み込んだスケジュール構造体を保存する配列。
@@ -199,11 +782,35 @@ extern "C" {
 		     struct schedule** scheds, size_t scheds_len,
 		     size_t *loaded_len);
 
+  /**
+   * @brief データベースのヘッダの値を設定する。
+   * @attention データベースをロックしてから呼び出す必要がある。
+   * @param[in] shm_path 共有メモリのパス。
+   * @param[in] key      ヘッダのキー。
+   * @param[in] value    設定する値。
+   * @return 成功時は0、失敗時には-1を返す。
+   */
+  int set_header_value(const char* shm_path, const char* key, long value);
+
+  /**
+   * @brief スケジュール構造体を、データベースに記録する書式の文字列にする。
+   * @param[in]  sched 対象のスケジュール。
+   * @param[out] str   作成した文字列が反映される。(末尾の改行は含まない。)
+   * @param[in]  size  strのサイズ。
+   * @return 成功した場合は0を、失敗した場合は-1を返す。
+   */
+  int record_to_string(const struct schedule* sched, char *str, size_t size);
+
   /**
    * @brief スケジュール群を決められた書式で共有メモリに書き込む。
+   *
+   * スケジュールIDを持たないスケジュール(継続時間0のものを除く)には、
+   * ヘッダの次のIDから新しいIDを割り当て、schedsにも反映する。\n
+   * 新しくIDを割り当てるスケジュールには、リーダーの開始時刻も記録する。
+   *
    * @param[in] path 共有メモリのパス。
    * @param[in] size 共有メモリのサイズ。
-   * @param[in] scheds 書き込むスケジュール構造体の配列。
+   * @param[in,out] scheds 書き込むスケジュール構造体の配列。
    * @param[in] len schedsの配列数。
    * @return 成功した場合は0を、失敗した場合は-1を返す。
    */
@@ -227,6 +834,21 @@ extern "C" {
    */
   int string_to_schedule(const char* str, struct schedule* *sched);
 
+  /**
+   * @brief データベースに記録された書式の文字列から、スケジュール構造体を作成
+   * する。
+   *
+   * 6番目の項目が属性の並びとして解釈できない場合は、属性のない以前の書式
+   * pgid:lock:terminator:start:duration:captionとして読み込む。
+   *
+   * @attention 戻り値のスケジュール構造体は、メモリを動的に確保しているので、
+   * 不要時にはメモリの解放をする必要がある。
+   * @param[in] str スケジュールを表す文字列。
+   * @param[out] sched 作成したschedule構造体を示すポインタ。
+   * @return 成功した場合は0を、失敗した場合は-1を返す。
+   */
+  int string_to_record(const char* str, struct schedule* *sched);
+
 #ifdef __cplusplus
 }
 #endif
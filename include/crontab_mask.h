@@ -0,0 +1,102 @@
+#ifndef _CRONTAB_MASK_H_
+#define _CRONTAB_MASK_H_
+
+/**
+ * @file crontab_mask.h
+ * @brief crontab形式の時刻指定の解析と、時刻の検索に関する宣言。
+ *
+ * crontabコマンドと、繰り返しスケジュールを展開する共通部分から使われる。
+ * libtmに含まれるので、コマンドの機能には依存しない。
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * @struct cron_mask
+ * @brief entry構造体のビット列を、ワード単位のマスクに詰め直したもの。
+ *
+ * 分、時などの判定をビット演算でまとめて行うために使用する。
+ */
+struct cron_mask {
+  uint64_t minute; /**< 分(bit0-59) */
+  uint32_t hour;   /**< 時(bit0-23) */
+  uint32_t dom;    /**< 日(bit0-30、1日がbit0) */
+  uint32_t month;  /**< 月(bit0-11、1月がbit0) */
+  uint32_t dow;    /**< 曜日(bit0-7、0と7が日曜日) */
+  int flags;       /**< entry構造体のflags値 */
+};
+
+/**
+ * @brief crontab形式の文字列を解析して、時刻指定を作成する。
+ * @attention 作成した時刻指定は、メモリを動的に確保しているので、
+ * 不要時にはcrontab_release()で解放する必要がある。
+ * @param[in]  str 解析するcrontab形式の文字列。
+ * @param[out] m   作成した時刻指定が反映される。
+ * @return 成功時は0、失敗時には-1、strの書式が不正な場合は1を返す。
+ */
+int crontab_compile(const char *str, struct cron_mask* *m);
+
+/**
+ * @brief crontab形式の文字列を解析して、呼び出し側の領域に時刻指定を作成する。
+ *
+ * 多くの文字列を続けて解析する場合は、作業用のファイルを使い回せる。
+ *
+ * @param[out] m     作成した時刻指定が反映される。
+ * @param[in]  str   解析するcrontab形式の文字列。
+ * @param[in]  tmpfp 作業用のファイル。先頭から上書きして使用する。NULLの場合は
+ * 一時ファイルを作成する。
+ * @return 成功時は0、失敗時には-1、strの書式が不正な場合は1を返す。
+ */
+int crontab_compile_mask(struct cron_mask *m, const char *str, FILE *tmpfp);
+
+/**
+ * @brief 時刻指定に一致する、startからstart+rangeまでの間の直近の時刻を取得する。
+ *
+ * 時刻指定は分単位なので、startの秒単位は切り捨てて検索する。
+ *
+ * @param[out] result 取得した時刻が反映される。
+ * @param[in]  m      時刻指定。
+ * @param[in]  start  検索を開始する時刻(time_t)
+ * @param[in]  range  検索する範囲(sec)
+ * @return 見つかった場合は0、見つからない場合は-1を返す。
+ */
+int crontab_next(time_t *result, const struct cron_mask *m, time_t start,
+		 unsigned int range);
+
+/**
+ * @brief crontab_compile()で作成した時刻指定を解放する。
+ * @param[in] m 解放する時刻指定。
+ */
+void crontab_release(struct cron_mask *m);
+
+/**
+ * @brief 日付(月、日、曜日)が時刻指定に一致するか確認する。
+ * @param[in] m   時刻指定。
+ * @param[in] day 確認する日付。mktime()で正規化されている必要がある。
+ * @return 一致する場合は1、一致しない場合は0を返す。
+ */
+int match_day(const struct cron_mask *m, const struct tm *day);
+
+/**
+ * @brief 日付に時分を加えた時刻を取得する。
+ * @param[in] day      日付(時分秒は0)。
+ * @param[in] midnight dayの0時0分0秒の時刻。
+ * @param[in] regular  その日が86400秒(夏時間の切り替えがない)場合は1。
+ * @param[in] hour     時
+ * @param[in] minute   分
+ * @return 時刻(time_t)
+ */
+time_t day_time(const struct tm *day, time_t midnight, int regular, int hour,
+		int minute);
+
+/**
+ * @brief 日付を正規化して、その日の0時0分0秒の時刻を取得する。
+ * @param[in,out] day     日付。時分秒は0に丸められる。
+ * @param[out]    regular その日が86400秒の場合は1が反映される。
+ * @return 0時0分0秒の時刻(time_t)
+ */
+time_t normalize_day(struct tm *day, int *regular);
+
+#endif
@@ -0,0 +1,193 @@
+/**
+ * @file daemon.h
+ * @brief データベースを常駐して管理するコマンドに関する宣言と説明。
+ *
+ * デーモンはデータベースごとに1つ起動し、スケジュールをスケジュール構造体の
+ * まま保持して、Unixドメインソケットで要求を受け付ける。\n
+ * 要求と応答は、固定長のヘッダに続けてスケジュール構造体をそのまま送る。\n
+ * 追加、有効化の要求は、共有メモリ上の受付列でも受け付ける。クライアントは
+ * 順番を取得して要求を書き込み、その順番の完了語で結果を待つ。受付列が
+ * 満杯の場合や取得の要求は、ソケットで送る。\n
+ * 同時に届いた変更の要求はまとめて到着順に処理し、1度のロックと書き込みで
+ * 反映する。\n
+ * 共有メモリの内容は、前回読み書きした内容と異なる場合にだけ読み込み直し、
+ * 変更は共有メモリにも書き込む。デーモンを使わないコマンドとも、同じ
+ * データベースを共有できる。\n
+ * 他のコマンドは、デーモンが動いていれば要求を送り、動いていなければ
+ * これまでどおり共有メモリを直接読み書きする。\n
+ * スケジュールと受付列は共有メモリ上にあるため、新しいデーモンは
+ * ソケットのファイル記述子だけを受け取れば、動いているデーモンを
+ * 止めずに置き換えられる。
+ */
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "common.h"
+
+/**
+ * @def DEFAULT_DAEMON_SOCKET_DIR
+ * @brief デーモンのソケットを置くディレクトリ。末尾にユーザーIDが付加される。
+ * 所有者だけが読み書きできるディレクトリとして作成する。
+ */
+#define DEFAULT_DAEMON_SOCKET_DIR "/tmp/tmd-"
+
+/**
+ * @def DEFAULT_DAEMON_SOCKET_NAME
+ * @brief デーモンのソケットのファイル名。末尾にデータベース番号が付加される。
+ */
+#define DEFAULT_DAEMON_SOCKET_NAME "timemanager"
+
+/**
+ * @def DEFAULT_RING_NAME
+ * @brief 要求の受付列の共有メモリ名。末尾にデータベース番号が付加される。
+ */
+#define DEFAULT_RING_NAME "/ring_timemanager"
+
+/**
+ * @def RING_SIZE
+ * @brief 受付列の順番の数。
+ */
+#define RING_SIZE 64
+
+/**
+ * @def DAEMON_OP_ADD
+ * @brief スケジュールを追加、上書きする要求。スケジュール構造体を1つ送る。
+ */
+#define DAEMON_OP_ADD 1
+
+/**
+ * @def DAEMON_OP_LIST
+ * @brief すべてのスケジュールを取得する要求。
+ */
+#define DAEMON_OP_LIST 2
+
+/**
+ * @def DAEMON_OP_ACTIVATE
+ * @brief スケジュールを有効にする要求。終了機能のpid値をterminator値に設定した
+ * スケジュール構造体を1つ送る。
+ */
+#define DAEMON_OP_ACTIVATE 3
+
+/**
+ * @def DAEMON_OP_HANDOFF
+ * @brief 要求を受け付けるソケットを引き継ぐ要求。スケジュール構造体は送らない。
+ *
+ * 応答にソケットのファイル記述子が添付される。受け取ったデーモンは受付列を
+ * 引き継いでから1バイトを送り返し、それを受けて元のデーモンは終了する。
+ */
+#define DAEMON_OP_HANDOFF 4
+
+/**
+ * @def DAEMON_OK
+ * @brief 要求が成功した場合の応答。
+ */
+#define DAEMON_OK 0
+
+/**
+ * @def DAEMON_CONFLICT
+ * @brief 重複のため追加できなかった場合の応答。
+ */
+#define DAEMON_CONFLICT 1
+
+/**
+ * @def DAEMON_BUSY
+ * @brief ロックが取得できず、要求を処理しなかった場合の応答。
+ */
+#define DAEMON_BUSY 2
+
+/**
+ * @def DAEMON_ERROR
+ * @brief 要求の処理に失敗した場合の応答。
+ */
+#define DAEMON_ERROR 3
+
+/**
+ * @struct daemon_request
+ * @brief 要求のヘッダ。len個のスケジュール構造体が続く。
+ */
+struct daemon_request {
+  uint32_t op;  /**< 要求の種類(DAEMON_OP_*) */
+  pid_t pgid;  /**< 要求したプロセスグループ */
+  uint32_t len;  /**< 続くスケジュール構造体の数 */
+};
+
+/**
+ * @struct daemon_response
+ * @brief 応答のヘッダ。len個のスケジュール構造体が続く。
+ */
+struct daemon_response {
+  int32_t status;  /**< 処理の結果(DAEMON_OKなど) */
+  uint32_t len;  /**< 続くスケジュール構造体の数 */
+};
+
+/**
+ * @brief データベースを常駐して管理する。
+ * @param[in] argc argc値
+ * @param[in] argv argv値
+ * @return 成功時は0、失敗時には1、使用方法に誤りがある場合は2を返す。
+ */
+int run_daemon(int argc, char* argv[]);
+
+/**
+ * @brief データベースのデーモンが動いているかを確認する。
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @return 動いている場合は1、それ以外の場合は0を返す。
+ */
+int is_daemon_running(const char *shm_name);
+
+/**
+ * @brief デーモンにスケジュールの追加を依頼する。
+ *
+ * デーモンが動いていない場合や、重複などで追加されなかった場合は、
+ * 共有メモリを直接読み書きする通常の手順で追加し直す。
+ *
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @param[in] sched    追加するスケジュール。
+ * @return 追加された場合は0、追加されなかった場合は1を返す。
+ */
+int add_by_daemon(const char *shm_name, const struct schedule *sched);
+
+/**
+ * @brief デーモンにスケジュールの有効化を依頼する。
+ *
+ * 繰り返し、伸縮するスケジュールと、2回目の有効化は受け付けられない。
+ *
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @param[in] sched    有効にするスケジュール。terminator値に終了機能のpid値を
+ * 設定しておく。
+ * @return 有効にされた場合は0、有効にされなかった場合は1を返す。
+ */
+int activate_by_daemon(const char *shm_name, const struct schedule *sched);
+
+/**
+ * @brief デーモンからすべてのスケジュールを読み込む。
+ * @param[in]  shm_name   データベースの共有メモリ名。
+ * @param[out] scheds     読み込んだスケジュール構造体を保存する配列。
+ * cleanup_schedules()で解放する。
+ * @param[in]  scheds_len schedsの配列数。
+ * @param[out] loaded_len 読み込んだスケジュール数が反映される。
+ * @return 成功時は0、デーモンが使えない場合は1を返す。
+ */
+int list_by_daemon(const char *shm_name, struct schedule* *scheds,
+		   size_t scheds_len, size_t *loaded_len);
+
+/**
+ * @brief すべてのスケジュールを読み込む。
+ *
+ * デーモンが動いている場合はデーモンから、動いていない場合は
+ * load_schedules()で共有メモリから読み込む。
+ *
+ * @param[in]  shm_name   データベースの共有メモリ名。
+ * @param[out] scheds     読み込んだスケジュール構造体を保存する配列。
+ * cleanup_schedules()で解放する。
+ * @param[in]  scheds_len schedsの配列数。
+ * @param[out] loaded_len 読み込んだスケジュール数が反映される。
+ * @return 成功時は0、失敗時は-1返す。
+ */
+int fetch_schedules(const char *shm_name, struct schedule* *scheds,
+		    size_t scheds_len, size_t *loaded_len);
+
+#endif
@@ -0,0 +1,20 @@
+/**
+ * @file export.h
+ * @brief データベースのスケジュールをまとめて書き出すコマンドに関する宣言と説明。
+ *
+ * データベースをロックしてスケジュールを読み込み、その時点のすべての
+ * レコードをstart値の昇順でstdoutに出力する。\n
+ * 出力はimportコマンドでそのまま読み込める。
+ */
+#ifndef _EXPORT_H_
+#define _EXPORT_H_
+
+/**
+ * @brief データベースのスケジュールをまとめて書き出す。
+ * @param[in] argc argc値
+ * @param[in] argv argv値
+ * @return 成功時は0、失敗時には1、使用方法に誤りがある場合は2を返す。
+ */
+int export(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,23 @@
+/**
+ * @file import.h
+ * @brief スケジュールをまとめて読み込むコマンドに関する宣言と説明。
+ *
+ * stdinからexportコマンドの出力と同じ書式のレコードを読み込み、start値で
+ * ソートしてから、データベースのスケジュールと重複しないかを確認する。\n
+ * 繰り返し、資源を持つスケジュールがない場合は、既存のスケジュールと
+ * まとめて1度走査するだけで確認する。\n
+ * すべてのレコードが重複しない場合だけ、1度の書き込みでデータベースに反映する。
+ */
+#ifndef _IMPORT_H_
+#define _IMPORT_H_
+
+/**
+ * @brief スケジュールをまとめて読み込む。
+ * @param[in] argc argc値
+ * @param[in] argv argv値
+ * @return 成功時は0、失敗時には1、使用方法に誤りがある場合は2、重複する
+ * レコードがある場合は3を返す。
+ */
+int import(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,106 @@
+/**
+ * @file launcher.h
+ * @brief デーモンが予約されたコマンドを起動する機能(起動機能)に関する宣言と説明。
+ *
+ * runコマンドは、コマンドライン、環境変数、作業ディレクトリ、標準入出力の
+ * リダイレクト先をスプールファイルに書き込み、起動を待つジョブとして
+ * スケジュールを追加する。\n
+ * 起動を待つジョブのスケジュールは、所有するプロセスグループがまだないので、
+ * スケジュールIDから作った負のpgid値で記録され、プロセスグループが終了した
+ * スケジュールとして取り除かれることはない。\n
+ * デーモンは開始時刻になったジョブを新しいプロセスグループで起動し、
+ * pgid値を起動したプロセスグループに、terminator値を自分のpid値に
+ * 書き換える。終了時刻になると、プロセスグループにSIGTERMを送る。\n
+ * デーモンは起動したジョブのリーダーを、終了してもすぐには回収せず、pidfdで
+ * 終了を確認してから回収する。回収するまではpgid値が再利用されないので、
+ * 別のプロセスグループにシグナルを送ることはない。
+ */
+#ifndef _LAUNCHER_H_
+#define _LAUNCHER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "common.h"
+
+/**
+ * @def DEFAULT_SPOOL_DIR
+ * @brief スプールファイルを置くディレクトリ。末尾にユーザーIDが付加される。
+ * 所有者だけが読み書きできるディレクトリとして作成し、データベース番号の
+ * サブディレクトリにスプールファイルを置く。
+ */
+#define DEFAULT_SPOOL_DIR "/tmp/tm_spool-"
+
+/**
+ * @struct job
+ * @brief 起動するコマンドの実行環境。
+ */
+struct job {
+  char* *argv;  /**< コマンドライン。argv[0]は絶対パス。NULLで終わる */
+  char* *envp;  /**< 環境変数。NULLで終わる */
+  const char *cwd;  /**< 作業ディレクトリ */
+  const char *in;  /**< 標準入力のリダイレクト元 */
+  const char *out;  /**< 標準出力のリダイレクト先(追記) */
+  const char *err;  /**< 標準エラー出力のリダイレクト先(追記) */
+};
+
+/**
+ * @brief 起動を待つジョブのスケジュールに使うpgid値を返す。
+ * @param[in] id ジョブのスケジュールID。
+ * @return 負のpgid値を返す。
+ */
+pid_t job_pgid(uint64_t id);
+
+/**
+ * @brief ジョブをスプールファイルの一時ファイルに書き込む。
+ *
+ * スケジュールを追加してから、publish_spool()で名前を変える。デーモンが
+ * 書きかけのファイルを読んだり、スケジュールのないファイルとして
+ * 削除したりすることはない。
+ *
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @param[in] id       ジョブのスケジュールID。
+ * @param[in] job      書き込むジョブ。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+int spool_job(const char *shm_name, uint64_t id, const struct job *job);
+
+/**
+ * @brief spool_job()で書き込んだ一時ファイルを、スプールファイルにする。
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @param[in] id       ジョブのスケジュールID。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+int publish_spool(const char *shm_name, uint64_t id);
+
+/**
+ * @brief ジョブのスプールファイルと一時ファイルを削除する。
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @param[in] id       ジョブのスケジュールID。
+ */
+void unspool_job(const char *shm_name, uint64_t id);
+
+/**
+ * @brief 開始時刻になったジョブを起動し、終了時刻になったジョブを終了させる。
+ *
+ * データベースのロックを獲得した状態で、デーモンから呼び出す。\n
+ * 開始時刻を過ぎても起動できなかったジョブと、終了時刻を過ぎてから
+ * 起動しようとしたジョブは、スケジュールごと取り除く。リーダーが終了した
+ * ジョブは、プロセスグループに残ったプロセスにSIGTERMを送り、スケジュールを
+ * 取り除く。\n
+ * adoptを指定すると、スプールファイルが残っている起動済みのジョブの
+ * terminator値を自分のpid値にして引き継ぎ、スケジュールのない
+ * スプールファイルを削除する。デーモンを起動した直後に指定する。
+ *
+ * @param[in]     shm_name データベースの共有メモリ名。
+ * @param[in,out] scheds   データベースのスケジュール群。
+ * @param[in,out] len      schedsの配列数。
+ * @param[in]     now      現在時刻。
+ * @param[in]     adopt    起動済みのジョブを引き継ぐ場合は1。
+ * @return 変更したスケジュールの数を返す。
+ */
+size_t run_jobs(const char *shm_name, struct schedule* *scheds, size_t *len,
+		time_t now, int adopt);
+
+#endif
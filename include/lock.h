@@ -21,4 +21,15 @@
  */
 int lock(int argc, char* argv[]);
 
+/**
+ * @brief データベース番号を指定して、スケジュールの書き換えをロックする。
+ *
+ * 他のコマンドのコマンドライン引数はlock()にそのまま渡せないので、
+ * lock()用の引数を組み立てて呼び出す。
+ *
+ * @param[in] db データベース番号。NULLの場合は環境変数の値が使われる。
+ * @return lock()の戻り値を返す。
+ */
+int lock_database(const char *db);
+
 #endif
@@ -0,0 +1,145 @@
+/**
+ * @file notify.h
+ * @brief スケジュールの解放の通知に関する宣言と説明。
+ *
+ * 重複のためにスケジュールを追加できなかったクライアントは、待機表に
+ * 希望する時間の範囲を登録して待機する。\n
+ * スケジュールが終了、削除された時には、その範囲と重なる待機中の
+ * クライアントだけを起こす。\n
+ * 待機表はデータベースごとに共有メモリ上に置かれ、Linuxではfutex、
+ * その他の環境ではポーリングで待機する。
+ */
+#ifndef _NOTIFY_H_
+#define _NOTIFY_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @def DEFAULT_WAIT_TABLE_NAME
+ * @brief 待機表の共有メモリ名。末尾にデータベース番号が付加される。
+ */
+#define DEFAULT_WAIT_TABLE_NAME "/wait_timemanager"
+
+/**
+ * @def MAX_NUM_WAITERS
+ * @brief 同時に待機できるクライアント数の上限。
+ */
+#define MAX_NUM_WAITERS 64
+
+/**
+ * @def WAIT_RECHECK_INTERVAL
+ * @brief 通知がなくても再確認する間隔(sec)。
+ *
+ * 強制終了されたプロセスグループなど、通知されない解放に備える。
+ */
+#define WAIT_RECHECK_INTERVAL 10
+
+/**
+ * @def WAIT_POLL_INTERVAL_NSEC
+ * @brief 待機表に空きがない場合に、再確認する間隔(nsec)。
+ */
+#define WAIT_POLL_INTERVAL_NSEC (100 * 1000 * 1000)
+
+struct wait_table;
+
+/**
+ * @struct wait_handle
+ * @brief 待機表への登録情報。
+ * \sa register_wait()
+ */
+struct wait_handle {
+  struct wait_table *table;  /**< 待機表 */
+  int slot;  /**< 待機表の登録位置 */
+  uint32_t seq;  /**< 登録時の通知番号 */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /**
+   * @brief スケジュールの解放を、範囲の重なる待機中のクライアントに通知する。
+   * @param[in] shm_name データベースの共有メモリ名。
+   * @param[in] start    解放された範囲の開始時刻。
+   * @param[in] end      解放された範囲の終了時刻。
+   * @return 成功時は0、失敗時には-1を返す。
+   */
+  int notify_release(const char *shm_name, time_t start, time_t end);
+
+  /**
+   * @brief 複数の範囲の解放を、まとめて通知する。
+   *
+   * 待機表のマップは1度だけ行う。
+   *
+   * @param[in] shm_name データベースの共有メモリ名。
+   * @param[in] starts   解放された範囲の開始時刻の配列。
+   * @param[in] ends     解放された範囲の終了時刻の配列。
+   * @param[in] len      範囲の数。
+   * @return 成功時は0、失敗時には-1を返す。
+   */
+  int notify_releases(const char *shm_name, const time_t *starts,
+		      const time_t *ends, size_t len);
+
+  /**
+   * @brief 待機表に希望する時間の範囲を登録する。
+   *
+   * 通知を取りこぼさないよう、データベースをロックしている間に登録し、
+   * ロックを解放してからwait_for_release()で待機する。
+   *
+   * @param[in]  shm_name データベースの共有メモリ名。
+   * @param[in]  start    希望する範囲の開始時刻。
+   * @param[in]  end      希望する範囲の終了時刻。
+   * @param[out] h        登録情報が反映される。
+   * @return 成功時は0、失敗時には-1、待機表に空きがない場合は1を返す。
+   */
+  int register_wait(const char *shm_name, time_t start, time_t end,
+		    struct wait_handle *h);
+
+  /**
+   * @brief 範囲の重なるスケジュールの解放が通知されるまで待機する。
+   *
+   * 通知がなくても、@link WAIT_RECHECK_INTERVAL @endlink 秒ごとに戻る。
+   *
+   * @param[in] h        登録情報。
+   * @param[in] deadline 待機を諦める時刻。0の場合は無制限。
+   * @return 通知された場合は0、失敗時には-1、通知されないまま戻った場合は1、
+   * deadlineを過ぎた場合は2を返す。
+   */
+  int wait_for_release(struct wait_handle *h, time_t deadline);
+
+  /**
+   * @brief 待機表から登録を削除する。
+   * @param[in] h 登録情報。
+   */
+  void unregister_wait(struct wait_handle *h);
+
+  /**
+   * @brief 共有メモリ上の値が変わるまで待機する。
+   *
+   * Linuxではfutex、その他の環境ではポーリングで待機する。
+   *
+   * @param[in] seq     待機する値。
+   * @param[in] old     待機前の値。すでに変わっている場合は、すぐに戻る。
+   * @param[in] timeout 待機する時間。
+   */
+  void wait_word(uint32_t *seq, uint32_t old, const struct timespec *timeout);
+
+  /**
+   * @brief wait_word()で待機しているプロセスを起こす。
+   * @param[in] seq 待機している値。
+   */
+  void wake_word(uint32_t *seq);
+
+  /**
+   * @brief 待機表の共有メモリを削除する。
+   * @param[in] shm_name データベースの共有メモリ名。
+   * @return 成功時は0、失敗時には-1を返す。
+   */
+  int remove_wait_table(const char *shm_name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,21 @@
+/**
+ * @file plan.h
+ * @brief 複数のジョブをまとめて空き時間に配置するコマンドに関する宣言と説明。
+ *
+ * stdinから、継続時間と配置できる範囲、優先度を持つジョブを読み込み、
+ * データベースの空き時間に、互いに重ならないように配置します。\n
+ * 配置はメモリ上で行い、データベースの読み込みは1度だけです。
+ */
+#ifndef _PLAN_H_
+#define _PLAN_H_
+
+/**
+ * @brief ジョブをまとめて空き時間に配置する。
+ * @param[in] argc argc値
+ * @param[in] argv argv値
+ * @return 成功時は0、失敗時には1、使用方法に誤りがある場合は2、配置できない
+ * ジョブがある場合は3を返す。
+ */
+int plan(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,22 @@
+/**
+ * @file probe.h
+ * @brief 複数の候補の範囲が空いているかをまとめて調べるコマンドに関する宣言と説明。
+ *
+ * stdinから候補の範囲を読み込み、データベースを1度だけ読み込んで、
+ * それぞれの候補がスケジュールと重複するかを出力します。\n
+ * 重複の確認にはprobe_schedules()を使い、候補ごとにデータベースを
+ * 読み込み直すことはありません。
+ */
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+/**
+ * @brief 候補の範囲が空いているかをまとめて調べる。
+ * @param[in] argc argc値
+ * @param[in] argv argv値
+ * @return 成功時は0、失敗時には1、使用方法に誤りがある場合は2、重複する
+ * 候補がある場合は3を返す。
+ */
+int probe(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,56 @@
+/**
+ * @file reaper.h
+ * @brief 終了したプロセスグループのスケジュールを取り除く機能(reaper)に関する
+ * 宣言と説明。
+ *
+ * デーモンは自分のpid値と開始時刻をヘッダに記録し、reaperとして
+ * 終了したプロセスグループのスケジュールを取り除く。reaperが動いている
+ * 間は、load_schedules()はkillpg()で存在しないと分かるものだけを除き、
+ * リーダーの開始時刻を調べずに読み込む。\n
+ * Linuxでは、プロセスグループのリーダーをpidfdで監視し、epollで終了の通知を
+ * まとめて受け取る。通知を受けるまでは、システムコールを使わずに続いている
+ * とみなす。リーダーが終了したプロセスグループと、pidfdが使えない環境では、
+ * is_group_alive()で調べる。
+ */
+#ifndef _REAPER_H_
+#define _REAPER_H_
+
+#include <stddef.h>
+
+#include "common.h"
+
+/**
+ * @brief 自分をreaperとしてヘッダに記録する。
+ *
+ * すでに記録されている場合は、何もしない。
+ *
+ * @attention データベースをロックしてから呼び出す必要がある。
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @return 記録した場合は1、記録済みの場合は0、失敗時には-1を返す。
+ */
+int publish_reaper(const char *shm_name);
+
+/**
+ * @brief 自分がreaperとして記録されている場合は、記録を消す。
+ *
+ * 監視しているpidfdも閉じる。
+ *
+ * @attention データベースをロックしてから呼び出す必要がある。
+ * @param[in] shm_name データベースの共有メモリ名。
+ */
+void withdraw_reaper(const char *shm_name);
+
+/**
+ * @brief 終了したプロセスグループのスケジュールを取り除く。
+ *
+ * 範囲の重なる待機中のクライアントには、解放を通知する。
+ *
+ * @param[in]     shm_name データベースの共有メモリ名。
+ * @param[in,out] scheds   スケジュール群。
+ * @param[in,out] len      schedsの配列数。
+ * @return 取り除いたスケジュールの数を返す。
+ */
+size_t reap_schedules(const char *shm_name, struct schedule* *scheds,
+		      size_t *len);
+
+#endif
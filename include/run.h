@@ -0,0 +1,24 @@
+/**
+ * @file run.h
+ * @brief コマンドを予約し、デーモンに起動させるコマンドに関する宣言と説明。
+ *
+ * stdinから読み込んだスケジュールで、コマンドを起動を待つジョブとして
+ * データベースに追加する。コマンドライン、環境変数、作業ディレクトリ、
+ * 標準入出力のリダイレクト先はスプールファイルに書き込まれ、開始時刻に
+ * デーモンが新しいプロセスグループで起動する。\n
+ * 開始時刻までコマンドのプロセスは存在しないので、予約したジョブが
+ * 使う資源はデータベースのレコードとスプールファイルだけになる。
+ */
+#ifndef _RUN_H_
+#define _RUN_H_
+
+/**
+ * @brief コマンドを予約し、デーモンに起動させる。
+ * @param[in] argc argc値
+ * @param[in] argv argv値
+ * @return 成功時は0、失敗時には1、使用方法に誤りがある場合は2、重複のため
+ * 予約できなかった場合は3を返す。
+ */
+int run(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,321 @@
+/**
+ * @file tm.h
+ * @brief TimeManagerをプログラムから使うためのライブラリ(libtm)に関する宣言と
+ * 説明。
+ *
+ * tmコマンドを起動せずに、同じデータベースのスケジュールを追加、有効化、
+ * 検索し、空き時間を確保できる。結果は出力せずに、構造体で返す。
+ * tmコマンドのadd、activate、unoccupiedも、このライブラリで処理する。\n
+ * tm_open()で取得したハンドルを、それ以降の関数に渡して使う。ハンドルは
+ * 開いた後に変更されないので、複数のスレッドから同時に使ってよい。
+ * データベースを書き換える関数は、プロセス内でもデータベースごとに1つずつ
+ * 実行される。別のハンドルでも、同じデータベースであれば待ち合わせる。\n
+ * 関数は何も出力しない。失敗の原因はtm_status列挙型の負の値で返し、
+ * tm_strerror()で説明を取得できる。\n
+ * データベースのスケジュールはプロセスグループごとに1つなので、
+ * 追加、有効化するスケジュールはpgid値で指定する。\n
+ * libtm.aまたはlibtm.soと、-lpthread、-lrt(MacOS X以外)をリンクする。
+ * ライブラリが公開するのは、tm_で始まる関数だけである。
+ */
+#ifndef _TM_H_
+#define _TM_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/**
+ * @def TM_API
+ * @brief libtmが公開する関数に付ける属性。libtmはそれ以外の関数を隠して
+ * ビルドされる。
+ */
+#if defined(__GNUC__)
+#define TM_API __attribute__((visibility("default")))
+#else
+#define TM_API
+#endif
+
+/**
+ * @def TM_CAPTION_LEN
+ * @brief tm_schedule構造体のcaptionの大きさ。終端文字を含む。
+ */
+#define TM_CAPTION_LEN 256
+
+/**
+ * @def TM_RULE_LEN
+ * @brief tm_schedule構造体のruleの大きさ。終端文字を含む。
+ */
+#define TM_RULE_LEN 128
+
+/**
+ * @def TM_RESOURCES_LEN
+ * @brief tm_schedule構造体のresourcesの大きさ。終端文字を含む。
+ */
+#define TM_RESOURCES_LEN 128
+
+/**
+ * @def TM_LOCK_TIMEOUT
+ * @brief データベースのロックを待つ時間(sec)。
+ */
+#define TM_LOCK_TIMEOUT 5
+
+/**
+ * @def TM_ADD_QUEUE
+ * @brief tm_add()のflags。上書きせずに、プロセスグループの最後の
+ * スケジュールの後に予約する。
+ */
+#define TM_ADD_QUEUE 0x1
+
+/**
+ * @def TM_FREE_OWN
+ * @brief tm_find_free()のflags。呼び出したプロセスのプロセスグループの
+ * スケジュールも、空きとみなさない。
+ */
+#define TM_FREE_OWN 0x1
+
+/**
+ * @enum tm_status
+ * @brief ライブラリの関数が返す値。
+ *
+ * 0は成功、正の値は処理できなかった理由、負の値は失敗の原因を表す。
+ */
+enum tm_status {
+  TM_OK = 0,  /**< 成功 */
+  TM_CONFLICT = 1,  /**< 他のスケジュールと重複した */
+  TM_TIMEOUT = 2,  /**< データベースのロックがタイムアウトした */
+  TM_NOT_FOUND = 3,  /**< 該当するスケジュール、空き時間がない */
+  TM_REFUSED = 4,  /**< 該当するスケジュールは処理を受け付けない */
+  TM_TRUNCATED = 5,  /**< 結果が配列に収まらなかった */
+  TM_ERROR = -1,  /**< 原因の分からない失敗 */
+  TM_ESYSTEM = -2,  /**< システムコール(共有メモリ、セマフォなど)の失敗 */
+  TM_ENOMEM = -3,  /**< メモリの確保に失敗した */
+  TM_EINVAL = -4,  /**< 引数が不正 */
+  TM_EFORMAT = -5,  /**< データベースの内容が壊れている */
+  TM_EFULL = -6  /**< データベースに空きがない */
+};
+
+struct tm_handle;
+
+/**
+ * @struct tm_schedule
+ * @brief ライブラリが受け渡すスケジュール。
+ *
+ * 繰り返しスケジュールは、1回分ずつに展開して返す。
+ */
+struct tm_schedule {
+  pid_t pgid;  /**< 所有するプロセスグループ */
+  pid_t terminator;  /**< 終了機能のpid。有効にされていない場合は0 */
+  time_t start;  /**< 開始時刻 */
+  unsigned int duration;  /**< 継続時間(sec) */
+  char caption[TM_CAPTION_LEN];  /**< スケジュールの簡単な説明(改行混入不可) */
+  char resources[TM_RESOURCES_LEN];  /**< 占有する資源の集合(カンマ区切り)。データベース全体の場合は空文字列 */
+  char rule[TM_RULE_LEN];  /**< 繰り返しの時刻指定(crontab形式)。繰り返さない場合は空文字列 */
+  unsigned int min_duration;  /**< 伸縮する場合の最小の継続時間(sec)。伸縮しない場合は0 */
+  unsigned int max_duration;  /**< 伸縮する場合の最大の継続時間(sec)。伸縮しない場合は0 */
+  int early;  /**< 空きができたら開始時刻より早く開始してよい場合は1 */
+  char after[TM_CAPTION_LEN];  /**< 先に終わるのを待つスケジュールのpgid値またはcaption。待たない場合は空文字列 */
+  uint64_t id;  /**< スケジュールID。tm_add()では使われない */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /**
+   * @brief データベースを開く。
+   * @param[in]  db データベース番号("1"-"5")。NULLの場合は環境変数TM_DB_NUMの
+   * 値が使われる。
+   * @param[out] h  ハンドルが反映される。tm_close()で解放する。
+   * @return 成功時はTM_OK、失敗時には負の値を返す。
+   */
+  TM_API int tm_open(const char *db, struct tm_handle* *h);
+
+  /**
+   * @brief データベースを閉じ、ハンドルを解放する。
+   * @param[in] h ハンドル。
+   */
+  TM_API void tm_close(struct tm_handle *h);
+
+  /**
+   * @brief スケジュールを追加する。
+   *
+   * すでにsched->pgidのスケジュールが存在する場合は、上書きする。
+   * 伸縮するスケジュールは、addコマンドと同じく縮めて空きを作り、
+   * 追加したスケジュールが伸縮する場合は、後ろの空き時間に延長する。
+   * 繰り返しスケジュールのstartが0の場合は、現在時刻とする。
+   *
+   * @param[in]  h        ハンドル。
+   * @param[in]  sched    追加するスケジュール。pgidが0の場合は、呼び出した
+   * プロセスのプロセスグループ。terminatorとidは使われない。
+   * @param[in]  flags    TM_ADD_QUEUEを指定すると、予約する。予約する
+   * スケジュールは、繰り返し、伸縮、early、afterを指定できず、最後の
+   * スケジュールの終了時刻以降に開始する必要がある。
+   * @param[out] conflict 重複した場合、重なるスケジュールの1つが反映される。
+   * NULLでもよい。
+   * @return 追加した場合はTM_OK、重複のため追加できなかった場合は
+   * TM_CONFLICT、ロックがタイムアウトした場合はTM_TIMEOUT、失敗時には
+   * 負の値を返す。
+   */
+  TM_API int tm_add(struct tm_handle *h, const struct tm_schedule *sched,
+		    int flags, struct tm_schedule *conflict);
+
+  /**
+   * @brief プロセスグループのスケジュールを取得する。
+   *
+   * データベースはロックせずに読み込む。予約されたスケジュールがある場合は、
+   * 先頭のスケジュールを返す。
+   *
+   * @param[in]  h    ハンドル。
+   * @param[in]  pgid 取得するスケジュールのpgid値。0の場合は、呼び出した
+   * プロセスのプロセスグループ。
+   * @param[out] out  取得したスケジュールが反映される。繰り返しスケジュールは
+   * 展開しない。
+   * @return 見つかった場合はTM_OK、見つからない場合はTM_NOT_FOUND、
+   * 失敗時には負の値を返す。
+   */
+  TM_API int tm_get(struct tm_handle *h, pid_t pgid, struct tm_schedule *out);
+
+  /**
+   * @brief スケジュールIDのスケジュールを取得する。
+   *
+   * tm_get()と同じく、データベースはロックせずに読み込む。予約された
+   * スケジュールも取得できる。
+   *
+   * @param[in]  h   ハンドル。
+   * @param[in]  id  取得するスケジュールのID。
+   * @param[out] out 取得したスケジュールが反映される。
+   * @return 見つかった場合はTM_OK、見つからない場合はTM_NOT_FOUND、idが0の
+   * 場合はTM_EINVAL、失敗時には負の値を返す。
+   */
+  TM_API int tm_get_by_id(struct tm_handle *h, uint64_t id,
+			  struct tm_schedule *out);
+
+  /**
+   * @brief スケジュールを有効にする。
+   *
+   * 終了機能のpid値を記録するだけで、activateコマンドと違い、終了機能の
+   * プロセスは起動しない。終了時刻の処理は呼び出し側で行う。\n
+   * 繰り返し、伸縮するスケジュールと、2回目の有効化は受け付けない。
+   *
+   * @param[in] h          ハンドル。
+   * @param[in] pgid       有効にするスケジュールのpgid値。0の場合は、呼び出した
+   * プロセスのプロセスグループ。
+   * @param[in] terminator 終了機能のpid値。
+   * @return 有効にした場合はTM_OK、pgidのスケジュールがない場合は
+   * TM_NOT_FOUND、受け付けないスケジュールの場合はTM_REFUSED、ロックが
+   * タイムアウトした場合はTM_TIMEOUT、失敗時には負の値を返す。
+   */
+  TM_API int tm_activate(struct tm_handle *h, pid_t pgid, pid_t terminator);
+
+  /**
+   * @brief スケジュールIDのスケジュールを有効にする。
+   *
+   * tm_activate()と同じ処理を行う。予約されたスケジュールは、
+   * プロセスグループの先頭のスケジュールになるまで受け付けない。
+   *
+   * @param[in] h          ハンドル。
+   * @param[in] id         有効にするスケジュールのID。
+   * @param[in] terminator 終了機能のpid値。
+   * @return tm_activate()と同じ。idが0の場合はTM_EINVALを返す。
+   */
+  TM_API int tm_activate_by_id(struct tm_handle *h, uint64_t id,
+			       pid_t terminator);
+
+  /**
+   * @brief 指定の範囲と重なるスケジュールを、start値の昇順で取得する。
+   *
+   * データベースはロックせずに読み込む。
+   *
+   * @param[in]  h     ハンドル。
+   * @param[in]  begin 範囲の開始時刻。
+   * @param[in]  end   範囲の終了時刻。
+   * @param[out] out   取得したスケジュールが反映される。
+   * @param[in]  max   outの配列数。
+   * @param[out] len   範囲と重なるスケジュールの数が反映される。maxより
+   * 大きい場合は、先頭からmax個だけがoutに反映される。
+   * @return 成功時はTM_OK、maxを超えた場合はTM_TRUNCATED、失敗時には
+   * 負の値を返す。
+   */
+  TM_API int tm_query_range(struct tm_handle *h, time_t begin, time_t end,
+			    struct tm_schedule *out, size_t max, size_t *len);
+
+  /**
+   * @brief 指定の範囲で、最初にdurationが収まる空き時間を探す。
+   *
+   * データベースはロックせずに読み込む。flagsにTM_FREE_OWNを指定しない
+   * 場合は、呼び出したプロセスのプロセスグループのスケジュールは空きと
+   * みなす。
+   *
+   * @param[in]  h         ハンドル。
+   * @param[in]  begin     検索する範囲の開始時刻。
+   * @param[in]  end       検索する範囲の終了時刻。
+   * @param[in]  duration  必要な継続時間(sec)。
+   * @param[in]  resources 占有する資源の集合(カンマ区切り)。NULLまたは
+   * 空文字列の場合はデータベース全体。
+   * @param[in]  flags     0またはTM_FREE_OWN。
+   * @param[out] start     見つかった空き時間の開始時刻が反映される。
+   * @param[out] free_end  見つかった空き時間の終了時刻が反映される。NULLでも
+   * よい。
+   * @return 見つかった場合はTM_OK、見つからない場合はTM_NOT_FOUND、
+   * 失敗時には負の値を返す。
+   */
+  TM_API int tm_find_free(struct tm_handle *h, time_t begin, time_t end,
+			  unsigned int duration, const char *resources,
+			  int flags, time_t *start, time_t *free_end);
+
+  /**
+   * @brief 重複したスケジュールの代わりに、継続時間が収まる直近の前後の
+   * 開始時刻を探す。
+   *
+   * データベースはロックせずに読み込む。sched->pgidのスケジュールは
+   * 上書きされるので、空きとみなす。前の開始時刻は現在時刻以降に限る。
+   * 繰り返しスケジュールの場合は、どちらも見つからないものとする。
+   *
+   * @param[in]  h       ハンドル。
+   * @param[in]  sched   追加できなかったスケジュール。pgidが0の場合は、
+   * 呼び出したプロセスのプロセスグループ。
+   * @param[in]  range   sched->startの前後に探す範囲(sec)。
+   * @param[out] earlier 前の開始時刻が反映される。見つからない場合は-1。
+   * @param[out] later   後の開始時刻が反映される。見つからない場合は-1。
+   * @return 成功時はTM_OK、失敗時には負の値を返す。
+   */
+  TM_API int tm_find_nearest(struct tm_handle *h,
+			     const struct tm_schedule *sched,
+			     unsigned int range, time_t *earlier,
+			     time_t *later);
+
+  /**
+   * @brief 空き時間を探し、そこにスケジュールを追加する。
+   *
+   * 検索から追加までを、1度のロックの中で行う。sched->pgidの既存の
+   * スケジュールは上書きされるので、空きとみなす。空き時間は、継続時間が
+   * minとsched->durationの両方以上のものを選ぶ。
+   *
+   * @param[in]  h          ハンドル。
+   * @param[in]  sched      追加するスケジュール。startは使われず、見つかった
+   * 空き時間の開始時刻になる。durationが0の場合は、空き時間全体を使用する。
+   * 繰り返し、伸縮、予約はできない。
+   * @param[in]  begin      検索する範囲の開始時刻。
+   * @param[in]  end        検索する範囲の終了時刻。
+   * @param[in]  min        空き時間の最小の継続時間(sec)。
+   * @param[out] free_start 見つかった空き時間の開始時刻が反映される。
+   * @param[out] free_end   見つかった空き時間の終了時刻が反映される。
+   * @return 追加した場合はTM_OK、見つからない場合はTM_NOT_FOUND、ロックが
+   * タイムアウトした場合はTM_TIMEOUT、失敗時には負の値を返す。
+   */
+  TM_API int tm_reserve(struct tm_handle *h, const struct tm_schedule *sched,
+			time_t begin, time_t end, unsigned int min,
+			time_t *free_start, time_t *free_end);
+
+  /**
+   * @brief ライブラリの関数が返した値の説明を取得する。
+   * @param[in] status tm_status列挙型の値。
+   * @return 説明の文字列。解放する必要はない。
+   */
+  TM_API const char* tm_strerror(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
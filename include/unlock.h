@@ -17,4 +17,14 @@
  */
 int unlock(int argc, char* argv[]);
 
+/**
+ * @brief データベース番号を指定して、スケジュールの書き換えをアンロックする。
+ *
+ * unlock()用の引数を組み立てて呼び出す。\sa lock_database()
+ *
+ * @param[in] db データベース番号。NULLの場合は環境変数の値が使われる。
+ * @return unlock()の戻り値を返す。
+ */
+int unlock_database(const char *db);
+
 #endif
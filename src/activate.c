@@ -26,6 +26,7 @@
 #include "../include/activate.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdio.h>
@@ -35,7 +36,11 @@
 #include <unistd.h>
 
 #include "../include/common.h"
+#include "../include/crontab_mask.h"
+#include "../include/daemon.h"
 #include "../include/lock.h"
+#include "../include/notify.h"
+#include "../include/tm.h"
 #include "../include/unlock.h"
 
 #define DEFAULT_SIGNO SIGTERM
@@ -140,7 +145,26 @@ static void print_usage()
     "また、終了時刻には、自プロセスグループに指定のシグナルを送信します。"
     "送信されるシグナルのデフォルトはSIGTERMです。\n"
     "\n"
-    "開始時刻後に再度実行された場合は、終了時刻が再スケジュールされます。\n";
+    "開始時刻後に再度実行された場合は、終了時刻が再スケジュールされます。\n"
+    "\n"
+    "伸縮するスケジュール(addコマンドのEオプション)の場合は、他のスケジュールの"
+    "追加で継続時間が短縮されると、終了時刻も早まります。終了時刻に後ろが"
+    "空いていれば、最大の継続時間まで延長して待ち続けます。\n"
+    "\n"
+    "早く開始してよいスケジュール(addコマンドのeオプション)の場合は、"
+    "開始時刻を待つ間に直前のスケジュールが解放されると、開始時刻を早めて"
+    "すぐに開始します。\n"
+    "\n"
+    "先に終わるのを待つスケジュール(addコマンドのaオプション)の場合は、"
+    "相手のスケジュールが終わるか、そのプロセスグループが終了するまで待ち、"
+    "その時点以降の最も早い空きに開始時刻を合わせ直して開始します。\n"
+    "\n"
+    "繰り返しスケジュールの場合は、実行中または次回の繰り返しを、"
+    "開始時刻として確定します。有効にした回の終了前に再度実行された場合は、"
+    "その次の回を確定します。繰り返しスケジュールは、追加したプロセスグループが"
+    "終了すると削除されます。各回の終了時刻に送信されるシグナルで、繰り返し"
+    "activateコマンドを実行するシェルが終了しないよう、シェルではシグナルを"
+    "trapしてください。\n";
 
   const char *optarg = "OPTIONS\n"
     "\t-d database データベース番号(1-5が使用可能)\n"
@@ -217,6 +241,101 @@ static int parse_arguments(int argc, char* *argv, char *shm_name, int *d_opt,
 }
 
 
+/**
+ * @brief 繰り返しスケジュールの、実行中または次回の繰り返しを確定する。
+ *
+ * 確定した繰り返しの開始時刻がstart値となる。rule値はそのまま残るので、
+ * 以降の繰り返しも引き続き予約される。すでに有効にした回がある場合は、
+ * その次の回を確定する。
+ *
+ * @param[in/out] sched 対象のスケジュール。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int materialize_occurrence(struct schedule *sched)
+{
+  struct cron_mask *m;
+  if (crontab_compile(sched->rule, &m) != 0) {
+    fprintf(stderr, "%s:%d: Error: Invalid rule. \"%s\"\n", __FILE__,
+	    __LINE__, sched->rule);
+    return -1;
+  }
+
+  // 実行中の繰り返しがあれば、それを対象とする。有効にした回の終了前に
+  // 再度実行された場合は、その回は終わったものとする。
+  time_t from = time(NULL) - sched->duration + 1;
+  if (sched->terminator != 0)
+    from = sched->start + 1;
+  if (from < sched->start)
+    from = sched->start;
+  from = ((from + 59) / 60) * 60;
+
+  time_t t;
+  int ret = crontab_next(&t, m, from, RECUR_HORIZON);
+  crontab_release(m);
+  if (ret != 0) {
+    fprintf(stderr, "%s:%d: Error: No occurrence. rule:\"%s\"\n", __FILE__,
+	    __LINE__, sched->rule);
+    return -1;
+  }
+
+  sched->start = t;
+
+  return 0;
+}
+
+
+/**
+ * @brief 今回の回が終わったことを、データベースに反映する。
+ *
+ * 繰り返しスケジュールは、start値を次の回に進め、終了機能のpid値を消す。
+ * 次回のactivateは終了した回を選ばず、終了した終了機能を止めようともしない。
+ * rule値は残すので、次回以降の予約は続く。
+ *
+ * 繰り返しでないスケジュールは、継続時間を0にして範囲を解放する。
+ * プロセスグループの終了を待たずに、待機中のクライアントが再確認できる。
+ *
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int finish_occurrence(const char *shm_name)
+{
+  if (lock(g_argc, g_argv) != 0)
+    return -1;
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  if (load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		     &scheds_len) != 0) {
+    unlock(g_argc, g_argv);
+    return -1;
+  }
+
+  // 再度のactivateで、別の終了機能に置き換わっている場合は何もしない。
+  int ret = 0;
+  struct schedule *s;
+  if (find_sched_by_pgid(getpgid(0), scheds, scheds_len, &s) == 0 &&
+      s->terminator == getpid()) {
+    if (s->rule[0] == '\0') {
+      s->start = 0;
+      s->duration = 0;
+    } else if (materialize_occurrence(s) != 0) {
+      ret = -1;
+    }
+
+    if (ret == 0) {
+      s->terminator = 0;
+      ret = save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, scheds_len);
+    }
+  }
+
+  cleanup_schedules(scheds, scheds_len);
+  if (unlock(g_argc, g_argv) != 0)
+    return -1;
+
+  return ret;
+}
+
+
 /**
  * @brief SIGTERM,SIGINT,SIGQUITのシグナルハンドラをデフォルトに設定する。
  * @return 成功時は0、失敗時には-1を返す。
@@ -317,6 +436,409 @@ static void timespec_diff(struct timespec *start, struct timespec *stop, struct
 }
 
 
+/**
+ * @brief 終了時刻まで、または継続時間の変更が知らされるまでブロックする。
+ * @attention @link RESIZE_SIGNO @endlink は、あらかじめブロックしておく必要が
+ * ある。
+ * @param[in] end 終了時刻(time_t)
+ * @return 終了時刻になった場合は0、変更が知らされた場合は1、失敗時には-1を
+ * 返す。
+ */
+static int wait_till_the_end_or_resize(time_t end)
+{
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, RESIZE_SIGNO);
+
+  while (1) {
+    struct timespec ts_current;
+    if (clock_gettime(CLOCK_REALTIME, &ts_current) != 0) {
+      fprintf(stderr, "%s:%d: Error: %s\n", __FILE__, __LINE__,
+	      strerror(errno));
+      return -1;
+    }
+
+    struct timespec ts_end = {end, 0};
+    struct timespec ts_interval;
+    timespec_diff(&ts_current, &ts_end, &ts_interval);
+    if (ts_interval.tv_sec < 0)
+      return 0;
+
+#if defined(__MACH__)
+    // sigtimedwait()がないので、1秒ごとに保留中のシグナルを確認する。
+    sigset_t pending;
+    int sig;
+    if (sigpending(&pending) == 0 && sigismember(&pending, RESIZE_SIGNO)) {
+      sigwait(&set, &sig);
+      return 1;
+    }
+    if (ts_interval.tv_sec > 0) {
+      ts_interval.tv_sec = 1;
+      ts_interval.tv_nsec = 0;
+    }
+    nanosleep(&ts_interval, NULL);
+#else
+    errno = 0;
+    if (sigtimedwait(&set, NULL, &ts_interval) == RESIZE_SIGNO)
+      return 1;
+    if (errno != EAGAIN && errno != EINTR) {
+      fprintf(stderr, "%s:%d: Bug!: sigtimedwait() %s\n", __FILE__, __LINE__,
+	      strerror(errno));
+      return -1;
+    }
+#endif
+  }
+}
+
+
+/**
+ * @brief 自プロセスグループのスケジュールの開始、終了時刻を、データベースから
+ * 読み直す。
+ *
+ * growが1の場合は、データベースをロックして、伸縮するスケジュールを
+ * 終了時刻の後ろの空き時間に延長してから読み直す。自プロセスグループが
+ * すでにロックしている場合は、延長しない。
+ *
+ * @param[in]  shm_name データベース名。
+ * @param[in]  db       データベース番号。環境変数を使う場合はNULL。
+ * @param[in]  grow     延長を試みる場合は1。
+ * @param[out] start    開始時刻が反映される。スケジュールがない場合は変更しない。
+ * @param[out] end      終了時刻が反映される。スケジュールがない場合は変更しない。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int reload_end(const char *shm_name, const char *db, int grow,
+		      time_t *start, time_t *end)
+{
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  if (load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		     &scheds_len) != 0)
+    return -1;
+
+  struct schedule *s = NULL;
+  if (find_sched_by_pgid(getpgid(0), scheds, scheds_len, &s) != 0) {
+    cleanup_schedules(scheds, scheds_len);
+    return 0;
+  }
+
+  if (!grow || s->max_duration <= s->duration || s->lock != 0) {
+    *start = s->start;
+    *end = s->start + s->duration;
+    cleanup_schedules(scheds, scheds_len);
+    return 0;
+  }
+  cleanup_schedules(scheds, scheds_len);
+
+  if (lock_database(db) != 0)
+    return -1;
+
+  int ret = 0;
+  unsigned int capacity;
+  scheds_len = 0;
+  if (get_capacity(shm_name, &capacity) != 0 ||
+      load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		     &scheds_len) != 0) {
+    unlock_database(db);
+    return -1;
+  }
+
+  if (find_sched_by_pgid(getpgid(0), scheds, scheds_len, &s) == 0) {
+    switch (grow_elastic_schedule(s, scheds, scheds_len, capacity)) {
+    case -1:
+      ret = -1;
+      break;
+    case 1:
+      if (save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds,
+			 scheds_len) != 0)
+	ret = -1;
+      break;
+    }
+    if (ret == 0) {
+      *start = s->start;
+      *end = s->start + s->duration;
+    }
+  }
+
+  cleanup_schedules(scheds, scheds_len);
+
+  if (unlock_database(db) != 0)
+    return -1;
+
+  return ret;
+}
+
+
+/**
+ * @brief 終了した自プロセスグループのスケジュールを取り除き、予約されている
+ * 次のスケジュールを有効にする。
+ *
+ * 次のスケジュールの終了機能は、呼び出した終了機能が引き継ぐ。
+ * 次のスケジュールがない場合は、何も変更しない。
+ *
+ * @param[in]     shm_name データベース名。
+ * @param[in]     db       データベース番号。環境変数を使う場合はNULL。
+ * @param[in,out] start    次のスケジュールの開始時刻が反映される。
+ * @param[in,out] end      次のスケジュールの終了時刻が反映される。
+ * @param[out]    elastic  次のスケジュールが伸縮する場合は1が反映される。
+ * @return 次のスケジュールに進んだ場合は1、次のスケジュールがない場合は0、
+ * 失敗時には-1を返す。
+ */
+static int advance_to_next_schedule(const char *shm_name, const char *db,
+				    time_t *start, time_t *end, int *elastic)
+{
+  if (lock_database(db) != 0)
+    return -1;
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  if (load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		     &scheds_len) != 0) {
+    unlock_database(db);
+    return -1;
+  }
+
+  // 2回目の有効化などで、別の終了機能に替わっている場合は進まない。
+  struct schedule *s = NULL, *next = NULL;
+  if (find_sched_by_pgid(getpgid(0), scheds, scheds_len, &s) != 0 ||
+      s->terminator != getpid() ||
+      find_next_sched_by_pgid(s, scheds, scheds_len, &next) != 0) {
+    cleanup_schedules(scheds, scheds_len);
+    return unlock_database(db);
+  }
+
+  time_t old_start = s->start, old_end = s->start + s->duration;
+  next->terminator = getpid();
+  remove_schedule(s, scheds, &scheds_len);
+
+  int ret = 1;
+  if (save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, scheds_len) != 0)
+    ret = -1;
+
+  if (ret == 1) {
+    *start = next->start;
+    *end = next->start + next->duration;
+    *elastic = (next->max_duration != 0);
+    if (verbose > 0) {
+      fprintf(stderr, "%s:%d: DEBUG: Advance to next schedule. id:%" PRIu64
+	      " start:%ld end:%ld\n", __FILE__, __LINE__, next->id, *start,
+	      *end);
+    }
+  }
+
+  cleanup_schedules(scheds, scheds_len);
+
+  if (unlock_database(db) != 0)
+    return -1;
+
+  if (ret == 1)
+    notify_release(shm_name, old_start, old_end);
+
+  return ret;
+}
+
+
+/**
+ * @brief 早く開始してよいスケジュールについて、開始時刻まで待つ間に空きが
+ * できたら、開始時刻を早める。
+ *
+ * 開始時刻の前の範囲を待機表に登録して、スケジュールの解放が通知される
+ * たびに、データベースをロックしてadvance_early_schedule()で確認する。
+ * 早めた場合は、終了機能に終了時刻の変更を知らせ、空いた範囲の解放を
+ * 通知する。開始時刻になるか、開始時刻を現在時刻まで早めたら戻る。
+ *
+ * @param[in]     shm_name データベース名。
+ * @param[in]     db       データベース番号。環境変数を使う場合はNULL。
+ * @param[in,out] start    開始時刻。早めた場合は新しい開始時刻が反映される。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int wait_for_early_start(const char *shm_name, const char *db,
+				time_t *start)
+{
+  while (*start > time(NULL)) {
+
+    if (lock_database(db) != 0)
+      return -1;
+
+    struct schedule* scheds[MAX_NUM_SCHEDULES];
+    size_t scheds_len = 0;
+    unsigned int capacity;
+    if (get_capacity(shm_name, &capacity) != 0 ||
+	load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		       &scheds_len) != 0) {
+      unlock_database(db);
+      return -1;
+    }
+
+    // スケジュールが削除された場合は、元の開始時刻まで待つ。
+    struct schedule *s = NULL;
+    if (find_sched_by_pgid(getpgid(0), scheds, scheds_len, &s) != 0) {
+      cleanup_schedules(scheds, scheds_len);
+      return unlock_database(db);
+    }
+
+    time_t old_end = s->start + s->duration;
+    int ret = advance_early_schedule(s, scheds, scheds_len, capacity,
+				     time(NULL));
+    if (ret == 1 &&
+	save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, scheds_len) != 0)
+      ret = -1;
+
+    // 終了機能に、終了時刻の変更を知らせる。
+    if (ret == 1)
+      signal_terminator(s, RESIZE_SIGNO);
+
+    *start = s->start;
+    time_t new_end = s->start + s->duration;
+    cleanup_schedules(scheds, scheds_len);
+
+    // 通知を取りこぼさないよう、ロックを解放する前に待機表に登録する。
+    // 解放の通知は、データベースの更新の後に送られるので、通知を受けたら
+    // すぐに再確認できる。待機表に空きがない場合は、短い間隔で再確認する。
+    struct wait_handle h;
+    int registered = 1;
+    if (ret == 0)
+      registered = register_wait(shm_name, time(NULL), *start, &h);
+
+    if (ret == -1 || registered == -1) {
+      unlock_database(db);
+      return -1;
+    }
+
+    if (unlock_database(db) != 0) {
+      if (registered == 0)
+	unregister_wait(&h);
+      return -1;
+    }
+
+    if (ret == 1) {
+      if (verbose > 0) {
+	fprintf(stderr, "%s:%d: DEBUG: Start early. start:%ld\n", __FILE__,
+		__LINE__, *start);
+      }
+      notify_release(shm_name, new_end, old_end);
+      continue;
+    }
+
+    if (registered == 0) {
+      int w = wait_for_release(&h, *start);
+      unregister_wait(&h);
+      if (w == -1)
+	return -1;
+    } else {
+      struct timespec ts = {0, WAIT_POLL_INTERVAL_NSEC};
+      nanosleep(&ts, NULL);
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief 先に終わるのを待つスケジュール(addコマンドのaオプション)が終わるまで
+ * 待ち、終わったら開始時刻をその時点に合わせ直す。
+ *
+ * 待つ相手が残っている間は、その終了時刻以降の最も早い空きに開始時刻を
+ * 合わせ、終了時刻の範囲を待機表に登録して待機する。相手のスケジュールが
+ * 解放されるか、プロセスグループが終了して通知を受けたら、現在時刻以降の
+ * 最も早い空きに合わせ直して戻る。開始時刻を変えた場合は、終了機能に
+ * 終了時刻の変更を知らせ、元の範囲の解放を通知する。
+ *
+ * @param[in]     shm_name データベース名。
+ * @param[in]     db       データベース番号。環境変数を使う場合はNULL。
+ * @param[in,out] start    開始時刻。合わせ直した場合は新しい開始時刻が反映される。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int wait_for_predecessor(const char *shm_name, const char *db,
+				time_t *start)
+{
+  while (1) {
+
+    if (lock_database(db) != 0)
+      return -1;
+
+    struct schedule* scheds[MAX_NUM_SCHEDULES];
+    size_t scheds_len = 0;
+    unsigned int capacity;
+    if (get_capacity(shm_name, &capacity) != 0 ||
+	load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		       &scheds_len) != 0) {
+      unlock_database(db);
+      return -1;
+    }
+
+    // スケジュールが削除された場合は、元の開始時刻まで待つ。
+    struct schedule *s = NULL;
+    if (find_sched_by_pgid(getpgid(0), scheds, scheds_len, &s) != 0 ||
+	s->after[0] == '\0') {
+      cleanup_schedules(scheds, scheds_len);
+      return unlock_database(db);
+    }
+
+    // 相手が残っていれば、その終了時刻以降に合わせる。
+    time_t now = time(NULL), pred_end = 0;
+    int waiting = find_predecessor(s, scheds, scheds_len, now, &pred_end);
+
+    time_t old_start = s->start;
+    time_t old_end = s->start + s->duration;
+    int ret = anchor_schedule(s, scheds, scheds_len, capacity,
+			      waiting ? pred_end : now);
+    if (ret == 0 && s->start != old_start &&
+	save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, scheds_len) != 0)
+      ret = -1;
+
+    // 終了機能に、終了時刻の変更を知らせる。
+    if (ret == 0 && s->start != old_start)
+      signal_terminator(s, RESIZE_SIGNO);
+
+    *start = s->start;
+    cleanup_schedules(scheds, scheds_len);
+
+    // 通知を取りこぼさないよう、ロックを解放する前に待機表に登録する。
+    // 解放の通知は、データベースの更新の後に送られるので、通知を受けたら
+    // すぐに再確認できる。待機表に空きがない場合は、短い間隔で再確認する。
+    struct wait_handle h;
+    int registered = 1;
+    if (ret != -1 && waiting)
+      registered = register_wait(shm_name, now, pred_end, &h);
+
+    if (ret == -1 || registered == -1) {
+      unlock_database(db);
+      return -1;
+    }
+
+    if (unlock_database(db) != 0) {
+      if (registered == 0)
+	unregister_wait(&h);
+      return -1;
+    }
+
+    if (*start != old_start) {
+      if (verbose > 0) {
+	fprintf(stderr, "%s:%d: DEBUG: Re-anchored. start:%ld\n", __FILE__,
+		__LINE__, *start);
+      }
+      notify_release(shm_name, old_start, old_end);
+    }
+
+    if (!waiting)
+      break;
+
+    if (registered == 0) {
+      int w = wait_for_release(&h, pred_end);
+      unregister_wait(&h);
+      if (w == -1)
+	return -1;
+    } else {
+      struct timespec ts = {0, WAIT_POLL_INTERVAL_NSEC};
+      nanosleep(&ts, NULL);
+    }
+  }
+
+  return 0;
+}
+
+
 /**
  * @brief startで指定された時刻までブロックする。
  * @param[in] start 指定時刻(time_t)
@@ -360,6 +882,269 @@ static int wait_till_the_time(time_t time, int is_end)
 }
 
 
+/**
+ * @brief 終了機能。終了時刻まで待ち、自プロセスグループにシグナルを送信する。
+ *
+ * fork()した子プロセスで呼び出す。戻らない。
+ * @attention @link RESIZE_SIGNO @endlink は、fork()の前にブロックしておく必要が
+ * ある。
+ *
+ * @param[in] shm_name データベース名。
+ * @param[in] db       データベース番号。環境変数を使う場合はNULL。
+ * @param[in] signo    終了時刻に送信するシグナルの番号。
+ * @param[in] start    開始時刻。
+ * @param[in] end      終了時刻。
+ * @param[in] elastic  伸縮するスケジュールの場合は1。
+ */
+static void __attribute__((noreturn))
+run_terminator(const char *shm_name, const char *db, int signo, time_t start,
+	       time_t end, int elastic)
+{
+  if (verbose > 0) {
+    fprintf(stderr, "%s:%d: child pid:%d pgid:%d\n", __FILE__, __LINE__,
+	    getpid(), getpgid(0));
+  }
+
+  // 不要なパイプを閉じる。
+  if (close_unused_pipes() != 0)
+    _exit(1);
+
+  // 親プロセスで変更されたシグナルハンドラをデフォルト値に戻す。
+  if (reset_signal_handler() != 0)
+    _exit(1);
+
+  // 終了時刻まで待つ。継続時間が変更された場合は、終了時刻を読み直す。
+  // 伸縮するスケジュールは、終了時刻に後ろの空き時間への延長を試みる。
+  // 予約されている次のスケジュールがある場合は、終了させずにそちらに進む。
+  do {
+    while (1) {
+      int ret = wait_till_the_end_or_resize(end);
+      if (ret == -1)
+	_exit(1);
+      if (ret == 0 && !elastic)
+	break;
+
+      if (reload_end(shm_name, db, (ret == 0), &start, &end) != 0 ||
+	  end <= time(NULL))
+	break;
+    }
+  } while (advance_to_next_schedule(shm_name, db, &start, &end, &elastic)
+	   == 1);
+
+  // 今回の回を終えてから、シグナルを送信する。繰り返しスケジュールは、
+  // プロセスグループが続く限り予約が残る。失敗しても、終了時刻を
+  // 過ぎたプロセスグループは止める。
+  finish_occurrence(shm_name);
+
+  // 自プロセスグループを抜けてから、シグナルを送信する。
+  pid_t pgid = getpgid(0);
+  errno = 0;
+  if (setpgid(0, 0) == -1) {
+    fprintf(stderr, "%s:%d: Bug!: setpgid() %s.\n", __FILE__, __LINE__,
+	    strerror(errno));
+    _exit(1);
+  }
+
+  errno = 0;
+  if (killpg(pgid, signo) == -1) {
+    fprintf(stderr, "%s:%d: Bug!: killpg() %s. to:%d, sig:%d\n", __FILE__,
+	    __LINE__, strerror(errno), pgid, signo);
+    _exit(1);
+  }
+
+  // 最後に、待機中のクライアントにスケジュールの終了を通知する。
+  notify_release(shm_name, start, end);
+
+  _exit(0);
+}
+
+
+/**
+ * @brief 有効にしたスケジュールの開始時刻まで待ち、stdinの内容をstdoutに
+ * 受け流す。
+ * @param[in] shm_name データベース名。
+ * @param[in] db       データベース番号。環境変数を使う場合はNULL。
+ * @param[in] own      有効にした自プロセスグループのスケジュール。
+ * @return activate()の戻り値を返す。
+ */
+static int start_at_the_time(const char *shm_name, const char *db,
+			     const struct schedule *own)
+{
+  time_t start = own->start;
+  int early = (own->early && own->rule[0] == '\0');
+  int after = (own->after[0] != '\0' && own->rule[0] == '\0');
+
+  // 先に終わるのを待つ場合は、相手が終わるのを待つ。
+  // 早く開始してよい場合は、空きができるのを待つ。
+  if (after && wait_for_predecessor(shm_name, db, &start) != 0)
+    return EXIT_FAILURE;
+  if (early && wait_for_early_start(shm_name, db, &start) != 0)
+    return EXIT_FAILURE;
+
+  // 開始時刻まで待つ。
+  if (wait_till_the_time(start, 0) != 0)
+    return EXIT_FAILURE;
+
+  // 残りのstdinの内容をstdoutに受け流す。
+  if (pass_another_data_from_stdin_to_stdout() != 0)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
+
+
+/**
+ * @brief 有効にするスケジュールの終了機能を起動する。
+ *
+ * 子プロセスが継続時間の変更を受け取れるよう、fork()の前にシグナルを
+ * ブロックしておく。
+ *
+ * @param[in] shm_name データベース名。
+ * @param[in] db       データベース番号。環境変数を使う場合はNULL。
+ * @param[in] signo    終了時刻に送信するシグナルの番号。
+ * @param[in] own      有効にするスケジュール。繰り返し、伸縮しないもの。
+ * @return 成功時は終了機能のpid値、失敗時には-1を返す。
+ */
+static pid_t fork_terminator(const char *shm_name, const char *db, int signo,
+			     const struct schedule *own)
+{
+  sigset_t resize_set, org_set;
+  sigemptyset(&resize_set);
+  sigaddset(&resize_set, RESIZE_SIGNO);
+  sigprocmask(SIG_BLOCK, &resize_set, &org_set);
+
+  errno = 0;
+  pid_t child_pid = fork();
+  if (child_pid == -1) {
+    fprintf(stderr, "%s:%d: Error: %s\n", __FILE__, __LINE__, strerror(errno));
+    sigprocmask(SIG_SETMASK, &org_set, NULL);
+    return -1;
+  }
+  if (child_pid == 0)
+    run_terminator(shm_name, db, signo, own->start,
+		   own->start + own->duration, 0);
+
+  sigprocmask(SIG_SETMASK, &org_set, NULL);
+
+  return child_pid;
+}
+
+
+/**
+ * @brief デーモンが動いている場合は、デーモンにスケジュールの有効化を依頼する。
+ *
+ * 終了機能を起動してから依頼し、受け付けられなかった場合は終了機能を
+ * 止める。応答を受け取れなかった場合は、デーモンが止めた終了機能を
+ * 記録していることがあるので、そのpid値をstaleに反映する。
+ * 繰り返し、伸縮するスケジュールと、2回目の有効化は、通常の手順で行う。
+ *
+ * @param[in]  shm_name データベース名。
+ * @param[in]  db       データベース番号。環境変数を使う場合はNULL。
+ * @param[in]  signo    終了時刻に送信するシグナルの番号。
+ * @param[out] own      有効にしたスケジュールが反映される。
+ * @param[out] stale    止めた終了機能のpid値が反映される。止めていない場合は0。
+ * @return 有効にした場合は0、通常の手順で行う場合は1、失敗時には-1を返す。
+ */
+static int activate_with_daemon(const char *shm_name, const char *db,
+				int signo, struct schedule *own, pid_t *stale)
+{
+  *stale = 0;
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  if (list_by_daemon(shm_name, scheds, MAX_NUM_SCHEDULES, &scheds_len) != 0)
+    return 1;
+
+  struct schedule *s = NULL;
+  if (find_sched_by_pgid(getpgid(0), scheds, scheds_len, &s) != 0 ||
+      s->rule[0] != '\0' || s->max_duration != 0 || s->terminator != 0) {
+    cleanup_schedules(scheds, scheds_len);
+    return 1;
+  }
+  *own = *s;
+  cleanup_schedules(scheds, scheds_len);
+
+  pid_t child_pid = fork_terminator(shm_name, db, signo, own);
+  if (child_pid == -1)
+    return -1;
+
+  own->terminator = child_pid;
+  if (activate_by_daemon(shm_name, own) != 0) {
+    kill(child_pid, SIGKILL);
+    *stale = child_pid;
+    return 1;
+  }
+
+  if (verbose > 0) {
+    fprintf(stderr, "%s:%d: Activated by daemon. terminator:%d\n", __FILE__,
+	    __LINE__, child_pid);
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief libtmでスケジュールを有効にする。
+ *
+ * デーモンと同じく、終了機能を起動してからtm_activate()で記録し、受け付け
+ * られなかった場合は終了機能を止める。繰り返し、伸縮するスケジュールの
+ * 有効化は、繰り返しの確定や延長と終了機能の起動を同じロックの中で行う
+ * 必要があるので、2回目の有効化とともに通常の手順で行う。
+ *
+ * @param[in]  shm_name データベース名。
+ * @param[in]  db       データベース番号。環境変数を使う場合はNULL。
+ * @param[in]  signo    終了時刻に送信するシグナルの番号。
+ * @param[out] own      有効にしたスケジュールが反映される。
+ * @return 有効にした場合は0、通常の手順で行う場合は1、失敗時には-1を返す。
+ */
+static int activate_with_library(const char *shm_name, const char *db,
+				 int signo, struct schedule *own)
+{
+  struct tm_handle *h;
+  if (tm_open(db, &h) != TM_OK)
+    return -1;
+
+  struct tm_schedule s;
+  if (tm_get(h, 0, &s) != TM_OK || s.rule[0] != '\0' ||
+      s.max_duration != 0 || s.terminator != 0) {
+    tm_close(h);
+    return 1;
+  }
+
+  memset(own, 0, sizeof(*own));
+  own->pgid = s.pgid;
+  own->start = s.start;
+  own->duration = s.duration;
+  strcpy(own->caption, s.caption);
+  strcpy(own->resources, s.resources);
+  own->early = s.early;
+  strcpy(own->after, s.after);
+  own->id = s.id;
+
+  pid_t child_pid = fork_terminator(shm_name, db, signo, own);
+  if (child_pid == -1) {
+    tm_close(h);
+    return -1;
+  }
+
+  int ret = tm_activate(h, 0, child_pid);
+  tm_close(h);
+  if (ret != TM_OK) {
+    kill(child_pid, SIGKILL);
+    return 1;
+  }
+  own->terminator = child_pid;
+
+  if (verbose > 0) {
+    fprintf(stderr, "%s:%d: Activated by libtm. terminator:%d\n", __FILE__,
+	    __LINE__, child_pid);
+  }
+
+  return 0;
+}
+
+
 int activate(int argc, char *argv[])
 {
   char shm_name[NAME_MAX] = DEFAULT_SHARED_MEMORY_NAME;
@@ -402,6 +1187,26 @@ int activate(int argc, char *argv[])
     return EXIT_FAILURE;
   }
 
+  // デーモンが動いている場合は、有効化を依頼する。
+  const char *db = opt_d ? shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME)
+    : NULL;
+  struct schedule own;
+  pid_t stale;
+  switch (activate_with_daemon(shm_name, db, signo, &own, &stale)) {
+  case -1:
+    return EXIT_FAILURE;
+  case 0:
+    return start_at_the_time(shm_name, db, &own);
+  }
+
+  // 繰り返し、伸縮しないスケジュールは、libtmで有効にする。
+  switch (activate_with_library(shm_name, db, signo, &own)) {
+  case -1:
+    return EXIT_FAILURE;
+  case 0:
+    return start_at_the_time(shm_name, db, &own);
+  }
+
   // データベースをロックする。
   if (lock(argc, argv) != 0)
     return EXIT_FAILURE;
@@ -425,6 +1230,11 @@ int activate(int argc, char *argv[])
     return EXIT_MISUSE;
   }
 
+  // デーモンへの依頼で止めた終了機能が記録されている場合は、
+  // まだ有効にされていないものとして扱う。
+  if (stale != 0 && s->terminator == stale)
+    s->terminator = 0;
+
   if (verbose > 0) {
     fprintf(stderr,
        "%s:%d: DEBUG: pgid:%d lock:%d terminator:%d start:%ld dur:%d cap:%s\n",
@@ -432,6 +1242,23 @@ int activate(int argc, char *argv[])
 	    s->duration,s->caption);
   }
 
+  // 繰り返しスケジュールの場合は、今回の開始時刻を確定する。
+  if (s->rule[0] != '\0' && materialize_occurrence(s) != 0) {
+    cleanup_schedules(scheds, scheds_len);
+    unlock(argc, argv);
+    return EXIT_FAILURE;
+  }
+
+  // 伸縮するスケジュールは、後ろの空き時間に延長しておく。
+  unsigned int capacity;
+  if (s->max_duration != 0 &&
+      (get_capacity(shm_name, &capacity) != 0 ||
+       grow_elastic_schedule(s, scheds, scheds_len, capacity) == -1)) {
+    cleanup_schedules(scheds, scheds_len);
+    unlock(argc, argv);
+    return EXIT_FAILURE;
+  }
+
   // 上書きの場合は、既存プロセスをkillする。
   if (s->terminator != 0) {
     if (verbose > 0) {
@@ -449,11 +1276,19 @@ int activate(int argc, char *argv[])
   }
 
   // 終了機能
+  // 子プロセスが継続時間の変更を受け取れるよう、fork()の前にシグナルを
+  // ブロックしておく。
+  sigset_t resize_set, org_set;
+  sigemptyset(&resize_set);
+  sigaddset(&resize_set, RESIZE_SIGNO);
+  sigprocmask(SIG_BLOCK, &resize_set, &org_set);
+
   errno = 0;
   pid_t child_pid;
   switch (child_pid = fork()) {
   case -1:
     fprintf(stderr, "%s:%d: Error: %s\n", __FILE__, __LINE__, strerror(errno));
+    sigprocmask(SIG_SETMASK, &org_set, NULL);
     cleanup_schedules(scheds, scheds_len);
     unlock(argc, argv);
     return EXIT_FAILURE;
@@ -464,36 +1299,13 @@ int activate(int argc, char *argv[])
       // 終了時刻まで待ち、終了時刻になったら、自プロセスグループにシグナルを
       // 送信する。親プロセスにwaitされず、initに引き取られる。
 
-      if (verbose > 0) {
-	fprintf(stderr, "%s:%d: child pid:%d pgid:%d\n", __FILE__, __LINE__,
-		getpid(), getpgid(0));
-      }
-
-      // 不要なパイプを閉じる。
-      if (close_unused_pipes() != 0)
-	_exit(1);
-
-      // 親プロセスで変更されたシグナルハンドラをデフォルト値に戻す。
-      if (reset_signal_handler() != 0)
-	_exit(1);
-
       // 必要な値のみ取り出して、親から受け継いだものを掃除する。
+      time_t start = s->start;
       time_t end = s->start + s->duration;
+      int elastic = (s->max_duration != 0);
       cleanup_schedules(scheds, scheds_len);
 
-      // 終了時刻まで待つ。
-      if (wait_till_the_time(end, 1) != 0)
-	_exit(1);	
-
-      // 自プロセスグループにシグナルを送信。
-      errno = 0;
-      if (killpg(getpgid(0), signo) == -1) {
-	fprintf(stderr, "%s:%d: Bug!: killpg() %s. to:%d, sig:%d\n", __FILE__,
-		__LINE__, strerror(errno), getpgid(0), signo);
-	_exit(1);
-      }
-
-      _exit(0);
+      run_terminator(shm_name, db, signo, start, end, elastic);
     }
   default:
     {
@@ -507,6 +1319,7 @@ int activate(int argc, char *argv[])
       }
 
       // 申し訳ないが、子プロセスはinitに引き取ってもらう。//
+      sigprocmask(SIG_SETMASK, &org_set, NULL);
 
       // 子プロセスのpidを保存する。
       s->terminator = child_pid;
@@ -523,21 +1336,12 @@ int activate(int argc, char *argv[])
 	return EXIT_FAILURE;
 
       // 必要な値のみ取り出して、掃除する。
-      time_t start = s->start;
+      own = *s;
       cleanup_schedules(scheds, scheds_len);
 
       // アクティベート処理ここまで //
-       
-      // 開始時刻まで待つ。
-      if (wait_till_the_time(start, 0) != 0)
-	return EXIT_FAILURE;
-
-      // 残りのstdinの内容をstdoutに受け流す。
-      if (pass_another_data_from_stdin_to_stdout() != 0)
-	return EXIT_FAILURE;
 
+      return start_at_the_time(shm_name, db, &own);
     } // default
   } // switch
-  
-  return EXIT_SUCCESS;
 }
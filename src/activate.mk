@@ -3,5 +3,9 @@ OBJECTS += $(OBJ_DIR)/activate.o
 $(OBJ_DIR)/activate.o: $(SOURCE_DIR)/activate.c \
                        $(INCLUDE_DIR)/activate.h \
                        $(INCLUDE_DIR)/common.h \
+                       $(INCLUDE_DIR)/crontab_mask.h \
+                       $(INCLUDE_DIR)/daemon.h \
                        $(INCLUDE_DIR)/lock.h \
-                       $(INCLUDE_DIR)/unlock.h
\ No newline at end of file
+                       $(INCLUDE_DIR)/unlock.h \
+                       $(INCLUDE_DIR)/notify.h \
+                       $(INCLUDE_DIR)/tm.h
\ No newline at end of file
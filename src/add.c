@@ -33,8 +33,19 @@
 #include <unistd.h>
 
 #include "../include/common.h"
-#include "../include/lock.h"
-#include "../include/unlock.h"
+#include "../include/crontab_mask.h"
+#include "../include/daemon.h"
+#include "../include/notify.h"
+#include "../include/tm.h"
+
+/** 待機がタイムアウトした場合の戻り値 */
+#define EXIT_TIMEOUT 3
+
+/** 重複のため追加できなかった場合の戻り値 */
+#define EXIT_CONFLICT 4
+
+/** 重複した場合に、代わりの開始時刻を探す前後の範囲(sec) */
+#define ALTERNATIVE_RANGE (60*60*24)
 
 static int verbose = 0;
 
@@ -43,7 +54,8 @@ static int verbose = 0;
  */
 static void print_usage()
 {
-  const char *usage = "tm add [-d database] [-v] [-h]\n";
+  const char *usage = "tm add [-a name] [-c expression] [-d database] [-e] "
+    "[-E min:max] [-q] [-R resources] [-w timeout] [-v] [-h]\n";
 
   const char *description = "stdinからスケジュール文字列を読み取り、スケジュ"
     "ールデータベースへ追加します。\n"
@@ -52,23 +64,90 @@ static void print_usage()
     "startは、スケジュールの開始時刻(time_t形式)、durationは、継続時間(sec)、"
     "captionは、スケジュールの簡単な説明です。\n"
     "\n"
-    "すでに自プロセスグループのスケジュールが存在する場合は、上書きします。\n";
+    "すでに自プロセスグループのスケジュールが存在する場合は、上書きします。\n"
+    "\n"
+    "qオプションを指定すると、上書きせずに、自プロセスグループの最後の"
+    "スケジュールの後に続くスケジュールとして予約します。startは、最後の"
+    "スケジュールの終了時刻以降である必要があります。activateコマンドが起動した"
+    "終了機能は、有効にしたスケジュールの終了時刻にプロセスグループを終了させず、"
+    "予約された次のスケジュールを有効にして、その終了時刻まで待ちます。"
+    "プロセスグループを分けずに、複数の区間を続けて実行できます。"
+    "各スケジュールには、データベースに書き込む時にスケジュールIDが割り当てられ、"
+    "schedule -Aの出力のid属性で確認できます。a、c、e、Eオプションとは同時に"
+    "指定できません。\n"
+    "\n"
+    "aオプションを指定すると、nameのスケジュールが先に終わるのを待つ"
+    "スケジュールとして追加します。nameが数字だけの場合はpgid値、それ以外の"
+    "場合はcaptionで相手を指定します。activateコマンドは、相手のスケジュールが"
+    "終わるか、そのプロセスグループが終了するまで待ち、その時点以降の最も早い"
+    "空きに開始時刻を合わせ直して開始します。startは仮の開始時刻となります。"
+    "繰り返しスケジュールには効果がありません。\n"
+    "\n"
+    "cオプションを指定すると、繰り返しスケジュールとして追加します。"
+    "繰り返しスケジュールは、start以降の、crontab形式の時刻指定に一致するすべて"
+    "の時刻から、duration秒間のスケジュールとなります。startに0を指定した場合は"
+    "現在時刻となります。繰り返しの各回は、activateコマンドで有効にされた時に"
+    "確定します。繰り返しスケジュールは、追加したプロセスグループが終了すると"
+    "削除されるので、各回の終了時刻に送信されるシグナルをtrapするシェルから"
+    "追加し、activateコマンドを繰り返し実行します。\n"
+    "\n"
+    "eオプションを指定すると、早く開始してよいスケジュールとして追加します。"
+    "activateコマンドで開始時刻を待っている間に、直前のスケジュールが終了、"
+    "または削除されて空きができると、開始時刻をその空きの始まりまで早めて、"
+    "すぐに開始します。継続時間は変わらず、終了時刻も同じだけ早まります。"
+    "繰り返しスケジュールには効果がありません。\n"
+    "\n"
+    "Eオプションを指定すると、継続時間がminからmaxの間で伸縮するスケジュール"
+    "として追加します。終了時刻の後ろが空いていれば、maxまで延長されます。"
+    "後から追加されるスケジュールと重なる場合は、minを下回らない範囲で、"
+    "そのスケジュールの開始時刻で終わるように短縮されます。継続時間の変更は、"
+    "activateコマンドが起動した終了機能に通知され、終了時刻が変わります。"
+    "繰り返しスケジュールには指定できません。\n"
+    "\n"
+    "Rオプションを指定すると、カンマ区切りで指定した資源だけを占有する"
+    "スケジュールとして追加します。すべての資源が空いている場合にだけ、"
+    "まとめて追加します。指定しない場合は、データベース全体を占有します。\n"
+    "\n"
+    "wオプションを指定すると、重複がある場合に失敗せず、重なるスケジュールが"
+    "終了、または削除されるまで待機してから追加します。待機中は、重なる"
+    "スケジュールの解放が通知された時にだけ再確認します。timeoutに0を指定した"
+    "場合は、無制限に待機します。\n"
+    "\n"
+    "重複のため追加できなかった場合は、前後1日の範囲で、継続時間が収まる直近の"
+    "前後の開始時刻を、earlier:start:duration:caption、"
+    "later:start:duration:captionの書式でstderrに出力し、4を返します。"
+    "見つからない方は出力しません。\n";
 
   const char *optarg = "OPTIONS\n"
+    "\t-a name     先に終わるのを待つスケジュールのpgid値またはcaption\n"
+    "\t-c expression 繰り返しの時刻指定(crontab形式。例: \"0 7 * * *\")\n"
     "\t-d database データベース番号(1-5が使用可能)\n"
+    "\t-e          空きができたら開始時刻より早く開始してよい。\n"
+    "\t-E min:max  伸縮する継続時間の範囲(sec)\n"
+    "\t-q          自プロセスグループの最後のスケジュールの後に予約する。\n"
+    "\t-R resources 占有する資源の集合(カンマ区切り。例: tuner,speaker)\n"
+    "\t-w timeout  重複がある場合に待機する最大の時間(sec)。0は無制限\n"
     "\t-v          verboseモード\n"
     "\t-h          show this help message and exit\n";
 
   const char *exit_status = "EXIT STATUS\n"
     "\t0 正常終了\n"
     "\t1 異常終了\n"
-    "\t2 使用方法に誤りがある場合\n";
+    "\t2 使用方法に誤りがある場合\n"
+    "\t3 待機がタイムアウトした場合\n"
+    "\t4 重複のため追加できなかった場合\n";
 
   const char *env = "ENVIRONMENT\n"
     "\tTM_DB_NUM データベース番号(1-5が使用可能)。dオプションが指定された場合は、そちらが優先される。\n";
 
   const char *example = "EXAMPLE\n"
-    "\t$ sh -c 'echo \"1503180600:600:今朝のニュース\" | tm add && tm activate && myprogram; tm terminate;'\n";
+    "\t$ sh -c 'echo \"1503180600:600:今朝のニュース\" | tm add && tm activate && myprogram; tm terminate;'\n"
+    "\t$ sh -c 'trap : TERM; echo \"0:600:毎朝のニュース\" | tm add -c \"0 7 * * *\" && while tm activate; do myprogram; done; tm terminate;'\n"
+    "\t$ sh -c 'echo \"1503180600:600:今朝のニュース\" | tm add -w 3600 && tm activate && myprogram; tm terminate;'\n"
+    "\t$ sh -c 'echo \"1503180600:600:今朝のニュース\" | tm add -R tuner,speaker && tm activate && myprogram; tm terminate;'\n"
+    "\t$ sh -c 'echo \"1503180600:1800:音楽\" | tm add -E 300:3600 && tm activate && myprogram; tm terminate;'\n"
+    "\t$ sh -c 'echo \"1503181200:600:変換\" | tm add -a 今朝のニュース && tm activate && myprogram; tm terminate;'\n"
+    "\t$ sh -c 'echo \"1503180600:600:前半\" | tm add && echo \"1503181800:600:後半\" | tm add -q && tm activate && myplayer; tm terminate;'\n";
   
   fprintf(stderr, "usage: %s\n%s\n%s\n%s\n%s\n%s\n",
 	  usage, description, optarg, exit_status, env, example);
@@ -79,23 +158,57 @@ static void print_usage()
  * @brief コマンドライン引数を解析する。
  * @param[in]  argc     argc値
  * @param[in]  argv     argv値
+ * @param[out] after    '-a'オプション(先に終わるのを待つスケジュール)が反映される。
+ * @param[out] rule     '-c'オプション(繰り返しの時刻指定)が反映される。
  * @param[out] shm_name '-d'オプション(データベース番号)が反映される。
  * @param[out] d_opt    '-d'オプション(データベース番号)が指定された場合、1が設
  * 定される。
+ * @param[out] early    '-e'オプション(早く開始してよい)が指定された場合、1が設
+ * 定される。
+ * @param[out] min      '-E'オプション(伸縮する継続時間の最小値)が反映される。
+ * @param[out] max      '-E'オプション(伸縮する継続時間の最大値)が反映される。
+ * @param[out] queue    '-q'オプション(予約)が指定された場合、1が設定される。
+ * @param[out] resources '-R'オプション(資源の集合)の値が反映される。
+ * @param[out] w_opt    '-w'オプション(待機)が指定された場合、1が設定される。
+ * @param[out] timeout  '-w'オプション(待機する最大の時間)の値が反映される。
  * @param[out] verbose  '-v'オプション(verboseモード)の値が反映される。
  * @return 成功時は0、'h'オプションが指定された場合は1、不正な値が与えられた場
  * 合は2を返す。
  */
-static int parse_arguments(int argc, char* *argv, char *shm_name, int *d_opt,
-			   int *verbose)
+static int parse_arguments(int argc, char* *argv, char *after, char *rule,
+			   char *shm_name, int *d_opt, int *early, unsigned int *min,
+			   unsigned int *max, int *queue, char *resources,
+			   int *w_opt, unsigned int *timeout, int *verbose)
 {  
   // TimeManagerから呼ばれる場合、argvは{"tm", "add". "opt"...}となる。
   // オプションを読み込むためには、optindを1つ進めて2にしておく必要がある。
   opterr = 0;
   optind = 2;
   int opt;
-  while ((opt = getopt(argc, argv, "d:hv")) != -1) {
+  while ((opt = getopt(argc, argv, "a:c:d:eE:hqR:vw:")) != -1) {
     switch (opt) {
+    case 'a':
+      // 先に終わるのを待つスケジュール。レコードの区切り文字は使用できない。
+      if (optarg[0] == '\0' || strlen(optarg) >= MAX_CAPTION_LEN ||
+	  strpbrk(optarg, ":;=\n") != NULL) {
+	fprintf(stderr, "Error: Invalid name. \"%s\"\n", optarg);
+	return 2;
+      }
+      strcpy(after, optarg);
+      break;
+    case 'c':
+      {
+	// 繰り返しの時刻指定。レコードの区切り文字は使用できない。
+	struct cron_mask *m;
+	if (strlen(optarg) >= MAX_RULE_LEN || strpbrk(optarg, ":;\n") != NULL
+	    || crontab_compile(optarg, &m) != 0) {
+	  fprintf(stderr, "Error: Invalid expression. \"%s\"\n", optarg);
+	  return 2;
+	}
+	crontab_release(m);
+	strcpy(rule, optarg);
+      }
+      break;
     case 'd':
       // データベース番号
       if (atoi(optarg) < 1 || atoi(optarg) > MAX_NUM_DB) {
@@ -106,14 +219,50 @@ static int parse_arguments(int argc, char* *argv, char *shm_name, int *d_opt,
       strcat(shm_name, optarg);
       *d_opt = 1;
       break;
+    case 'e':
+      // 早く開始してよい。
+      *early = 1;
+      break;
+    case 'E':
+      {
+	// 伸縮する継続時間の範囲
+	char sep = 0;
+	if (sscanf(optarg, "%u%c%u", min, &sep, max) != 3 || sep != ':' ||
+	    *min == 0 || *min > *max) {
+	  fprintf(stderr, "Error: Invalid duration range. \"%s\"\n", optarg);
+	  return 2;
+	}
+      }
+      break;
     case 'h':
       // ヘルプ
       print_usage();
       return 1;
+    case 'q':
+      // 予約
+      *queue = 1;
+      break;
+    case 'R':
+      // 資源の集合
+      if (check_resource_set(optarg) != 0) {
+	fprintf(stderr, "Error: Invalid resources. \"%s\"\n", optarg);
+	return 2;
+      }
+      strcpy(resources, optarg);
+      break;
     case 'v':
       // verboseモード
       *verbose = 1;
       break;
+    case 'w':
+      // 重複がある場合に待機する。
+      if (atoi(optarg) < 0) {
+	fprintf(stderr, "Error: Invalid timeout value. \"%s\"\n", optarg);
+	return 2;
+      }
+      *w_opt = 1;
+      *timeout = atoi(optarg);
+      break;
     case '?':
       //fprintf(stderr, "%s:%d: Error: Unknown option.\n", __FILE__, __LINE__);
       //return -1;
@@ -128,16 +277,70 @@ static int parse_arguments(int argc, char* *argv, char *shm_name, int *d_opt,
 }
 
 
+/**
+ * @brief 重複したスケジュールの代わりに、継続時間が収まる直近の前後の開始時刻
+ * をstderrに出力する。
+ *
+ * 前の開始時刻は現在時刻以降に限る。繰り返しスケジュールの場合は出力しない。
+ *
+ * @param[in] h     ハンドル。
+ * @param[in] sched 追加できなかったスケジュール。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int print_alternatives(struct tm_handle *h,
+			      const struct tm_schedule *sched)
+{
+  time_t earlier, later;
+  if (tm_find_nearest(h, sched, ALTERNATIVE_RANGE, &earlier, &later) != TM_OK)
+    return -1;
+
+  if (earlier != -1) {
+    fprintf(stderr, "earlier:%ld:%u:%s\n", earlier, sched->duration,
+	    sched->caption);
+  }
+  if (later != -1) {
+    fprintf(stderr, "later:%ld:%u:%s\n", later, sched->duration,
+	    sched->caption);
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief スケジュール構造体を、libtmに渡すスケジュールに変換する。
+ * @param[in]  s   変換するスケジュール。
+ * @param[out] out 変換したスケジュールが反映される。
+ */
+static void to_tm_schedule(const struct schedule *s, struct tm_schedule *out)
+{
+  memset(out, 0, sizeof(*out));
+  out->pgid = s->pgid;
+  out->start = s->start;
+  out->duration = s->duration;
+  strcpy(out->caption, s->caption);
+  strcpy(out->resources, s->resources);
+  strcpy(out->rule, s->rule);
+  out->min_duration = s->min_duration;
+  out->max_duration = s->max_duration;
+  out->early = s->early;
+  strcpy(out->after, s->after);
+}
+
+
 /**
  * @brief stdinからスケジュールを読み込む。
  * 
  * stdinから始めの1行をスケジュールとして読み込む。
  * 読み込んだスケジュールの終了時刻が、現在時刻よりも過去の場合は1を返す。
+ * 繰り返しスケジュールの場合は、過去の確認をせず、start値が0の場合は現在時刻
+ * とする。
  *
+ * @param[in]  rule  繰り返しの時刻指定。繰り返さない場合は空文字列。
  * @param[out] sched 読み込んだスケジュールが反映される。
  * @return 成功時は0、失敗時には-1、不正なスケジュールの場合は1を返す。
  */
-static int read_schedule(struct schedule* *sched)
+static int read_schedule(const char *rule, struct schedule* *sched)
 {
   // stdinから1行読み取る。
   char buf[MAX_SCHEDULE_STRING_LEN+1];
@@ -157,7 +360,11 @@ static int read_schedule(struct schedule* *sched)
   }
   
   time_t current = time(NULL);
-  if (((*sched)->start + (*sched)->duration) < current) {
+  if (rule[0] != '\0') {
+    strcpy((*sched)->rule, rule);
+    if ((*sched)->start == 0)
+      (*sched)->start = current;
+  } else if (((*sched)->start + (*sched)->duration) < current) {
     fprintf(stderr, "%s:%d: Error: past schedule. current:%ld, new_end:%ld\n",
 	    __FILE__, __LINE__, current, ((*sched)->start+(*sched)->duration));
     free((*sched));
@@ -177,10 +384,16 @@ static int read_schedule(struct schedule* *sched)
 int add(int argc, char *argv[])
 {
   char shm_name[NAME_MAX] = DEFAULT_SHARED_MEMORY_NAME;
-  int d_opt = 0;
+  char rule[MAX_RULE_LEN] = "";
+  char after[MAX_CAPTION_LEN] = "";
+  char resources[MAX_RESOURCES_LEN] = "";
+  int d_opt = 0, w_opt = 0, early = 0, queue = 0;
+  unsigned int timeout = 0, min = 0, max = 0;
 
   // オプション解析
-  switch (parse_arguments(argc, argv, shm_name, &d_opt, &verbose)) {
+  switch (parse_arguments(argc, argv, after, rule, shm_name, &d_opt, &early,
+			  &min, &max, &queue, resources, &w_opt, &timeout,
+			  &verbose)) {
   case 1:
     return EXIT_SUCCESS;
   case 2:
@@ -198,74 +411,133 @@ int add(int argc, char *argv[])
 
   // stdinからスケジュールを読み込む。
   struct schedule* new;
-  switch (read_schedule(&new)) {
+  switch (read_schedule(rule, &new)) {
   case -1:
     return EXIT_FAILURE;
   case 1:
     return EXIT_MISUSE;
   }
-
-  // データベースをロックする。
-  if (lock(argc, argv) != 0)
-    return EXIT_FAILURE;
-
-  // 既存のスケジュール取得
-  struct schedule* scheds[MAX_NUM_SCHEDULES];
-  size_t scheds_len = 0;
-  if (load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
-		     &scheds_len) != 0) {
+  strcpy(new->resources, resources);
+  new->early = early;
+  strcpy(new->after, after);
+
+  // 伸縮する継続時間の範囲は、tm_add()が確認する。
+  new->min_duration = min;
+  new->max_duration = max;
+
+  // 予約するスケジュールは、開始時刻が決まっている必要がある。
+  if (queue && (new->rule[0] != '\0' || max != 0 || early ||
+		new->after[0] != '\0')) {
+    fprintf(stderr, "%s:%d: Error: -q cannot be used with -a, -c, -e, -E.\n",
+	    __FILE__, __LINE__);
     free(new);
-    unlock(argc, argv);
-    return EXIT_FAILURE;
+    return EXIT_MISUSE;
   }
 
-  // 重複チェック
-  if (check_sched_conflict(new, scheds, scheds_len) != 0) {
-    fprintf(stderr, "%s:%d: Error: Double booking.\n", __FILE__, __LINE__);
-    cleanup_schedules(scheds, scheds_len);
+  // デーモンが動いている場合は、追加を依頼する。重複などで追加されなかった
+  // 場合は、以下のlibtmの手順で、縮められるスケジュールを探し、代わりの
+  // 開始時刻の出力や待機を行う。伸縮するスケジュールはlibtmで追加する。
+  if (max == 0 && !queue && add_by_daemon(shm_name, new) == 0) {
+    if (verbose > 0)
+      fprintf(stderr, "%s:%d: Added by daemon.\n", __FILE__, __LINE__);
     free(new);
-    unlock(argc, argv);
-    return EXIT_FAILURE;
+    return EXIT_SUCCESS;
   }
-  
-  // すでにスケジュールがあるか。
-  struct schedule *s = NULL;
-  if (find_sched_by_pgid(getpgid(0), scheds, scheds_len, &s) == 0) {
-    // スケジュールあり。上書き。
-    if (verbose > 0) {
-      fprintf(stderr, "%s:%d: Find record. update lock value.\n", __FILE__,
-	      __LINE__);
-    }
 
-    s->start = new->start;
-    s->duration = new->duration;
-    strcpy(s->caption, new->caption);
+  struct tm_schedule sched;
+  to_tm_schedule(new, &sched);
+  int flags = queue ? TM_ADD_QUEUE : 0;
 
-    free(new);
+  // 待機する場合に、解放の通知を受ける範囲。
+  time_t wait_end = new->start + new->duration;
+  if (new->rule[0] != '\0')
+    wait_end += RECUR_HORIZON;
+  free(new);
 
-  } else {
-    // スケジュールなし。追加。
-    if (verbose > 0) {
-      fprintf(stderr, "%s:%d: Not found record. Create new record.\n",
-	      __FILE__, __LINE__);
+  const char *db = NULL;
+  if (d_opt)
+    db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+
+  struct tm_handle *h;
+  if (tm_open(db, &h) != TM_OK)
+    return EXIT_FAILURE;
+
+  time_t deadline = (timeout != 0) ? time(NULL) + timeout : 0;
+
+  // 重複がなくなるまで繰り返す。待機しない場合は1度だけ。
+  int ret;
+  while (1) {
+
+    // 通知を取りこぼさないよう、追加を試みる前に待機表に登録する。
+    // 待機表に空きがない場合は、短い間隔で再確認する。
+    struct wait_handle wh;
+    int registered = 1;
+    if (w_opt) {
+      registered = register_wait(shm_name, sched.start, wait_end, &wh);
+      if (registered == -1) {
+	ret = TM_ERROR;
+	break;
+      }
     }
 
-    scheds[scheds_len] = new;
-    scheds_len++;
-  }
+    ret = tm_add(h, &sched, flags, NULL);
+    if (ret != TM_CONFLICT || !w_opt) {
+      if (registered == 0)
+	unregister_wait(&wh);
+      break;
+    }
 
-  // データベースファイルを更新する。
-  if (save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, scheds_len) != 0) {
-    cleanup_schedules(scheds, scheds_len);
-    unlock(argc, argv);
-    return EXIT_FAILURE;
+    int waited = 1;
+    if (registered == 0) {
+      if (verbose > 0) {
+	fprintf(stderr, "%s:%d: Double booking. Waiting for release.\n",
+		__FILE__, __LINE__);
+      }
+      waited = wait_for_release(&wh, deadline);
+      unregister_wait(&wh);
+    } else {
+      struct timespec ts = {0, WAIT_POLL_INTERVAL_NSEC};
+      nanosleep(&ts, NULL);
+      if (deadline != 0 && time(NULL) >= deadline)
+	waited = 2;
+    }
+
+    if (waited == -1) {
+      ret = TM_ERROR;
+      break;
+    }
+    if (waited == 2) {
+      fprintf(stderr, "%s:%d: Error: Double booking. Timed out.\n", __FILE__,
+	      __LINE__);
+      tm_close(h);
+      return EXIT_TIMEOUT;
+    }
   }
 
-  cleanup_schedules(scheds, scheds_len);
+  int status;
+  switch (ret) {
+  case TM_OK:
+    status = EXIT_SUCCESS;
+    break;
+  case TM_CONFLICT:
+    fprintf(stderr, "%s:%d: Error: Double booking.\n", __FILE__, __LINE__);
+    status = (print_alternatives(h, &sched) == 0) ? EXIT_CONFLICT
+      : EXIT_FAILURE;
+    break;
+  case TM_EINVAL:
+    status = EXIT_MISUSE;
+    break;
+  case TM_TIMEOUT:
+    fprintf(stderr, "%s:%d: Error: %s.\n", __FILE__, __LINE__,
+	    tm_strerror(ret));
+    status = EXIT_FAILURE;
+    break;
+  default:
+    status = EXIT_FAILURE;
+    break;
+  }
 
-  // データベースをアンロックする。
-  if (unlock(argc, argv) != 0)
-    return EXIT_FAILURE;
+  tm_close(h);
 
-  return EXIT_SUCCESS;
+  return status;
 }
@@ -3,5 +3,7 @@ OBJECTS += $(OBJ_DIR)/add.o
 $(OBJ_DIR)/add.o: $(SOURCE_DIR)/add.c \
                   $(INCLUDE_DIR)/add.h \
                   $(INCLUDE_DIR)/common.h \
-                  $(INCLUDE_DIR)/lock.h \
-                  $(INCLUDE_DIR)/unlock.h
\ No newline at end of file
+                  $(INCLUDE_DIR)/crontab_mask.h \
+                  $(INCLUDE_DIR)/daemon.h \
+                  $(INCLUDE_DIR)/notify.h \
+                  $(INCLUDE_DIR)/tm.h
\ No newline at end of file
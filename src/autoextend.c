@@ -138,6 +138,10 @@ static int parse_arguments(int argc, char* *argv, char *shm_name, int *d_opt,
 
 /**
  * @brief スケジュールの空き状況に応じて、継続時間を延長する。
+ *
+ * capacityが2以上の場合、空き時間は自分のスケジュールの終了時刻より前から
+ * 続いていることがある。
+ *
  * @param[in] sched 延長されるスケジュール
  * @param[in] scheds 空きスケジュール群
  * @param[in] scheds_len 空きスケジュール群の配列数。
@@ -147,7 +151,9 @@ static int update_schedule(struct schedule *sched, struct schedule* *scheds, int
 {
   int i;
   for (i=0; i<scheds_len; i++) {
-    if ((sched->start + sched->duration) == scheds[i]->start) {
+    time_t end = sched->start + sched->duration;
+    if (scheds[i]->start <= end &&
+	end < scheds[i]->start + scheds[i]->duration) {
       sched->duration = (scheds[i]->start + scheds[i]->duration)-sched->start;
     }
   }
@@ -230,6 +236,12 @@ int autoextend(int argc, char* argv[])
 		s->duration, s->caption);
       }
 
+      unsigned int capacity;
+      if (get_capacity(shm_name, &capacity) != 0) {
+	cleanup_schedules(scheds, scheds_len);
+	return -1;
+      }
+
       // 空きスケジュールを取得。
       // 重なりを出すため、検索幅調整。
       time_t start = time(NULL) - interval;
@@ -241,6 +253,7 @@ int autoextend(int argc, char* argv[])
 							    MAX_NUM_SCHEDULES,
 								    start,
 								    range,
+								    capacity,
 								    "");
 
       // スケジュールを更新
@@ -0,0 +1,701 @@
+/*
+ * batch.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file batch.c
+ * @brief 複数の操作をまとめて1度のロックで反映するコマンドに関する実装。
+ */
+
+#include "../include/batch.h"
+
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/common.h"
+#include "../include/lock.h"
+#include "../include/notify.h"
+#include "../include/unlock.h"
+
+/** 失敗した操作がある場合の戻り値 */
+#define EXIT_FAILED_OP 3
+
+/** 操作の種類 */
+#define OP_ADD 1
+#define OP_REMOVE 2
+#define OP_MOVE 3
+#define OP_EXTEND 4
+#define OP_QUERY 5
+#define OP_CANCEL 6
+
+/** 操作の結果 */
+#define RESULT_OK 0
+#define RESULT_FREE 1
+#define RESULT_CONFLICT 2
+#define RESULT_NOT_FOUND 3
+#define RESULT_ACTIVE 4
+#define RESULT_INVALID 5
+#define RESULT_ERROR 6
+#define RESULT_ROLLED_BACK 7
+
+/**
+ * @struct batch_op
+ * @brief stdinから読み込んだ操作1つ分。
+ */
+struct batch_op {
+  int line;  /**< 入力の行番号 */
+  int type;  /**< 操作の種類(OP_*) */
+  pid_t pgid;  /**< 対象のプロセスグループ */
+  time_t start;  /**< 移動先、検索の開始時刻 */
+  unsigned int duration;  /**< 検索の継続時間(sec) */
+  long delta;  /**< 延長する時間(sec)。負の場合は短縮 */
+  uint64_t id;  /**< 取り消すスケジュールID */
+  struct schedule *sched;  /**< 追加するスケジュール */
+  int result;  /**< 操作の結果(RESULT_*) */
+  struct schedule conflict;  /**< 重複したスケジュール */
+};
+
+/**
+ * @struct release_range
+ * @brief 操作によって解放された範囲。
+ */
+struct release_range {
+  time_t start;  /**< 開始時刻 */
+  time_t end;  /**< 終了時刻。解放されていない場合は0 */
+};
+
+static int verbose = 0;
+
+
+/**
+ * @brief ヘルプをstderrに出力する。
+ */
+static void print_usage()
+{
+  const char *usage = "tm batch [-a] [-d database] [-v] [-h]\n";
+
+  const char *description = "stdinのすべての行を操作として読み込み、"
+    "データベースを1度だけロックして、読み込んだ順番に適用します。"
+    "データベースへの書き込みも、最後に1度だけ行います。\n"
+    "\n"
+    "操作の書式は以下のとおりです。pgidに0を指定した場合は、自プロセス"
+    "グループとなります。空行と#で始まる行は読み飛ばします。\n"
+    "\tadd pgid start:duration:caption  スケジュールを追加、上書きする。\n"
+    "\tremove pgid                      スケジュールを削除する。\n"
+    "\tcancel id                        スケジュールIDで指定して削除する。\n"
+    "\tmove pgid start                  開始時刻を変更する。\n"
+    "\textend pgid seconds              継続時間を延長する。負の値は短縮。\n"
+    "\tquery start:duration             範囲が空いているかを調べる。\n"
+    "\n"
+    "プロセスグループに予約されたスケジュールが複数ある場合、pgidで指定する"
+    "操作は先頭のスケジュールが対象となります。"
+    "後の操作は、前の操作を適用したスケジュールで重複を確認します。"
+    "有効にされたスケジュールは、削除、移動できません。延長、短縮した場合は、"
+    "終了機能に終了時刻の変更を知らせます。伸縮するスケジュールは延長できません。\n"
+    "\n"
+    "結果は入力の順番に line:result の書式でstdoutに出力します。lineは入力の"
+    "行番号、resultは ok、free、conflict:pgid:caption、notfound、active、"
+    "invalid、error、rolledback のいずれかです。\n"
+    "\n"
+    "aオプションを指定すると、失敗した操作が1つでもある場合は、すべての操作を"
+    "データベースに反映しません。検索の結果は失敗に含みません。"
+    "反映しなかった場合、成功した操作の結果は rolledback になります。\n";
+
+  const char *optarg = "OPTIONS\n"
+    "\t-a          すべての操作が成功した場合だけ反映する。\n"
+    "\t-d database データベース番号(1-5が使用可能)\n"
+    "\t-v          verboseモード\n"
+    "\t-h          show this help message and exit\n";
+
+  const char *exit_status = "EXIT STATUS\n"
+    "\t0 正常終了\n"
+    "\t1 異常終了\n"
+    "\t2 使用方法に誤りがある場合\n"
+    "\t3 失敗した操作がある場合\n";
+
+  const char *env = "ENVIRONMENT\n"
+    "\tTM_DB_NUM データベース番号(1-5が使用可能)。dオプションが指定された場合は、そちらが優先される。\n";
+
+  const char *example = "EXAMPLE\n"
+    "\t$ printf \"add 1234 1517188474:600:news\\nextend 1235 300\\n"
+    "query 1517189074:600\\n\" | tm batch -a\n"
+    "\t1:ok\n"
+    "\t2:ok\n"
+    "\t3:free\n";
+
+  fprintf(stderr, "usage: %s\n%s\n%s\n%s\n%s\n%s\n", usage, description,
+	  optarg, exit_status, env, example);
+}
+
+
+/**
+ * @brief コマンドライン引数を解析する。
+ * @param[in]  argc     argc値
+ * @param[in]  argv     argv値
+ * @param[out] atomic   '-a'オプション(すべて成功した場合だけ反映)が指定された場合、1が設定される。
+ * @param[out] shm_name '-d'オプション(データベース番号)が反映される。
+ * @param[out] d_opt    '-d'オプション(データベース番号)が指定された場合、1が設定される。
+ * @param[out] verbose  '-v'オプション(verboseモード)の値が反映される。
+ * @return 成功時は0、'h'オプションが指定された場合は1、不正な値が与えられた場
+ * 合は2を返す。
+ */
+static int parse_arguments(int argc, char* *argv, int *atomic, char *shm_name,
+			   int *d_opt, int *verbose)
+{
+  // TimeManagerから呼ばれる場合、argvは{"tm", "batch", "opt"...}となる。
+  // オプションを読み込むためには、optindを1つ進めて2にしておく必要がある。
+  opterr = 0;
+  optind = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "ad:hv")) != -1) {
+    switch (opt) {
+    case 'a':
+      // すべて成功した場合だけ反映
+      *atomic = 1;
+      break;
+    case 'd':
+      // データベース番号
+      if (atoi(optarg) < 1 || atoi(optarg) > MAX_NUM_DB) {
+	fprintf(stderr, "Error: Invalid database number. (Valid 1-%d)\n",
+		MAX_NUM_DB);
+	return 2;
+      }
+      strcat(shm_name, optarg);
+      *d_opt = 1;
+      break;
+    case 'h':
+      // ヘルプ
+      print_usage();
+      return 1;
+    case 'v':
+      // verboseモード
+      *verbose = 1;
+      break;
+    case '?':
+    default:
+      fprintf(stderr, "%s:%d: Error: Unknown option.\n", __FILE__, __LINE__);
+      return 2;
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief pgid値を読み込む。0の場合は自プロセスグループとする。
+ * @param[in]  str  読み込む文字列。
+ * @param[out] pgid 読み込んだpgid値が反映される。
+ * @param[out] n    読み込んだ文字数が反映される。
+ * @return 成功時は0、不正な値の場合は1を返す。
+ */
+static int parse_pgid(const char *str, pid_t *pgid, int *n)
+{
+  if (sscanf(str, "%d %n", pgid, n) != 1 || *pgid < 0)
+    return 1;
+
+  if (*pgid == 0)
+    *pgid = getpgid(0);
+
+  return 0;
+}
+
+
+/**
+ * @brief 1行分の操作を読み込む。
+ * @param[in]  line 読み込む行。改行は取り除いておく。
+ * @param[out] op   読み込んだ操作が反映される。
+ * @return 成功時は0、失敗時には-1、不正な書式の場合は1を返す。
+ */
+static int parse_op(const char *line, struct batch_op *op)
+{
+  char name[16];
+  int n = 0, m = 0;
+  if (sscanf(line, "%15s %n", name, &n) != 1)
+    return 1;
+  const char *args = line + n;
+
+  char rest = '\0';
+  if (strcmp(name, "add") == 0) {
+    op->type = OP_ADD;
+    if (parse_pgid(args, &op->pgid, &m) != 0)
+      return 1;
+
+    // addコマンドと同じく、string_to_schedule()の書式にして読み込む。
+    char str[MAX_SCHEDULE_STRING_LEN];
+    if (snprintf(str, sizeof(str), "%d:0:0:%s", op->pgid, args + m)
+	>= (int)sizeof(str))
+      return 1;
+    if (string_to_schedule(str, &op->sched) != 0)
+      return 1;
+
+    if (op->sched->start + op->sched->duration < time(NULL)) {
+      fprintf(stderr, "%s:%d: Error: past schedule.\n", __FILE__, __LINE__);
+      return 1;
+    }
+
+  } else if (strcmp(name, "remove") == 0) {
+    op->type = OP_REMOVE;
+    if (parse_pgid(args, &op->pgid, &m) != 0 || args[m] != '\0')
+      return 1;
+
+  } else if (strcmp(name, "cancel") == 0) {
+    op->type = OP_CANCEL;
+    if (sscanf(args, "%" SCNu64 " %c", &op->id, &rest) != 1 || op->id == 0)
+      return 1;
+
+  } else if (strcmp(name, "move") == 0) {
+    op->type = OP_MOVE;
+    if (parse_pgid(args, &op->pgid, &m) != 0 ||
+	sscanf(args + m, "%ld %c", &op->start, &rest) != 1 || op->start <= 0)
+      return 1;
+
+  } else if (strcmp(name, "extend") == 0) {
+    op->type = OP_EXTEND;
+    if (parse_pgid(args, &op->pgid, &m) != 0 ||
+	sscanf(args + m, "%ld %c", &op->delta, &rest) != 1 || op->delta == 0)
+      return 1;
+
+  } else if (strcmp(name, "query") == 0) {
+    op->type = OP_QUERY;
+    char sep = '\0';
+    if (sscanf(args, "%ld%c%u %c", &op->start, &sep, &op->duration, &rest)
+	!= 3 || sep != ':' || op->start <= 0)
+      return 1;
+
+  } else {
+    return 1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief stdinからすべての操作を読み込む。
+ * @param[out] ops 読み込んだ操作が反映される。cleanup_ops()で解放する。
+ * @param[out] len 読み込んだ操作の数が反映される。
+ * @return 成功時は0、失敗時には-1、操作が不正な場合は1を返す。
+ */
+static int read_ops(struct batch_op* *ops, size_t *len)
+{
+  char buf[MAX_SCHEDULE_STRING_LEN+1];
+  size_t cap = 0;
+  int line = 0;
+
+  *ops = NULL;
+  *len = 0;
+  while (fgets(buf, MAX_SCHEDULE_STRING_LEN+1, stdin) != NULL) {
+    line++;
+    buf[strcspn(buf, "\n")] = '\0';
+    if (buf[0] == '\0' || buf[0] == '#')
+      continue;
+
+    if (*len == cap) {
+      cap = (cap == 0) ? 256 : cap * 2;
+      struct batch_op *p = realloc(*ops, cap * sizeof(struct batch_op));
+      if (p == NULL) {
+	fprintf(stderr, "%s:%d: Error: Faild to allocate memory.\n", __FILE__,
+		__LINE__);
+	return -1;
+      }
+      *ops = p;
+    }
+
+    struct batch_op *op = &(*ops)[*len];
+    memset(op, 0, sizeof(*op));
+    op->line = line;
+    (*len)++;
+    if (parse_op(buf, op) != 0) {
+      fprintf(stderr, "%s:%d: Error: Unknown operation format. line:%d \"%s\"\n",
+	      __FILE__, __LINE__, line, buf);
+      return 1;
+    }
+  }
+
+  if (ferror(stdin)) {
+    fprintf(stderr, "%s:%d: Error: Reading stdin.\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief 読み込んだ操作を解放する。
+ * @param[in] ops 操作群。
+ * @param[in] len opsの配列数。
+ */
+static void cleanup_ops(struct batch_op *ops, size_t len)
+{
+  size_t i;
+  for (i=0; i<len; i++)
+    free(ops[i].sched);
+  free(ops);
+}
+
+
+/**
+ * @brief スケジュールの範囲を、解放された範囲に加える。
+ * @param[in,out] r 解放された範囲。
+ * @param[in]     s 解放されるスケジュール。
+ */
+static void add_release(struct release_range *r, const struct schedule *s)
+{
+  if (s->duration == 0)
+    return;
+
+  time_t end = s->start + s->duration;
+  if (s->rule[0] != '\0')
+    end += RECUR_HORIZON;
+
+  if (r->end == 0 || s->start < r->start)
+    r->start = s->start;
+  if (end > r->end)
+    r->end = end;
+}
+
+
+/**
+ * @brief スケジュールを追加できるか確認し、重複する場合はその1つを記録する。
+ * @param[in]     sched    確認するスケジュール。
+ * @param[in]     scheds   スケジュール群。
+ * @param[in]     len      schedsの配列数。
+ * @param[in]     capacity データベースのcapacity。
+ * @param[in,out] op       重複した場合、結果とconflictが反映される。
+ * @return 追加できる場合は0、それ以外の場合は1を返す。
+ */
+static int check_op(struct schedule *sched, struct schedule* *scheds,
+		    size_t len, unsigned int capacity, struct batch_op *op)
+{
+  switch (check_sched_capacity(sched, scheds, len, capacity)) {
+  case 0:
+    return 0;
+  case 1:
+    op->result = RESULT_CONFLICT;
+    if (find_conflicting_schedule(sched, scheds, len, capacity,
+				  &op->conflict) != 0)
+      memset(&op->conflict, 0, sizeof(op->conflict));
+    return 1;
+  default:
+    op->result = RESULT_ERROR;
+    return 1;
+  }
+}
+
+
+/**
+ * @brief 操作を1つ、メモリ上のスケジュール群に適用する。
+ *
+ * 結果はop->resultに反映される。
+ *
+ * @param[in,out] op           操作。
+ * @param[in,out] scheds       スケジュール群。
+ * @param[in,out] len          schedsの配列数。
+ * @param[in]     capacity     データベースのcapacity。
+ * @param[in,out] released     解放された範囲。
+ * @param[out]    resized      継続時間を変更した、有効なスケジュールのpgid値が
+ * 追加される。
+ * @param[in,out] nresized     resizedの配列数。
+ */
+static void apply_op(struct batch_op *op, struct schedule* *scheds,
+		     size_t *len, unsigned int capacity,
+		     struct release_range *released, pid_t *resized,
+		     size_t *nresized)
+{
+  op->result = RESULT_OK;
+
+  if (op->type == OP_QUERY) {
+    // probeコマンドと同じく、自プロセスグループのスケジュールは調べない。
+    struct schedule tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.pgid = getpgid(0);
+    tmp.start = op->start;
+    tmp.duration = op->duration;
+    switch (find_conflicting_schedule(&tmp, scheds, *len, capacity,
+				      &op->conflict)) {
+    case 0:
+      op->result = RESULT_CONFLICT;
+      break;
+    case 1:
+      op->result = RESULT_FREE;
+      break;
+    default:
+      op->result = RESULT_ERROR;
+      break;
+    }
+    return;
+  }
+
+  if (op->type == OP_ADD) {
+    struct schedule tmp = *op->sched;
+    if (check_op(&tmp, scheds, *len, capacity, op) != 0)
+      return;
+
+    struct schedule *old = NULL;
+    if (find_sched_by_pgid(op->pgid, scheds, *len, &old) == 0)
+      add_release(released, old);
+
+    struct schedule *new = malloc(sizeof(struct schedule));
+    if (new == NULL) {
+      op->result = RESULT_ERROR;
+      return;
+    }
+    *new = tmp;
+    if (update_sched_by_pgid(new, scheds, len, MAX_NUM_SCHEDULES) != 0) {
+      free(new);
+      op->result = RESULT_ERROR;
+    }
+    return;
+  }
+
+  // 以下は、既存のスケジュールに対する操作。
+  struct schedule *s = NULL;
+  int found = (op->type == OP_CANCEL) ?
+    find_sched_by_id(op->id, scheds, *len, &s) :
+    find_sched_by_pgid(op->pgid, scheds, *len, &s);
+  if (found != 0 || s->duration == 0) {
+    op->result = RESULT_NOT_FOUND;
+    return;
+  }
+
+  if (s->terminator != 0 && op->type != OP_EXTEND) {
+    op->result = RESULT_ACTIVE;
+    return;
+  }
+
+  struct schedule tmp = *s;
+  switch (op->type) {
+  case OP_REMOVE:
+  case OP_CANCEL:
+    add_release(released, s);
+    remove_schedule(s, scheds, len);
+    break;
+
+  case OP_MOVE:
+    tmp.start = op->start;
+    if (tmp.rule[0] == '\0' && tmp.start + tmp.duration < time(NULL)) {
+      op->result = RESULT_INVALID;
+      break;
+    }
+    if (check_op(&tmp, scheds, *len, capacity, op) != 0)
+      break;
+    add_release(released, s);
+    s->start = tmp.start;
+    break;
+
+  case OP_EXTEND:
+    if (s->max_duration != 0 || (long)s->duration + op->delta <= 0 ||
+	(long)s->duration + op->delta > UINT_MAX) {
+      op->result = RESULT_INVALID;
+      break;
+    }
+    tmp.duration = s->duration + op->delta;
+    if (op->delta > 0 && check_op(&tmp, scheds, *len, capacity, op) != 0)
+      break;
+    if (op->delta < 0)
+      add_release(released, s);
+    s->duration = tmp.duration;
+
+    // 有効にされたスケジュールは、終了機能に終了時刻の変更を知らせる。
+    if (s->terminator != 0)
+      resized[(*nresized)++] = s->pgid;
+    break;
+  }
+}
+
+
+/**
+ * @brief 操作の結果をstdoutに出力する。
+ * @param[in] op 操作。
+ */
+static void print_result(const struct batch_op *op)
+{
+  switch (op->result) {
+  case RESULT_OK:
+    fprintf(stdout, "%d:ok\n", op->line);
+    break;
+  case RESULT_FREE:
+    fprintf(stdout, "%d:free\n", op->line);
+    break;
+  case RESULT_CONFLICT:
+    fprintf(stdout, "%d:conflict:%d:%s\n", op->line, op->conflict.pgid,
+	    op->conflict.caption);
+    break;
+  case RESULT_NOT_FOUND:
+    fprintf(stdout, "%d:notfound\n", op->line);
+    break;
+  case RESULT_ACTIVE:
+    fprintf(stdout, "%d:active\n", op->line);
+    break;
+  case RESULT_INVALID:
+    fprintf(stdout, "%d:invalid\n", op->line);
+    break;
+  case RESULT_ROLLED_BACK:
+    fprintf(stdout, "%d:rolledback\n", op->line);
+    break;
+  default:
+    fprintf(stdout, "%d:error\n", op->line);
+    break;
+  }
+}
+
+
+int batch(int argc, char* argv[])
+{
+  char shm_name[NAME_MAX] = DEFAULT_SHARED_MEMORY_NAME;
+  int atomic = 0, d_opt = 0;
+
+  // オプションチェック
+  switch (parse_arguments(argc, argv, &atomic, shm_name, &d_opt, &verbose)) {
+  case 1:
+    return EXIT_SUCCESS;
+  case 2:
+    return EXIT_MISUSE;
+  }
+
+  // 'd'オプションが指定されていない場合は、環境変数を確認する。
+  if (!d_opt) {
+    if (get_env(NULL, shm_name) != 0)
+      return EXIT_FAILURE;
+  }
+
+  // ロックする前に、すべての操作を読み込んでおく。
+  struct batch_op *ops;
+  size_t len;
+  switch (read_ops(&ops, &len)) {
+  case -1:
+    cleanup_ops(ops, len);
+    return EXIT_FAILURE;
+  case 1:
+    cleanup_ops(ops, len);
+    return EXIT_MISUSE;
+  }
+
+  // lock()はaオプションを解釈しないので、データベース番号のみ渡す。
+  const char *db = NULL;
+  if (d_opt)
+    db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+
+  if (lock_database(db) != 0) {
+    cleanup_ops(ops, len);
+    return EXIT_FAILURE;
+  }
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  unsigned int capacity;
+  if (get_capacity(shm_name, &capacity) != 0 ||
+      load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		     &scheds_len) != 0) {
+    cleanup_ops(ops, len);
+    unlock_database(db);
+    return EXIT_FAILURE;
+  }
+
+  // すべての操作を、読み込んだ順番に適用する。
+  struct release_range released = {0, 0};
+  pid_t *resized = malloc((len + 1) * sizeof(pid_t));
+  size_t i, nresized = 0, nchanged = 0, nfailed = 0, nerror = 0;
+  if (resized == NULL) {
+    cleanup_schedules(scheds, scheds_len);
+    cleanup_ops(ops, len);
+    unlock_database(db);
+    return EXIT_FAILURE;
+  }
+
+  for (i=0; i<len; i++) {
+    apply_op(&ops[i], scheds, &scheds_len, capacity, &released, resized,
+	     &nresized);
+
+    if (ops[i].result == RESULT_ERROR)
+      nerror++;
+    if (ops[i].type == OP_QUERY)
+      continue;
+    if (ops[i].result == RESULT_OK)
+      nchanged++;
+    else
+      nfailed++;
+  }
+
+  if (verbose > 0) {
+    fprintf(stderr, "%s:%d: DEBUG: ops:%zu changed:%zu failed:%zu\n",
+	    __FILE__, __LINE__, len, nchanged, nfailed);
+  }
+
+  // aオプションの場合は、失敗した操作が1つでもあれば書き込まない。
+  int ret = EXIT_SUCCESS;
+  int commit = (nchanged > 0 && !(atomic && nfailed > 0));
+  if (commit && save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds,
+			       scheds_len) != 0) {
+    commit = 0;
+    ret = EXIT_FAILURE;
+  }
+
+  // 延長、短縮したスケジュールの終了機能に、終了時刻の変更を知らせる。
+  // 終了機能のpid値は、ロックしている間だけ信頼できる。
+  if (commit) {
+    for (i=0; i<nresized; i++) {
+      struct schedule *s = NULL;
+      if (find_sched_by_pgid(resized[i], scheds, scheds_len, &s) == 0)
+	signal_terminator(s, RESIZE_SIGNO);
+    }
+  }
+  free(resized);
+
+  cleanup_schedules(scheds, scheds_len);
+
+  if (unlock_database(db) != 0)
+    ret = EXIT_FAILURE;
+
+  if (commit) {
+    if (released.end != 0)
+      notify_release(shm_name, released.start, released.end);
+  } else {
+    // 反映しなかった場合、成功した操作は取り消されたことを示す。
+    for (i=0; i<len; i++) {
+      if (ops[i].type != OP_QUERY && ops[i].result == RESULT_OK)
+	ops[i].result = RESULT_ROLLED_BACK;
+    }
+    if (atomic && nfailed > 0) {
+      fprintf(stderr, "%s:%d: Error: Some operations failed. "
+	      "Nothing applied.\n", __FILE__, __LINE__);
+    }
+  }
+
+  for (i=0; i<len; i++)
+    print_result(&ops[i]);
+  fflush(stdout);
+
+  cleanup_ops(ops, len);
+
+  if (ret == EXIT_SUCCESS && nerror > 0)
+    ret = EXIT_FAILURE;
+  else if (ret == EXIT_SUCCESS && nfailed > 0)
+    ret = EXIT_FAILED_OP;
+
+  return ret;
+}
@@ -0,0 +1,8 @@
+OBJECTS += $(OBJ_DIR)/batch.o
+
+$(OBJ_DIR)/batch.o: $(SOURCE_DIR)/batch.c \
+                    $(INCLUDE_DIR)/batch.h \
+                    $(INCLUDE_DIR)/common.h \
+                    $(INCLUDE_DIR)/lock.h \
+                    $(INCLUDE_DIR)/notify.h \
+                    $(INCLUDE_DIR)/unlock.h
\ No newline at end of file
@@ -0,0 +1,247 @@
+/*
+ * capacity.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file capacity.c
+ * @brief データベースのcapacityの設定に関する実装。
+ */
+
+#include "../include/capacity.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/common.h"
+#include "../include/lock.h"
+#include "../include/unlock.h"
+
+static int verbose = 0;
+
+/**
+ * @brief ヘルプをstderrに出力する。
+ */
+static void print_usage()
+{
+  const char *usage = "tm capacity [-d database] [-v] [-h] [number]\n";
+  const char *description = "データベースで同時に重なることができる"
+    "スケジュールの数(capacity)を設定します。\n"
+    "numberを省略した場合は、現在の値をstdoutに出力します。\n"
+    "初期値は1で、この場合はスケジュールの重複は許されません。\n"
+    "2以上の場合は、同時に重なっているスケジュールの数がcapacity未満で"
+    "あれば、スケジュールを追加できます。\n"
+    "現在のスケジュールが既にnumberを超えて重なっている場合は、"
+    "設定できません。\n"
+    "設定はresetコマンドで初期値に戻ります。\n";
+
+  const char *optarg = "OPTIONS\n"
+    "\tnumber      capacity(1-64が使用可能)\n"
+    "\t-d database データベース番号(1-5が使用可能)\n"
+    "\t-v          verboseモード\n"
+    "\t-h          show this help message and exit\n";
+
+  const char *exit_status = "EXIT STATUS\n"
+    "\t0 正常終了\n"
+    "\t1 異常終了\n"
+    "\t2 使用方法に誤りがある場合\n";
+
+  const char *env = "ENVIRONMENT\n"
+    "\tTM_DB_NUM データベース番号(1-5が使用可能)。dオプションが指定された場合は、そちらが優先される。\n";
+
+  const char *example = "EXAMPLE\n"
+    "\tデータベース3番で、3つのスケジュールまで重なれるようにする。\n"
+    "\t$ tm capacity -d 3 3\n"
+    "\n"
+    "\t現在のcapacityを出力する。\n"
+    "\t$ tm capacity -d 3\n"
+    "\t3\n";
+
+  fprintf(stderr, "usage: %s\n%s\n%s\n%s\n%s\n%s\n", usage, description,
+	  optarg, exit_status, env, example);
+}
+
+
+/**
+ * @brief コマンドライン引数を解析する。
+ * @param[in]  argc     argc値
+ * @param[in]  argv     argv値
+ * @param[out] shm_name '-d'オプション(データベース番号)が反映される。
+ * @param[out] d_opt    '-d'オプション(データベース番号)が指定された場合、1が設定される。
+ * @param[out] number   設定するcapacityが反映される。指定がない場合は0。
+ * @param[out] verbose  '-v'オプション(verboseモード)の値が反映される。
+ * @return 成功時は0、'h'オプションが指定された場合は1、不正な値が与えられた場
+ * 合は2を返す。
+ */
+static int parse_arguments(int argc, char* *argv, char *shm_name, int *d_opt,
+			   unsigned int *number, int *verbose)
+{
+  // TimeManagerから呼ばれる場合、argvは{"tm", "capacity", "opt"...}となる。
+  // オプションを読み込むためには、optindを1つ進めて2にしておく必要がある。
+  opterr = 0;
+  optind = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:hv")) != -1) {
+    switch (opt) {
+    case 'd':
+      // データベース番号
+      if (atoi(optarg) < 1 || atoi(optarg) > MAX_NUM_DB) {
+	fprintf(stderr, "Error: Invalid database number. (Valid 1-%d)\n",
+		MAX_NUM_DB);
+	return 2;
+      }
+      strcat(shm_name, optarg);
+      *d_opt = 1;
+      break;
+    case 'h':
+      // ヘルプ
+      print_usage();
+      return 1;
+    case 'v':
+      // verboseモード
+      *verbose = 1;
+      break;
+    case '?':
+    default:
+      fprintf(stderr, "%s:%d: Error: Unknown option.\n", __FILE__, __LINE__);
+      return 2;
+    }
+  }
+
+  *number = 0;
+  if (optind < argc) {
+    char *endptr;
+    errno = 0;
+    long n = strtol(argv[optind], &endptr, 10);
+    if (errno != 0 || *endptr != '\0' || n < 1 || n > MAX_CAPACITY) {
+      fprintf(stderr, "Error: Invalid capacity. (Valid 1-%d)\n",
+	      MAX_CAPACITY);
+      return 2;
+    }
+    *number = n;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief 現在のスケジュールが、同時にいくつ重なっているかを求める。
+ *
+ * 繰り返しスケジュールは、現在時刻から一定期間の範囲で展開して数える。
+ *
+ * @param[in]  shm_name データベース名。
+ * @param[out] max      同時に重なっているスケジュール数の最大値が反映される。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int get_current_overlap(const char *shm_name, unsigned int *max)
+{
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  if (load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		     &scheds_len) != 0)
+    return -1;
+
+  time_t now = time(NULL);
+  struct expansion ex;
+  if (expand_schedules(scheds, scheds_len, now, now + RECUR_HORIZON,
+		       &ex) != 0) {
+    cleanup_schedules(scheds, scheds_len);
+    return -1;
+  }
+
+  // pgidが0のスケジュールはないので、すべてを数える。
+  *max = count_max_overlap(ex.scheds, ex.len, 0, now, now + RECUR_HORIZON);
+
+  cleanup_expansion(&ex);
+  cleanup_schedules(scheds, scheds_len);
+
+  return 0;
+}
+
+
+int capacity(int argc, char* argv[])
+{
+  char shm_name[NAME_MAX] = DEFAULT_SHARED_MEMORY_NAME;
+  int d_opt = 0;
+  unsigned int number = 0;
+
+  // オプションチェック
+  switch (parse_arguments(argc, argv, shm_name, &d_opt, &number, &verbose)) {
+  case 1:
+    return EXIT_SUCCESS;
+  case 2:
+    return EXIT_MISUSE;
+  }
+
+  // 'd'オプションが指定されていない場合は、環境変数を確認する。
+  if (!d_opt) {
+    if (get_env(NULL, shm_name) != 0)
+      return EXIT_FAILURE;
+  }
+
+  // 指定がない場合は、現在の値を出力する。
+  if (number == 0) {
+    unsigned int current;
+    if (get_capacity(shm_name, &current) != 0)
+      return EXIT_FAILURE;
+    fprintf(stdout, "%u\n", current);
+    return EXIT_SUCCESS;
+  }
+
+  // データベースをロックする。
+  const char *db = NULL;
+  if (d_opt)
+    db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+  if (lock_database(db) != 0)
+    return EXIT_FAILURE;
+
+  // 既に重なっているスケジュールがcapacityを超える場合は設定しない。
+  unsigned int overlap;
+  if (get_current_overlap(shm_name, &overlap) != 0) {
+    unlock_database(db);
+    return EXIT_FAILURE;
+  }
+
+  if (verbose > 0) {
+    fprintf(stderr, "%s:%d: capacity:%u overlap:%u\n", __FILE__, __LINE__,
+	    number, overlap);
+  }
+
+  if (overlap > number) {
+    fprintf(stderr, "%s:%d: Error: %u schedules already overlap.\n",
+	    __FILE__, __LINE__, overlap);
+    unlock_database(db);
+    return EXIT_FAILURE;
+  }
+
+  if (set_header_value(shm_name, CAPACITY_KEY, number) != 0) {
+    unlock_database(db);
+    return EXIT_FAILURE;
+  }
+
+  if (unlock_database(db) != 0)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,7 @@
+OBJECTS += $(OBJ_DIR)/capacity.o
+
+$(OBJ_DIR)/capacity.o: $(SOURCE_DIR)/capacity.c \
+                       $(INCLUDE_DIR)/capacity.h \
+                       $(INCLUDE_DIR)/common.h \
+                       $(INCLUDE_DIR)/lock.h \
+                       $(INCLUDE_DIR)/unlock.h
\ No newline at end of file
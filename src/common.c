@@ -28,7 +28,11 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h> // for O_WRONLY..etc
+#include <inttypes.h>
+#include <limits.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -36,6 +40,281 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "../include/crontab_mask.h"
+#include "../include/notify.h"
+
+/** エラーメッセージの出力先。NULLの場合は出力しない。 */
+static FILE *g_error_output = NULL;
+
+/** 呼び出したスレッドで、最後に記録したエラーの種類 */
+static __thread enum error_code g_last_error = ERROR_NONE;
+
+/**
+ * @brief 時刻を分単位に切り上げる。
+ *
+ * 繰り返しスケジュールの開始時刻は、必ず分単位となる。
+ */
+static time_t ceil_minute(time_t t)
+{
+  return ((t + 59) / 60) * 60;
+}
+
+
+/**
+ * @brief 資源の集合から、k番目の資源名を取り出す。
+ * @param[in]  set  資源の集合(カンマ区切り)。
+ * @param[in]  k    取り出す資源名の位置。
+ * @param[out] name 資源名の先頭が反映される。終端文字列はない。
+ * @param[out] len  資源名の文字数が反映される。
+ * @return 見つかった場合は0、見つからない場合は-1を返す。
+ */
+static int resource_at(const char *set, size_t k, const char* *name,
+		       size_t *len)
+{
+  if (set[0] == '\0')
+    return -1;
+
+  const char *p = set;
+  while (k > 0) {
+    p = strchr(p, ',');
+    if (p == NULL)
+      return -1;
+    p++;
+    k--;
+  }
+
+  const char *comma = strchr(p, ',');
+  *name = p;
+  *len = (comma == NULL) ? strlen(p) : (size_t)(comma - p);
+
+  return 0;
+}
+
+
+/**
+ * @brief 資源の集合の、資源の数を数える。
+ */
+static size_t count_resources(const char *set)
+{
+  if (set[0] == '\0')
+    return 0;
+
+  size_t n = 1;
+  const char *p;
+  for (p=set; *p!='\0'; p++) {
+    if (*p == ',')
+      n++;
+  }
+
+  return n;
+}
+
+
+/**
+ * @brief 資源の集合のスケジュールが、資源を占有するか確認する。
+ *
+ * 資源の集合が空文字列の場合は、すべての資源を占有する。
+ *
+ * @param[in] set  スケジュールの資源の集合。
+ * @param[in] name 資源名。終端文字列は不要。
+ * @param[in] len  資源名の文字数。
+ * @return 占有する場合は1、しない場合は0を返す。
+ */
+static int occupies_resource(const char *set, const char *name, size_t len)
+{
+  if (set[0] == '\0')
+    return 1;
+
+  const char *r;
+  size_t r_len, k;
+  for (k=0; resource_at(set, k, &r, &r_len) == 0; k++) {
+    if (r_len == len && strncmp(r, name, len) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief 2つの資源の集合に、共通の資源があるか確認する。
+ * @return 共通の資源がある場合は1、ない場合は0を返す。
+ */
+static int shares_resource(const char *a, const char *b)
+{
+  if (a[0] == '\0' || b[0] == '\0')
+    return 1;
+
+  const char *r;
+  size_t r_len, k;
+  for (k=0; resource_at(b, k, &r, &r_len) == 0; k++) {
+    if (occupies_resource(a, r, r_len))
+      return 1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief スケジュール群から、資源を占有するスケジュールだけを選ぶ。
+ * @param[in]  scheds 対象のスケジュール群。
+ * @param[in]  len    schedsの配列数。
+ * @param[in]  name   資源名。終端文字列は不要。
+ * @param[in]  n      資源名の文字数。
+ * @param[out] out    選んだスケジュールが反映される。lenの配列数が必要。
+ * @return 選んだスケジュールの数を返す。
+ */
+static size_t select_by_resource(struct schedule* *scheds, size_t len,
+				 const char *name, size_t n,
+				 struct schedule* *out)
+{
+  size_t i, found = 0;
+  for (i=0; i<len; i++) {
+    if (occupies_resource(scheds[i]->resources, name, n))
+      out[found++] = scheds[i];
+  }
+
+  return found;
+}
+
+
+/**
+ * @brief スケジュール群の繰り返しの時刻指定を、それぞれ解析する。
+ *
+ * 繰り返しでないスケジュールと、時刻指定が不正なスケジュールはNULLとなる。
+ *
+ * @param[in]  scheds 対象のスケジュール群。
+ * @param[in]  len    schedsの配列数。
+ * @param[out] masks  解析した時刻指定が反映される。lenの配列数が必要。
+ */
+static void compile_rules(struct schedule* *scheds, size_t len,
+			  struct cron_mask* *masks)
+{
+  size_t i;
+  for (i=0; i<len; i++) {
+    masks[i] = NULL;
+    if (scheds[i]->rule[0] == '\0')
+      continue;
+
+    if (crontab_compile(scheds[i]->rule, &masks[i]) != 0) {
+      report_error(ERROR_FORMAT,
+		   "%s:%d: Error: Invalid rule. pgid:%d rule:%s\n", __FILE__,
+		   __LINE__, scheds[i]->pgid, scheds[i]->rule);
+      masks[i] = NULL;
+    }
+  }
+}
+
+
+/**
+ * @brief compile_rules()で解析した時刻指定を解放する。
+ */
+static void release_rules(struct cron_mask* *masks, size_t len)
+{
+  size_t i;
+  for (i=0; i<len; i++) {
+    if (masks[i] != NULL)
+      crontab_release(masks[i]);
+  }
+}
+
+
+/**
+ * @brief 繰り返しスケジュールの、fromからendまでの間の直近の開始時刻を取得する。
+ * @param[out] result 取得した時刻が反映される。
+ * @param[in]  m      時刻指定。
+ * @param[in]  from   検索を開始する時刻。
+ * @param[in]  end    検索を終了する時刻。
+ * @return 見つかった場合は0、見つからない場合は-1を返す。
+ */
+static int next_occurrence(time_t *result, const struct cron_mask *m,
+			   time_t from, time_t end)
+{
+  from = ceil_minute(from);
+  if (from > end)
+    return -1;
+  return crontab_next(result, m, from, end - from);
+}
+
+
+/**
+ * @brief スケジュールの1回分が、スケジュール群の中のスケジュールと重複して
+ * いないか確認する。
+ * @param[in] pgid     確認するスケジュールのpgid値。同じ値のスケジュールは
+ * 飛ばす。
+ * @param[in] start    確認するスケジュールの開始時刻。
+ * @param[in] duration 確認するスケジュールの継続時間(sec)。
+ * @param[in] scheds   確認される側のスケジュール群
+ * @param[in] masks    schedsの各要素の時刻指定。\sa compile_rules()
+ * @param[in] len      scheds配列の個数
+ * @return 重複がない場合は0を、重複がある場合は1を返す。
+ */
+static int check_occurrence_conflict(pid_t pgid, time_t start,
+				     unsigned int duration,
+				     struct schedule* *scheds,
+				     struct cron_mask* *masks, size_t len)
+{
+  size_t i;
+  for (i=0; i<len; i++) {
+
+    // もちろん自分のスケジュールは飛ばす。
+    if (scheds[i]->pgid == pgid)
+      continue;
+
+    if (masks[i] == NULL) {
+      if (scheds[i]->start < (start + duration) &&
+	  (scheds[i]->start + scheds[i]->duration) > start)
+	return 1;
+      continue;
+    }
+
+    // 繰り返しスケジュールは、重なる可能性のある開始時刻があるか調べる。
+    time_t from = start - scheds[i]->duration + 1;
+    if (from < scheds[i]->start)
+      from = scheds[i]->start;
+    time_t t;
+    if (next_occurrence(&t, masks[i], from, start + duration - 1) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+
+int advance_early_schedule(struct schedule* sched, struct schedule* *scheds,
+			   size_t len, unsigned int capacity, time_t now)
+{
+  assert(sched != NULL && scheds != NULL);
+
+  if (!sched->early || sched->rule[0] != '\0' || sched->start <= now)
+    return 0;
+
+  struct expansion ex;
+  if (expand_schedules(scheds, len, now, sched->start, &ex) != 0)
+    return -1;
+
+  // 開始時刻まで続いている、最後の空き時間を探す。
+  struct gap_iterator it;
+  init_gap_iterator(&it, &ex, sched->pgid, now, sched->start, capacity,
+		    sched->resources);
+
+  time_t gap_start, gap_end, last_start = -1, last_end = -1;
+  while (next_gap(&it, &gap_start, &gap_end) == 0) {
+    last_start = gap_start;
+    last_end = gap_end;
+  }
+  cleanup_expansion(&ex);
+
+  if (last_end != sched->start || last_start >= sched->start)
+    return 0;
+
+  sched->start = last_start;
+
+  return 1;
+}
+
+
 /**
  * @brief ファイルの存在を確認する。ファイルが存在しない場合は作成する。
  * @param[in] path スケジュールデータベースのパス
@@ -46,7 +325,8 @@ static int check_sched_db_file(const char* path)
   errno = 0;
   int fd = open(path, O_WRONLY|O_CREAT, S_IRUSR|S_IWUSR);
   if (fd == -1) {
-    fprintf(stderr, "%s:%d: Error: %s\n", __FILE__, __LINE__, strerror(errno));
+    report_error(ERROR_SYSTEM, "%s:%d: Error: %s\n", __FILE__, __LINE__,
+		 strerror(errno));
     return -1;
   }
   close(fd);
@@ -55,24 +335,214 @@ static int check_sched_db_file(const char* path)
 }
 
 
+int anchor_schedule(struct schedule* sched, struct schedule* *scheds,
+		    size_t len, unsigned int capacity, time_t now)
+{
+  assert(sched != NULL && scheds != NULL);
+
+  struct expansion ex;
+  if (expand_schedules(scheds, len, now, now + RECUR_HORIZON, &ex) != 0)
+    return -1;
+
+  struct gap_iterator it;
+  init_gap_iterator(&it, &ex, sched->pgid, now, now + RECUR_HORIZON, capacity,
+		    sched->resources);
+
+  int ret = 1;
+  time_t gap_start, gap_end;
+  while (next_gap(&it, &gap_start, &gap_end) == 0) {
+    if (gap_end - gap_start >= sched->duration) {
+      sched->start = gap_start;
+      ret = 0;
+      break;
+    }
+  }
+  cleanup_expansion(&ex);
+
+  return ret;
+}
+
+
 int check_sched_conflict(struct schedule* sched, struct schedule* *scheds,
 			 size_t len)
 {
   assert(sched != NULL && scheds != NULL);
 
-  int i;
-  for (i=0; i<len; i++) {
+  struct cron_mask* masks[len+1];
+  compile_rules(scheds, len, masks);
 
-    // もちろん自分のスケジュールは飛ばす。
-    if (scheds[i]->pgid == sched->pgid)
-      continue;
+  int ret = 0;
+  if (sched->rule[0] == '\0') {
+    ret = check_occurrence_conflict(sched->pgid, sched->start,
+				    sched->duration, scheds, masks, len);
+  } else {
+    // 繰り返しスケジュールは、一定期間の繰り返しをすべて確認する。
+    struct cron_mask *m;
+    if (crontab_compile(sched->rule, &m) != 0) {
+      release_rules(masks, len);
+      return 1;
+    }
+
+    time_t end = sched->start + RECUR_HORIZON;
+    time_t t, head = sched->start;
+    while (next_occurrence(&t, m, head, end) == 0) {
+      if (check_occurrence_conflict(sched->pgid, t, sched->duration, scheds,
+				    masks, len) != 0) {
+	ret = 1;
+	break;
+      }
+      head = t + 60;
+    }
+    crontab_release(m);
+  }
 
-    if (scheds[i]->start < (sched->start + sched->duration) &&
-	(scheds[i]->start + scheds[i]->duration) > sched->start) {
-      /*fprintf(stderr, "Schedule conflict. pgid:%d start:%ld dur:%d cap:%s\n",
-	sched->pgid, sched->start, sched->duration, sched->caption);*/
+  release_rules(masks, len);
+
+  return ret;
+}
+
+
+/**
+ * @brief 1つの資源を占有するスケジュール群について、スケジュールを追加すると
+ * 同時に重なる数がcapacityを超えないか確認する。
+ * @param[in] sched    確認するスケジュール
+ * @param[in] scheds   確認される側のスケジュール群
+ * @param[in] len      scheds配列の個数
+ * @param[in] capacity 同時に重なることができるスケジュール数
+ * @return 超えない場合は0を、超える場合は1を、失敗時には-1を返す。
+ */
+static int check_pool_capacity(struct schedule* sched,
+			       struct schedule* *scheds, size_t len,
+			       unsigned int capacity)
+{
+  struct cron_mask *m = NULL;
+  time_t end = sched->start + sched->duration;
+  if (sched->rule[0] != '\0') {
+    if (crontab_compile(sched->rule, &m) != 0)
       return 1;
+    end = sched->start + RECUR_HORIZON + sched->duration;
+  }
+
+  // 確認する範囲で、確認される側の繰り返しスケジュールを展開する。
+  struct expansion ex;
+  if (expand_schedules(scheds, len, sched->start, end, &ex) != 0) {
+    if (m != NULL)
+      crontab_release(m);
+    return -1;
+  }
+
+  int ret = 0;
+  if (m == NULL) {
+    if (count_max_overlap(ex.scheds, ex.len, sched->pgid, sched->start,
+			  sched->start + sched->duration) >= capacity)
+      ret = 1;
+  } else {
+    // 繰り返しスケジュールは、一定期間の繰り返しをすべて確認する。
+    time_t t, head = sched->start;
+    while (next_occurrence(&t, m, head, sched->start + RECUR_HORIZON) == 0) {
+      if (count_max_overlap(ex.scheds, ex.len, sched->pgid, t,
+			    t + sched->duration) >= capacity) {
+	ret = 1;
+	break;
+      }
+      head = t + 60;
+    }
+    crontab_release(m);
+  }
+
+  cleanup_expansion(&ex);
+
+  return ret;
+}
+
+
+int check_sched_capacity(struct schedule* sched, struct schedule* *scheds,
+			 size_t len, unsigned int capacity)
+{
+  assert(sched != NULL && scheds != NULL);
+
+  // 資源を共有しないスケジュールとは重複しない。
+  struct schedule* pool[len+1];
+  if (capacity <= 1) {
+    size_t i, n = 0;
+    for (i=0; i<len; i++) {
+      if (shares_resource(sched->resources, scheds[i]->resources))
+	pool[n++] = scheds[i];
+    }
+    return check_sched_conflict(sched, pool, n);
+  }
+
+  // 資源ごとに、その資源を占有するスケジュールだけで確認する。
+  // データベース全体を占有するスケジュールは、記録されているすべての資源で
+  // 確認する。
+  const char *set = sched->resources;
+  size_t i = 0, k = 0, checked = 0;
+  while (1) {
+    const char *name;
+    size_t n;
+    if (set[0] != '\0') {
+      if (resource_at(set, k++, &name, &n) != 0)
+	break;
+    } else {
+      // 記録されている資源名を順に取り出す。
+      if (i >= len)
+	break;
+      if (resource_at(scheds[i]->resources, k++, &name, &n) != 0) {
+	i++;
+	k = 0;
+	continue;
+      }
+
+      // 前に確認した資源名は飛ばす。
+      size_t j;
+      int seen = 0;
+      for (j=0; j<i && !seen; j++)
+	seen = (scheds[j]->resources[0] != '\0' &&
+		occupies_resource(scheds[j]->resources, name, n));
+      if (seen)
+	continue;
+    }
+
+    size_t pool_len = select_by_resource(scheds, len, name, n, pool);
+    int ret = check_pool_capacity(sched, pool, pool_len, capacity);
+    if (ret != 0)
+      return ret;
+    checked++;
+  }
+
+  // 資源が1つも記録されていない場合は、データベース全体で確認する。
+  if (checked == 0)
+    return check_pool_capacity(sched, scheds, len, capacity);
+
+  return 0;
+}
+
+
+int check_resource_set(const char *resources)
+{
+  assert(resources != NULL);
+
+  if (strlen(resources) >= MAX_RESOURCES_LEN ||
+      count_resources(resources) > MAX_NUM_RESOURCES)
+    return -1;
+
+  const char *p;
+  size_t len = 0;
+  for (p=resources; ; p++) {
+    if (*p == ',' || *p == '\0') {
+      // 空の資源名は不可。
+      if (len == 0)
+	return -1;
+      if (*p == '\0')
+	break;
+      len = 0;
+      continue;
     }
+
+    if (!(('a' <= *p && *p <= 'z') || ('A' <= *p && *p <= 'Z') ||
+	  ('0' <= *p && *p <= '9') || *p == '_' || *p == '-' || *p == '.'))
+      return -1;
+    len++;
   }
 
   return 0;
@@ -90,6 +560,20 @@ void cleanup_schedules(struct schedule* *scheds, size_t len)
 }
 
 
+void cleanup_expansion(struct expansion *ex)
+{
+  assert(ex != NULL);
+
+  free(ex->scheds);
+  free(ex->occurrences);
+  free(ex->ends);
+  ex->scheds = NULL;
+  ex->occurrences = NULL;
+  ex->ends = NULL;
+  ex->len = 0;
+}
+
+
 /**
  * @brief qsort()用の関数。スケジュール構造体のstart値で昇順ソートする。
  */
@@ -101,7 +585,129 @@ static int compare_start_val(const void *a, const void *b)
   //return (*(struct schedule**)b)->start - (*(struct schedule**)a)->start;
 
   // 昇順
-  return (*(struct schedule**)a)->start - (*(struct schedule**)b)->start;
+  // time_tの差はintに収まらない場合があるので、比較結果のみ返す。
+  time_t sa = (*(struct schedule**)a)->start;
+  time_t sb = (*(struct schedule**)b)->start;
+  return (sa > sb) - (sa < sb);
+}
+
+
+/**
+ * @brief qsort()用の関数。time_tの値で昇順ソートする。
+ */
+static int compare_time_val(const void *a, const void *b)
+{
+  time_t ta = *(const time_t*)a;
+  time_t tb = *(const time_t*)b;
+  return (ta > tb) - (ta < tb);
+}
+
+
+unsigned int count_max_overlap(struct schedule* *scheds, size_t len,
+			       pid_t pgid, time_t start, time_t end)
+{
+  assert(scheds != NULL);
+
+  // 範囲と重なるスケジュールの開始、終了時刻を、範囲内に切り詰めて集める。
+  // 継続時間が0のスケジュールは、どの時刻とも重ならない。
+  time_t starts[len+1], ends[len+1];
+  size_t n = 0, i;
+  for (i=0; i<len; i++) {
+    time_t s_start = scheds[i]->start;
+    time_t s_end = scheds[i]->start + scheds[i]->duration;
+    if (scheds[i]->pgid == pgid || scheds[i]->duration == 0 ||
+	s_start >= end || s_end <= start)
+      continue;
+
+    starts[n] = (s_start < start) ? start : s_start;
+    ends[n] = (s_end > end) ? end : s_end;
+    n++;
+  }
+
+  qsort(starts, n, sizeof(time_t), compare_time_val);
+  qsort(ends, n, sizeof(time_t), compare_time_val);
+
+  // 時刻順に走査する。同じ時刻では、終了を先に数える。各終了時刻は
+  // 対応する開始時刻より後なので、countが0の時に終了を数えることはない。
+  unsigned int count = 0, max = 0;
+  size_t j = 0;
+  i = 0;
+  while (i < n) {
+    if (j >= n || count == 0 || starts[i] < ends[j]) {
+      count++;
+      if (count > max)
+	max = count;
+      i++;
+    } else {
+      count--;
+      j++;
+    }
+  }
+
+  return max;
+}
+
+
+int shrink_elastic_schedules(struct schedule* sched,
+			     struct schedule* *scheds, size_t len,
+			     unsigned int capacity,
+			     struct schedule* *changed, size_t *nchanged)
+{
+  assert(sched != NULL && scheds != NULL && changed != NULL &&
+	 nchanged != NULL);
+
+  *nchanged = 0;
+  if (sched->rule[0] != '\0')
+    return 1;
+
+  time_t now = time(NULL);
+  time_t end = sched->start + sched->duration;
+  unsigned int org[len+1];
+  int ret;
+  while ((ret = check_sched_capacity(sched, scheds, len, capacity)) == 1) {
+
+    // 縮められるスケジュールのうち、開始時刻が最も遅いものを選ぶ。
+    struct schedule *target = NULL;
+    time_t target_end = 0;
+    size_t i;
+    for (i=0; i<len; i++) {
+      struct schedule *s = scheds[i];
+      if (s->pgid == sched->pgid || s->max_duration == 0 ||
+	  s->rule[0] != '\0' ||
+	  !shares_resource(s->resources, sched->resources))
+	continue;
+
+      time_t s_end = s->start + s->duration;
+      if (s->start >= end || s_end <= sched->start)
+	continue;
+
+      time_t new_end = (sched->start > now) ? sched->start : now;
+      if (new_end >= s_end || new_end < s->start + s->min_duration)
+	continue;
+
+      if (target == NULL || s->start > target->start) {
+	target = s;
+	target_end = new_end;
+      }
+    }
+
+    if (target == NULL)
+      break;
+
+    org[*nchanged] = target->duration;
+    changed[(*nchanged)++] = target;
+    target->duration = target_end - target->start;
+  }
+
+  // 空きができなかった場合は、元に戻す。
+  if (ret != 0) {
+    size_t i;
+    for (i=0; i<*nchanged; i++)
+      changed[i]->duration = org[i];
+    *nchanged = 0;
+  }
+
+  return ret;
 }
 
 
@@ -113,8 +719,8 @@ int create_schedule(pid_t pgid, int lock, pid_t terminator, time_t start,
 
   *sched = (struct schedule*)malloc(sizeof(struct schedule));
   if (*sched == NULL) {
-    fprintf(stderr, "%s:%d: Error: Faild to allocate memory.\n", __FILE__,
-	    __LINE__);
+    report_error(ERROR_MEMORY, "%s:%d: Error: Faild to allocate memory.\n",
+		 __FILE__, __LINE__);
     return -1;
   }
 
@@ -124,6 +730,14 @@ int create_schedule(pid_t pgid, int lock, pid_t terminator, time_t start,
   (*sched)->start      = start;
   (*sched)->duration   = duration;
   strcpy((*sched)->caption, caption);
+  (*sched)->rule[0]    = '\0';
+  (*sched)->resources[0] = '\0';
+  (*sched)->min_duration = 0;
+  (*sched)->max_duration = 0;
+  (*sched)->early = 0;
+  (*sched)->after[0] = '\0';
+  (*sched)->id = 0;
+  (*sched)->leader_start = 0;
 
   return 0;
 }
@@ -150,31 +764,567 @@ void debug_schedule(const char* comment, struct schedule* *scheds, size_t len)
 }
 
 
-/**
- * @brief 環境変数を解析する。
- * @param[out] sem_name セマフォ名。環境変数(データベース番号)が反映される。
- * @param[out] shm_name 共有メモリ名。環境変数(データベース番号)が反映される。
- * @return 成功時は0、失敗時には-1を返す。
- */
-int get_env(char *sem_name, char *shm_name)
+int expand_schedules(struct schedule* *scheds, size_t len, time_t begin,
+		     time_t end, struct expansion *ex)
 {
-  // 環境変数よりシェルのパスを取得
-  char *str = getenv(ENV_NAME);
-  if (str != NULL) {
-    if (atoi(str) < 1 || atoi(str) > MAX_NUM_DB) {
-      fprintf(stderr, "Error: Invalid database number. (Valid 1-%d)\n",
-	      MAX_NUM_DB);
-      return -1;
-    }
+  assert(scheds != NULL && ex != NULL);
 
-    if (sem_name != NULL)
-      strcat(sem_name, str);
+  ex->scheds = NULL;
+  ex->len = 0;
+  ex->occurrences = NULL;
+  ex->ends = NULL;
 
-    if (shm_name != NULL)
-      strcat(shm_name, str);
-  }
+  // まず、繰り返しスケジュールの範囲内の開始時刻をすべて作成する。
+  struct cron_mask* masks[len+1];
+  compile_rules(scheds, len, masks);
 
-  return 0;
+  size_t occ_len = 0, occ_cap = 0, plain_len = 0;
+  size_t i;
+  for (i=0; i<len; i++) {
+    if (masks[i] == NULL) {
+      plain_len++;
+      continue;
+    }
+
+    time_t from = begin - scheds[i]->duration + 1;
+    if (from < scheds[i]->start)
+      from = scheds[i]->start;
+
+    time_t t;
+    while (next_occurrence(&t, masks[i], from, end - 1) == 0) {
+      if (occ_len == occ_cap) {
+	occ_cap = (occ_cap == 0) ? 64 : occ_cap * 2;
+	struct schedule *p = realloc(ex->occurrences,
+				     occ_cap * sizeof(struct schedule));
+	if (p == NULL) {
+	  report_error(ERROR_MEMORY,
+		       "%s:%d: Error: Faild to allocate memory.\n", __FILE__,
+		       __LINE__);
+	  release_rules(masks, len);
+	  cleanup_expansion(ex);
+	  return -1;
+	}
+	ex->occurrences = p;
+      }
+
+      struct schedule *o = &(ex->occurrences[occ_len]);
+      *o = *(scheds[i]);
+      o->start = t;
+      o->rule[0] = '\0';
+      occ_len++;
+
+      from = t + 60;
+    }
+  }
+  release_rules(masks, len);
+
+  // 繰り返しでないスケジュールと、作成したスケジュールをまとめる。
+  ex->scheds = malloc((plain_len + occ_len + 1) * sizeof(struct schedule*));
+  ex->ends = malloc((plain_len + occ_len + 1) * sizeof(struct schedule*));
+  if (ex->scheds == NULL || ex->ends == NULL) {
+    report_error(ERROR_MEMORY, "%s:%d: Error: Faild to allocate memory.\n",
+		 __FILE__, __LINE__);
+    cleanup_expansion(ex);
+    return -1;
+  }
+
+  for (i=0; i<len; i++) {
+    if (scheds[i]->rule[0] == '\0')
+      ex->scheds[ex->len++] = scheds[i];
+  }
+  for (i=0; i<occ_len; i++)
+    ex->scheds[ex->len++] = &(ex->occurrences[i]);
+
+  return 0;
+}
+
+
+/**
+ * @brief 環境変数を解析する。
+ * @param[out] sem_name セマフォ名。環境変数(データベース番号)が反映される。
+ * @param[out] shm_name 共有メモリ名。環境変数(データベース番号)が反映される。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+int get_env(char *sem_name, char *shm_name)
+{
+  // 環境変数よりシェルのパスを取得
+  char *str = getenv(ENV_NAME);
+  if (str != NULL) {
+    if (atoi(str) < 1 || atoi(str) > MAX_NUM_DB) {
+      report_error(ERROR_INVALID,
+		   "Error: Invalid database number. (Valid 1-%d)\n",
+		   MAX_NUM_DB);
+      return -1;
+    }
+
+    if (sem_name != NULL)
+      strcat(sem_name, str);
+
+    if (shm_name != NULL)
+      strcat(shm_name, str);
+  }
+
+  return 0;
+}
+
+
+int get_capacity(const char* shm_path, unsigned int *capacity)
+{
+  assert(shm_path != NULL && capacity != NULL);
+
+  long value = DEFAULT_CAPACITY;
+  if (get_header_value(shm_path, CAPACITY_KEY, &value) != 0)
+    return -1;
+
+  if (value < 1 || value > MAX_CAPACITY) {
+    report_error(ERROR_FORMAT, "%s:%d: Error: Invalid capacity. %ld\n",
+		 __FILE__, __LINE__, value);
+    return -1;
+  }
+
+  *capacity = value;
+
+  return 0;
+}
+
+
+/**
+ * @brief qsort()用の関数。スケジュール構造体の終了時刻で昇順ソートする。
+ */
+static int compare_end_val(const void *a, const void *b)
+{
+  const struct schedule *sa = *(struct schedule**)a;
+  const struct schedule *sb = *(struct schedule**)b;
+  time_t ea = sa->start + sa->duration;
+  time_t eb = sb->start + sb->duration;
+  return (ea > eb) - (ea < eb);
+}
+
+
+void init_gap_iterator(struct gap_iterator *it, struct expansion *ex,
+		       pid_t pgid, time_t begin, time_t end,
+		       unsigned int capacity, const char *resources)
+{
+  assert(it != NULL && ex != NULL);
+
+  if (pgid != 0) {
+    size_t i, n = 0;
+    for (i=0; i<ex->len; i++) {
+      if (ex->scheds[i]->pgid != pgid)
+	ex->scheds[n++] = ex->scheds[i];
+    }
+    ex->len = n;
+  }
+  sort_schedules(ex->scheds, ex->len);
+
+  it->scheds = ex->scheds;
+  it->len = ex->len;
+  it->index = 0;
+  it->head = begin;
+  it->end = end;
+  it->capacity = (capacity < 1) ? 1 : capacity;
+  it->resources = (resources == NULL) ? "" : resources;
+  it->ends = NULL;
+  it->end_index = 0;
+  memset(it->counts, 0, sizeof(it->counts));
+
+  // 同時に重なる数を数えるため、終了時刻の順にも並べておく。
+  if (it->capacity > 1) {
+    memcpy(ex->ends, ex->scheds, ex->len * sizeof(struct schedule*));
+    qsort(ex->ends, ex->len, sizeof(struct schedule*), compare_end_val);
+    it->ends = ex->ends;
+  }
+}
+
+
+/**
+ * @brief スケジュールの開始、終了を、資源ごとの重なっている数に反映する。
+ * @param[in]     it     空き時間を取得するための状態。
+ * @param[in,out] counts 資源ごとの重なっている数。
+ * @param[in]     s      開始、終了したスケジュール。
+ * @param[in]     delta  開始の場合は1、終了の場合は-1。
+ */
+static void count_gap_event(const struct gap_iterator *it, int *counts,
+			    const struct schedule *s, int delta)
+{
+  // 資源の指定がない場合は、データベース全体を1つとして数える。
+  if (it->resources[0] == '\0') {
+    counts[0] += delta;
+    return;
+  }
+
+  const char *name;
+  size_t n, k;
+  for (k=0; resource_at(it->resources, k, &name, &n) == 0; k++) {
+    if (occupies_resource(s->resources, name, n))
+      counts[k] += delta;
+  }
+}
+
+
+/**
+ * @brief いずれかの資源で、重なっている数がcapacityに達しているか確認する。
+ * @return 達している場合は1、空きがある場合は0を返す。
+ */
+static int is_gap_full(const struct gap_iterator *it, const int *counts)
+{
+  size_t k, n = count_resources(it->resources);
+  if (n == 0)
+    n = 1;
+
+  for (k=0; k<n; k++) {
+    if (counts[k] >= (int)it->capacity)
+      return 1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief capacityが2以上の場合の、next_gap()の実装。
+ *
+ * 開始時刻順と終了時刻順のスケジュール群を並行して走査し、資源ごとに
+ * headで同時に重なっているスケジュール数を数える。
+ */
+static int next_gap_with_capacity(struct gap_iterator *it, time_t *start,
+				  time_t *end)
+{
+  size_t len = it->len;
+
+  while (it->head < it->end) {
+
+    // headまでに開始、終了したスケジュールを数える。
+    while (it->index < len && it->scheds[it->index]->start <= it->head) {
+      count_gap_event(it, it->counts, it->scheds[it->index], 1);
+      it->index++;
+    }
+    while (it->end_index < len &&
+	   (it->ends[it->end_index]->start + it->ends[it->end_index]->duration)
+	   <= it->head) {
+      count_gap_event(it, it->counts, it->ends[it->end_index], -1);
+      it->end_index++;
+    }
+    // 空きがない場合は、次にスケジュールが終了する時刻までheadを進める。
+    if (is_gap_full(it, it->counts)) {
+      struct schedule *e = it->ends[it->end_index];
+      it->head = e->start + e->duration;
+      continue;
+    }
+
+    // 空きがなくなる時刻(または範囲の終わり)までが空き時間。
+    int counts[MAX_NUM_RESOURCES];
+    memcpy(counts, it->counts, sizeof(counts));
+    size_t i = it->index, j = it->end_index;
+    time_t t = it->end;
+    while (i < len || j < len) {
+      time_t next_start = (i < len) ? it->scheds[i]->start : it->end;
+      time_t next_end = it->end;
+      if (j < len)
+	next_end = it->ends[j]->start + it->ends[j]->duration;
+      t = (next_start < next_end) ? next_start : next_end;
+      if (t >= it->end) {
+	t = it->end;
+	break;
+      }
+
+      // 同じ時刻の開始、終了はまとめて数える。
+      while (i < len && it->scheds[i]->start == t)
+	count_gap_event(it, counts, it->scheds[i++], 1);
+      while (j < len && it->ends[j]->start + it->ends[j]->duration == t) {
+	count_gap_event(it, counts, it->ends[j], -1);
+	j++;
+      }
+
+      if (is_gap_full(it, counts))
+	break;
+      t = it->end;
+    }
+
+    *start = it->head;
+    *end = t;
+    it->head = t;
+    return 0;
+  }
+
+  return -1;
+}
+
+
+int next_gap(struct gap_iterator *it, time_t *start, time_t *end)
+{
+  assert(it != NULL && start != NULL && end != NULL);
+
+  if (it->capacity > 1)
+    return next_gap_with_capacity(it, start, end);
+
+  while (it->head < it->end) {
+
+    // 残りのスケジュールがない場合は、範囲の終わりまでが空き時間。
+    if (it->index >= it->len) {
+      *start = it->head;
+      *end = it->end;
+      it->head = it->end;
+      return 0;
+    }
+
+    struct schedule *s = it->scheds[it->index];
+    time_t s_start = s->start;
+    time_t s_end = s->start + s->duration;
+    it->index++;
+
+    // 調べる資源を占有しないスケジュールは飛ばす。
+    if (!shares_resource(s->resources, it->resources))
+      continue;
+
+    // headより前に終わっているスケジュールは飛ばす。
+    if (s_end <= it->head)
+      continue;
+
+    // headと重なるスケジュールは、終了時刻までheadを進める。
+    if (s_start <= it->head) {
+      it->head = s_end;
+      continue;
+    }
+
+    // headからスケジュールの開始時刻(または範囲の終わり)までが空き時間。
+    *start = it->head;
+    *end = (s_start < it->end) ? s_start : it->end;
+    it->head = s_end;
+    return 0;
+  }
+
+  return -1;
+}
+
+
+int probe_schedules(struct schedule* *scheds, size_t len, pid_t pgid,
+		    unsigned int capacity, const char *resources,
+		    struct probe *probes, size_t n)
+{
+  assert(scheds != NULL && resources != NULL && (probes != NULL || n == 0));
+
+  struct schedule* *sorted = malloc((len + 1) * sizeof(struct schedule*));
+  size_t *latest = malloc((len + 1) * sizeof(size_t));
+  if (sorted == NULL || latest == NULL) {
+    report_error(ERROR_MEMORY, "%s:%d: Error: Faild to allocate memory.\n",
+		 __FILE__, __LINE__);
+    free(sorted);
+    free(latest);
+    return -1;
+  }
+
+  // 候補と資源を共有するスケジュールだけを、start値で昇順ソートする。
+  size_t i, m = 0;
+  for (i=0; i<len; i++) {
+    if (scheds[i]->pgid != pgid &&
+	shares_resource(scheds[i]->resources, resources))
+      sorted[m++] = scheds[i];
+  }
+  sort_schedules(sorted, m);
+
+  // 先頭から各位置までで、最も遅く終わるスケジュールの添字を求めておく。
+  for (i=0; i<m; i++) {
+    latest[i] = i;
+    if (i > 0) {
+      struct schedule *s = sorted[latest[i-1]];
+      if (s->start + s->duration > sorted[i]->start + sorted[i]->duration)
+	latest[i] = latest[i-1];
+    }
+  }
+
+  int ret = 0;
+  for (i=0; i<n; i++) {
+    time_t start = probes[i].start;
+    time_t end = probes[i].start + probes[i].duration;
+    probes[i].conflict = NULL;
+
+    // 候補の終了時刻より前に始まるスケジュールの数を、二分探索で求める。
+    size_t lo = 0, hi = m;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (sorted[mid]->start < end)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+    if (lo == 0)
+      continue;
+
+    // その中で最も遅く終わるスケジュールが、候補の開始時刻より後に終わる
+    // 場合に重複する。
+    struct schedule *s = sorted[latest[lo-1]];
+    if (s->start + s->duration <= start)
+      continue;
+
+    // capacityが2以上の場合は、同時に重なる数を確認する。
+    if (capacity > 1) {
+      struct schedule p;
+      memset(&p, 0, sizeof(p));
+      p.pgid = pgid;
+      p.start = probes[i].start;
+      p.duration = probes[i].duration;
+      snprintf(p.resources, sizeof(p.resources), "%s", resources);
+
+      int full = check_sched_capacity(&p, sorted, lo, capacity);
+      if (full == -1) {
+	ret = -1;
+	break;
+      }
+      if (full == 0)
+	continue;
+    }
+
+    probes[i].conflict = s;
+  }
+
+  free(sorted);
+  free(latest);
+
+  return ret;
+}
+
+
+int find_conflicting_schedule(const struct schedule* sched,
+			      struct schedule* *scheds, size_t len,
+			      unsigned int capacity, struct schedule *conflict)
+{
+  assert(sched != NULL && scheds != NULL && conflict != NULL);
+
+  struct expansion ex;
+  if (expand_schedules(scheds, len, sched->start,
+		       sched->start + sched->duration, &ex) != 0)
+    return -1;
+
+  struct probe p = {sched->start, sched->duration, NULL};
+  int ret = 1;
+  if (probe_schedules(ex.scheds, ex.len, sched->pgid, capacity,
+		      sched->resources, &p, 1) != 0) {
+    ret = -1;
+  } else if (p.conflict != NULL) {
+    *conflict = *p.conflict;
+    ret = 0;
+  }
+  cleanup_expansion(&ex);
+
+  return ret;
+}
+
+
+int grow_elastic_schedule(struct schedule* sched, struct schedule* *scheds,
+			  size_t len, unsigned int capacity)
+{
+  assert(sched != NULL && scheds != NULL);
+
+  if (sched->max_duration <= sched->duration || sched->rule[0] != '\0')
+    return 0;
+
+  time_t end = sched->start + sched->duration;
+  time_t limit = sched->start + sched->max_duration;
+
+  struct expansion ex;
+  if (expand_schedules(scheds, len, end, limit, &ex) != 0)
+    return -1;
+
+  // 終了時刻から始まる空き時間の終わりまで延長する。
+  struct gap_iterator it;
+  init_gap_iterator(&it, &ex, sched->pgid, end, limit, capacity,
+		    sched->resources);
+
+  int ret = 0;
+  time_t gap_start, gap_end;
+  if (next_gap(&it, &gap_start, &gap_end) == 0 && gap_start == end) {
+    sched->duration = gap_end - sched->start;
+    ret = 1;
+  }
+
+  cleanup_expansion(&ex);
+
+  return ret;
+}
+
+
+int signal_terminator(const struct schedule* sched, int signo)
+{
+  assert(sched != NULL);
+
+  // 終了機能は、終了時刻になるまでスケジュールのプロセスグループに属する。
+  if (sched->terminator <= 0 || getpgid(sched->terminator) != sched->pgid)
+    return -1;
+
+  return kill(sched->terminator, signo);
+}
+
+
+int spawn_holder(time_t end, pid_t *pgid)
+{
+  assert(pgid != NULL);
+
+  errno = 0;
+  pid_t pid = fork();
+  switch (pid) {
+  case -1:
+    report_error(ERROR_SYSTEM, "%s:%d: Error: fork() %s\n", __FILE__,
+		 __LINE__, strerror(errno));
+    return -1;
+  case 0:
+    setpgid(0, 0);
+
+    // 出力先のパイプなどを開いたままにしないよう、標準入出力を閉じる。
+    if (freopen("/dev/null", "r", stdin) == NULL ||
+	freopen("/dev/null", "w", stdout) == NULL ||
+	freopen("/dev/null", "w", stderr) == NULL)
+      _exit(1);
+
+    if (end == 0) {
+      for (;;)
+	pause();
+    }
+
+    time_t now;
+    while ((now = time(NULL)) < end)
+      sleep(end - now);
+    _exit(0);
+  }
+
+  // 子プロセスと親プロセスの両方で設定し、競合を避ける。
+  setpgid(pid, pid);
+  *pgid = pid;
+
+  return 0;
+}
+
+
+int find_predecessor(const struct schedule* sched, struct schedule* *scheds,
+		     size_t len, time_t now, time_t *end)
+{
+  assert(sched != NULL && scheds != NULL && end != NULL);
+
+  // 数字だけの場合はpgid値とみなす。
+  const char *after = sched->after;
+  pid_t pgid = 0;
+  if (after[0] != '\0' && strspn(after, "0123456789") == strlen(after))
+    pgid = atoi(after);
+
+  int found = 0;
+  size_t i;
+  for (i=0; i<len; i++) {
+    struct schedule *s = scheds[i];
+    if (s->pgid == sched->pgid || s->duration == 0)
+      continue;
+    if (pgid != 0 ? (s->pgid != pgid) : (strcmp(s->caption, after) != 0))
+      continue;
+
+    time_t s_end = s->start + s->duration;
+    if (s_end <= now)
+      continue;
+
+    if (!found || s_end > *end)
+      *end = s_end;
+    found = 1;
+  }
+
+  return found;
 }
 
 
@@ -195,149 +1345,910 @@ int find_sched_by_pgid(pid_t pgid, struct schedule* *scheds, size_t len,
 }
 
 
-size_t generate_unoccupied_scheds_from_scheds(struct schedule** scheds,
-					      size_t len,
-					   struct schedule** unoccupied_scheds,
-					      size_t max_len,
-					      time_t range_start,
-					      unsigned int range_dur,
-					      const char* caption)
+int update_sched_by_pgid(struct schedule* new, struct schedule* *scheds,
+			 size_t *len, size_t max_len)
+{
+  assert(new != NULL && scheds != NULL && len != NULL);
+
+  struct schedule *s = NULL;
+  if (find_sched_by_pgid(new->pgid, scheds, *len, &s) == 0) {
+    // スケジュールあり。上書き。
+    s->start = new->start;
+    s->duration = new->duration;
+    strcpy(s->caption, new->caption);
+    strcpy(s->rule, new->rule);
+    strcpy(s->resources, new->resources);
+    s->min_duration = new->min_duration;
+    s->max_duration = new->max_duration;
+    s->early = new->early;
+    strcpy(s->after, new->after);
+    free(new);
+    return 0;
+  }
+
+  // スケジュールなし。追加。
+  if (*len >= max_len) {
+    report_error(ERROR_FULL, "%s:%d: Error: Too many schedules.\n", __FILE__,
+		 __LINE__);
+    return -1;
+  }
+  scheds[*len] = new;
+  (*len)++;
+
+  return 0;
+}
+
+
+int find_next_sched_by_pgid(const struct schedule* sched,
+			    struct schedule* *scheds, size_t len,
+			    struct schedule* *next)
+{
+  assert(sched != NULL && scheds != NULL);
+
+  size_t i;
+  for (i=0; i<len && scheds[i] != sched; i++)
+    ;
+
+  for (i++; i<len; i++) {
+    if (scheds[i]->pgid == sched->pgid) {
+      *next = scheds[i];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+int find_sched_by_id(uint64_t id, struct schedule* *scheds, size_t len,
+		     struct schedule* *sched)
+{
+  assert(id != 0 && scheds != NULL);
+
+  size_t i;
+  for (i=0; i<len; i++) {
+    if (scheds[i]->id == id) {
+      *sched = scheds[i];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+void remove_schedule(struct schedule* sched, struct schedule* *scheds,
+		     size_t *len)
+{
+  assert(sched != NULL && scheds != NULL && len != NULL);
+
+  // ロックは、同じプロセスグループの次のスケジュールに引き継ぐ。
+  struct schedule *next = NULL;
+  if (sched->lock == 1) {
+    if (find_next_sched_by_pgid(sched, scheds, *len, &next) != 0) {
+      sched->start = 0;
+      sched->duration = 0;
+      strcpy(sched->caption, DEFAULT_SCHED_CAPTION);
+      sched->rule[0] = '\0';
+      sched->resources[0] = '\0';
+      sched->min_duration = sched->max_duration = 0;
+      sched->early = 0;
+      sched->after[0] = '\0';
+      sched->id = 0;
+      return;
+    }
+    next->lock = 1;
+  }
+
+  size_t i;
+  for (i=0; i<*len && scheds[i] != sched; i++)
+    ;
+  if (i == *len)
+    return;
+
+  free(sched);
+  memmove(&scheds[i], &scheds[i+1], (*len - i - 1) * sizeof(scheds[0]));
+  (*len)--;
+}
+
+
+size_t generate_unoccupied_scheds_from_scheds(struct schedule** scheds,
+					      size_t len,
+					   struct schedule** unoccupied_scheds,
+					      size_t max_len,
+					      time_t range_start,
+					      unsigned int range_dur,
+					      unsigned int capacity,
+					      const char* caption)
+{
+  assert(scheds != NULL && unoccupied_scheds != NULL);
+  assert(caption != NULL);
+
+  size_t index_found = 0;
+  time_t range_end = range_start + range_dur;
+  pid_t pgid = getpgid(0);
+
+  // 繰り返しスケジュールを、検索範囲内で展開する。
+  struct expansion ex;
+  if (expand_schedules(scheds, len, range_start, range_end, &ex) != 0)
+    return 0;
+
+  // 空き時間を順に取得して、スケジュールを作成する。
+  struct gap_iterator it;
+  init_gap_iterator(&it, &ex, 0, range_start, range_end, capacity, NULL);
+
+  time_t gap_start, gap_end;
+  while (next_gap(&it, &gap_start, &gap_end) == 0) {
+    if (index_found >= max_len) {
+      fprintf(stderr, "found! but over max size. %zu\n", max_len);
+      break;
+    }
+
+    struct schedule *s;
+    if (create_schedule(pgid, 0, 0, gap_start, (gap_end-gap_start), caption,
+			&s) != 0)
+      break;
+
+    unoccupied_scheds[index_found] = s;
+    index_found++;
+  }
+
+  cleanup_expansion(&ex);
+
+  return index_found;
+}
+
+
+/**
+ * @brief 共有メモリのアドレスを取得する。
+ * @param[in] path 共有メモリのパス。
+ * @param[in] size 共有メモリのサイズ。
+ * @param[out] addr 取得したアドレスが反映される。
+ * @return 成功した場合は0を、失敗した場合は-1を返す。
+ */
+static int get_shared_memory_address(const char* path, size_t size,char* *addr)
+{
+  errno = 0;
+  int fd = shm_open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    report_error(ERROR_SYSTEM, "%s:%d: Error: shm_open() %s\n", __FILE__,
+		 __LINE__, strerror(errno));
+    return -1;
+  }
+  
+  // c - ftruncate not working on POSIX shared memory in Mac OS X - Stack Overflow
+  // stackoverflow.com/questions/25502229/ftruncate-not-working-on-posix-shared-memory-in-mac-os-x
+  struct stat mapstat;
+  if (-1 != fstat(fd, &mapstat) && mapstat.st_size == 0) {
+    errno = 0;
+    if (ftruncate(fd, size) == -1) {
+      report_error(ERROR_SYSTEM, "%s:%d: Error: ftruncate. %s\n", __FILE__,
+		   __LINE__, strerror(errno));
+      return -1;
+    }
+  }
+  
+  errno = 0;
+  *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    report_error(ERROR_SYSTEM, "%s:%d: Error: mmap() %s.\n", __FILE__,
+		 __LINE__, strerror(errno));
+    return -1;
+  }
+
+  if (close(fd) == -1) {
+    report_error(ERROR_SYSTEM, "%s:%d: Error: close()\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @struct released
+ * @brief load_schedules()が解放したスケジュールの範囲。
+ */
+struct released {
+  time_t starts[MAX_NUM_SCHEDULES];  /**< 範囲の開始時刻 */
+  time_t ends[MAX_NUM_SCHEDULES];  /**< 範囲の終了時刻 */
+  size_t len;  /**< 範囲の数 */
+};
+
+
+/**
+ * @brief 解放したスケジュールの範囲を、まとめて待機中のクライアントに通知する。
+ * @param[in]     shm_path 共有メモリのパス。
+ * @param[in/out] r        解放したスケジュールの範囲。通知後は空になる。
+ */
+static void flush_released(const char* shm_path, struct released *r)
+{
+  // 通知の失敗は無視する。待機中のクライアントは定期的に再確認する。
+  if (r->len != 0)
+    notify_releases(shm_path, r->starts, r->ends, r->len);
+
+  r->len = 0;
+}
+
+
+/**
+ * @brief 行が、keyのヘッダの行かを調べる。
+ */
+static int is_header_line(const char* line, const char* key)
+{
+  size_t key_len = strlen(key);
+  return line[0] == HEADER_PREFIX && strncmp(line+1, key, key_len) == 0 &&
+    line[1+key_len] == ':';
+}
+
+
+/**
+ * @brief 文字列の中から、ヘッダの行を探す。
+ * @param[in] str 共有メモリの内容。
+ * @param[in] key ヘッダのキー。
+ * @return 見つかった場合は行の先頭を、見つからない場合はNULLを返す。
+ */
+static const char* find_header_line(const char* str, const char* key)
+{
+  const char *line = str;
+  while (*line != '\0') {
+    if (is_header_line(line, key))
+      return line;
+
+    const char *next = strchr(line, '\n');
+    if (next == NULL)
+      break;
+    line = next + 1;
+  }
+
+  return NULL;
+}
+
+
+int get_header_value(const char* shm_path, const char* key, long *value)
+{
+  assert(shm_path != NULL && key != NULL && value != NULL);
+
+  char *addr;
+  if (get_shared_memory_address(shm_path, SHARED_MEMORY_SIZE, &addr)
+      != 0)
+    return -1;
+
+  int ret = 0;
+  const char *line = find_header_line(addr, key);
+  if (line != NULL) {
+    char *endptr;
+    errno = 0;
+    long v = strtol(line + 1 + strlen(key) + 1, &endptr, 10);
+    if (errno != 0 || (*endptr != '\n' && *endptr != '\0')) {
+      report_error(ERROR_FORMAT, "%s:%d: Error: Invalid header. \"%s\"\n",
+		   __FILE__, __LINE__, key);
+      ret = -1;
+    } else {
+      *value = v;
+    }
+  }
+
+  if (munmap(addr, SHARED_MEMORY_SIZE) != 0) {
+    report_error(ERROR_SYSTEM, "%s:%d: Error: munmap()\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  return ret;
+}
+
+
+/**
+ * @brief 終了したプロセスグループのスケジュールを解放する。
+ *
+ * 範囲を記録してから、メモリを解放する。繰り返しスケジュールは、start値以降
+ * のすべてが解放される。範囲はflush_released()でまとめて通知する。
+ *
+ * @param[in]     shm_path 共有メモリのパス。
+ * @param[in]     sched    解放するスケジュール。
+ * @param[in/out] r        解放したスケジュールの範囲が追加される。
+ */
+static void release_schedule(const char* shm_path, struct schedule* sched,
+			     struct released *r)
+{
+  if (sched->duration != 0) {
+    if (r->len == MAX_NUM_SCHEDULES)
+      flush_released(shm_path, r);
+
+    time_t end = sched->start + sched->duration;
+    if (sched->rule[0] != '\0')
+      end = sched->start + RECUR_HORIZON + sched->duration;
+
+    r->starts[r->len] = sched->start;
+    r->ends[r->len] = end;
+    r->len++;
+  }
+
+  free(sched);
+}
+
+
+int get_process_start(pid_t pid, uint64_t *start)
+{
+  assert(start != NULL);
+
+#if defined(__linux__)
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL)
+    return -1;
+
+  char buf[1024];
+  size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+  fclose(fp);
+  buf[n] = '\0';
+
+  // コマンド名は空白や括弧を含みうるので、最後の')'から数える。
+  // starttimeは22番目のフィールド。
+  const char *p = strrchr(buf, ')');
+  if (p == NULL ||
+      sscanf(p + 1, "%*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s "
+	     "%*s %*s %*s %*s %*s %*s %" SCNu64, start) != 1)
+    return -1;
+
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+
+int is_group_alive(const struct schedule* sched)
+{
+  assert(sched != NULL);
+
+  // 起動を待つジョブは、まだプロセスグループを持たない。終了時刻を過ぎても
+  // 起動されていない場合は、起動するデーモンがいないとみなす。
+  if (sched->pgid < 0)
+    return sched->start + sched->duration > time(NULL);
+
+  uint64_t start;
+  if (sched->leader_start != 0 && get_process_start(sched->pgid, &start) == 0)
+    return start == sched->leader_start;
+
+  // プロセスグループが続いている間は、そのpgid値がpid値として再利用される
+  // ことはない。
+  return killpg(sched->pgid, 0) == 0;
+}
+
+
+/**
+ * @brief プロセスグループが存在しないことが、killpg()で分かるかを調べる。
+ *
+ * reaperが動いている場合に、load_schedules()が使う。reaperが取り除くまでの
+ * 間も、終了したプロセスグループのスケジュールと重なって追加できなくなる
+ * ことはない。pgid値の再利用と、起動を待つジョブの期限はreaperが調べる。
+ *
+ * @param[in] sched 調べるスケジュール。
+ * @return 存在しない場合は1、それ以外の場合は0を返す。
+ */
+static int is_group_gone(const struct schedule* sched)
+{
+  if (sched->pgid < 0)
+    return 0;
+
+  return killpg(sched->pgid, 0) != 0 && errno == ESRCH;
+}
+
+
+/**
+ * @brief ヘッダに記録されたreaperが動いているかを調べる。
+ * @param[in] str 共有メモリの内容。
+ * @return 動いている場合は1、それ以外の場合は0を返す。
+ */
+static int is_reaper_running(const char* str)
+{
+  const char *line = find_header_line(str, REAPER_KEY);
+  if (line == NULL)
+    return 0;
+
+  pid_t pid = atoi(line + 1 + strlen(REAPER_KEY) + 1);
+  if (pid <= 0)
+    return 0;
+
+  // 開始時刻が取得できる環境では、pid値の再利用を見分ける。
+  uint64_t start;
+  line = find_header_line(str, REAPER_START_KEY);
+  if (line != NULL && get_process_start(pid, &start) == 0)
+    return start == strtoull(line + 1 + strlen(REAPER_START_KEY) + 1, NULL,
+			     10);
+
+  return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+
+/**
+ * @brief 共有メモリからスケジュールを読み込み、スケジュール構造体を作成する。
+ * @param[in]  shm_path 共有メモリのパス。
+ * @param[in]  shm_size 共有メモリのサイズ。
+ * @param[out] scheds 読み込んだスケジュール構造体を保存する配列。あらかじめ
+ * メモリを確保しておく必要がある。
+ * @param[in]  scheds_len schedsの配列数。
+ * @param[out] loaded_len 読み込んだスケジュール数が反映される。
+ * @return 成功時は0、失敗時は-1返す。
+ */
+int load_schedules(const char* shm_path, size_t shm_size, 
+		   struct schedule** scheds, size_t scheds_len,
+		   size_t *loaded_len)
+{
+  assert(scheds_len != 0);
+
+  char *addr;
+  if (get_shared_memory_address(shm_path, shm_size, &addr) != 0)
+    return -1;
+
+  // strtok_r()は元の文字列に変更を加えるので、共有メモリの内容をローカルにコピー
+  // する。
+  char buff[strlen(addr)+1];
+  strcpy(buff, addr);
+
+  if (munmap(addr, shm_size) != 0) {
+    report_error(ERROR_SYSTEM, "%s:%d: Error: munmap()\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  // reaperが動いている場合は、開始時刻を調べずに読み込む。
+  int reaped = is_reaper_running(buff);
+
+  int index = 0;
+  struct released released;
+  released.len = 0;
+
+  char *token, *saveptr;
+  for (token = strtok_r(buff, "\n", &saveptr); token != NULL;
+       token = strtok_r(NULL, "\n", &saveptr)) {
+
+    // ヘッダは読み飛ばす。
+    if (token[0] == HEADER_PREFIX)
+      continue;
+
+    struct schedule* s;
+    if (string_to_record(token, &s) != 0) {
+      cleanup_schedules(scheds, index);
+      flush_released(shm_path, &released);
+      return -1;
+    }
+
+    // プロセスグループが終了している場合は読み込まない。
+    if (reaped ? !is_group_gone(s) : is_group_alive(s)) {
+      scheds[index] = s;
+      index++;
+    } else {
+      release_schedule(shm_path, s, &released);
+    }
+
+    if (index+1 >= scheds_len)
+      break;
+  }
+
+  *loaded_len = index;
+
+  flush_released(shm_path, &released);
+
+  return 0;
+}
+
+
+/**
+ * @brief rule属性の値を文字列にする。
+ * @param[in]  sched 対象のスケジュール。
+ * @param[out] value 値が反映される。
+ * @param[in]  size  valueのサイズ。
+ * @return 値の長さ、属性を持たない場合は0を返す。
+ */
+static int format_rule(const struct schedule* sched, char *value, size_t size)
+{
+  if (sched->rule[0] == '\0')
+    return 0;
+
+  return snprintf(value, size, "%s", sched->rule);
+}
+
+
+/**
+ * @brief rule属性の値を、スケジュールに反映する。
+ * @param[in]  value 属性の値。
+ * @param[out] sched 値が反映されるスケジュール。
+ * @return 成功した場合は0を、不正な値の場合は-1を返す。
+ */
+static int parse_rule(const char *value, struct schedule* sched)
+{
+  if (strlen(value) >= MAX_RULE_LEN)
+    return -1;
+
+  strcpy(sched->rule, value);
+
+  return 0;
+}
+
+
+/**
+ * @brief res属性の値を文字列にする。
+ * @param[in]  sched 対象のスケジュール。
+ * @param[out] value 値が反映される。
+ * @param[in]  size  valueのサイズ。
+ * @return 値の長さ、属性を持たない場合は0を返す。
+ */
+static int format_res(const struct schedule* sched, char *value, size_t size)
+{
+  if (sched->resources[0] == '\0')
+    return 0;
+
+  return snprintf(value, size, "%s", sched->resources);
+}
+
+
+/**
+ * @brief res属性の値を、スケジュールに反映する。
+ * @param[in]  value 属性の値。
+ * @param[out] sched 値が反映されるスケジュール。
+ * @return 成功した場合は0を、不正な値の場合は-1を返す。
+ */
+static int parse_res(const char *value, struct schedule* sched)
+{
+  if (check_resource_set(value) != 0)
+    return -1;
+
+  strcpy(sched->resources, value);
+
+  return 0;
+}
+
+
+/**
+ * @brief 属性の値を、符号なし整数として解析する。
+ * @param[in]  value 属性の値。
+ * @param[out] n     解析した値が反映される。
+ * @return 成功した場合は0を、数値でない場合は-1を返す。
+ */
+static int parse_attr_uint(const char *value, unsigned int *n)
+{
+  if (value[0] < '0' || value[0] > '9')
+    return -1;
+
+  errno = 0;
+  char *end;
+  unsigned long v = strtoul(value, &end, 10);
+  if (errno != 0 || *end != '\0' || v > UINT_MAX)
+    return -1;
+
+  *n = v;
+
+  return 0;
+}
+
+
+/**
+ * @brief min属性の値を文字列にする。伸縮しないスケジュールは属性を持たない。
+ * @param[in]  sched 対象のスケジュール。
+ * @param[out] value 値が反映される。
+ * @param[in]  size  valueのサイズ。
+ * @return 値の長さ、属性を持たない場合は0を返す。
+ */
+static int format_min(const struct schedule* sched, char *value, size_t size)
+{
+  if (sched->max_duration == 0)
+    return 0;
+
+  return snprintf(value, size, "%u", sched->min_duration);
+}
+
+
+/**
+ * @brief min属性の値を、スケジュールに反映する。
+ * @param[in]  value 属性の値。
+ * @param[out] sched 値が反映されるスケジュール。
+ * @return 成功した場合は0を、不正な値の場合は-1を返す。
+ */
+static int parse_min(const char *value, struct schedule* sched)
+{
+  return parse_attr_uint(value, &sched->min_duration);
+}
+
+
+/**
+ * @brief max属性の値を文字列にする。伸縮しないスケジュールは属性を持たない。
+ * @param[in]  sched 対象のスケジュール。
+ * @param[out] value 値が反映される。
+ * @param[in]  size  valueのサイズ。
+ * @return 値の長さ、属性を持たない場合は0を返す。
+ */
+static int format_max(const struct schedule* sched, char *value, size_t size)
+{
+  if (sched->max_duration == 0)
+    return 0;
+
+  return snprintf(value, size, "%u", sched->max_duration);
+}
+
+
+/**
+ * @brief max属性の値を、スケジュールに反映する。
+ * @param[in]  value 属性の値。
+ * @param[out] sched 値が反映されるスケジュール。
+ * @return 成功した場合は0を、不正な値の場合は-1を返す。
+ */
+static int parse_max(const char *value, struct schedule* sched)
+{
+  return parse_attr_uint(value, &sched->max_duration);
+}
+
+
+/**
+ * @brief early属性の値を文字列にする。
+ * @param[in]  sched 対象のスケジュール。
+ * @param[out] value 値が反映される。
+ * @param[in]  size  valueのサイズ。
+ * @return 値の長さ、属性を持たない場合は0を返す。
+ */
+static int format_early(const struct schedule* sched, char *value,
+			size_t size)
+{
+  if (!sched->early)
+    return 0;
+
+  return snprintf(value, size, "1");
+}
+
+
+/**
+ * @brief early属性の値を、スケジュールに反映する。
+ * @param[in]  value 属性の値。
+ * @param[out] sched 値が反映されるスケジュール。
+ * @return 成功した場合は0を、不正な値の場合は-1を返す。
+ */
+static int parse_early(const char *value, struct schedule* sched)
+{
+  if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0)
+    return -1;
+
+  sched->early = (value[0] == '1');
+
+  return 0;
+}
+
+
+/**
+ * @brief after属性の値を文字列にする。
+ * @param[in]  sched 対象のスケジュール。
+ * @param[out] value 値が反映される。
+ * @param[in]  size  valueのサイズ。
+ * @return 値の長さ、属性を持たない場合は0を返す。
+ */
+static int format_after(const struct schedule* sched, char *value,
+			size_t size)
+{
+  if (sched->after[0] == '\0')
+    return 0;
+
+  return snprintf(value, size, "%s", sched->after);
+}
+
+
+/**
+ * @brief after属性の値を、スケジュールに反映する。
+ * @param[in]  value 属性の値。
+ * @param[out] sched 値が反映されるスケジュール。
+ * @return 成功した場合は0を、不正な値の場合は-1を返す。
+ */
+static int parse_after(const char *value, struct schedule* sched)
+{
+  if (strlen(value) >= MAX_CAPTION_LEN)
+    return -1;
+
+  strcpy(sched->after, value);
+
+  return 0;
+}
+
+
+/**
+ * @brief id属性の値を文字列にする。
+ * @param[in]  sched 対象のスケジュール。
+ * @param[out] value 値が反映される。
+ * @param[in]  size  valueのサイズ。
+ * @return 値の長さ、属性を持たない場合は0を返す。
+ */
+static int format_id(const struct schedule* sched, char *value, size_t size)
+{
+  if (sched->id == 0)
+    return 0;
+
+  return snprintf(value, size, "%" PRIu64, sched->id);
+}
+
+
+/**
+ * @brief id属性の値を、スケジュールに反映する。
+ * @param[in]  value 属性の値。
+ * @param[out] sched 値が反映されるスケジュール。
+ * @return 成功した場合は0を、不正な値の場合は-1を返す。
+ */
+static int parse_id(const char *value, struct schedule* sched)
+{
+  if (value[0] < '0' || value[0] > '9')
+    return -1;
+
+  errno = 0;
+  char *end;
+  uint64_t id = strtoull(value, &end, 10);
+  if (errno != 0 || *end != '\0' || id == 0)
+    return -1;
+
+  sched->id = id;
+
+  return 0;
+}
+
+
+/**
+ * @brief st属性(リーダーの開始時刻)の値を文字列にする。
+ * @param[in]  sched 対象のスケジュール。
+ * @param[out] value 値が反映される。
+ * @param[in]  size  valueのサイズ。
+ * @return 値の長さ、属性を持たない場合は0を返す。
+ */
+static int format_st(const struct schedule* sched, char *value, size_t size)
 {
-  assert(scheds != NULL && unoccupied_scheds != NULL);
-  assert(caption != NULL);
+  if (sched->leader_start == 0)
+    return 0;
 
-  size_t index_found = 0;
-  time_t head = range_start;
-  time_t unoccupied_start = 0, unoccupied_end = 0;
-  time_t range_end = range_start + range_dur;
-  pid_t pgid = getpgid(0);
+  return snprintf(value, size, "%" PRIu64, sched->leader_start);
+}
 
-  // まず、スケジュールをstart値で昇順ソート
-  qsort(scheds, len, sizeof(struct schedule*), compare_start_val);
 
-  int i;
-  for (i=0; i<len; i++) {
-    //fprintf(stderr, "search head:%ld start:%ld end:%ld dur:%d\n", head, scheds[i]->start, scheds[i]->start+scheds[i]->duration, scheds[i]->duration);
+/**
+ * @brief st属性(リーダーの開始時刻)の値を、スケジュールに反映する。
+ * @param[in]  value 属性の値。
+ * @param[out] sched 値が反映されるスケジュール。
+ * @return 成功した場合は0を、不正な値の場合は-1を返す。
+ */
+static int parse_st(const char *value, struct schedule* sched)
+{
+  if (value[0] < '0' || value[0] > '9')
+    return -1;
 
-    // headがレンジ内か確認する。
-    if (head > range_end) {
-      //fprintf(stderr, "Out of Range. head:%ld range_end:%ld\n", head, range_end);
-      return index_found;
-    }
+  errno = 0;
+  char *end;
+  uint64_t start = strtoull(value, &end, 10);
+  if (errno != 0 || *end != '\0')
+    return -1;
 
-    time_t sched_start = scheds[i]->start;
-    time_t sched_end = scheds[i]->start + scheds[i]->duration;
+  sched->leader_start = start;
 
-    if (sched_start > head) {
-      // ヘッドがスケジュールの開始時間前にある場合。
-      //  |<-head
-      //  |  +-+-+-+-+-+-+  +-+-+-+-+-+-+-+  
-      //  |  | scheds[i] |  | scheds[i+1] | ...
-      //  |  +-+-+-+-+-+-+  +-+-+-+-+-+-+-+  
-      //  | | <-> |<-range_end 
+  return 0;
+}
 
-      // 新しいschedの開始時刻はheadの値になる。
-      unoccupied_start = head;
 
-      // 新しいschedの終了時刻は、元のschedの開始時間または検索範囲末尾になる。
-      if (sched_start < range_end)
-	unoccupied_end = sched_start;
-      else
-	unoccupied_end = range_end;
+/**
+ * @struct attr
+ * @brief レコードの追加の属性の定義。
+ */
+struct attr {
+  const char *key;  /**< 属性のキー */
+  int (*format)(const struct schedule*, char*, size_t);  /**< 値を文字列にする関数 */
+  int (*parse)(const char*, struct schedule*);  /**< 値を反映する関数 */
+};
 
-    }
+/**
+ * @brief 追加の属性の一覧。
+ *
+ * レコードの属性は、この一覧に登録されたキーに限る。属性の書き出し、
+ * 読み込み、以前の書式との判別は、すべてこの一覧を使う。
+ */
+static const struct attr g_attrs[] = {
+  {"rule", format_rule, parse_rule},
+  {"res", format_res, parse_res},
+  {"min", format_min, parse_min},
+  {"max", format_max, parse_max},
+  {"early", format_early, parse_early},
+  {"after", format_after, parse_after},
+  {"id", format_id, parse_id},
+  {"st", format_st, parse_st},
+  {NULL, NULL, NULL}
+};
 
-    // 新しい空き時間が見つかった場合は、新規作成する。
-    if (unoccupied_start != 0 && unoccupied_end != 0) {
-      struct schedule *s;
-      create_schedule(pgid,
-		      0, // lock
-		      0, // terminator_pid
-		      unoccupied_start,
-		      (unoccupied_end-unoccupied_start),
-		      caption,
-		      &s);
 
-      //fprintf(stderr, "found! %ld, %ld\n", s->start, unoccupied_end);
-      if (index_found > max_len-1) {
-	fprintf(stderr, "found! but over max size. %zu\n", max_len);
-	return index_found;
-      }
-      unoccupied_scheds[index_found] = s;
-      index_found++;
-    }
+/**
+ * @brief 追加の属性の定義を、キーから探す。
+ * @param[in] key キー。
+ * @param[in] len keyの長さ。
+ * @return 見つかった場合は定義を、見つからなかった場合はNULLを返す。
+ */
+static const struct attr* find_attr(const char *key, size_t len)
+{
+  const struct attr *a;
+  for (a=g_attrs; a->key != NULL; a++) {
+    if (strlen(a->key) == len && strncmp(a->key, key, len) == 0)
+      return a;
+  }
 
-    // ヘッド位置を更新する。
-    if (sched_end > range_start)
-      head = sched_end;
-    else
-      head = range_start;
+  return NULL;
+}
 
-  } //for
-  
 
-  if (head < range_end) {
-    // schedsの終わりからレンジの終わりまでを調べる。
-    //              |<-head |
-    //  +-+-+-+-+-+-+       |
-    //    scheds[?] |  no more scheds...
-    //  +-+-+-+-+-+-+       |
-    //              |       |<-range_end 
+/**
+ * @brief スケジュールの追加の属性を、key=valueの形でつなげた文字列にする。
+ * @param[in]  sched 対象のスケジュール。
+ * @param[out] str   作成した文字列が反映される。属性がない場合は空文字列。
+ * @param[in]  size  strのサイズ。
+ * @return 成功した場合は0を、失敗した場合は-1を返す。
+ */
+static int format_attrs(const struct schedule* sched, char *str, size_t size)
+{
+  str[0] = '\0';
+
+  size_t len = 0;
+  const struct attr *a;
+  for (a=g_attrs; a->key != NULL; a++) {
+    char value[MAX_RECORD_STRING_LEN];
+    int n = a->format(sched, value, sizeof(value));
+    if (n == 0)
+      continue;
+    if (n < 0 || (size_t)n >= sizeof(value))
+      goto too_long;
 
-    struct schedule *s;
-    create_schedule(pgid, 0, 0, head, (range_end-head), caption, &s);
-    //fprintf(stderr, "found! %ld, %ld\n", s->start, unoccupied_end);
-    if (index_found > max_len-1) {
-      fprintf(stderr, "found! but over max size. %zu\n", max_len);
-      return index_found;
-    }
-    unoccupied_scheds[index_found] = s;
-    index_found++;
-  } 
+    len += snprintf(str + len, size - len, "%s%s=%s", (len > 0) ? ";" : "",
+		    a->key, value);
+    if (len >= size)
+      goto too_long;
+  }
 
-  return index_found;
+  return 0;
+
+ too_long:
+  report_error(ERROR_INVALID, "%s:%d: Error: Too long attributes.\n", __FILE__,
+	       __LINE__);
+  return -1;
 }
 
 
 /**
- * @brief 共有メモリのアドレスを取得する。
- * @param[in] path 共有メモリのパス。
- * @param[in] size 共有メモリのサイズ。
- * @param[out] addr 取得したアドレスが反映される。
+ * @brief key=valueの形でつなげた追加の属性を解析して、スケジュールに反映する。
+ *
+ * 未知の属性は無視する。
+ *
+ * @param[in]  str   属性の文字列。内容は変更される。
+ * @param[out] sched 属性が反映されるスケジュール。
  * @return 成功した場合は0を、失敗した場合は-1を返す。
  */
-static int get_shared_memory_address(const char* path, size_t size,char* *addr)
+static int parse_attrs(char *str, struct schedule* sched)
 {
-  errno = 0;
-  int fd = shm_open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-  if (fd == -1) {
-    fprintf(stderr, "%s:%d: Error: shm_open() %s\n", __FILE__, __LINE__,
-	    strerror(errno));
-    return -1;
-  }
-  
-  // c - ftruncate not working on POSIX shared memory in Mac OS X - Stack Overflow
-  // stackoverflow.com/questions/25502229/ftruncate-not-working-on-posix-shared-memory-in-mac-os-x
-  struct stat mapstat;
-  if (-1 != fstat(fd, &mapstat) && mapstat.st_size == 0) {
-    errno = 0;
-    if (ftruncate(fd, size) == -1) {
-      fprintf(stderr, "%s:%d: Error: ftruncate. %s\n", __FILE__, __LINE__,
-	      strerror(errno));
+  char *saveptr;
+  char *token = strtok_r(str, ";", &saveptr);
+  while (token != NULL) {
+    char *value = strchr(token, '=');
+    if (value == NULL) {
+      report_error(ERROR_FORMAT, "%s:%d: Error: Invalid attribute. \"%s\"\n",
+		   __FILE__, __LINE__, token);
       return -1;
     }
-  }
-  
-  errno = 0;
-  *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-  if (addr == MAP_FAILED) {
-    fprintf(stderr, "%s:%d: Error: mmap() %s.\n", __FILE__, __LINE__,
-	    strerror(errno));
-    return -1;
+
+    const struct attr *a = find_attr(token, value - token);
+    value++;
+    if (a != NULL && a->parse(value, sched) != 0) {
+      report_error(ERROR_FORMAT, "%s:%d: Error: Invalid attribute. \"%s\"\n",
+		   __FILE__, __LINE__, token);
+      return -1;
+    }
+
+    token = strtok_r(NULL, ";", &saveptr);
   }
 
-  if (close(fd) == -1) {
-    fprintf(stderr, "%s:%d: Error: close()\n", __FILE__, __LINE__);
+  // 伸縮の範囲は、min<=maxで、解放されていない場合は継続時間を含む。
+  if ((sched->max_duration == 0 && sched->min_duration != 0) ||
+      sched->min_duration > sched->max_duration ||
+      (sched->duration != 0 && sched->max_duration != 0 &&
+       (sched->duration < sched->min_duration ||
+	sched->duration > sched->max_duration))) {
+    report_error(ERROR_FORMAT, "%s:%d: Error: Invalid elastic range. "
+		 "min:%u max:%u dur:%u\n", __FILE__, __LINE__,
+		 sched->min_duration, sched->max_duration, sched->duration);
     return -1;
   }
 
@@ -345,88 +2256,88 @@ static int get_shared_memory_address(const char* path, size_t size,char* *addr)
 }
 
 
-/**
- * @brief 共有メモリからスケジュールを読み込み、スケジュール構造体を作成する。
- * @param[in]  shm_path 共有メモリのパス。
- * @param[in]  shm_size 共有メモリのサイズ。
- * @param[out] scheds 読み込んだスケジュール構造体を保存する配列。あらかじめ
- * メモリを確保しておく必要がある。
- * @param[in]  scheds_len schedsの配列数。
- * @param[out] loaded_len 読み込んだスケジュール数が反映される。
- * @return 成功時は0、失敗時は-1返す。
- */
-int load_schedules(const char* shm_path, size_t shm_size, 
-		   struct schedule** scheds, size_t scheds_len,
-		   size_t *loaded_len)
+int record_to_string(const struct schedule* sched, char *str, size_t size)
 {
-  assert(scheds_len != 0);
+  assert(sched != NULL && str != NULL);
 
-  char *addr;
-  if (get_shared_memory_address(shm_path, shm_size, &addr) != 0)
+  char attrs[MAX_RECORD_STRING_LEN];
+  if (format_attrs(sched, attrs, sizeof(attrs)) != 0)
     return -1;
 
-  // strtok()は元の文字列に変更を加えるので、共有メモリの内容をローカルにコピー
-  // する。
-  char buff[strlen(addr)+1];
-  strcpy(buff, addr);
-
-  if (munmap(addr, shm_size) != 0) {
-    fprintf(stderr, "%s:%d: Error: munmap()\n", __FILE__, __LINE__);
+  int n = snprintf(str, size, "%d:%d:%d:%ld:%u:%s:%s", sched->pgid, sched->lock,
+		   sched->terminator, sched->start, sched->duration, attrs,
+		   sched->caption);
+  if (n < 0 || (size_t)n >= size) {
+    report_error(ERROR_INVALID, "%s:%d: Error: Too long record.\n", __FILE__,
+		 __LINE__);
     return -1;
   }
 
-  char *token;
-  token = strtok(buff, "\n");
-  if (token == NULL) {
-    // buffは空
-    return 0;
-  }
+  return 0;
+}
 
-  //fprintf(stderr, "1st:%s\n", token);
 
-  int index = 0;
+unsigned long get_generation(const char* addr)
+{
+  assert(addr != NULL);
 
-  struct schedule* s;
-  if (string_to_schedule(token, &s) != 0) {
-    return -1;
-  }
+  size_t key_len = strlen(GENERATION_KEY);
+  if (addr[0] != HEADER_PREFIX ||
+      strncmp(addr+1, GENERATION_KEY, key_len) != 0 || addr[1+key_len] != ':')
+    return 0;
 
-  // プロセスグループが終了している場合は読み込まない。
-  if (killpg(s->pgid, 0) == 0) {
-    scheds[index] = s;
-    index++;
-  } else {
-    free(s);
-  }
-  
-  while (1) {
-    token = strtok(NULL, "\n");
+  return strtoul(addr + 1 + key_len + 1, NULL, 10);
+}
 
-    if (token == NULL)
-      break;
 
-    //fprintf(stderr, "2nd:%s\n", token);
+/**
+ * @brief 共有メモリの内容の世代番号を1つ進めた、世代番号の行を作成する。
+ * @param[in]  src  共有メモリの内容。
+ * @param[out] dst  世代番号の行が反映される。
+ * @param[in]  size dstのサイズ。
+ * @return 作成した行の長さを返す。
+ */
+static size_t next_generation_line(const char* src, char *dst, size_t size)
+{
+  // 0は世代番号がないことを表すので、使わない。
+  unsigned long gen = get_generation(src) + 1;
+  if (gen == 0)
+    gen = 1;
+
+  int n = snprintf(dst, size, "%c%s:%lu\n", HEADER_PREFIX, GENERATION_KEY,
+		   gen);
+  return (n < 0 || (size_t)n >= size) ? 0 : (size_t)n;
+}
 
-    struct schedule* s;
-    if (string_to_schedule(token, &s) != 0) {
-      return -1;
-    }
 
-    // プロセスグループが終了している場合は読み込まない。
-    if (killpg(s->pgid, 0) == 0) {
-      scheds[index] = s;
-      index++;
-    } else {
-      free(s);
+/**
+ * @brief 共有メモリの内容から、世代番号と次のID以外のヘッダの行だけを取り出す。
+ * @param[in]  src  共有メモリの内容。
+ * @param[out] dst  ヘッダの行が反映される。
+ * @param[in]  size dstのサイズ。
+ */
+static void copy_header_lines(const char* src, char *dst, size_t size)
+{
+  size_t len = 0;
+  dst[0] = '\0';
+
+  const char *line = src;
+  while (*line != '\0') {
+    const char *next = strchr(line, '\n');
+    size_t line_len = (next == NULL) ? strlen(line) : (size_t)(next - line);
+
+    if (line[0] == HEADER_PREFIX && !is_header_line(line, GENERATION_KEY) &&
+	!is_header_line(line, NEXT_ID_KEY) && len + line_len + 2 <= size) {
+      memcpy(dst + len, line, line_len);
+      len += line_len;
+      dst[len++] = '\n';
+      dst[len] = '\0';
     }
 
-    if (index+1 >= scheds_len)
+    if (next == NULL)
       break;
+    line = next + 1;
   }
-
-  *loaded_len = index;
-
-  return 0;
 }
 
 
@@ -444,37 +2355,119 @@ int save_schedules(const char* path, const size_t size,
   char *addr;
   if (get_shared_memory_address(path, size, &addr) != 0)
     return -1;
-  
-  // すべて0で埋めてきれいにする。
-  memset(addr, 0x0, size);
+
+  // IDを持たないスケジュールに、ヘッダの次のIDから割り当てる。
+  uint64_t next_id = 1;
+  const char *line = find_header_line(addr, NEXT_ID_KEY);
+  if (line != NULL)
+    next_id = strtoull(line + 1 + strlen(NEXT_ID_KEY) + 1, NULL, 10);
+
+  int i;
+  for (i=0; i<len; i++) {
+    if (scheds[i]->id != 0 || scheds[i]->duration == 0)
+      continue;
+    scheds[i]->id = next_id++;
+
+    // リーダーの開始時刻は、レコードを作成する時に1度だけ調べる。取得できない
+    // 場合は、記録しないままにする。
+    if (scheds[i]->leader_start == 0 && scheds[i]->pgid > 0)
+      get_process_start(scheds[i]->pgid, &scheds[i]->leader_start);
+  }
 
   // 共有メモリに書き込むための、各スケジュールをまとめた文字列を作成。
+  // 世代番号を進めて先頭に置き、次のIDは書き換え、他のヘッダは、そのまま
+  // 残す。末尾の位置を覚えておき、つなげるたびに先頭から終端を探さないように
+  // する。
   char sched[size];
-  sched[0] = '\0';
+  size_t gen_len = next_generation_line(addr, sched, size);
+  copy_header_lines(addr, sched + gen_len, size - gen_len);
+  size_t sched_len = strlen(sched);
+  if (next_id > 1) {
+    sched_len += snprintf(sched + sched_len, size - sched_len,
+			  "%c%s:%" PRIu64 "\n", HEADER_PREFIX, NEXT_ID_KEY,
+			  next_id);
+  }
 
-  int i;
   for (i=0; i<len; i++) {
-    char buff[MAX_RECORD_STRING_LEN+1+1]; // +1は改行分、+1は終端文字列。
-    if (sprintf(buff,
-		"%d:%d:%d:%ld:%d:%s\n",
-		scheds[i]->pgid,
-		scheds[i]->lock,
-		scheds[i]->terminator,
-		scheds[i]->start,
-		scheds[i]->duration,
-		scheds[i]->caption) < 0) {
-      fprintf(stderr, "%s:%d: Error: sprintf()\n", __FILE__, __LINE__);
+    // 書き込みに失敗した場合は、共有メモリの内容を変更しない。
+    char buff[MAX_RECORD_STRING_LEN+1];
+    if (record_to_string(scheds[i], buff, sizeof(buff)) != 0) {
+      munmap(addr, size);
+      return -1;
+    }
+
+    size_t n = strlen(buff);
+    if (sched_len + n + 2 > size) {  // +1は改行分、+1は終端文字列。
+      report_error(ERROR_FULL, "%s:%d: Error: Database is full.\n", __FILE__,
+		   __LINE__);
+      munmap(addr, size);
       return -1;
     }
-    strcat(sched, buff);
+    memcpy(sched + sched_len, buff, n);
+    sched_len += n;
+    sched[sched_len++] = '\n';
+    sched[sched_len] = '\0';
   }
   //fprintf(stderr, "sched:%s\n", sched);
 
-  // 共有メモリへ書き込み。
-  strcpy(addr, sched);
+  // 共有メモリへ書き込み。残りはすべて0で埋めてきれいにする。
+  memcpy(addr, sched, sched_len);
+  memset(addr + sched_len, 0x0, size - sched_len);
+
+  if (munmap(addr, size) != 0) {
+    report_error(ERROR_SYSTEM, "%s:%d: Error: munmap()\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int set_header_value(const char* shm_path, const char* key, long value)
+{
+  assert(shm_path != NULL && key != NULL);
+
+  size_t size = SHARED_MEMORY_SIZE;
+  char *addr;
+  if (get_shared_memory_address(shm_path, size, &addr) != 0)
+    return -1;
+
+  // 世代番号を進めて先頭に置き、新しいヘッダを続ける。同じキーの古い
+  // ヘッダと古い世代番号を除いて、残りを続ける。
+  char buff[size];
+  size_t len = next_generation_line(addr, buff, size);
+  int n = snprintf(buff + len, size - len, "%c%s:%ld\n", HEADER_PREFIX, key,
+		   value);
+  len += n;
+
+  const char *line = addr;
+  while (*line != '\0') {
+    const char *next = strchr(line, '\n');
+    size_t line_len = (next == NULL) ? strlen(line) : (size_t)(next - line);
+
+    if (!is_header_line(line, key) && !is_header_line(line, GENERATION_KEY)) {
+      if (len + line_len + 2 > size) {
+	report_error(ERROR_FULL, "%s:%d: Error: Database is full.\n", __FILE__,
+		     __LINE__);
+	munmap(addr, size);
+	return -1;
+      }
+      memcpy(buff + len, line, line_len);
+      len += line_len;
+      buff[len++] = '\n';
+    }
+
+    if (next == NULL)
+      break;
+    line = next + 1;
+  }
+  buff[len] = '\0';
+
+  memset(addr, 0x0, size);
+  strcpy(addr, buff);
 
   if (munmap(addr, size) != 0) {
-    fprintf(stderr, "%s:%d: Error: munmap()\n", __FILE__, __LINE__);
+    report_error(ERROR_SYSTEM, "%s:%d: Error: munmap()\n", __FILE__, __LINE__);
     return -1;
   }
 
@@ -507,22 +2500,23 @@ int string_to_schedule(const char* str, struct schedule* *sched)
 
   // 区切り文字をチェック
   if (sep1 != ':' || sep2 != ':' || sep3 != ':' || sep4 != ':' || sep5 != ':'){
-    fprintf(stderr, "Error: Unknown schedule format. \"%s\"\n", str);
+    report_error(ERROR_INVALID, "Error: Unknown schedule format. \"%s\"\n",
+		 str);
     return -1;
   }
 
   // lock値は0または1
   if (lock != 0 && lock != 1) {
-    fprintf(stderr, "%s:%d: Error: Invalid lock value. lock:%d\n", __FILE__,
-	    __LINE__, lock);
+    report_error(ERROR_INVALID, "%s:%d: Error: Invalid lock value. lock:%d\n",
+		 __FILE__, __LINE__, lock);
     return -1;
   }
 
   // 開始時刻、継続時間がマイナスはあり得ない。
   if (start < 0 || dur < 0) {
-    fprintf(stderr,
-	    "%s:%d: Error: Invalid start or dur value. start:%ld dur:%d\n",
-	    __FILE__, __LINE__, start, dur);
+    report_error(ERROR_INVALID,
+		 "%s:%d: Error: Invalid start or dur value. start:%ld dur:%d\n",
+		 __FILE__, __LINE__, start, dur);
     return -1;
   }
 
@@ -532,3 +2526,127 @@ int string_to_schedule(const char* str, struct schedule* *sched)
 
   return 0;
 }
+
+
+/**
+ * @brief 文字列が、parse_attrs()で解析できる属性の並びかを調べる。
+ *
+ * 各属性のキーは、g_attrsに登録されたものに限る。
+ *
+ * @param[in] str 調べる文字列。
+ * @param[in] len strの長さ。
+ * @return 属性の並びの場合は1、それ以外の場合は0を返す。
+ */
+static int is_attrs_string(const char *str, size_t len)
+{
+  const char *p = str, *end = str + len;
+  while (p < end) {
+    const char *next = memchr(p, ';', end - p);
+    if (next == NULL)
+      next = end;
+
+    const char *eq = memchr(p, '=', next - p);
+    if (eq == NULL || find_attr(p, eq - p) == NULL)
+      return 0;
+
+    p = next + 1;
+  }
+
+  return 1;
+}
+
+
+int string_to_record(const char* str, struct schedule* *sched)
+{
+  assert(str != NULL);
+
+  // 始めの5項目は、string_to_schedule()と同じ書式。
+  int dur;
+  int lock;
+  pid_t pgid, terminator;
+  time_t start;
+  int n = 0;
+  if (sscanf(str, "%d:%d:%d:%ld:%d:%n",
+	     &pgid, &lock, &terminator, &start, &dur, &n) != 5 || n == 0) {
+    report_error(ERROR_FORMAT, "Error: Unknown record format. \"%s\"\n", str);
+    return -1;
+  }
+
+  // 属性は次のコロンまで、その後ろはすべてcaption。属性として解釈できない
+  // 場合は、以前の書式として残りをすべてcaptionとする。
+  const char *attrs = str + n;
+  const char *caption = strchr(attrs, ':');
+  size_t attrs_len;
+  if (caption != NULL && is_attrs_string(attrs, caption - attrs)) {
+    attrs_len = caption - attrs;
+    caption++;
+  } else {
+    attrs_len = 0;
+    caption = attrs;
+  }
+
+  if (lock != 0 && lock != 1) {
+    report_error(ERROR_FORMAT, "%s:%d: Error: Invalid lock value. lock:%d\n",
+		 __FILE__, __LINE__, lock);
+    return -1;
+  }
+
+  if (start < 0 || dur < 0) {
+    report_error(ERROR_FORMAT,
+		 "%s:%d: Error: Invalid start or dur value. start:%ld dur:%d\n",
+		 __FILE__, __LINE__, start, dur);
+    return -1;
+  }
+
+  if (strlen(caption) >= MAX_CAPTION_LEN) {
+    report_error(ERROR_FORMAT, "%s:%d: Error: Too long caption.\n", __FILE__,
+		 __LINE__);
+    return -1;
+  }
+
+  char buff[attrs_len + 1];
+  memcpy(buff, attrs, attrs_len);
+  buff[attrs_len] = '\0';
+
+  if (create_schedule(pgid, lock, terminator, start, dur, caption, sched) != 0)
+    return -1;
+
+  if (parse_attrs(buff, *sched) != 0) {
+    free(*sched);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void set_error_output(FILE *fp)
+{
+  g_error_output = fp;
+}
+
+
+void report_error(enum error_code code, const char *format, ...)
+{
+  g_last_error = code;
+
+  if (g_error_output == NULL)
+    return;
+
+  va_list ap;
+  va_start(ap, format);
+  vfprintf(g_error_output, format, ap);
+  va_end(ap);
+}
+
+
+enum error_code get_last_error()
+{
+  return g_last_error;
+}
+
+
+void clear_last_error()
+{
+  g_last_error = ERROR_NONE;
+}
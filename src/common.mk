@@ -5,7 +5,9 @@ ifneq ($(shell uname),Darwin)
   LIBS += -lrt
 endif
 
-OBJECTS += $(OBJ_DIR)/common.o
+LIB_OBJECTS += $(OBJ_DIR)/common.o
 
 $(OBJ_DIR)/common.o: $(SOURCE_DIR)/common.c \
-                     $(INCLUDE_DIR)/common.h
\ No newline at end of file
+                     $(INCLUDE_DIR)/common.h \
+                     $(INCLUDE_DIR)/crontab_mask.h \
+                     $(INCLUDE_DIR)/notify.h
\ No newline at end of file
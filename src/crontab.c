@@ -27,6 +27,8 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,75 +36,242 @@
 #include <unistd.h>
 
 #include "../include/common.h"
-
-#define MAIN_PROGRAM // For cron.h
-#include "../include/crontab_cron.h"
+#include "../include/crontab_mask.h"
+#include "../include/lock.h"
+#include "../include/unlock.h"
 
 /** 空き時間が見つからない場合の戻り値 */
 #define EXIT_NOT_FOUND 3
 
 static int verbose = 0;
 
+/** 一括処理モードで使用するスレッド数の上限 */
+#define MAX_NUM_THREADS 64
+
+/**
+ * @struct batch_job
+ * @brief 一括処理モードで読み込んだ1行分の内容。
+ */
+struct batch_job {
+  struct cron_mask mask;  /**< 時刻指定 */
+  unsigned int duration;  /**< 継続時間(sec) */
+  char caption[MAX_CAPTION_LEN]; /**< スケジュールの簡単な説明 */
+};
+
+/**
+ * @struct occurrence
+ * @brief 一括処理モードで見つかった開始時刻。
+ */
+struct occurrence {
+  time_t start;  /**< 開始時刻 */
+  size_t index;  /**< batch_job配列の添字(入力順) */
+};
+
+/**
+ * @struct batch_worker
+ * @brief 一括処理モードのスレッドごとの作業領域。
+ */
+struct batch_worker {
+  const struct batch_job *jobs; /**< 担当するjobの先頭 */
+  size_t first;  /**< 担当するjobの先頭の添字 */
+  size_t len;    /**< 担当するjobの数 */
+  time_t begin;  /**< 検索範囲の開始時刻 */
+  time_t end;    /**< 検索範囲の終了時刻 */
+  struct occurrence *found; /**< 見つかった開始時刻(動的に確保) */
+  size_t found_len;  /**< foundの要素数 */
+  size_t found_cap;  /**< foundの確保済み要素数 */
+  int error;     /**< メモリ確保に失敗した場合は1 */
+};
+
 static void print_usage();
 
+
 /**
- * @brief entry構造体を解析して、直近の時刻を取得する。
+ * @brief 時刻指定に一致する開始時刻のうち、スケジュール群と重ならない直近の
+ * 時刻を取得する。
+ *
+ * 開始時刻と重なるスケジュールが見つかった場合は、そのスケジュールの終了時刻
+ * から次の開始時刻を検索する。終了時刻が現在時刻より過去になる開始時刻は
+ * 対象外とする。\n
+ * capacityが2以上の場合は、同時に重なるスケジュール数がcapacity未満の開始時刻
+ * を検索する。
+ *
  * @param[out] result 取得した時刻が反映される。
- * @param[in]  e      解析するentry構造体へのポインタ。
+ * @param[in]  m      時刻指定。
+ * @param[in]  sched  配置するスケジュール。pgid、duration値を使用する。
+ * @param[in]  scheds 確認される側のスケジュール群
+ * @param[in]  len    schedsの配列数
  * @param[in]  start  検索を開始する時刻(time_t)
  * @param[in]  range  検索する範囲(sec)
- * @return 成功時は0、失敗時には-1を返す。
+ * @param[in]  capacity データベースのcapacity
+ * @return 成功時は0、見つからない場合は-1を返す。
  */
-static int attack(time_t *result,  struct _entry *e, time_t start,
-		  unsigned int range)
+static int attack_unoccupied(time_t *result, const struct cron_mask *m,
+			     const struct schedule *sched,
+			     struct schedule* *scheds, size_t len,
+			     time_t start, unsigned int range,
+			     unsigned int capacity)
 {
-  assert(e != NULL);
-  
-  // 1分ごとにこつこつ調べる。
-  time_t head;
-  for (head=start; head<=(start+range); head+=60) {
-
-    // tm構造体に変換して、要素ごとに取り出しやすくする。
-    // 秒単位は0に丸める。
-    struct tm *c = localtime(&head);
-    c->tm_sec = 0;
-    //fprintf(stderr, "current:%s", asctime(c));
-    
-    // month
-    if (!bit_test(e->month, c->tm_mon)) { 
-      //fprintf(stderr, "month\n");
+  assert(m != NULL && sched != NULL && scheds != NULL);
+
+  time_t end = start + range;
+  time_t now = time(NULL);
+  time_t head = start;
+
+  while (head <= end) {
+    time_t t;
+    if (crontab_next(&t, m, head, end - head) != 0)
+      return -1;
+
+    // 過去の時刻は飛ばす。
+    if (t + (time_t)sched->duration < now) {
+      head = t + 60;
       continue;
     }
-    
-    // DOM and DOW //tm_mdayが(1-31)のため-1する。
-    if (!( ((e->flags & DOM_STAR) || (e->flags & DOW_STAR))
-	   ? (bit_test(e->dow, c->tm_wday) && bit_test(e->dom, c->tm_mday-1))
-	   : (bit_test(e->dow, c->tm_wday) || bit_test(e->dom, c->tm_mday-1))
-	   )) {
-      //fprintf(stderr, "DOM\n");
+
+    // 同時に重なる数がcapacityに達していなければ、その時刻に配置できる。
+    if (capacity > 1) {
+      if (count_max_overlap(scheds, len, sched->pgid, t,
+			    t + sched->duration) < capacity) {
+	*result = t;
+	return 0;
+      }
+      head = t + 60;
       continue;
     }
-    
-    // hour
-    if (!bit_test(e->hour, c->tm_hour)) {
-      //fprintf(stderr, "HOUR:%d\n", hour);
-      continue;
+
+    // 重なるスケジュールのうち、最も遅い終了時刻を求める。
+    time_t busy_until = 0;
+    size_t i;
+    for (i=0; i<len; i++) {
+      if (scheds[i]->pgid == sched->pgid)
+	continue;
+
+      time_t s_end = scheds[i]->start + scheds[i]->duration;
+      if (scheds[i]->start < t + (time_t)sched->duration && s_end > t &&
+	  s_end > busy_until)
+	busy_until = s_end;
     }
-    
-    // minute
-    if (!bit_test(e->minute, c->tm_min)) {
-      //fprintf(stderr, "MINUTE:%d\n", minute);
-      continue;
+
+    if (busy_until == 0) {
+      *result = t;
+      return 0;
     }
- 
-    *result = mktime(c);
-    return 0;
+
+    if (verbose > 0) {
+      fprintf(stderr, "%s:%d: debug: occupied start:%ld until:%ld\n",
+	      __FILE__, __LINE__, t, busy_until);
+    }
+
+    // 次の開始時刻は、重なったスケジュールの終了時刻(分単位に切り上げ)以降。
+    head = ((busy_until + 59) / 60) * 60;
   }
-  
+
   return -1;
 }
 
 
+/**
+ * @brief 見つかった開始時刻を作業領域に追加する。
+ * @param[in,out] w     作業領域。
+ * @param[in]     start 開始時刻。
+ * @param[in]     index batch_job配列の添字。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int append_occurrence(struct batch_worker *w, time_t start,
+			     size_t index)
+{
+  if (w->found_len == w->found_cap) {
+    size_t cap = (w->found_cap == 0) ? 256 : w->found_cap * 2;
+    struct occurrence *p = realloc(w->found, cap * sizeof(struct occurrence));
+    if (p == NULL) {
+      fprintf(stderr, "%s:%d: Error: out of memory.\n", __FILE__, __LINE__);
+      return -1;
+    }
+    w->found = p;
+    w->found_cap = cap;
+  }
+
+  w->found[w->found_len].start = start;
+  w->found[w->found_len].index = index;
+  w->found_len++;
+
+  return 0;
+}
+
+
+/**
+ * @brief 担当するjobをまとめて評価する。(pthread_create()用)
+ *
+ * 検索範囲を1日ずつ進み、その日付を全てのjobで共有して判定する。
+ * 
+ * @param[in,out] arg batch_worker構造体へのポインタ。
+ * @return NULL
+ */
+static void* evaluate_jobs(void *arg)
+{
+  struct batch_worker *w = (struct batch_worker*)arg;
+
+  struct tm day;
+  localtime_r(&(w->begin), &day);
+
+  while (1) {
+    int regular;
+    time_t midnight = normalize_day(&day, &regular);
+    if (midnight > w->end)
+      break;
+
+    size_t i;
+    for (i=0; i<w->len; i++) {
+      const struct cron_mask *m = &(w->jobs[i].mask);
+      if (!match_day(m, &day))
+	continue;
+
+      uint32_t hours = m->hour;
+      while (hours) {
+	int h = __builtin_ctz(hours);
+	hours &= hours - 1;
+
+	uint64_t minutes = m->minute;
+	while (minutes) {
+	  int min = __builtin_ctzll(minutes);
+	  minutes &= minutes - 1;
+
+	  time_t t = day_time(&day, midnight, regular, h, min);
+	  if (t < w->begin || t > w->end)
+	    continue;
+
+	  if (append_occurrence(w, t, w->first + i) != 0) {
+	    w->error = 1;
+	    return NULL;
+	  }
+	}
+      }
+    }
+
+    day.tm_mday++;
+  }
+
+  return NULL;
+}
+
+
+/**
+ * @brief qsort()用の関数。開始時刻、入力順の順に昇順ソートする。
+ */
+static int compare_occurrence(const void *a, const void *b)
+{
+  const struct occurrence *x = (const struct occurrence*)a;
+  const struct occurrence *y = (const struct occurrence*)b;
+
+  if (x->start != y->start)
+    return (x->start < y->start) ? -1 : 1;
+  if (x->index != y->index)
+    return (x->index < y->index) ? -1 : 1;
+  return 0;
+}
+
+
 /**
  * @brief stdinの内容をstdoutに受け流す。
  * @param[in] in stdinから読み込んだスケジュール。
@@ -156,6 +325,13 @@ static void output_schedule(struct schedule *in, time_t start)
  * @param[in]  argc           argc値
  * @param[in]  argv           argv値
  * @param[out] arg            位置引数の値が反映される。
+ * @param[out] shm_name       '-d'オプション(データベース番号)が反映される。
+ * @param[out] db             '-d'オプション(データベース番号)の値が反映される。
+ * @param[out] opt_b          '-b'オプション(一括処理モード)の値が反映される。
+ * @param[out] opt_e          '-e'オプション(全行処理モード)の値が反映される。
+ * @param[out] opt_f          '-f'オプション(空き時間検索)の値が反映される。
+ * @param[out] opt_k          '-k'オプション(空き時間確保)の値が反映される。
+ * @param[out] nthreads       '-j'オプション(スレッド数)の値が反映される。
  * @param[out] range_backward '-r'オプションの値が反映される。
  * @param[out] range_forward  '-R'オプションの値が反映される。
  * @param[out] verbose        '-v'オプション(verboseモード)の値が反映される。
@@ -163,6 +339,8 @@ static void output_schedule(struct schedule *in, time_t start)
  * 合は2を返す。
  */
 static int parse_arguments(int argc, char* *argv, char **arg,
+			   char *shm_name, char **db, int *opt_b, int *opt_e,
+			   int *opt_f, int *opt_k, unsigned int *nthreads,
 			   unsigned int *range_backward,
 			   unsigned int *range_forward, int *verbose)
 {  
@@ -172,8 +350,44 @@ static int parse_arguments(int argc, char* *argv, char **arg,
   //optind = 1;
   optind = 2;
   int opt;
-  while ((opt = getopt(argc, argv, "hR:r:v")) != -1) {
+  while ((opt = getopt(argc, argv, "bd:efhj:kR:r:v")) != -1) {
     switch (opt) {
+    case 'b':
+      // 一括処理モード
+      *opt_b = 1;
+      break;
+    case 'd':
+      // データベース番号
+      if (atoi(optarg) < 1 || atoi(optarg) > MAX_NUM_DB) {
+	fprintf(stderr, "Error: Invalid database number. (Valid 1-%d)\n",
+		MAX_NUM_DB);
+	return 2;
+      }
+      strcat(shm_name, optarg);
+      *db = optarg;
+      break;
+    case 'e':
+      // 全行処理モード
+      *opt_e = 1;
+      break;
+    case 'f':
+      // 空き時間検索
+      *opt_f = 1;
+      break;
+    case 'k':
+      // 空き時間を検索して確保する。
+      *opt_f = 1;
+      *opt_k = 1;
+      break;
+    case 'j':
+      // 一括処理モードで使用するスレッド数
+      if (atoi(optarg) < 1 || atoi(optarg) > MAX_NUM_THREADS) {
+	fprintf(stderr, "Error: Invalid number of threads. (Valid 1-%d)\n",
+		MAX_NUM_THREADS);
+	return 2;
+      }
+      *nthreads = atoi(optarg);
+      break;
     case 'r':
       // 実行時刻を基準とした時刻を検索する過去の範囲(sec)
       *range_backward = atoi(optarg);
@@ -199,6 +413,21 @@ static int parse_arguments(int argc, char* *argv, char **arg,
     }    
   }
 
+  // 一括処理モードでは、時刻指定をstdinから読み込む。
+  if (*opt_b) {
+    if (*opt_e || *opt_f) {
+      fprintf(stderr, "Error: -e, -f and -k can not be used with -b.\n");
+      return 2;
+    }
+    return 0;
+  }
+
+  // 確保できるスケジュールは、1プロセスグループにつき1つ。
+  if (*opt_e && *opt_k) {
+    fprintf(stderr, "Error: -k can not be used with -e.\n");
+    return 2;
+  }
+
   // 引数が足りない。
   if (optind == argc) {
     print_usage();
@@ -215,125 +444,334 @@ static int parse_arguments(int argc, char* *argv, char **arg,
 }
 
 
+
+/**
+ * @brief crontabフォーマットの文字列を解析して、直近の時刻を取得する。
+ * @param[out] result         取得した時刻が反映される。
+ * @param[in]  str            解析するcrontabフォーマットの文字列。
+ * @param[in]  range_backward 検索する過去の範囲(sec)
+ * @param[in]  range_forward  検索する未来の範囲(sec)
+ * @return 成功時には0を、失敗時には-1、strの書式が不正な場合は1、時刻が見つからない場合は2を返す。
+ */
+static int process(time_t *result, const char* str,
+		   unsigned int range_backward, unsigned int range_forward)
+{
+  assert(str != NULL);
+
+  struct cron_mask m;
+  int ret = crontab_compile_mask(&m, str, NULL);
+  if (ret != 0)
+    return ret;
+
+  // 時刻を取得
+  time_t start = time(NULL) - range_backward;
+  time_t range = range_backward + range_forward;
+  if (crontab_next(result, &m, start, range) != 0) {
+    fprintf(stderr, "%s:%d: Error: Not found.\n", __FILE__, __LINE__);
+    return 2;
+  }
+
+  return 0;
+}
+
+
 /**
- * @brief ファイルに書き込まれたcrontabフォーマットの文字列を解析してentry構造体を作成する。
+ * @brief crontabフォーマットの文字列を解析して、データベースのスケジュールと
+ * 重ならない直近の時刻を取得する。
  *
- * 作成された構造体は、不要になったときメモリの解放をする必要がある。
+ * reserveが1の場合は、データベースをロックし、見つかった時刻のスケジュールを
+ * 自プロセスグループのスケジュールとしてデータベースに追加してから
+ * ロックを解放する。
  *
- * @param[in] fp 解析するcrontabフォーマットの文字列が書き込まれたファイルへのポインタ。
- * @return 成功時にはentry構造体のポインタを、失敗時にはNULLを返す。
+ * @param[out] result         取得した時刻が反映される。
+ * @param[in]  str            解析するcrontabフォーマットの文字列。
+ * @param[in]  sched          stdinから読み込んだスケジュール。
+ * @param[in]  db             データベース番号。NULLの場合は環境変数の値。
+ * @param[in]  shm_name       データベース名。
+ * @param[in]  reserve        1の場合は、見つかった時刻を確保する。
+ * @param[in]  range_backward 検索する過去の範囲(sec)
+ * @param[in]  range_forward  検索する未来の範囲(sec)
+ * @return 成功時には0を、失敗時には-1、strの書式が不正な場合は1、時刻が見つからない場合は2を返す。
  */
-static entry* parse_string(FILE *fp)
+static int process_unoccupied(time_t *result, const char* str,
+			      const struct schedule *sched, const char *db,
+			      const char *shm_name, int reserve,
+			      unsigned int range_backward,
+			      unsigned int range_forward)
 {
-  entry *e = (entry *) calloc(sizeof(entry), sizeof(char));
-  if (e == NULL) {
-    fprintf(stderr, "%s:%d: Error: out of memory.\n", __FILE__, __LINE__);
-    return NULL;
-  }
+  assert(str != NULL && sched != NULL && shm_name != NULL);
 
-  int ch = get_char(fp);
-  if (ch == EOF) {
-    fprintf(stderr, "%s:%d: Error: nothing to read.\n", __FILE__, __LINE__);
-    goto eof;
-  }
+  struct cron_mask m;
+  int ret = crontab_compile_mask(&m, str, NULL);
+  if (ret != 0)
+    return ret;
 
-  // minute
-  ch = get_list(e->minute, FIRST_MINUTE, LAST_MINUTE, PPC_NULL, ch, fp);
-  if (ch == EOF) {
-    fprintf(stderr, "%s:%d: Error: bad minute.\n", __FILE__, __LINE__);
-    goto eof;
-  }
+  // 確保する場合は、検索から書き込みまでをロックする。
+  if (reserve && lock_database(db) != 0)
+    return -1;
 
-  // hour
-  ch = get_list(e->hour, FIRST_HOUR, LAST_HOUR, PPC_NULL, ch, fp);
-  if (ch == EOF) {
-    fprintf(stderr, "%s:%d: Error: bad hour.\n", __FILE__, __LINE__);
-    goto eof;
+  unsigned int capacity;
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  if (get_capacity(shm_name, &capacity) != 0 ||
+      load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		     &scheds_len) != 0) {
+    if (reserve)
+      unlock_database(db);
+    return -1;
   }
 
-  // DOM (days of month)
-  if (ch == '*')
-    e->flags |= DOM_STAR;
-  ch = get_list(e->dom, FIRST_DOM, LAST_DOM, PPC_NULL, ch, fp);
-  if (ch == EOF) {
-    fprintf(stderr, "%s:%d: Error: bad day-of-month.\n", __FILE__, __LINE__);
-    goto eof;
-  }
+  struct schedule self = *sched;
+  self.pgid = getpgid(0);
 
-  // month 
-  ch = get_list(e->month, FIRST_MONTH, LAST_MONTH, MonthNames, ch, fp);
-  if (ch == EOF) {
-    fprintf(stderr, "%s:%d: Error: bad month.\n", __FILE__, __LINE__);
-    goto eof;
+  time_t start = time(NULL) - range_backward;
+  time_t range = range_backward + range_forward;
+
+  // 繰り返しスケジュールは、検索範囲内で展開する。
+  struct expansion ex;
+  if (expand_schedules(scheds, scheds_len, start,
+		       start + range + self.duration, &ex) != 0) {
+    cleanup_schedules(scheds, scheds_len);
+    if (reserve)
+      unlock_database(db);
+    return -1;
   }
 
-  // DOW (days of week)
-  if (ch == '*')
-    e->flags |= DOW_STAR;
-  ch = get_list(e->dow, FIRST_DOW, LAST_DOW, DowNames, ch, fp);
-  if (ch == EOF) {
-    fprintf(stderr, "%s:%d: Error: bad day-of-week.\n", __FILE__, __LINE__);
-    goto eof;
+  ret = attack_unoccupied(result, &m, &self, ex.scheds, ex.len, start, range,
+			  capacity);
+  cleanup_expansion(&ex);
+  if (ret != 0) {
+    fprintf(stderr, "%s:%d: Error: Not found.\n", __FILE__, __LINE__);
+    cleanup_schedules(scheds, scheds_len);
+    if (reserve)
+      unlock_database(db);
+    return 2;
   }
 
-  // make sundays equivilent
-  if (bit_test(e->dow, 0) || bit_test(e->dow, 7)) {
-    bit_set(e->dow, 0);
-    bit_set(e->dow, 7);
+  if (reserve) {
+    struct schedule *new;
+    if (create_schedule(self.pgid, 0, 0, *result, self.duration,
+			self.caption, &new) != 0) {
+      cleanup_schedules(scheds, scheds_len);
+      unlock_database(db);
+      return -1;
+    }
+
+    if (update_sched_by_pgid(new, scheds, &scheds_len,
+			     MAX_NUM_SCHEDULES) != 0) {
+      free(new);
+      cleanup_schedules(scheds, scheds_len);
+      unlock_database(db);
+      return -1;
+    }
+
+    // データベースを更新する。
+    if (save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds,
+		       scheds_len) != 0) {
+      cleanup_schedules(scheds, scheds_len);
+      unlock_database(db);
+      return -1;
+    }
   }
 
-  return e;
+  cleanup_schedules(scheds, scheds_len);
 
- eof:
-  free_entry(e);
-  return NULL;
+  if (reserve && unlock_database(db) != 0)
+    return -1;
+
+  return 0;
 }
 
 
 /**
- * @brief crontabフォーマットの文字列を解析して、直近の時刻を取得する。
- * @param[out] result         取得した時刻が反映される。
- * @param[in]  str            解析するcrontabフォーマットの文字列。
- * @param[in]  range_backward 検索する過去の範囲(sec)
- * @param[in]  range_forward  検索する未来の範囲(sec)
- * @return 成功時には0を、失敗時には-1、strの書式が不正な場合は1、時刻が見つからない場合は2を返す。
+ * @brief stdinから一括処理モードの入力を読み込む。
+ *
+ * 1行の書式は、crontab形式の時刻指定とスケジュール(duration:caption)を
+ * タブで区切ったもの。空行は読み飛ばす。
+ *
+ * @param[out] jobs 読み込んだ内容が反映される。動的に確保しているので、
+ * 不要時にはメモリの解放をする必要がある。
+ * @param[out] len  jobsの配列数が反映される。
+ * @return 成功時は0、失敗時には-1、書式が不正な場合は1を返す。
  */
-static int process(time_t *result, const char* str,
-		   unsigned int range_backward, unsigned int range_forward)
+static int read_batch_jobs(struct batch_job* *jobs, size_t *len)
 {
-  assert(str != NULL);
-
-  // tmpfileに読み込んだ内容を書き込む。
   FILE *tmpfp = tmpfile();
   if (tmpfp == NULL) {
     fprintf(stderr, "%s:%d: Error: tmpfile().\n", __FILE__, __LINE__);
     return -1;
   }
-  fputs(str, tmpfp);
-  fputs("\n", tmpfp);
-  fflush(tmpfp);
-  rewind(tmpfp);
 
-  // 文字列からデータを起こす。
-  entry *e = parse_string(tmpfp);
-  if (e == NULL) {
+  *jobs = NULL;
+  *len = 0;
+  size_t cap = 0;
+  int line = 0;
+  char buf[MAX_SCHEDULE_STRING_LEN+1];
+  while (fgets(buf, MAX_SCHEDULE_STRING_LEN+1, stdin) != NULL) {
+    line++;
+    buf[strcspn(buf, "\n")] = '\0';
+    if (buf[0] == '\0')
+      continue;
+
+    // 時刻指定とスケジュールを分ける。
+    char *sched = strchr(buf, '\t');
+    if (sched == NULL) {
+      fprintf(stderr, "%s:%d: Error: Missing tab. line:%d\n", __FILE__,
+	      __LINE__, line);
+      goto bad;
+    }
+    *sched = '\0';
+    sched++;
+
+    if (*len == cap) {
+      cap = (cap == 0) ? 64 : cap * 2;
+      struct batch_job *p = realloc(*jobs, cap * sizeof(struct batch_job));
+      if (p == NULL) {
+	fprintf(stderr, "%s:%d: Error: out of memory.\n", __FILE__, __LINE__);
+	free(*jobs);
+	fclose(tmpfp);
+	return -1;
+      }
+      *jobs = p;
+    }
+    struct batch_job *job = &((*jobs)[*len]);
+
+    // duration:caption
+    char sep0 = '\0';
+    job->caption[0] = '\0';
+    sscanf(sched, "%u%c%255[^\n]", &(job->duration), &sep0, job->caption);
+    if (sep0 != ':') {
+      fprintf(stderr, "%s:%d: Error: Unknown schedule format. line:%d\n",
+	      __FILE__, __LINE__, line);
+      goto bad;
+    }
+
+    switch (crontab_compile_mask(&(job->mask), buf, tmpfp)) {
+    case -1:
+      free(*jobs);
+      fclose(tmpfp);
+      return -1;
+    case 1:
+      fprintf(stderr, "%s:%d: Error: Bad crontab format. line:%d\n",
+	      __FILE__, __LINE__, line);
+      goto bad;
+    }
+
+    (*len)++;
+  }
+
+  if (ferror(stdin)) {
+    fprintf(stderr, "%s:%d: Error: while reading stdin.\n", __FILE__,
+	    __LINE__);
+    free(*jobs);
     fclose(tmpfp);
-    return 1;
+    return -1;
   }
+
   fclose(tmpfp);
+  return 0;
 
-  // 時刻を取得
-  time_t start = time(NULL) - range_backward;
-  time_t range = range_backward + range_forward;
-  if (attack(result, e, start, range) != 0) {
-    fprintf(stderr, "%s:%d: Error: Not found.\n", __FILE__, __LINE__);
-    free_entry(e);
-    return 2;
+ bad:
+  free(*jobs);
+  fclose(tmpfp);
+  return 1;
+}
+
+
+/**
+ * @brief jobを範囲内で評価し、見つかった開始時刻を時刻順にstdoutに出力する。
+ * @param[in] jobs     評価するjob。
+ * @param[in] len      jobsの配列数。
+ * @param[in] begin    検索範囲の開始時刻。秒単位は切り捨てられる。
+ * @param[in] end      検索範囲の終了時刻。
+ * @param[in] nthreads 使用するスレッド数。
+ * @return 成功時は0、失敗時には-1、開始時刻が1つも見つからない場合は1を返す。
+ */
+static int run_batch(const struct batch_job *jobs, size_t len, time_t begin,
+		     time_t end, unsigned int nthreads)
+{
+  // crontab_next()と同じく、開始時刻の分も範囲に含める。
+  begin -= begin % 60;
+
+  if (nthreads > len)
+    nthreads = (len == 0) ? 1 : len;
+
+  struct batch_worker workers[MAX_NUM_THREADS];
+  pthread_t threads[MAX_NUM_THREADS];
+  memset(workers, 0, sizeof(workers));
+
+  // jobをスレッドごとに分割する。
+  size_t first = 0;
+  unsigned int i;
+  for (i=0; i<nthreads; i++) {
+    size_t n = len / nthreads + ((i < len % nthreads) ? 1 : 0);
+    workers[i].jobs = jobs + first;
+    workers[i].first = first;
+    workers[i].len = n;
+    workers[i].begin = begin;
+    workers[i].end = end;
+    first += n;
   }
 
-  free_entry(e);
+  // 1つ目はこのスレッドで処理する。
+  for (i=1; i<nthreads; i++) {
+    if (pthread_create(&threads[i], NULL, evaluate_jobs, &workers[i]) != 0) {
+      fprintf(stderr, "%s:%d: Error: pthread_create().\n", __FILE__,
+	      __LINE__);
+      nthreads = i;
+      workers[0].error = 1;
+      break;
+    }
+  }
+  evaluate_jobs(&workers[0]);
+  for (i=1; i<nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  // スレッドごとの結果をまとめる。
+  int ret = 0;
+  size_t total = 0;
+  for (i=0; i<nthreads; i++) {
+    if (workers[i].error)
+      ret = -1;
+    total += workers[i].found_len;
+  }
 
-  return 0;
+  struct occurrence *all = NULL;
+  if (ret == 0 && total > 0) {
+    all = malloc(total * sizeof(struct occurrence));
+    if (all == NULL) {
+      fprintf(stderr, "%s:%d: Error: out of memory.\n", __FILE__, __LINE__);
+      ret = -1;
+    }
+  }
+
+  if (all != NULL) {
+    size_t n = 0;
+    for (i=0; i<nthreads; i++) {
+      memcpy(all + n, workers[i].found,
+	     workers[i].found_len * sizeof(struct occurrence));
+      n += workers[i].found_len;
+    }
+
+    qsort(all, total, sizeof(struct occurrence), compare_occurrence);
+
+    size_t j;
+    for (j=0; j<total; j++) {
+      const struct batch_job *job = &(jobs[all[j].index]);
+      fprintf(stdout, "%ld:%u:%s\n", all[j].start, job->duration,
+	      job->caption);
+    }
+    fflush(stdout);
+    free(all);
+  }
+
+  for (i=0; i<nthreads; i++)
+    free(workers[i].found);
+
+  if (ret == 0 && total == 0)
+    return 1;
+
+  return ret;
 }
 
 
@@ -342,19 +780,40 @@ static int process(time_t *result, const char* str,
  */
 static void print_usage()
 {
-  const char *usage = "tm crontab"
-    " [-r range_backward] [-R range_forward] [-v] [-h] schedule\n";
+  const char *usage = "tm crontab [-d database] [-e] [-f | -k]"
+    " [-r range_backward] [-R range_forward] [-v] [-h] schedule\n"
+    "       tm crontab -b [-j threads]"
+    " [-r range_backward] [-R range_forward] [-v] [-h]\n";
 
   const char *description = ""
     "引数から取得したcrontab形式の文字列を解析して、直近の時刻を取得します。"
 "取得した時刻はstdinから読み込んだスケジュールの開始時刻に反映して、stdoutに出力します。\n"
     "\n"
-    "デフォルトの検索範囲は、プログラム実行時刻から24時間です。\n";
+    "デフォルトの検索範囲は、プログラム実行時刻から24時間です。\n"
+    "\n"
+    "-fオプションを指定すると、データベースのスケジュールと重ならない"
+    "直近の時刻を取得します。-kオプションを指定すると、さらにデータベースを"
+    "ロックしたまま、その時刻のスケジュールを自プロセスグループの"
+    "スケジュールとしてデータベースに追加します。\n"
+    "\n"
+    "-eオプションを指定すると、stdinのすべての行をスケジュールとして読み込み、"
+    "それぞれ前のスケジュールの終了時刻以降の直近の時刻を反映して出力します。"
+    "-fと併用した場合、データベースの読み込みは1度だけです。\n"
+    "\n"
+    "一括処理モード(-b)では、stdinの各行からcrontab形式の時刻指定と"
+    "スケジュール(duration:caption)をタブ区切りで読み込み、検索範囲内の"
+    "すべての開始時刻を、時刻順にまとめてstdoutに出力します。\n";
 
   const char *posarg = "ARGUMENT\n"
     "\tschedule crontab形式の時刻指定\n";
 
   const char *optarg = "OPTIONS\n"
+    "\t-b                一括処理モード\n"
+    "\t-d database       データベース番号(1-5が使用可能)\n"
+    "\t-e                stdinのすべての行に、順に時刻を反映する。\n"
+    "\t-f                データベースのスケジュールと重ならない時刻を取得する。\n"
+    "\t-j threads        一括処理モードで使用するスレッド数(1-64)。\n"
+    "\t-k                -fで取得した時刻のスケジュールをデータベースに追加する。\n"
     "\t-r range_backward 実行時刻を基準とした時刻を検索する過去の範囲(sec)。\n"
     "\t-R range_forward  実行時刻を基準とした時刻を検索する未来の範囲(sec)。\n"
     "\t-v                verboseモード\n"
@@ -374,17 +833,36 @@ static void print_usage()
     "\t始めの1行をスケジュールとして読み込み、それ以降はそのまま出力される。\n"
     "\t$ echo -e \"0:600:今朝のニュース\\nABCDEFG\" | tm crontab \"0 7 20 8 *\"\n"
     "\t1503180600:600:今朝のニュース\n"
-    "\tABCDEFG\n";
+    "\tABCDEFG\n"
+    "\n"
+    "\t毎朝7時のうち、空いている直近の時刻に10分間のスケジュールを確保する。\n"
+    "\t$ sh -c 'echo \"0:600:News\" | tm crontab -k -R 604800 \"0 7 * * *\""
+    " && tm activate && myprogram'\n"
+    "\n"
+    "\t複数の時刻指定をまとめて評価する。\n"
+    "\t$ printf \"0 7 * * *\\t600:News\\n30 6 * * *\\t300:Weather\\n\" |"
+    " tm crontab -b\n"
+    "\t1503178800:300:Weather\n"
+    "\t1503180600:600:News\n"
+    "\n"
+    "\t毎時0分と30分の枠に、プレイリストの各項目を順に割り当てる。\n"
+    "\t$ printf \"0:1200:A\\n0:1200:B\\n\" | tm crontab -e \"0,30 * * * *\"\n"
+    "\t1503180000:1200:A\n"
+    "\t1503181800:1200:B\n";
     
-  fprintf(stderr, "usage: %s\n%s\n%s\n%s\n%s\n%s\n",
-	  usage, description, posarg, optarg, exit_status, example);
+  const char *env = "ENVIRONMENT\n"
+    "\tTM_DB_NUM データベース番号(1-5が使用可能)。f、kオプションの場合に使用する。dオプションが指定された場合は、そちらが優先される。\n";
+
+  fprintf(stderr, "usage: %s\n%s\n%s\n%s\n%s\n%s\n%s\n",
+	  usage, description, posarg, optarg, exit_status, env, example);
 }
 
 
 /**
  * @brief stdinからスケジュールを読み込む。
  * @param[out] sched 読み込んだスケジュールが反映される。
- * @return 成功時は0、失敗時には-1、スケジュールが不正な場合は1を返す。
+ * @return 成功時は0、失敗時には-1、スケジュールが不正な場合は1、stdinの終わり
+ * に達した場合は2を返す。
  */
 static int read_schedule(struct schedule *sched)
 {
@@ -394,8 +872,9 @@ static int read_schedule(struct schedule *sched)
     if (feof(stdin) == 0) {
       fprintf(stderr, "%s:%d: Error: while reading stdin.\n", __FILE__,
 	      __LINE__);
+      return -1;
     }
-    return -1;
+    return 2;
   }
 
   //
@@ -425,24 +904,180 @@ static int read_schedule(struct schedule *sched)
 }
 
 
+/**
+ * @brief stdinのすべてのスケジュールに、crontabフォーマットの文字列に一致する
+ * 時刻を順に反映して、stdoutに出力する。
+ *
+ * 各スケジュールの開始時刻は、前のスケジュールの終了時刻以降の、直近の一致
+ * する時刻となる。unoccupiedが1の場合は、さらにデータベースのスケジュールと
+ * 重ならない時刻とする。データベースの読み込みは1度だけ行う。
+ *
+ * @param[in] str            解析するcrontabフォーマットの文字列。
+ * @param[in] unoccupied     1の場合は、データベースのスケジュールを避ける。
+ * @param[in] shm_name       データベース名。
+ * @param[in] range_backward 検索する過去の範囲(sec)
+ * @param[in] range_forward  検索する未来の範囲(sec)
+ * @return 成功時には0を、失敗時には-1、書式が不正な場合は1、時刻が見つからな
+ * い場合は2を返す。
+ */
+static int process_each(const char* str, int unoccupied, const char *shm_name,
+			unsigned int range_backward,
+			unsigned int range_forward)
+{
+  assert(str != NULL && shm_name != NULL);
+
+  struct cron_mask m;
+  int ret = crontab_compile_mask(&m, str, NULL);
+  if (ret != 0)
+    return ret;
+
+  time_t head = time(NULL) - range_backward;
+  time_t end = head + range_backward + range_forward;
+
+  // データベースのスケジュールを避ける場合は、始めに1度だけ読み込んでおく。
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  struct expansion ex = {NULL, 0, NULL, NULL};
+  unsigned int capacity = DEFAULT_CAPACITY;
+  if (unoccupied) {
+    if (get_capacity(shm_name, &capacity) != 0 ||
+	load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds,
+		       MAX_NUM_SCHEDULES, &scheds_len) != 0)
+      return -1;
+
+    // 最後のスケジュールの継続時間は分からないので、範囲は1日余分に取る。
+    if (expand_schedules(scheds, scheds_len, head, end + 60*60*24,
+			 &ex) != 0) {
+      cleanup_schedules(scheds, scheds_len);
+      return -1;
+    }
+  }
+
+  while (1) {
+    struct schedule sched;
+    ret = read_schedule(&sched);
+    if (ret == 2) {
+      ret = 0;
+      break;
+    }
+    if (ret != 0)
+      break;
+
+    time_t t;
+    if (head > end) {
+      ret = -1;
+    } else if (unoccupied) {
+      struct schedule self = sched;
+      self.pgid = getpgid(0);
+      ret = attack_unoccupied(&t, &m, &self, ex.scheds, ex.len, head,
+			      end - head, capacity);
+    } else {
+      ret = crontab_next(&t, &m, head, end - head);
+    }
+    if (ret != 0) {
+      fprintf(stderr, "%s:%d: Error: Not found. \"%s\"\n", __FILE__,
+	      __LINE__, sched.caption);
+      ret = 2;
+      break;
+    }
+
+    output_schedule(&sched, t);
+
+    // 次のスケジュールは、このスケジュールの終了時刻(分単位に切り上げ)以降。
+    time_t next = t + ((sched.duration > 60) ? sched.duration : 60);
+    head = ((next + 59) / 60) * 60;
+  }
+
+  if (unoccupied) {
+    cleanup_expansion(&ex);
+    cleanup_schedules(scheds, scheds_len);
+  }
+
+  return ret;
+}
+
+
 int crontab(int argc, char *argv[])
 {
   char *arg = NULL;
+  char shm_name[NAME_MAX] = DEFAULT_SHARED_MEMORY_NAME;
+  char *db = NULL;
+  int opt_b = 0, opt_e = 0, opt_f = 0, opt_k = 0;
+  unsigned int nthreads = 1;
   unsigned int range_backward = 0, range_forward = 60*60*24;//24hours
 
   // オプション解析
-  switch (parse_arguments(argc, argv, &arg, &range_backward, &range_forward,
-			  &verbose)) {
+  switch (parse_arguments(argc, argv, &arg, shm_name, &db, &opt_b, &opt_e,
+			  &opt_f, &opt_k, &nthreads, &range_backward,
+			  &range_forward, &verbose)) {
   case 1:
     return EXIT_SUCCESS;
   case 2:
     return EXIT_MISUSE;
   }
 
+  // データベースを使うのは'f'オプションの場合だけ。'd'オプションが指定されて
+  // いない場合は、環境変数を確認する。
+  if (opt_f && db == NULL) {
+    if (get_env(NULL, shm_name) != 0)
+      return EXIT_FAILURE;
+  }
+
+  // 一括処理モード
+  if (opt_b) {
+    struct batch_job *jobs;
+    size_t len;
+    switch (read_batch_jobs(&jobs, &len)) {
+    case -1:
+      return EXIT_FAILURE;
+    case 1:
+      return EXIT_MISUSE;
+    }
+
+    if (verbose > 0) {
+      fprintf(stderr, "%s:%d: range_b:%dsec range_f:%dsec jobs:%zu "
+	      "threads:%u\n", __FILE__, __LINE__, range_backward,
+	      range_forward, len, nthreads);
+    }
+
+    time_t now = time(NULL);
+    int ret = run_batch(jobs, len, now - range_backward, now + range_forward,
+			nthreads);
+    free(jobs);
+
+    switch (ret) {
+    case -1:
+      return EXIT_FAILURE;
+    case 1:
+      return EXIT_NOT_FOUND;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  // 全行処理モード
+  if (opt_e) {
+    if (verbose > 0) {
+      fprintf(stderr, "%s:%d: range_b:%dsec range_f:%dsec arg:%s each\n",
+	      __FILE__, __LINE__, range_backward, range_forward, arg);
+    }
+
+    switch (process_each(arg, opt_f, shm_name, range_backward,
+			 range_forward)) {
+    case -1:
+      return EXIT_FAILURE;
+    case 1:
+      return EXIT_MISUSE;
+    case 2:
+      return EXIT_NOT_FOUND;
+    }
+    return EXIT_SUCCESS;
+  }
+
   // stdinからスケジュールを取得する。
   struct schedule sched;
   switch (read_schedule(&sched)) {
   case -1:
+  case 2:
     return EXIT_FAILURE;
   case 1:
     return EXIT_MISUSE;
@@ -455,7 +1090,14 @@ int crontab(int argc, char *argv[])
 
   // 指定された開始時刻取得。
   time_t start = 0;
-  switch (process(&start, arg, range_backward, range_forward)) {
+  int ret;
+  if (opt_f)
+    ret = process_unoccupied(&start, arg, &sched, db, shm_name, opt_k,
+			     range_backward, range_forward);
+  else
+    ret = process(&start, arg, range_backward, range_forward);
+
+  switch (ret) {
   case -1:
     return EXIT_FAILURE;
   case 1:
@@ -1,11 +1,20 @@
 # リンクしてほしいオブジェクトファイルの絶対パスを追加する。
-OBJECTS += $(addprefix $(OBJ_DIR)/, crontab.o crontab_entry.o crontab_misc.o)
+# 時刻指定の解析はlibtmに、crontabコマンドはtmコマンドだけに含める。
+OBJECTS += $(OBJ_DIR)/crontab.o
+LIB_OBJECTS += $(addprefix $(OBJ_DIR)/, crontab_mask.o crontab_entry.o crontab_misc.o)
 
 # 依存関係を絶対パスで書く。(依存関係の一番最初は必ずソースファイルにする)
 $(OBJ_DIR)/crontab.o: $(SOURCE_DIR)/crontab.c \
                       $(INCLUDE_DIR)/crontab.h \
                       $(INCLUDE_DIR)/common.h \
-                      $(INCLUDE_DIR)/crontab_cron.h
+                      $(INCLUDE_DIR)/crontab_mask.h \
+                      $(INCLUDE_DIR)/lock.h \
+                      $(INCLUDE_DIR)/unlock.h
+
+$(OBJ_DIR)/crontab_mask.o: $(SOURCE_DIR)/crontab_mask.c \
+                           $(INCLUDE_DIR)/crontab_mask.h \
+                           $(INCLUDE_DIR)/common.h \
+                           $(INCLUDE_DIR)/crontab_cron.h
 
 $(OBJ_DIR)/crontab_entry.o: $(SOURCE_DIR)/crontab_entry.c \
                             $(INCLUDE_DIR)/crontab_cron.h
@@ -0,0 +1,351 @@
+/*
+ * crontab_mask.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file crontab_mask.c
+ * @brief crontab形式の時刻指定の解析と、時刻の検索に関する実装。
+ */
+
+#include "../include/crontab_mask.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#define MAIN_PROGRAM // For cron.h
+#include "../include/common.h"
+#include "../include/crontab_cron.h"
+
+/** 時刻指定の解析を排他するためのmutex */
+static pthread_mutex_t compile_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief ビット列をワード単位のマスクに変換する。
+ * @param[in] bits  変換するビット列。
+ * @param[in] nbits ビット数(64以下)。
+ * @return 変換したマスク。
+ */
+static uint64_t bits_to_mask(const bitstr_t *bits, int nbits)
+{
+  uint64_t mask = 0;
+  int i;
+  for (i=0; i<nbits; i++) {
+    if (bit_test(bits, i))
+      mask |= (uint64_t)1 << i;
+  }
+  return mask;
+}
+
+
+/**
+ * @brief entry構造体のビット列を、cron_mask構造体に詰め直す。
+ * @param[in]  e entry構造体へのポインタ。
+ * @param[out] m 変換結果が反映される。
+ */
+static void pack_entry(const entry *e, struct cron_mask *m)
+{
+  assert(e != NULL && m != NULL);
+
+  m->minute = bits_to_mask(e->minute, MINUTE_COUNT);
+  m->hour   = (uint32_t)bits_to_mask(e->hour, HOUR_COUNT);
+  m->dom    = (uint32_t)bits_to_mask(e->dom, DOM_COUNT);
+  m->month  = (uint32_t)bits_to_mask(e->month, MONTH_COUNT);
+  m->dow    = (uint32_t)bits_to_mask(e->dow, DOW_COUNT);
+  m->flags  = e->flags;
+}
+
+
+int match_day(const struct cron_mask *m, const struct tm *day)
+{
+  // month
+  if (!(m->month & ((uint32_t)1 << day->tm_mon)))
+    return 0;
+
+  // DOM and DOW //tm_mdayが(1-31)のため-1する。
+  int dow = (m->dow & ((uint32_t)1 << day->tm_wday)) != 0;
+  int dom = (m->dom & ((uint32_t)1 << (day->tm_mday-1))) != 0;
+  if ((m->flags & DOM_STAR) || (m->flags & DOW_STAR))
+    return dow && dom;
+  else
+    return dow || dom;
+}
+
+
+time_t day_time(const struct tm *day, time_t midnight, int regular, int hour,
+		int minute)
+{
+  if (regular)
+    return midnight + hour*3600 + minute*60;
+
+  // 夏時間の切り替えがある日は、mktime()に任せる。
+  struct tm c = *day;
+  c.tm_hour = hour;
+  c.tm_min = minute;
+  c.tm_sec = 0;
+  c.tm_isdst = -1;
+  return mktime(&c);
+}
+
+
+time_t normalize_day(struct tm *day, int *regular)
+{
+  day->tm_hour = 0;
+  day->tm_min = 0;
+  day->tm_sec = 0;
+  day->tm_isdst = -1;
+  time_t midnight = mktime(day);
+
+  struct tm next = *day;
+  next.tm_mday++;
+  next.tm_isdst = -1;
+  *regular = (mktime(&next) - midnight == 86400);
+
+  return midnight;
+}
+
+
+/**
+ * @brief 時刻指定に一致する、startからstart+rangeまでの間の直近の時刻を取得する。
+ *
+ * 1日ごとに月、日、曜日を判定し、一致した日だけ時、分のマスクをビット単位で
+ * 走査する。
+ *
+ * @param[out] result 取得した時刻が反映される。
+ * @param[in]  m      時刻指定。
+ * @param[in]  start  検索を開始する時刻(time_t)。秒単位は切り捨てられる。
+ * @param[in]  range  検索する範囲(sec)
+ * @return 成功時は0、見つからない場合は-1を返す。
+ */
+static int attack(time_t *result, const struct cron_mask *m, time_t start,
+		  unsigned int range)
+{
+  assert(m != NULL);
+
+  time_t end = start + range;
+  time_t head = start - (start % 60);
+
+  struct tm day;
+  localtime_r(&start, &day);
+
+  while (1) {
+    int regular;
+    time_t midnight = normalize_day(&day, &regular);
+    if (midnight > end)
+      break;
+
+    if (match_day(m, &day)) {
+      uint32_t hours = m->hour;
+      while (hours) {
+	int h = __builtin_ctz(hours);
+	hours &= hours - 1;
+
+	uint64_t minutes = m->minute;
+	while (minutes) {
+	  int min = __builtin_ctzll(minutes);
+	  minutes &= minutes - 1;
+
+	  time_t t = day_time(&day, midnight, regular, h, min);
+	  if (t < head)
+	    continue;
+	  if (t > end)
+	    return -1;
+
+	  *result = t;
+	  return 0;
+	}
+      }
+    }
+
+    day.tm_mday++;
+  }
+
+  return -1;
+}
+
+
+/**
+ * @brief ファイルに書き込まれたcrontabフォーマットの文字列を解析してentry構造体を作成する。
+ *
+ * 作成された構造体は、不要になったときメモリの解放をする必要がある。
+ *
+ * @param[in] fp 解析するcrontabフォーマットの文字列が書き込まれたファイルへのポインタ。
+ * @return 成功時にはentry構造体のポインタを、失敗時にはNULLを返す。
+ */
+static entry* parse_string(FILE *fp)
+{
+  entry *e = (entry *) calloc(sizeof(entry), sizeof(char));
+  if (e == NULL) {
+    report_error(ERROR_MEMORY, "%s:%d: Error: out of memory.\n", __FILE__,
+		 __LINE__);
+    return NULL;
+  }
+
+  int ch = get_char(fp);
+  if (ch == EOF) {
+    report_error(ERROR_FORMAT, "%s:%d: Error: nothing to read.\n", __FILE__,
+		 __LINE__);
+    goto eof;
+  }
+
+  // minute
+  ch = get_list(e->minute, FIRST_MINUTE, LAST_MINUTE, PPC_NULL, ch, fp);
+  if (ch == EOF) {
+    report_error(ERROR_FORMAT, "%s:%d: Error: bad minute.\n", __FILE__,
+		 __LINE__);
+    goto eof;
+  }
+
+  // hour
+  ch = get_list(e->hour, FIRST_HOUR, LAST_HOUR, PPC_NULL, ch, fp);
+  if (ch == EOF) {
+    report_error(ERROR_FORMAT, "%s:%d: Error: bad hour.\n", __FILE__,
+		 __LINE__);
+    goto eof;
+  }
+
+  // DOM (days of month)
+  if (ch == '*')
+    e->flags |= DOM_STAR;
+  ch = get_list(e->dom, FIRST_DOM, LAST_DOM, PPC_NULL, ch, fp);
+  if (ch == EOF) {
+    report_error(ERROR_FORMAT, "%s:%d: Error: bad day-of-month.\n", __FILE__,
+		 __LINE__);
+    goto eof;
+  }
+
+  // month 
+  ch = get_list(e->month, FIRST_MONTH, LAST_MONTH, MonthNames, ch, fp);
+  if (ch == EOF) {
+    report_error(ERROR_FORMAT, "%s:%d: Error: bad month.\n", __FILE__,
+		 __LINE__);
+    goto eof;
+  }
+
+  // DOW (days of week)
+  if (ch == '*')
+    e->flags |= DOW_STAR;
+  ch = get_list(e->dow, FIRST_DOW, LAST_DOW, DowNames, ch, fp);
+  if (ch == EOF) {
+    report_error(ERROR_FORMAT, "%s:%d: Error: bad day-of-week.\n", __FILE__,
+		 __LINE__);
+    goto eof;
+  }
+
+  // make sundays equivilent
+  if (bit_test(e->dow, 0) || bit_test(e->dow, 7)) {
+    bit_set(e->dow, 0);
+    bit_set(e->dow, 7);
+  }
+
+  return e;
+
+ eof:
+  free_entry(e);
+  return NULL;
+}
+
+
+/**
+ * @brief crontabフォーマットの文字列を解析してentry構造体を作成する。
+ *
+ * 作成された構造体は、不要になったときメモリの解放をする必要がある。
+ *
+ * @param[in] tmpfp 作業用のファイル。先頭から上書きして使用する。
+ * @param[in] str   解析するcrontabフォーマットの文字列。
+ * @return 成功時にはentry構造体のポインタを、失敗時にはNULLを返す。
+ */
+static entry* compile_string(FILE *tmpfp, const char *str)
+{
+  assert(tmpfp != NULL && str != NULL);
+
+  // tmpfileに読み込んだ内容を書き込む。
+  // 前回の内容が残っていても、改行以降は読まれない。
+  rewind(tmpfp);
+  fputs(str, tmpfp);
+  fputs("\n", tmpfp);
+  fflush(tmpfp);
+  rewind(tmpfp);
+
+  // 文字列からデータを起こす。
+  // cronの解析処理は、行番号などを大域変数に持つため、同時に解析しない。
+  pthread_mutex_lock(&compile_mutex);
+  entry *e = parse_string(tmpfp);
+  pthread_mutex_unlock(&compile_mutex);
+
+  return e;
+}
+
+
+int crontab_compile(const char *str, struct cron_mask* *m)
+{
+  assert(str != NULL && m != NULL);
+
+  *m = malloc(sizeof(struct cron_mask));
+  if (*m == NULL) {
+    report_error(ERROR_MEMORY, "%s:%d: Error: out of memory.\n", __FILE__,
+		 __LINE__);
+    return -1;
+  }
+
+  int ret = crontab_compile_mask(*m, str, NULL);
+  if (ret != 0) {
+    free(*m);
+    *m = NULL;
+  }
+
+  return ret;
+}
+
+
+int crontab_compile_mask(struct cron_mask *m, const char *str, FILE *tmpfp)
+{
+  assert(m != NULL && str != NULL);
+
+  FILE *fp = tmpfp;
+  if (fp == NULL && (fp = tmpfile()) == NULL) {
+    report_error(ERROR_SYSTEM, "%s:%d: Error: tmpfile().\n", __FILE__,
+		 __LINE__);
+    return -1;
+  }
+
+  entry *e = compile_string(fp, str);
+  if (fp != tmpfp)
+    fclose(fp);
+  if (e == NULL)
+    return 1;
+
+  pack_entry(e, m);
+  free_entry(e);
+
+  return 0;
+}
+
+
+int crontab_next(time_t *result, const struct cron_mask *m, time_t start,
+		 unsigned int range)
+{
+  return attack(result, m, start, range);
+}
+
+
+void crontab_release(struct cron_mask *m)
+{
+  free(m);
+}
@@ -0,0 +1,2191 @@
+/*
+ * daemon.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file daemon.c
+ * @brief データベースを常駐して管理するコマンドに関する実装。
+ */
+
+#define _GNU_SOURCE // for struct ucred
+
+#include "../include/daemon.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/common.h"
+#include "../include/launcher.h"
+#include "../include/notify.h"
+#include "../include/reaper.h"
+
+/** セマフォ取得待ちのタイムアウト(sec) */
+#define LOCK_TIMEOUT 5
+
+/** クライアントとの送受信のタイムアウト(sec) */
+#define IO_TIMEOUT 10
+
+/** 接続待ちの上限 */
+#define LISTEN_BACKLOG 128
+
+/** まとめて処理する変更の要求の上限 */
+#define MAX_BATCH 64
+
+/** 要求がなくても、取り残された順番の回収とジョブの確認のために起きる
+ * 間隔(sec) */
+#define RING_IDLE_INTERVAL 1
+
+/** 完了語で待機する前に、完了を確認し続ける回数 */
+#define RING_SPIN_COUNT 2000
+
+/** 取得されたまま書き込まれず、取得したクライアントもわからない順番を、
+ * 読み飛ばすまでの時間(sec) */
+#define RING_CLAIM_TIMEOUT 1
+
+/** クライアントが受付列で結果を待つ時間の上限(sec) */
+#define RING_REQUEST_TIMEOUT IO_TIMEOUT
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * @struct database
+ * @brief デーモンが保持するデータベースの状態。
+ */
+struct database {
+  char shm_name[NAME_MAX];  /**< 共有メモリ名 */
+  char sem_name[NAME_MAX];  /**< セマフォ名 */
+  int fd;  /**< 共有メモリのファイル記述子 */
+  char *addr;  /**< マップした共有メモリ。マップしていない場合はNULL */
+  int loaded;  /**< schedsが読み込み済みの場合は1 */
+  unsigned long gen;  /**< 前回読み書きした共有メモリの世代番号 */
+  struct schedule* scheds[MAX_NUM_SCHEDULES];  /**< スケジュール群 */
+  size_t len;  /**< schedsの配列数 */
+  unsigned int capacity;  /**< データベースのcapacity */
+  int pruned;  /**< 取り除いたスケジュールを書き込んでいない場合は1 */
+};
+
+/**
+ * @struct ring_slot
+ * @brief 要求の順番1つ分。
+ *
+ * seq値は、空いている場合は順番号、要求が書き込まれた場合は順番号+1、
+ * デーモンが読み出した場合は順番号+2になる。クライアントが結果を読み終えるか、
+ * 読み出される前に取り消すと、次の周回の順番号に進める。デーモンが
+ * 書き込まれない順番を読み飛ばす場合も、次の周回の順番号に進める。\n
+ * claim値は、順番を取得したクライアントが前の周回の値からCASで設定する。
+ * デーモンが記録されないままの順番を読み飛ばす場合も、CASで順番号だけを
+ * 設定するので、遅れて記録しようとしたクライアントは書き込まずに諦める。\n
+ * クライアントは、claim値を記録してから結果を読み終えるまで、受付列の共有メモリの
+ * 順番の範囲にfcntl()のロックを保持する。ロックはプロセスの終了時に解放されるので、
+ * pid値が再利用されても、書き込む前に終了したクライアントを見分けられる。
+ */
+struct ring_slot {
+  uint64_t claim;  /**< 上位32ビットが取得した順番号、下位32ビットが
+		      取得したクライアントのpid。結果を読まずに待機をやめた
+		      場合と、デーモンが読み飛ばした場合、pidは0になる。 */
+  uint32_t seq;  /**< 順番の状態 */
+  uint32_t done;  /**< 完了語。処理が終わると1になる。futexとして使う。 */
+  uint32_t waiting;  /**< クライアントがdoneで待機している場合は1 */
+  int32_t status;  /**< 処理の結果 */
+  struct daemon_request req;  /**< 要求のヘッダ */
+  struct schedule sched;  /**< 要求のスケジュール */
+};
+
+/**
+ * @struct ring
+ * @brief 共有メモリ上の要求の受付列。
+ *
+ * 複数のクライアントが書き込み、デーモンだけが読み出す。
+ */
+struct ring {
+  pid_t daemon;  /**< デーモンのpid。停止している場合は0 */
+  uint32_t head;  /**< クライアントが次に取得する順番号 */
+  uint32_t tail;  /**< デーモンが次に読み出す順番号 */
+  uint32_t doorbell;  /**< 要求を書き込むたびに増える。futexとして使う。 */
+  uint32_t sleeping;  /**< デーモンがdoorbellで待機している場合は1 */
+  struct ring_slot slots[RING_SIZE];  /**< 順番 */
+};
+
+/**
+ * @struct pending
+ * @brief まとめて処理するために受け付けた、変更の要求1つ分。
+ */
+struct pending {
+  int fd;  /**< クライアントのソケット。受付列から読み出した場合は-1 */
+  struct ring_slot *slot;  /**< 受付列の順番。ソケットで受信した場合はNULL */
+  struct daemon_request req;  /**< 要求のヘッダ */
+  struct schedule sched;  /**< 要求のスケジュール */
+  int status;  /**< 処理の結果 */
+};
+
+static struct database g_db;
+static struct ring *g_ring = NULL;
+static int g_ring_fd = -1;
+static struct ring *g_client_ring = NULL;
+static int g_client_ring_fd = -1;
+static char g_client_ring_name[NAME_MAX];
+static volatile sig_atomic_t g_quit = 0;
+static int g_handoff = -1;
+static int verbose = 0;
+
+
+/**
+ * @brief ヘルプをstderrに出力する。
+ */
+static void print_usage()
+{
+  const char *usage = "tm daemon [-b window] [-d database] [-u] [-v] [-h]\n";
+
+  const char *description = "データベースを常駐して管理します。\n"
+    "\n"
+    "スケジュールをメモリ上に保持し、共有メモリ上の受付列と、Unixドメイン"
+    "ソケットで他のコマンドからの要求を受け付けます。addコマンドの追加、activateコマンドの有効化と、"
+    "schedule、probeコマンドの読み込みは、デーモンが動いていればデーモンに依頼し、動いていなければ"
+    "これまでどおりデータベースを直接読み書きします。\n"
+    "\n"
+    "データベースの内容は、前回読み書きした時から世代番号が変わっている場合に"
+    "だけ読み込み直し、変更はデータベースにも書き込みます。デーモンを使わない"
+    "コマンドとも、同じデータベースを共有できます。\n"
+    "\n"
+    "ソケットは、所有者だけが読み書きできる/tmp/tmd-<uid>ディレクトリに"
+    "作成します。デーモンは同じユーザーのプロセスからの要求だけを受け付け、"
+    "クライアントも同じユーザーのデーモンにだけ依頼します。\n"
+    "\n"
+    "同時に届いた追加、有効化の要求はまとめて、到着順に重複を確認し、"
+    "1度のロックと書き込みで反映します。結果はそれぞれのクライアントに"
+    "返します。bオプションを指定すると、最初の要求からwindowミリ秒の間に"
+    "届いた要求もまとめます。デフォルトは0で、接続待ちになっている要求だけを"
+    "まとめます。\n"
+    "\n"
+    "追加、有効化の要求は、共有メモリ上の受付列に書き込まれます。クライアントは"
+    "それぞれの順番の完了を待ち、受付列が満杯の場合はソケットで要求します。\n"
+    "\n"
+    "runコマンドで予約されたジョブは、開始時刻になると新しいプロセスグループで"
+    "起動し、終了時刻になるとSIGTERMを送ります。開始、終了の確認は1秒ごとに"
+    "行います。\n"
+    "\n"
+    "プロセスグループが終了したスケジュールは、1秒ごとにデータベースから"
+    "取り除きます。Linuxでは、プロセスグループのリーダーの終了をpidfdで"
+    "受け取ります。デーモンが動いている間は、他のコマンドはプロセスグループを"
+    "調べずにデータベースを読み込みます。\n"
+    "\n"
+    "uオプションを指定すると、動いているデーモンからソケットを受け取り、"
+    "受付列とジョブを引き継いで置き換えます。元のデーモンは処理中の要求を"
+    "返してから終了します。ソケットは閉じられないので、その間に届いた要求は"
+    "接続待ちや受付列に残り、新しいデーモンが処理します。デーモンを更新する"
+    "時に使います。動いているデーモンがない場合は、通常どおり起動します。\n"
+    "\n"
+    "SIGTERM、SIGINT、SIGHUPを受け取ると、ソケットと受付列を削除して終了します。"
+    "起動したジョブは終了させず、次に起動したデーモンが引き継ぎます。\n";
+
+  const char *optarg = "OPTIONS\n"
+    "\t-b window   変更の要求をまとめるために待つ時間(msec)\n"
+    "\t-d database データベース番号(1-5が使用可能)\n"
+    "\t-u          動いているデーモンを置き換える\n"
+    "\t-v          verboseモード\n"
+    "\t-h          show this help message and exit\n";
+
+  const char *exit_status = "EXIT STATUS\n"
+    "\t0 正常終了\n"
+    "\t1 異常終了\n"
+    "\t2 使用方法に誤りがある場合\n";
+
+  const char *env = "ENVIRONMENT\n"
+    "\tTM_DB_NUM データベース番号(1-5が使用可能)。dオプションが指定された場合は、そちらが優先される。\n";
+
+  const char *example = "EXAMPLE\n"
+    "\t$ tm daemon -d 1 &\n"
+    "\t$ tm daemon -d 1 -b 5 &\n"
+    "\t$ tm daemon -d 1 -u &\n";
+
+  fprintf(stderr, "usage: %s\n%s\n%s\n%s\n%s\n%s\n", usage, description,
+	  optarg, exit_status, env, example);
+}
+
+
+/**
+ * @brief コマンドライン引数を解析する。
+ * @param[in]  argc     argc値
+ * @param[in]  argv     argv値
+ * @param[out] window   '-b'オプション(要求をまとめるために待つ時間)の値が反映される。
+ * @param[out] sem_name '-d'オプション(データベース番号)が反映される。
+ * @param[out] shm_name '-d'オプション(データベース番号)が反映される。
+ * @param[out] d_opt    '-d'オプション(データベース番号)が指定された場合、1が設定される。
+ * @param[out] u_opt    '-u'オプション(置き換え)が指定された場合、1が設定される。
+ * @param[out] verbose  '-v'オプション(verboseモード)の値が反映される。
+ * @return 成功時は0、'h'オプションが指定された場合は1、不正な値が与えられた場
+ * 合は2を返す。
+ */
+static int parse_arguments(int argc, char* *argv, unsigned int *window,
+			   char *sem_name, char *shm_name, int *d_opt,
+			   int *u_opt, int *verbose)
+{
+  // TimeManagerから呼ばれる場合、argvは{"tm", "daemon", "opt"...}となる。
+  // オプションを読み込むためには、optindを1つ進めて2にしておく必要がある。
+  opterr = 0;
+  optind = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:d:huv")) != -1) {
+    switch (opt) {
+    case 'b':
+      // 要求をまとめるために待つ時間
+      if (atoi(optarg) < 0 || atoi(optarg) > 1000) {
+	fprintf(stderr, "Error: Invalid window. (Valid 0-1000) \"%s\"\n",
+		optarg);
+	return 2;
+      }
+      *window = atoi(optarg);
+      break;
+    case 'd':
+      // データベース番号
+      if (atoi(optarg) < 1 || atoi(optarg) > MAX_NUM_DB) {
+	fprintf(stderr, "Error: Invalid database number. (Valid 1-%d)\n",
+		MAX_NUM_DB);
+	return 2;
+      }
+      strcat(sem_name, optarg);
+      strcat(shm_name, optarg);
+      *d_opt = 1;
+      break;
+    case 'h':
+      // ヘルプ
+      print_usage();
+      return 1;
+    case 'u':
+      // 動いているデーモンを置き換える。
+      *u_opt = 1;
+      break;
+    case 'v':
+      // verboseモード
+      *verbose = 1;
+      break;
+    case '?':
+    default:
+      fprintf(stderr, "%s:%d: Error: Unknown option.\n", __FILE__, __LINE__);
+      return 2;
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief ソケットを置くディレクトリを確認する。
+ *
+ * 他のユーザーがソケットを置き換えたり、先に作成したりできないよう、
+ * 自分が所有し、所有者だけが読み書きできるディレクトリに限る。
+ *
+ * @param[in] dir    ディレクトリのパス。
+ * @param[in] create ディレクトリがない場合に作成する場合は1。
+ * @return 使える場合は0、使えない場合は-1を返す。
+ */
+static int check_socket_dir(const char *dir, int create)
+{
+  errno = 0;
+  if (create && mkdir(dir, S_IRWXU) == -1 && errno != EEXIST) {
+    fprintf(stderr, "%s:%d: Error: mkdir() %s. %s\n", __FILE__, __LINE__,
+	    strerror(errno), dir);
+    return -1;
+  }
+
+  struct stat st;
+  if (lstat(dir, &st) == -1)
+    return -1;
+
+  if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() ||
+      (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+    fprintf(stderr, "%s:%d: Error: Unsafe socket directory. %s\n", __FILE__,
+	    __LINE__, dir);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief データベースの共有メモリ名から、ソケットのパスを作成する。
+ * @param[in]  shm_name データベースの共有メモリ名。
+ * @param[in]  create   ソケットを置くディレクトリがない場合に作成する場合は1。
+ * @param[out] name     ソケットのパスが反映される。sockaddr_unのsun_pathの
+ * 大きさの領域が必要。
+ * @return 成功時は0、パスが長すぎる場合やディレクトリが使えない場合は-1を
+ * 返す。
+ */
+static int get_socket_name(const char *shm_name, int create, char *name)
+{
+  size_t size = sizeof(((struct sockaddr_un*)0)->sun_path);
+  int n = snprintf(name, size, "%s%u", DEFAULT_DAEMON_SOCKET_DIR,
+		   (unsigned int)getuid());
+  if (n < 0 || (size_t)n >= size) {
+    fprintf(stderr, "%s:%d: Error: Too long socket name.\n", __FILE__,
+	    __LINE__);
+    return -1;
+  }
+
+  if (check_socket_dir(name, create) != 0)
+    return -1;
+
+  // データベース番号は、共有メモリ名の末尾に付加されている。
+  const char *db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+  int m = snprintf(name + n, size - n, "/%s%s", DEFAULT_DAEMON_SOCKET_NAME, db);
+  if (m < 0 || (size_t)m >= size - n) {
+    fprintf(stderr, "%s:%d: Error: Too long socket name.\n", __FILE__,
+	    __LINE__);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief 接続相手のプロセスの資格情報を取得する。
+ * @param[in]  fd  ソケット。
+ * @param[out] uid 相手のユーザーIDが反映される。
+ * @param[out] pid 相手のpid値が反映される。取得できない環境では0。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int get_peer_cred(int fd, uid_t *uid, pid_t *pid)
+{
+#if defined(SO_PEERCRED)
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+    return -1;
+  *uid = cred.uid;
+  *pid = cred.pid;
+#else
+  gid_t gid;
+  if (getpeereid(fd, uid, &gid) == -1)
+    return -1;
+  *pid = 0;
+#endif
+
+  return 0;
+}
+
+
+/**
+ * @brief 接続相手が、同じユーザーのプロセスかを確認する。
+ * @param[in]  fd  ソケット。
+ * @param[out] pid 相手のpid値が反映される。取得できない環境では0。
+ * @return 同じユーザーの場合は0、そうでない場合や失敗時には-1を返す。
+ */
+static int check_peer(int fd, pid_t *pid)
+{
+  uid_t uid;
+  if (get_peer_cred(fd, &uid, pid) != 0 || uid != getuid()) {
+    if (verbose > 0)
+      fprintf(stderr, "%s:%d: DEBUG: Reject peer.\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief データベースの共有メモリ名から、受付列の共有メモリ名を作成する。
+ * @param[in]  shm_name データベースの共有メモリ名。
+ * @param[out] name     受付列の共有メモリ名が反映される。NAME_MAXの領域が必要。
+ * @return 成功時は0、名前が長すぎる場合は-1を返す。
+ */
+static int get_ring_name(const char *shm_name, char *name)
+{
+  const char *db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+  int n = snprintf(name, NAME_MAX, "%s%s", DEFAULT_RING_NAME, db);
+  if (n < 0 || n >= NAME_MAX) {
+    fprintf(stderr, "%s:%d: Error: Too long ring name.\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief ソケットの送受信にタイムアウトを設定する。
+ * @param[in] fd ソケット。
+ */
+static void set_io_timeout(int fd)
+{
+  struct timeval tv = {IO_TIMEOUT, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+
+/**
+ * @brief 指定の長さを読み終わるまで受信する。
+ * @param[in]  fd  ソケット。
+ * @param[out] buf 受信した内容が反映される。
+ * @param[in]  len 受信する長さ。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int read_full(int fd, void *buf, size_t len)
+{
+  char *p = buf;
+  while (len > 0) {
+    ssize_t n = recv(fd, p, len, 0);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief 指定の長さを書き終わるまで送信する。
+ * @param[in] fd  ソケット。
+ * @param[in] buf 送信する内容。
+ * @param[in] len 送信する長さ。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int write_full(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief データベースの共有メモリをマップする。すでにマップしている場合は、
+ * マップし直す。
+ * @param[in,out] db データベースの状態。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int map_database(struct database *db)
+{
+  if (db->addr != NULL) {
+    munmap(db->addr, SHARED_MEMORY_SIZE);
+    close(db->fd);
+    db->addr = NULL;
+  }
+  db->loaded = 0;
+
+  errno = 0;
+  int fd = shm_open(db->shm_name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    fprintf(stderr, "%s:%d: Error: shm_open() %s\n", __FILE__, __LINE__,
+	    strerror(errno));
+    return -1;
+  }
+
+  struct stat mapstat;
+  if (fstat(fd, &mapstat) != -1 && mapstat.st_size == 0) {
+    errno = 0;
+    if (ftruncate(fd, SHARED_MEMORY_SIZE) == -1) {
+      fprintf(stderr, "%s:%d: Error: ftruncate. %s\n", __FILE__, __LINE__,
+	      strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+
+  errno = 0;
+  void *addr = mmap(NULL, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "%s:%d: Error: mmap() %s.\n", __FILE__, __LINE__,
+	    strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  db->fd = fd;
+  db->addr = addr;
+
+  return 0;
+}
+
+
+/**
+ * @brief resetコマンドなどで、マップしている共有メモリが削除されたかを調べる。
+ * @param[in] db データベースの状態。
+ * @return 削除された場合は1、そうでない場合は0を返す。
+ */
+static int is_database_removed(const struct database *db)
+{
+  int fd = shm_open(db->shm_name, O_RDONLY, 0);
+  if (fd == -1)
+    return 1;
+
+  struct stat cur, org;
+  int removed = (fstat(fd, &cur) != 0 || fstat(db->fd, &org) != 0 ||
+		 cur.st_dev != org.st_dev || cur.st_ino != org.st_ino);
+  close(fd);
+
+  return removed;
+}
+
+
+/**
+ * @brief 共有メモリの世代番号を、前回読み書きした世代番号として記録する。
+ * @param[in,out] db データベースの状態。
+ */
+static void take_snapshot(struct database *db)
+{
+  db->gen = get_generation(db->addr);
+  db->loaded = 1;
+}
+
+
+/**
+ * @brief 共有メモリの世代番号が前回読み書きした時から変わっていれば、
+ * スケジュールを読み込み直す。
+ *
+ * 世代番号がない、以前の書式のデータベースは、毎回読み込み直す。
+ *
+ * @param[in,out] db データベースの状態。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int sync_database(struct database *db)
+{
+  if ((db->addr == NULL || is_database_removed(db)) && map_database(db) != 0)
+    return -1;
+
+  if (db->loaded && db->gen != 0 && get_generation(db->addr) == db->gen)
+    return 0;
+
+  if (verbose > 0)
+    fprintf(stderr, "%s:%d: DEBUG: Reload database.\n", __FILE__, __LINE__);
+
+  cleanup_schedules(db->scheds, db->len);
+  db->len = 0;
+  db->loaded = 0;
+  db->pruned = 0;
+  if (load_schedules(db->shm_name, SHARED_MEMORY_SIZE, db->scheds,
+		     MAX_NUM_SCHEDULES, &db->len) != 0 ||
+      get_capacity(db->shm_name, &db->capacity) != 0)
+    return -1;
+
+  take_snapshot(db);
+
+  return 0;
+}
+
+
+/**
+ * @brief スケジュールを共有メモリに書き込む。
+ * @param[in,out] db データベースの状態。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int commit_database(struct database *db)
+{
+  if (save_schedules(db->shm_name, SHARED_MEMORY_SIZE, db->scheds, db->len)
+      != 0) {
+    db->loaded = 0;
+    return -1;
+  }
+  db->pruned = 0;
+
+  take_snapshot(db);
+
+  return 0;
+}
+
+
+/**
+ * @brief プロセスグループが終了したスケジュールを取り除く。
+ *
+ * 終了時刻までに起動できなかったジョブは、スプールファイルも削除する。\n
+ * 範囲の重なる待機中のクライアントには、解放を通知する。\n
+ * デーモンはreaperとして記録されているので、load_schedules()はリーダーの
+ * 開始時刻を調べない。読み込んだ後は、必ずこの関数で取り除く。
+ *
+ * @param[in,out] db データベースの状態。
+ * @return 取り除いたスケジュールの数を返す。
+ */
+static size_t prune_database(struct database *db)
+{
+  size_t i;
+  for (i=0; i<db->len; i++) {
+    const struct schedule *s = db->scheds[i];
+    if (s->pgid < 0 && !is_group_alive(s)) {
+      fprintf(stderr, "%s:%d: Error: Missed the job. id:%" PRIu64 "\n",
+	      __FILE__, __LINE__, s->id);
+      unspool_job(db->shm_name, s->id);
+    }
+  }
+
+  size_t pruned = reap_schedules(db->shm_name, db->scheds, &db->len);
+  if (pruned > 0)
+    db->pruned = 1;
+
+  return pruned;
+}
+
+
+/**
+ * @brief プロセスグループがロックを持っているかを調べる。
+ *
+ * ロックを持っているプロセスグループ自身の要求でセマフォを待つと、
+ * デッドロックになる。lock値を変えるのはそのプロセスグループだけなので、
+ * ロックせずに読み込んだスケジュールで調べてよい。
+ *
+ * @param[in] db   データベースの状態。sync_database()で読み込み済みであること。
+ * @param[in] pgid 調べるプロセスグループ。
+ * @return ロックを持っている場合は1、そうでない場合は0を返す。
+ */
+static int holds_lock(const struct database *db, pid_t pgid)
+{
+  struct schedule *s = NULL;
+  return find_sched_by_pgid(pgid, (struct schedule**)db->scheds, db->len, &s)
+    == 0 && s->lock != 0;
+}
+
+
+/**
+ * @brief データベースのセマフォを獲得する。
+ * @param[in]  db  データベースの状態。
+ * @param[out] sem 獲得したセマフォが反映される。
+ * @return 成功時は0、失敗時には-1、タイムアウトした場合は1を返す。
+ */
+static int lock_semaphore(const struct database *db, sem_t* *sem)
+{
+  errno = 0;
+  *sem = sem_open(db->sem_name, O_CREAT, S_IRUSR | S_IWUSR, 1);
+  if (*sem == SEM_FAILED) {
+    fprintf(stderr, "%s:%d: Error: sem_open() %s.\n", __FILE__, __LINE__,
+	    strerror(errno));
+    return -1;
+  }
+
+  // SIGALRMでsem_wait()を中断させる。
+  alarm(LOCK_TIMEOUT);
+  errno = 0;
+  int ret = sem_wait(*sem);
+  int err = errno;
+  alarm(0);
+
+  if (ret == -1) {
+    sem_close(*sem);
+    if (err == EINTR)
+      return 1;
+    fprintf(stderr, "%s:%d: Error: sem_wait() %s.\n", __FILE__, __LINE__,
+	    strerror(err));
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief データベースのセマフォを解放する。
+ * @param[in] sem lock_semaphore()で獲得したセマフォ。
+ */
+static void unlock_semaphore(sem_t *sem)
+{
+  if (sem_post(sem) == -1)
+    fprintf(stderr, "%s:%d: Error: sem_post() %s.\n", __FILE__, __LINE__,
+	    strerror(errno));
+  sem_close(sem);
+}
+
+
+/**
+ * @brief スケジュールを追加、上書きする。
+ * @param[in,out] db        データベースの状態。
+ * @param[in]     req       追加するスケジュール。
+ * @param[out]    old_start 上書きした元のスケジュールの開始時刻が反映される。
+ * @param[out]    old_end   上書きした元のスケジュールの終了時刻が反映される。
+ * 上書きしなかった場合は0。
+ * @return DAEMON_OK、DAEMON_CONFLICT、DAEMON_ERRORのいずれかを返す。
+ */
+static int add_schedule(struct database *db, const struct schedule *req,
+			time_t *old_start, time_t *old_end)
+{
+  struct schedule *new = malloc(sizeof(struct schedule));
+  if (new == NULL) {
+    fprintf(stderr, "%s:%d: Error: Faild to allocate memory.\n", __FILE__,
+	    __LINE__);
+    return DAEMON_ERROR;
+  }
+  memcpy(new, req, sizeof(struct schedule));
+
+  int conflict = check_sched_capacity(new, db->scheds, db->len, db->capacity);
+
+  if (conflict != 0) {
+    free(new);
+    return (conflict == 1) ? DAEMON_CONFLICT : DAEMON_ERROR;
+  }
+
+  // 上書きする場合は、元のスケジュールの範囲を解放する。
+  struct schedule *old = NULL;
+  *old_end = 0;
+  if (find_sched_by_pgid(new->pgid, db->scheds, db->len, &old) == 0 &&
+      old->duration != 0) {
+    *old_start = old->start;
+    *old_end = old->start + old->duration;
+    if (old->rule[0] != '\0')
+      *old_end += RECUR_HORIZON;
+  }
+
+  if (update_sched_by_pgid(new, db->scheds, &db->len, MAX_NUM_SCHEDULES)
+      != 0) {
+    free(new);
+    return DAEMON_ERROR;
+  }
+
+  return DAEMON_OK;
+}
+
+
+/**
+ * @brief 要求群の結果をまとめて設定する。
+ * @param[out] batch  要求群。
+ * @param[in]  len    batchの配列数。
+ * @param[in]  status 設定する結果。
+ */
+static void set_batch_status(struct pending *batch, size_t len, int status)
+{
+  size_t i;
+  for (i=0; i<len; i++)
+    batch[i].status = status;
+}
+
+
+/**
+ * @brief スケジュールを有効にする。
+ *
+ * 終了機能のpid値を記録する。繰り返し、伸縮するスケジュールと、
+ * 2回目の有効化は受け付けない。
+ *
+ * @param[in,out] db  データベースの状態。
+ * @param[in]     req 有効にするスケジュール。start、duration値は、
+ * データベースの値と一致している必要がある。
+ * @return DAEMON_OK、DAEMON_CONFLICTのいずれかを返す。
+ */
+static int activate_schedule(struct database *db, const struct schedule *req)
+{
+  struct schedule *s = NULL;
+  if (find_sched_by_pgid(req->pgid, db->scheds, db->len, &s) != 0 ||
+      s->rule[0] != '\0' || s->max_duration != 0 || s->terminator != 0 ||
+      s->start != req->start || s->duration != req->duration)
+    return DAEMON_CONFLICT;
+
+  s->terminator = req->terminator;
+
+  return DAEMON_OK;
+}
+
+
+/**
+ * @brief まとめて受け付けた変更の要求を、到着順に処理する。
+ *
+ * ロックの獲得、共有メモリへの書き込み、解放の通知は、まとめて1度だけ
+ * 行う。それぞれの要求の結果は、status値に反映される。
+ *
+ * @param[in,out] batch 要求群。
+ * @param[in]     len   batchの配列数。
+ */
+static void process_batch(struct pending *batch, size_t len)
+{
+  if (sync_database(&g_db) != 0) {
+    g_db.loaded = 0;
+    set_batch_status(batch, len, DAEMON_ERROR);
+    return;
+  }
+
+  // 要求したプロセスグループがロックを持っている場合は、処理しない。
+  size_t i, nlocked = 0;
+  for (i=0; i<len; i++) {
+    batch[i].status = DAEMON_ERROR;
+    if (holds_lock(&g_db, batch[i].req.pgid)) {
+      batch[i].status = DAEMON_BUSY;
+      nlocked++;
+    }
+  }
+  if (nlocked == len)
+    return;
+
+  sem_t *sem;
+  switch (lock_semaphore(&g_db, &sem)) {
+  case -1:
+    return;
+  case 1:
+    set_batch_status(batch, len, DAEMON_BUSY);
+    return;
+  }
+
+  if (sync_database(&g_db) != 0) {
+    g_db.loaded = 0;
+    unlock_semaphore(sem);
+    return;
+  }
+
+  // 終了したプロセスグループのスケジュールは、取り除いてから調べる。
+  prune_database(&g_db);
+
+  // 解放される範囲は、まとめて1度だけ通知する。
+  time_t released_start = 0, released_end = 0;
+  int changed = 0;
+  for (i=0; i<len; i++) {
+    struct pending *p = &batch[i];
+    if (p->status == DAEMON_BUSY)
+      continue;
+
+    time_t old_start = 0, old_end = 0;
+    switch (p->req.op) {
+    case DAEMON_OP_ADD:
+      p->status = add_schedule(&g_db, &p->sched, &old_start, &old_end);
+      break;
+    case DAEMON_OP_ACTIVATE:
+      p->status = activate_schedule(&g_db, &p->sched);
+      break;
+    }
+
+    if (p->status == DAEMON_OK)
+      changed = 1;
+
+    if (p->status == DAEMON_OK && old_end != 0) {
+      if (released_end == 0 || old_start < released_start)
+	released_start = old_start;
+      if (old_end > released_end)
+	released_end = old_end;
+    }
+  }
+
+  // 書き込みに失敗した場合は、すべての要求を失敗とする。
+  if (changed && commit_database(&g_db) != 0) {
+    for (i=0; i<len; i++) {
+      if (batch[i].status == DAEMON_OK)
+	batch[i].status = DAEMON_ERROR;
+    }
+    released_end = 0;
+  }
+
+  unlock_semaphore(sem);
+
+  if (released_end != 0)
+    notify_release(g_db.shm_name, released_start, released_end);
+
+  if (verbose > 0) {
+    fprintf(stderr, "%s:%d: DEBUG: batch:%zu changed:%d\n", __FILE__,
+	    __LINE__, len, changed);
+  }
+}
+
+
+/**
+ * @brief 開始時刻になったジョブを起動し、終了時刻になったジョブを終了させる。
+ *
+ * 1秒に1度だけ処理する。要求の処理を遅らせないよう、セマフォは待たずに
+ * 獲得を試み、獲得できない場合は次の機会に処理する。\n
+ * 最初に処理できた時に、前のデーモンが起動したジョブを引き継ぐ。\n
+ * reaperとしてヘッダに記録し、終了したプロセスグループのスケジュールを
+ * 共有メモリからも取り除く。データベースが作り直された場合や、
+ * デーモンが引き継がれた場合は、記録し直す。
+ */
+static void process_jobs()
+{
+  static time_t last = 0;
+  static int adopted = 0;
+
+  time_t now = time(NULL);
+  if (now == last)
+    return;
+  last = now;
+
+  if ((g_db.addr == NULL || is_database_removed(&g_db)) &&
+      map_database(&g_db) != 0)
+    return;
+
+  sem_t *sem = sem_open(g_db.sem_name, O_CREAT, S_IRUSR | S_IWUSR, 1);
+  if (sem == SEM_FAILED)
+    return;
+  if (sem_trywait(sem) == -1) {
+    sem_close(sem);
+    return;
+  }
+
+  // 記録したヘッダは、続けて読み込み直す内容に含まれる。
+  publish_reaper(g_db.shm_name);
+  if (sync_database(&g_db) != 0) {
+    g_db.loaded = 0;
+    unlock_semaphore(sem);
+    return;
+  }
+  size_t pruned = prune_database(&g_db);
+
+  size_t changed = run_jobs(g_db.shm_name, g_db.scheds, &g_db.len, now,
+			    !adopted);
+  adopted = 1;
+  if (changed > 0 || g_db.pruned)
+    commit_database(&g_db);
+
+  unlock_semaphore(sem);
+
+  if (verbose > 0 && (changed > 0 || pruned > 0)) {
+    fprintf(stderr, "%s:%d: DEBUG: jobs changed:%zu, pruned:%zu\n", __FILE__,
+	    __LINE__, changed, pruned);
+  }
+}
+
+
+/**
+ * @brief 取得の要求を処理し、応答を送信する。
+ *
+ * 他の読み込み専用のコマンドと同じく、ロックせずに読み込む。
+ *
+ * @param[in] fd クライアントのソケット。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int handle_list(int fd)
+{
+  struct daemon_response res = {DAEMON_ERROR, 0};
+  if (sync_database(&g_db) != 0) {
+    g_db.loaded = 0;
+    return write_full(fd, &res, sizeof(res));
+  }
+  prune_database(&g_db);
+
+  res.status = DAEMON_OK;
+  res.len = g_db.len;
+  if (write_full(fd, &res, sizeof(res)) != 0)
+    return -1;
+
+  size_t i;
+  for (i=0; i<g_db.len; i++) {
+    if (write_full(fd, g_db.scheds[i], sizeof(struct schedule)) != 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief 受け付けた変更の要求を、そのまま使える状態に整える。
+ * @param[in,out] p 変更の要求。
+ */
+static void sanitize_request(struct pending *p)
+{
+  // 文字列は終端されているとは限らない。
+  p->sched.caption[MAX_CAPTION_LEN-1] = '\0';
+  p->sched.rule[MAX_RULE_LEN-1] = '\0';
+  p->sched.resources[MAX_RESOURCES_LEN-1] = '\0';
+  p->sched.after[MAX_CAPTION_LEN-1] = '\0';
+  p->sched.pgid = p->req.pgid;
+}
+
+
+/**
+ * @brief クライアントの要求を1つ受信する。
+ *
+ * 取得の要求は、その場で応答を送信する。変更の要求は、まとめて処理する
+ * ためにpに保存する。引き継ぎの要求は、g_handoffに保存する。
+ *
+ * @param[in]  fd クライアントのソケット。
+ * @param[out] p  変更の要求が反映される。
+ * @return 変更の要求を受信した場合は0、それ以外の場合は1、失敗時には-1を
+ * 返す。
+ */
+static int receive_request(int fd, struct pending *p)
+{
+  // 同じユーザーのプロセスからの要求だけを受け付ける。
+  pid_t pid;
+  if (check_peer(fd, &pid) != 0)
+    return -1;
+
+  if (read_full(fd, &p->req, sizeof(p->req)) != 0)
+    return -1;
+
+  // 他のプロセスグループになりすました要求は受け付けない。
+  if (pid != 0 && getpgid(pid) != p->req.pgid) {
+    fprintf(stderr, "%s:%d: Error: Mismatched pgid. pid:%d pgid:%d\n",
+	    __FILE__, __LINE__, pid, p->req.pgid);
+    return -1;
+  }
+
+  switch (p->req.op) {
+  case DAEMON_OP_ADD:
+  case DAEMON_OP_ACTIVATE:
+    if (p->req.len != 1 || read_full(fd, &p->sched, sizeof(p->sched)) != 0)
+      return -1;
+
+    p->fd = fd;
+    p->slot = NULL;
+    sanitize_request(p);
+    return 0;
+  case DAEMON_OP_LIST:
+    handle_list(fd);
+    return 1;
+  case DAEMON_OP_HANDOFF:
+    // 受け付けた要求を処理し終えてから引き渡す。
+    if (g_handoff == -1)
+      g_handoff = dup(fd);
+    return 1;
+  default:
+    fprintf(stderr, "%s:%d: Error: Unknown request. op:%u\n", __FILE__,
+	    __LINE__, p->req.op);
+    return -1;
+  }
+}
+
+
+/**
+ * @brief 受付列の順番の処理を完了し、待機しているクライアントを起こす。
+ * @param[in,out] slot   順番。
+ * @param[in]     status 処理の結果。
+ */
+static void complete_slot(struct ring_slot *slot, int status)
+{
+  slot->status = status;
+  __atomic_store_n(&slot->done, 1, __ATOMIC_SEQ_CST);
+
+  // 完了を確認し続けているクライアントは、起こす必要がない。
+  if (__atomic_load_n(&slot->waiting, __ATOMIC_SEQ_CST))
+    wake_word(&slot->done);
+}
+
+
+/**
+ * @brief 順番を使っているクライアントが、ロックを保持しているかを調べる。
+ * @param[in] slot 順番。
+ * @return 保持している場合は1、それ以外の場合は0を返す。調べられない場合は、
+ * 保持しているとみなす。
+ */
+static int is_slot_locked(const struct ring_slot *slot)
+{
+  struct flock fl;
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = F_WRLCK;
+  fl.l_whence = SEEK_SET;
+  fl.l_start = (const char*)slot - (const char*)g_ring;
+  fl.l_len = sizeof(struct ring_slot);
+  if (fcntl(g_ring_fd, F_GETLK, &fl) == -1)
+    return 1;
+
+  return fl.l_type != F_UNLCK;
+}
+
+
+/**
+ * @brief 取得されたまま書き込まれていない順番を、読み飛ばしてよいかを調べる。
+ *
+ * 取得したクライアントがロックを解放している場合と、取得したクライアントが
+ * 記録されないまま@link RING_CLAIM_TIMEOUT @endlink 秒が経った場合に読み飛ばす。
+ * 後者の場合は、順番号だけをclaim値に記録し、遅れて記録しようとした
+ * クライアントに書き込ませない。
+ *
+ * @param[in,out] slot 順番。
+ * @param[in]     pos  順番号。
+ * @return 読み飛ばしてよい場合は1、それ以外の場合は0を返す。
+ */
+static int is_claim_stale(struct ring_slot *slot, uint32_t pos)
+{
+  static uint32_t stalled_pos = 0;
+  static int stalled = 0;
+  static struct timespec since;
+
+  uint64_t claim = __atomic_load_n(&slot->claim, __ATOMIC_ACQUIRE);
+  if ((uint32_t)(claim >> 32) == pos)
+    return (uint32_t)claim == 0 || !is_slot_locked(slot);
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!stalled || stalled_pos != pos) {
+    stalled = 1;
+    stalled_pos = pos;
+    since = now;
+    return 0;
+  }
+  if (now.tv_sec - since.tv_sec < RING_CLAIM_TIMEOUT)
+    return 0;
+
+  // 記録に失敗した場合は、その間にクライアントが記録した。
+  return __atomic_compare_exchange_n(&slot->claim, &claim, (uint64_t)pos << 32,
+				     0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+
+/**
+ * @brief 受付列に書き込まれた要求を、書き込まれた順に読み出す。
+ *
+ * 取り消された順番と、取得したクライアントが書き込まずに終了した順番は
+ * 読み飛ばす。
+ *
+ * @param[out] batch 読み出した要求が反映される。
+ * @param[in]  max   batchに追加できる要求の数。
+ * @return 読み出した要求の数を返す。
+ */
+static size_t drain_ring(struct pending *batch, size_t max)
+{
+  size_t n = 0;
+  while (n < max) {
+    uint32_t pos = g_ring->tail;
+    struct ring_slot *slot = &(g_ring->slots[pos % RING_SIZE]);
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == pos) {
+      // 取得されていない場合は、まだ何も書き込まれていない。
+      if (__atomic_load_n(&g_ring->head, __ATOMIC_ACQUIRE) == pos ||
+	  !is_claim_stale(slot, pos))
+	break;
+      // 読み飛ばす前に書き込まれた場合は、読み出し直す。
+      if (__atomic_compare_exchange_n(&slot->seq, &seq, pos + RING_SIZE, 0,
+				      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	g_ring->tail = pos + 1;
+      continue;
+    }
+
+    if (seq == pos + RING_SIZE) {
+      // 読み出す前に取り消された。
+      g_ring->tail = pos + 1;
+      continue;
+    }
+
+    // 前の周回の結果が読まれていない場合は、まだ取得されていない。
+    if (seq != pos + 1)
+      break;
+    // 読み出す前に取り消された場合は、読み飛ばす。
+    if (!__atomic_compare_exchange_n(&slot->seq, &seq, pos + 2, 0,
+				     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      continue;
+    g_ring->tail = pos + 1;
+
+    struct pending *p = &batch[n];
+    p->req = slot->req;
+    if ((p->req.op != DAEMON_OP_ADD && p->req.op != DAEMON_OP_ACTIVATE) ||
+	p->req.len != 1) {
+      complete_slot(slot, DAEMON_ERROR);
+      continue;
+    }
+    p->sched = slot->sched;
+    p->fd = -1;
+    p->slot = slot;
+    sanitize_request(p);
+    n++;
+  }
+
+  return n;
+}
+
+
+/**
+ * @brief 結果を読まずに終了したクライアントの順番を、空きに戻す。
+ *
+ * 空きに戻さないと、次の周回でその順番を取得できず、受付列が満杯になる。
+ * 待機をやめたクライアントの順番も、同じく空きに戻す。クライアントが終了したかは、
+ * 順番のロックで調べる。
+ */
+static void reclaim_ring()
+{
+  int i;
+  for (i=0; i<RING_SIZE; i++) {
+    struct ring_slot *slot = &(g_ring->slots[i]);
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    uint64_t claim = __atomic_load_n(&slot->claim, __ATOMIC_ACQUIRE);
+    uint32_t pos = (uint32_t)(claim >> 32);
+    pid_t owner = (pid_t)(uint32_t)claim;
+    if (seq != pos + 2 || !__atomic_load_n(&slot->done, __ATOMIC_ACQUIRE) ||
+	(owner != 0 && is_slot_locked(slot)))
+      continue;
+
+    __atomic_compare_exchange_n(&slot->seq, &seq, pos + RING_SIZE, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  }
+}
+
+
+/**
+ * @brief 接続待ちになっている要求を、すべて受信する。
+ *
+ * 取得の要求は、その場で応答を送信する。
+ *
+ * @param[in]  lfd   要求を受け付けるソケット。O_NONBLOCKを設定しておく。
+ * @param[out] batch 受信した変更の要求が反映される。
+ * @param[in]  max   batchに追加できる要求の数。
+ * @return 受信した変更の要求の数、失敗時には-1を返す。
+ */
+static int accept_queued(int lfd, struct pending *batch, size_t max)
+{
+  size_t n = 0;
+  while (n < max && g_handoff == -1) {
+    int fd = accept(lfd, NULL, NULL);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+	continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+	break;
+      fprintf(stderr, "%s:%d: Error: accept() %s\n", __FILE__, __LINE__,
+	      strerror(errno));
+      return -1;
+    }
+
+    // O_NONBLOCKを引き継ぐ環境もあるため、解除しておく。
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    set_io_timeout(fd);
+
+    if (receive_request(fd, &batch[n]) != 0) {
+      close(fd);
+      continue;
+    }
+    n++;
+  }
+
+  return n;
+}
+
+
+/**
+ * @brief 要求を受け付け、変更の要求をまとめて処理する。
+ *
+ * 最初の要求が届くまで受付列で待ち、その後は受付列とソケットに届いている
+ * 要求と、windowミリ秒以内に届いた要求を、@link MAX_BATCH @endlink 個まで
+ * まとめる。ソケットで要求するクライアントも、接続後に受付列のdoorbellを
+ * 鳴らす。
+ *
+ * @param[in] lfd    要求を受け付けるソケット。
+ * @param[in] window まとめる要求を待つ時間(msec)。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int serve_batch(int lfd, unsigned int window)
+{
+  struct pending batch[MAX_BATCH];
+  size_t len = 0;
+  int ret = 0;
+
+  struct timespec first, idle;
+  clock_gettime(CLOCK_MONOTONIC, &idle);
+  while (len < MAX_BATCH && !g_quit && g_handoff == -1) {
+    uint32_t bell = __atomic_load_n(&g_ring->doorbell, __ATOMIC_SEQ_CST);
+
+    size_t n = drain_ring(&batch[len], MAX_BATCH - len);
+    int m = accept_queued(lfd, &batch[len+n], MAX_BATCH - len - n);
+    if (m == -1) {
+      ret = -1;
+      break;
+    }
+    if (len == 0 && n + m > 0)
+      clock_gettime(CLOCK_MONOTONIC, &first);
+    len += n + m;
+    if (n + m > 0)
+      continue;
+
+    // 変更の要求がない間も、取得の要求が続いてジョブの確認が遅れないよう、
+    // RING_IDLE_INTERVALごとに戻る。
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const struct timespec *since = (len > 0) ? &first : &idle;
+    long limit = (len > 0) ? (long)window : RING_IDLE_INTERVAL * 1000L;
+    long elapsed = (now.tv_sec - since->tv_sec) * 1000 +
+      (now.tv_nsec - since->tv_nsec) / 1000000;
+    if (elapsed >= limit) {
+      if (len == 0)
+	reclaim_ring();
+      break;
+    }
+    struct timespec timeout = {(limit - elapsed) / 1000,
+			       ((limit - elapsed) % 1000) * 1000000};
+
+    // 待機する前に鳴らされた場合は、doorbellが変わっているためすぐに戻る。
+    __atomic_store_n(&g_ring->sleeping, 1, __ATOMIC_SEQ_CST);
+    wait_word(&g_ring->doorbell, bell, &timeout);
+    __atomic_store_n(&g_ring->sleeping, 0, __ATOMIC_SEQ_CST);
+
+    if (len == 0 && __atomic_load_n(&g_ring->doorbell, __ATOMIC_SEQ_CST)
+	== bell) {
+      reclaim_ring();
+      break;
+    }
+  }
+
+  if (len > 0)
+    process_batch(batch, len);
+
+  // それぞれのクライアントに結果を返す。
+  size_t i;
+  for (i=0; i<len; i++) {
+    if (batch[i].slot != NULL) {
+      complete_slot(batch[i].slot, batch[i].status);
+    } else {
+      struct daemon_response res = {batch[i].status, 0};
+      write_full(batch[i].fd, &res, sizeof(res));
+      close(batch[i].fd);
+    }
+  }
+
+  return ret;
+}
+
+
+/**
+ * @brief 終了を指示するシグナルのハンドラ。
+ */
+static void quit_handler(int sig)
+{
+  (void)sig;
+  g_quit = 1;
+}
+
+
+/**
+ * @brief セマフォ取得待ちのタイムアウトを知らせるシグナルのハンドラ。
+ */
+static void alarm_handler(int sig)
+{
+  (void)sig;
+}
+
+
+/**
+ * @brief シグナルハンドラを設定する。
+ *
+ * ブロックしているシステムコールを中断させるため、SA_RESTARTは指定しない。
+ *
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int setup_signal_handler()
+{
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sigemptyset(&sa.sa_mask);
+
+  sa.sa_handler = quit_handler;
+  if (sigaction(SIGTERM, &sa, NULL) != 0 || sigaction(SIGINT, &sa, NULL) != 0
+      || sigaction(SIGHUP, &sa, NULL) != 0)
+    goto error;
+
+  sa.sa_handler = alarm_handler;
+  if (sigaction(SIGALRM, &sa, NULL) != 0)
+    goto error;
+
+  // 切断したクライアントへの送信で終了しないようにする。
+  sa.sa_handler = SIG_IGN;
+  if (sigaction(SIGPIPE, &sa, NULL) != 0)
+    goto error;
+
+  // ジョブの終了機能として送られる継続時間の変更の通知は、データベースを
+  // 読み直して反映するので無視する。
+  if (sigaction(RESIZE_SIGNO, &sa, NULL) != 0)
+    goto error;
+
+  // 起動したジョブは自動的には回収せず、run_jobs()が終了を確認してから
+  // 回収する。回収するまで、ジョブのpgid値は再利用されない。
+  sa.sa_handler = SIG_DFL;
+  if (sigaction(SIGCHLD, &sa, NULL) != 0)
+    goto error;
+
+  return 0;
+
+ error:
+  fprintf(stderr, "%s:%d: Error: %s\n", __FILE__, __LINE__, strerror(errno));
+  return -1;
+}
+
+
+/**
+ * @brief 要求を受け付けるソケットを作成する。
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @return 成功時はソケット、失敗時には-1を返す。
+ */
+static int open_listen_socket(const char *shm_name)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (get_socket_name(shm_name, 1, addr.sun_path) != 0)
+    return -1;
+
+  errno = 0;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    fprintf(stderr, "%s:%d: Error: socket() %s\n", __FILE__, __LINE__,
+	    strerror(errno));
+    return -1;
+  }
+
+  // 接続できる場合は、すでにデーモンが動いている。
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+    fprintf(stderr, "%s:%d: Error: Daemon is already running. %s\n",
+	    __FILE__, __LINE__, addr.sun_path);
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  // 強制終了したデーモンのソケットが残っていれば削除する。
+  unlink(addr.sun_path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    fprintf(stderr, "%s:%d: Error: socket() %s\n", __FILE__, __LINE__,
+	    strerror(errno));
+    return -1;
+  }
+
+  // データベースと同じく、所有者だけが読み書きできるようにする。
+  mode_t org = umask(S_IRWXG | S_IRWXO);
+  errno = 0;
+  int ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+  umask(org);
+  if (ret == -1 || listen(fd, LISTEN_BACKLOG) == -1) {
+    fprintf(stderr, "%s:%d: Error: %s. %s\n", __FILE__, __LINE__,
+	    strerror(errno), addr.sun_path);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+/**
+ * @brief 受付列を作成する。
+ *
+ * 強制終了したデーモンの受付列が残っていれば、初期化し直す。
+ *
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int create_ring(const char *shm_name)
+{
+  char name[NAME_MAX];
+  if (get_ring_name(shm_name, name) != 0)
+    return -1;
+
+  errno = 0;
+  int fd = shm_open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    fprintf(stderr, "%s:%d: Error: shm_open() %s\n", __FILE__, __LINE__,
+	    strerror(errno));
+    return -1;
+  }
+
+  errno = 0;
+  if (ftruncate(fd, sizeof(struct ring)) == -1) {
+    fprintf(stderr, "%s:%d: Error: ftruncate. %s\n", __FILE__, __LINE__,
+	    strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  void *addr = mmap(NULL, sizeof(struct ring), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "%s:%d: Error: mmap() %s.\n", __FILE__, __LINE__,
+	    strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  // クライアントのロックを調べるため、ファイル記述子は閉じない。
+  g_ring = addr;
+  g_ring_fd = fd;
+  memset(g_ring, 0, sizeof(struct ring));
+  int i;
+  for (i=0; i<RING_SIZE; i++) {
+    g_ring->slots[i].seq = i;
+    g_ring->slots[i].claim = (uint64_t)(uint32_t)(i - RING_SIZE) << 32;
+  }
+
+  // 初期化を終えてから、クライアントに受付を知らせる。
+  __atomic_store_n(&g_ring->daemon, getpid(), __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+
+/**
+ * @brief 動いているデーモンの受付列を、デーモン側で開く。
+ *
+ * 引き継ぐ場合に使う。順番は初期化せず、そのまま使い続ける。
+ *
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int open_ring(const char *shm_name)
+{
+  char name[NAME_MAX];
+  if (get_ring_name(shm_name, name) != 0)
+    return -1;
+
+  errno = 0;
+  int fd = shm_open(name, O_RDWR, 0);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1 || st.st_size != sizeof(struct ring)) {
+    fprintf(stderr, "%s:%d: Error: Failed to open ring. %s\n", __FILE__,
+	    __LINE__, strerror(errno));
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+
+  void *addr = mmap(NULL, sizeof(struct ring), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "%s:%d: Error: mmap() %s.\n", __FILE__, __LINE__,
+	    strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  // クライアントのロックを調べるため、ファイル記述子は閉じない。
+  g_ring = addr;
+  g_ring_fd = fd;
+
+  return 0;
+}
+
+
+/**
+ * @brief 受付列を削除する。
+ * @param[in] shm_name データベースの共有メモリ名。
+ */
+static void remove_ring(const char *shm_name)
+{
+  __atomic_store_n(&g_ring->daemon, 0, __ATOMIC_RELEASE);
+  munmap(g_ring, sizeof(struct ring));
+  close(g_ring_fd);
+  g_ring = NULL;
+  g_ring_fd = -1;
+
+  char name[NAME_MAX];
+  if (get_ring_name(shm_name, name) == 0)
+    shm_unlink(name);
+}
+
+
+/**
+ * @brief 受付列のデーモンが動いているかを確認する。
+ * @param[in] ring 受付列。
+ * @param[in] pid  確認するデーモンのpid。
+ * @return 動いている場合は1、それ以外の場合は0を返す。
+ */
+static int is_ring_alive(struct ring *ring, pid_t pid)
+{
+  return pid != 0 && __atomic_load_n(&ring->daemon, __ATOMIC_ACQUIRE) == pid
+    && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+
+/**
+ * @brief クライアント側で、受付列をマップする。
+ *
+ * マップした受付列は、プロセスが終了するまで使い回す。受付列のデーモンが
+ * 終了していれば、新しいデーモンの受付列をマップし直す。
+ *
+ * @param[in]  shm_name データベースの共有メモリ名。
+ * @param[out] ring     マップした受付列が反映される。
+ * @return 成功時は0、受付列が使えない場合は1を返す。
+ */
+static int map_ring(const char *shm_name, struct ring* *ring)
+{
+  char name[NAME_MAX];
+  if (get_ring_name(shm_name, name) != 0)
+    return 1;
+
+  if (g_client_ring != NULL) {
+    pid_t daemon = __atomic_load_n(&g_client_ring->daemon, __ATOMIC_ACQUIRE);
+    if (strcmp(g_client_ring_name, name) == 0 &&
+	is_ring_alive(g_client_ring, daemon)) {
+      *ring = g_client_ring;
+      return 0;
+    }
+    munmap(g_client_ring, sizeof(struct ring));
+    close(g_client_ring_fd);
+    g_client_ring = NULL;
+    g_client_ring_fd = -1;
+  }
+
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd == -1)
+    return 1;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size != sizeof(struct ring)) {
+    close(fd);
+    return 1;
+  }
+
+  void *addr = mmap(NULL, sizeof(struct ring), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    close(fd);
+    return 1;
+  }
+
+  // 順番のロックはファイル記述子を閉じると解放されるので、開いたままにする。
+  g_client_ring = addr;
+  g_client_ring_fd = fd;
+  strcpy(g_client_ring_name, name);
+  *ring = addr;
+
+  return 0;
+}
+
+
+/**
+ * @brief クライアント側で、順番のロックを確保または解放する。
+ * @param[in] ring 受付列。
+ * @param[in] slot 順番。
+ * @param[in] type F_WRLCKまたはF_UNLCK。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int lock_slot(const struct ring *ring, const struct ring_slot *slot,
+		     short type)
+{
+  struct flock fl;
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+  fl.l_start = (const char*)slot - (const char*)ring;
+  fl.l_len = sizeof(struct ring_slot);
+
+  return fcntl(g_client_ring_fd, F_SETLK, &fl);
+}
+
+
+/**
+ * @brief 受付列のdoorbellを鳴らし、待機しているデーモンを起こす。
+ * @param[in] ring 受付列。
+ */
+static void ring_doorbell(struct ring *ring)
+{
+  __atomic_add_fetch(&ring->doorbell, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST))
+    wake_word(&ring->doorbell);
+}
+
+
+/**
+ * @brief デーモンに接続する。
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @return 成功時はソケット、デーモンが動いていない場合は-1を返す。
+ */
+static int connect_daemon(const char *shm_name)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (get_socket_name(shm_name, 0, addr.sun_path) != 0)
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+
+  // 同じユーザーのデーモンにだけ依頼する。
+  pid_t pid;
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+      check_peer(fd, &pid) != 0) {
+    close(fd);
+    return -1;
+  }
+  set_io_timeout(fd);
+
+  // デーモンは受付列で待機しているため、接続したことを知らせる。
+  struct ring *ring;
+  if (map_ring(shm_name, &ring) == 0)
+    ring_doorbell(ring);
+
+  return fd;
+}
+
+
+/**
+ * @brief 引き継ぎを要求したデーモンに、ソケットを引き渡す。
+ *
+ * 受け取ったデーモンが受付列を引き継ぐまで待つ。その後に届いた要求は、
+ * 新しいデーモンが処理する。
+ *
+ * @param[in] lfd 要求を受け付けるソケット。
+ * @return 引き渡した場合は0、失敗した場合は-1を返す。
+ */
+static int hand_off(int lfd)
+{
+  int fd = g_handoff;
+  g_handoff = -1;
+
+  struct daemon_response res = {DAEMON_OK, 0};
+  struct iovec iov = {&res, sizeof(res)};
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &lfd, sizeof(int));
+
+  // 受付列のdaemon値が変わっていれば、引き継がれている。
+  char ack;
+  errno = 0;
+  int ret = -1;
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(res) ||
+      read_full(fd, &ack, sizeof(ack)) != 0 ||
+      __atomic_load_n(&g_ring->daemon, __ATOMIC_ACQUIRE) == getpid()) {
+    fprintf(stderr, "%s:%d: Error: Failed to hand off. %s\n", __FILE__,
+	    __LINE__, strerror(errno));
+  } else {
+    ret = 0;
+  }
+  close(fd);
+
+  return ret;
+}
+
+
+/**
+ * @brief 動いているデーモンから、ソケットと受付列を引き継ぐ。
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @return 引き継いだソケット、動いているデーモンがない場合は-1、失敗時には
+ * -2を返す。
+ */
+static int take_over(const char *shm_name)
+{
+  int fd = connect_daemon(shm_name);
+  if (fd == -1)
+    return -1;
+
+  struct daemon_request req = {DAEMON_OP_HANDOFF, getpgid(0), 0};
+  if (write_full(fd, &req, sizeof(req)) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  // 元のデーモンは、処理中の要求を返してから応答する。
+  struct daemon_response res;
+  struct iovec iov = {&res, sizeof(res)};
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  errno = 0;
+  ssize_t n = recvmsg(fd, &msg, MSG_WAITALL);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (n != sizeof(res) || res.status != DAEMON_OK || cmsg == NULL ||
+      cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+    fprintf(stderr, "%s:%d: Error: Failed to take over. %s\n", __FILE__,
+	    __LINE__, strerror(errno));
+    close(fd);
+    return -2;
+  }
+
+  int lfd;
+  memcpy(&lfd, CMSG_DATA(cmsg), sizeof(int));
+
+  // 受付列のdaemon値を変えてから知らせる。待機しているクライアントは、
+  // 新しいデーモンの完了を待ち続ける。
+  if (open_ring(shm_name) != 0) {
+    close(lfd);
+    close(fd);
+    return -2;
+  }
+  __atomic_store_n(&g_ring->daemon, getpid(), __ATOMIC_RELEASE);
+
+  char ack = 0;
+  write_full(fd, &ack, sizeof(ack));
+  close(fd);
+
+  return lfd;
+}
+
+
+int run_daemon(int argc, char* argv[])
+{
+  // オプションチェック
+  strcpy(g_db.sem_name, DEFAULT_SEMAPHORE_NAME);
+  strcpy(g_db.shm_name, DEFAULT_SHARED_MEMORY_NAME);
+  unsigned int window = 0;
+  int d_opt = 0, u_opt = 0;
+  switch (parse_arguments(argc, argv, &window, g_db.sem_name, g_db.shm_name,
+			  &d_opt, &u_opt, &verbose)) {
+  case 1:
+    return EXIT_SUCCESS;
+  case 2:
+    return EXIT_MISUSE;
+  }
+
+  // 'd'オプションが指定されていない場合は、環境変数を確認する。
+  if (!d_opt) {
+    if (get_env(g_db.sem_name, g_db.shm_name) != 0)
+      return EXIT_FAILURE;
+  }
+
+  if (verbose > 0) {
+    fprintf(stderr, "%s:%d: DEBUG: sem_name:%s shm_name:%s\n", __FILE__,
+	    __LINE__, g_db.sem_name, g_db.shm_name);
+  }
+
+  if (setup_signal_handler() != 0 || map_database(&g_db) != 0)
+    return EXIT_FAILURE;
+
+  // 置き換える場合は、動いているデーモンのソケットと受付列を引き継ぐ。
+  int lfd = u_opt ? take_over(g_db.shm_name) : -1;
+  int taken = (lfd >= 0);
+  if (lfd == -2)
+    return EXIT_FAILURE;
+  if (!taken) {
+    lfd = open_listen_socket(g_db.shm_name);
+    if (lfd == -1)
+      return EXIT_FAILURE;
+  }
+  if (verbose > 0 && taken)
+    fprintf(stderr, "%s:%d: DEBUG: Took over.\n", __FILE__, __LINE__);
+
+  // 受付列で待機している間も、ソケットの要求を確認できるようにする。
+  // 起動したジョブには、ソケットを引き継がない。
+  if (fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK) == -1 ||
+      fcntl(lfd, F_SETFD, FD_CLOEXEC) == -1 ||
+      (!taken && create_ring(g_db.shm_name) != 0)) {
+    close(lfd);
+    return EXIT_FAILURE;
+  }
+
+  // 終了を指示されるか、引き渡すまで、要求をまとめて処理する。
+  // 引き渡せなかった場合は、そのまま処理を続ける。
+  int ret = EXIT_SUCCESS, handed = 0;
+  process_jobs();
+  while (!g_quit && !handed) {
+    if (serve_batch(lfd, window) != 0) {
+      ret = EXIT_FAILURE;
+      break;
+    }
+    if (g_handoff != -1)
+      handed = (hand_off(lfd) == 0);
+    else
+      process_jobs();
+  }
+
+  // 引き渡した場合は、ソケットと受付列を新しいデーモンが使い続ける。
+  if (handed) {
+    munmap(g_ring, sizeof(struct ring));
+    close(g_ring_fd);
+    g_ring = NULL;
+    g_ring_fd = -1;
+  } else {
+    char name[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    if (get_socket_name(g_db.shm_name, 0, name) == 0)
+      unlink(name);
+    remove_ring(g_db.shm_name);
+
+    // 記録が残っても、読み込むコマンドはpid値と開始時刻で終了を判断する。
+    sem_t *sem;
+    if (g_db.addr != NULL && lock_semaphore(&g_db, &sem) == 0) {
+      withdraw_reaper(g_db.shm_name);
+      unlock_semaphore(sem);
+    }
+  }
+  close(lfd);
+
+  cleanup_schedules(g_db.scheds, g_db.len);
+  if (g_db.addr != NULL) {
+    munmap(g_db.addr, SHARED_MEMORY_SIZE);
+    close(g_db.fd);
+  }
+
+  return ret;
+}
+
+
+/**
+ * @brief 受付列でデーモンに変更を要求する。
+ *
+ * 順番を取得して要求を書き込み、その順番の完了語で結果を待つ。
+ *
+ * @param[in]  shm_name データベースの共有メモリ名。
+ * @param[in]  op       要求の種類。
+ * @param[in]  sched    要求のスケジュール。
+ * @param[out] status   処理の結果が反映される。
+ * @return 処理された場合は0、受付列が使えない場合は1を返す。
+ */
+static int request_by_ring(const char *shm_name, uint32_t op,
+			   const struct schedule *sched, int32_t *status)
+{
+  struct ring *ring;
+  if (map_ring(shm_name, &ring) != 0)
+    return 1;
+
+  pid_t daemon = __atomic_load_n(&ring->daemon, __ATOMIC_ACQUIRE);
+
+  // 空いている順番を取得する。満杯の場合はソケットで要求する。
+  struct ring_slot *slot;
+  uint32_t pos = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  for (;;) {
+    slot = &(ring->slots[pos % RING_SIZE]);
+    int32_t diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)
+			     - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 1,
+				      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	break;
+    } else if (diff < 0) {
+      return 1;
+    } else {
+      pos = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+  }
+
+  // 取得した直後に、ロックを確保して取得したことを記録する。読み飛ばされていた
+  // 場合は、書き込まずにソケットで要求する。
+  if (lock_slot(ring, slot, F_WRLCK) != 0)
+    return 1;
+  uint64_t claim = __atomic_load_n(&slot->claim, __ATOMIC_ACQUIRE);
+  do {
+    if ((int32_t)((uint32_t)(claim >> 32) - pos) >= 0) {
+      lock_slot(ring, slot, F_UNLCK);
+      return 1;
+    }
+  } while (!__atomic_compare_exchange_n(&slot->claim, &claim,
+					((uint64_t)pos << 32) |
+					(uint32_t)getpid(), 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos) {
+    lock_slot(ring, slot, F_UNLCK);
+    return 1;
+  }
+
+  slot->req.op = op;
+  slot->req.pgid = getpgid(0);
+  slot->req.len = 1;
+  slot->sched = *sched;
+  slot->done = 0;
+  slot->waiting = 0;
+  uint32_t seq = pos;
+  if (!__atomic_compare_exchange_n(&slot->seq, &seq, pos + 1, 0,
+				   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    lock_slot(ring, slot, F_UNLCK);
+    return 1;
+  }
+  ring_doorbell(ring);
+
+  // 処理は短時間で終わることが多いため、しばらくは待機せずに確認する。
+  int i;
+  for (i=0; i<RING_SPIN_COUNT; i++) {
+    if (__atomic_load_n(&slot->done, __ATOMIC_ACQUIRE))
+      break;
+  }
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += RING_REQUEST_TIMEOUT;
+
+  __atomic_store_n(&slot->waiting, 1, __ATOMIC_SEQ_CST);
+  while (!__atomic_load_n(&slot->done, __ATOMIC_SEQ_CST)) {
+    struct timespec timeout = {RING_IDLE_INTERVAL, 0};
+    wait_word(&slot->done, 0, &timeout);
+    if (__atomic_load_n(&slot->done, __ATOMIC_SEQ_CST))
+      break;
+
+    // デーモンが終了した場合、要求は処理されない。置き換えられた場合は、
+    // 新しいデーモンが処理する。
+    int give_up = 0;
+    if (!is_ring_alive(ring, daemon)) {
+      pid_t next = __atomic_load_n(&ring->daemon, __ATOMIC_ACQUIRE);
+      if (next == daemon || !is_ring_alive(ring, next))
+	give_up = 1;
+      daemon = next;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec >= deadline.tv_sec)
+      give_up = 1;
+    if (!give_up)
+      continue;
+
+    // 読み出される前なら取り消す。読み出された後なら、結果を読まずに
+    // 待機をやめたことを記録し、デーモンに順番を空きに戻させる。
+    seq = pos + 1;
+    if (!__atomic_compare_exchange_n(&slot->seq, &seq, pos + RING_SIZE, 0,
+				     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      __atomic_store_n(&slot->claim, (uint64_t)pos << 32, __ATOMIC_RELEASE);
+    lock_slot(ring, slot, F_UNLCK);
+    return 1;
+  }
+
+  // 次の周回で取得したクライアントがロックを確保できるように、先に解放する。
+  *status = slot->status;
+  lock_slot(ring, slot, F_UNLCK);
+  __atomic_store_n(&slot->seq, pos + RING_SIZE, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+
+/**
+ * @brief デーモンに変更を要求する。
+ *
+ * 受付列が使えない場合は、ソケットで要求する。
+ *
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @param[in] op       要求の種類。
+ * @param[in] sched    要求のスケジュール。
+ * @return 要求が成功した場合は0、それ以外の場合は1を返す。
+ */
+static int request_daemon(const char *shm_name, uint32_t op,
+			  const struct schedule *sched)
+{
+  int32_t status;
+  if (request_by_ring(shm_name, op, sched, &status) == 0)
+    return (status == DAEMON_OK) ? 0 : 1;
+
+  int fd = connect_daemon(shm_name);
+  if (fd == -1)
+    return 1;
+
+  struct daemon_request req = {op, getpgid(0), 1};
+  struct daemon_response res;
+  int ret = 1;
+  if (write_full(fd, &req, sizeof(req)) == 0 &&
+      write_full(fd, sched, sizeof(struct schedule)) == 0 &&
+      read_full(fd, &res, sizeof(res)) == 0 && res.status == DAEMON_OK)
+    ret = 0;
+  close(fd);
+
+  return ret;
+}
+
+
+int is_daemon_running(const char *shm_name)
+{
+  assert(shm_name != NULL);
+
+  struct ring *ring;
+  if (map_ring(shm_name, &ring) != 0)
+    return 0;
+
+  pid_t daemon = __atomic_load_n(&ring->daemon, __ATOMIC_ACQUIRE);
+  int alive = is_ring_alive(ring, daemon);
+  munmap(ring, sizeof(struct ring));
+
+  return alive;
+}
+
+
+int add_by_daemon(const char *shm_name, const struct schedule *sched)
+{
+  assert(shm_name != NULL && sched != NULL);
+
+  return request_daemon(shm_name, DAEMON_OP_ADD, sched);
+}
+
+
+int activate_by_daemon(const char *shm_name, const struct schedule *sched)
+{
+  assert(shm_name != NULL && sched != NULL);
+
+  return request_daemon(shm_name, DAEMON_OP_ACTIVATE, sched);
+}
+
+
+int list_by_daemon(const char *shm_name, struct schedule* *scheds,
+		   size_t scheds_len, size_t *loaded_len)
+{
+  assert(shm_name != NULL && scheds != NULL && loaded_len != NULL);
+
+  int fd = connect_daemon(shm_name);
+  if (fd == -1)
+    return 1;
+
+  struct daemon_request req = {DAEMON_OP_LIST, getpgid(0), 0};
+  struct daemon_response res;
+  if (write_full(fd, &req, sizeof(req)) != 0 ||
+      read_full(fd, &res, sizeof(res)) != 0 || res.status != DAEMON_OK ||
+      res.len >= scheds_len) {
+    close(fd);
+    return 1;
+  }
+
+  size_t i;
+  for (i=0; i<res.len; i++) {
+    scheds[i] = malloc(sizeof(struct schedule));
+    if (scheds[i] == NULL || read_full(fd, scheds[i], sizeof(struct schedule))
+	!= 0) {
+      cleanup_schedules(scheds, i + (scheds[i] != NULL));
+      close(fd);
+      return 1;
+    }
+  }
+  close(fd);
+  *loaded_len = res.len;
+
+  return 0;
+}
+
+
+int fetch_schedules(const char *shm_name, struct schedule* *scheds,
+		    size_t scheds_len, size_t *loaded_len)
+{
+  assert(shm_name != NULL && scheds != NULL && loaded_len != NULL);
+
+  if (list_by_daemon(shm_name, scheds, scheds_len, loaded_len) == 0)
+    return 0;
+
+  // デーモンが使えない場合は、共有メモリから直接読み込む。
+  return load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, scheds_len,
+			loaded_len);
+}
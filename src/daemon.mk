@@ -0,0 +1,8 @@
+OBJECTS += $(OBJ_DIR)/daemon.o
+
+$(OBJ_DIR)/daemon.o: $(SOURCE_DIR)/daemon.c \
+                     $(INCLUDE_DIR)/daemon.h \
+                     $(INCLUDE_DIR)/common.h \
+                     $(INCLUDE_DIR)/launcher.h \
+                     $(INCLUDE_DIR)/notify.h \
+                     $(INCLUDE_DIR)/reaper.h
\ No newline at end of file
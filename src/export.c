@@ -0,0 +1,207 @@
+/*
+ * export.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file export.c
+ * @brief データベースのスケジュールをまとめて書き出すコマンドに関する実装。
+ */
+
+#include "../include/export.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/common.h"
+#include "../include/lock.h"
+#include "../include/unlock.h"
+
+static int verbose = 0;
+
+
+/**
+ * @brief ヘルプをstderrに出力する。
+ */
+static void print_usage()
+{
+  const char *usage = "tm export [-d database] [-v] [-h]\n";
+
+  const char *description = "データベースのすべてのスケジュールを、"
+    "レコードの書式でstart値の昇順にstdoutに出力します。\n"
+    "\n"
+    "データベースをロックしてから読み込むので、出力はある時点の"
+    "データベースの内容と一致します。"
+    "スケジュールを持たないレコード(継続時間が0)は出力しません。"
+    "スケジュールIDとリーダーの開始時刻は、importコマンドが新しく記録する"
+    "ので出力しません。\n"
+    "\n"
+    "出力はimportコマンドでそのまま読み込めます。"
+    "他のデータベースへの移行や、resetした後の復元に使います。\n";
+
+  const char *optarg = "OPTIONS\n"
+    "\t-d database データベース番号(1-5が使用可能)\n"
+    "\t-v          verboseモード\n"
+    "\t-h          show this help message and exit\n";
+
+  const char *exit_status = "EXIT STATUS\n"
+    "\t0 正常終了\n"
+    "\t1 異常終了\n"
+    "\t2 使用方法に誤りがある場合\n";
+
+  const char *env = "ENVIRONMENT\n"
+    "\tTM_DB_NUM データベース番号(1-5が使用可能)。dオプションが指定された場合は、そちらが優先される。\n";
+
+  const char *example = "EXAMPLE\n"
+    "\tCopy all schedules in database 1 to database 2.\n"
+    "\t$ tm export -d 1 | tm import -d 2\n";
+
+  fprintf(stderr, "usage: %s\n%s\n%s\n%s\n%s\n%s\n", usage, description,
+	  optarg, exit_status, env, example);
+}
+
+
+/**
+ * @brief コマンドライン引数を解析する。
+ * @param[in]  argc     argc値
+ * @param[in]  argv     argv値
+ * @param[out] shm_name '-d'オプション(データベース番号)が反映される。
+ * @param[out] d_opt    '-d'オプション(データベース番号)が指定された場合、1が設定される。
+ * @param[out] verbose  '-v'オプション(verboseモード)の値が反映される。
+ * @return 成功時は0、'h'オプションが指定された場合は1、不正な値が与えられた場
+ * 合は2を返す。
+ */
+static int parse_arguments(int argc, char* *argv, char *shm_name, int *d_opt,
+			   int *verbose)
+{
+  // TimeManagerから呼ばれる場合、argvは{"tm", "export", "opt"...}となる。
+  // オプションを読み込むためには、optindを1つ進めて2にしておく必要がある。
+  opterr = 0;
+  optind = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:hv")) != -1) {
+    switch (opt) {
+    case 'd':
+      // データベース番号
+      if (atoi(optarg) < 1 || atoi(optarg) > MAX_NUM_DB) {
+	fprintf(stderr, "Error: Invalid database number. (Valid 1-%d)\n",
+		MAX_NUM_DB);
+	return 2;
+      }
+      strcat(shm_name, optarg);
+      *d_opt = 1;
+      break;
+    case 'h':
+      // ヘルプ
+      print_usage();
+      return 1;
+    case 'v':
+      // verboseモード
+      *verbose = 1;
+      break;
+    case '?':
+    default:
+      fprintf(stderr, "%s:%d: Error: Unknown option.\n", __FILE__, __LINE__);
+      return 2;
+    }
+  }
+
+  return 0;
+}
+
+
+int export(int argc, char* argv[])
+{
+  char shm_name[NAME_MAX] = DEFAULT_SHARED_MEMORY_NAME;
+  int d_opt = 0;
+
+  // オプションチェック
+  switch (parse_arguments(argc, argv, shm_name, &d_opt, &verbose)) {
+  case 1:
+    return EXIT_SUCCESS;
+  case 2:
+    return EXIT_MISUSE;
+  }
+
+  // 'd'オプションが指定されていない場合は、環境変数を確認する。
+  if (!d_opt) {
+    if (get_env(NULL, shm_name) != 0)
+      return EXIT_FAILURE;
+  }
+
+  const char *db = NULL;
+  if (d_opt)
+    db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+
+  // 書き込みの途中を読まないように、ロックしてから読み込む。
+  if (lock_database(db) != 0)
+    return EXIT_FAILURE;
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t len = 0;
+  if (load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		     &len) != 0) {
+    unlock_database(db);
+    return EXIT_FAILURE;
+  }
+
+  if (unlock_database(db) != 0) {
+    cleanup_schedules(scheds, len);
+    return EXIT_FAILURE;
+  }
+
+  sort_schedules(scheds, len);
+
+  int ret = EXIT_SUCCESS;
+  size_t i, n = 0;
+  for (i=0; i<len; i++) {
+    // ロックのためだけのレコードは出力しない。
+    if (scheds[i]->duration == 0)
+      continue;
+
+    // ロック、有効化の状態、スケジュールIDとリーダーの開始時刻は、この
+    // データベースでしか意味を持たない。
+    struct schedule s = *scheds[i];
+    s.lock = 0;
+    s.terminator = 0;
+    s.id = 0;
+    s.leader_start = 0;
+
+    char buff[MAX_RECORD_STRING_LEN+1];
+    if (record_to_string(&s, buff, sizeof(buff)) != 0) {
+      ret = EXIT_FAILURE;
+      break;
+    }
+    fprintf(stdout, "%s\n", buff);
+    n++;
+  }
+
+  cleanup_schedules(scheds, len);
+
+  if (fflush(stdout) != 0)
+    ret = EXIT_FAILURE;
+
+  if (verbose > 0)
+    fprintf(stderr, "%s:%d: DEBUG: exported:%zu\n", __FILE__, __LINE__, n);
+
+  return ret;
+}
@@ -0,0 +1,7 @@
+OBJECTS += $(OBJ_DIR)/export.o
+
+$(OBJ_DIR)/export.o: $(SOURCE_DIR)/export.c \
+                     $(INCLUDE_DIR)/export.h \
+                     $(INCLUDE_DIR)/common.h \
+                     $(INCLUDE_DIR)/lock.h \
+                     $(INCLUDE_DIR)/unlock.h
\ No newline at end of file
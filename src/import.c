@@ -0,0 +1,609 @@
+/*
+ * import.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file import.c
+ * @brief スケジュールをまとめて読み込むコマンドに関する実装。
+ */
+
+#include "../include/import.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/common.h"
+#include "../include/lock.h"
+#include "../include/notify.h"
+#include "../include/unlock.h"
+
+/** 重複するレコードがある場合の戻り値 */
+#define EXIT_CONFLICT 3
+
+/**
+ * @struct sweep_event
+ * @brief 重複の確認で走査する、スケジュールの開始または終了。
+ */
+struct sweep_event {
+  time_t time;  /**< 時刻 */
+  int delta;  /**< 開始の場合は1、終了の場合は-1 */
+  const struct schedule *sched;  /**< 対象のスケジュール */
+};
+
+static int verbose = 0;
+
+
+/**
+ * @brief ヘルプをstderrに出力する。
+ */
+static void print_usage()
+{
+  const char *usage = "tm import [-d database] [-v] [-h]\n";
+
+  const char *description = "stdinからレコードを読み込み、データベースに"
+    "まとめて追加します。レコードの書式はexportコマンドの出力と同じです。"
+    "空行と#で始まる行は読み飛ばします。\n"
+    "\n"
+    "読み込んだレコードはstart値でソートし、データベースのスケジュールと"
+    "重複しないかを確認します。1つでも重複する場合は、何も追加しません。"
+    "データベースに同じpgid値のスケジュールがある場合は、それらをすべて"
+    "置き換えます。同じpgid値のレコードが複数ある場合は、start値の順に"
+    "予約されたスケジュールとなります。スケジュールIDとリーダーの開始時刻は"
+    "新しく記録します。"
+    "ただし、有効にされたスケジュールは上書きできません。\n"
+    "\n"
+    "読み込んだレコードは、有効にされていない状態で追加されます。"
+    "終了したプロセスグループのレコードは、スケジュールを保持するためだけの"
+    "プロセスグループを作成して引き継ぎ、元のpgid値と新しいpgid値を "
+    "old:new の書式でstdoutに出力します。作成したプロセスグループは"
+    "スケジュールの終了時刻まで待機します。繰り返しスケジュールの場合は、"
+    "killpgで終了させるまで待機します。\n";
+
+  const char *optarg = "OPTIONS\n"
+    "\t-d database データベース番号(1-5が使用可能)\n"
+    "\t-v          verboseモード\n"
+    "\t-h          show this help message and exit\n";
+
+  const char *exit_status = "EXIT STATUS\n"
+    "\t0 正常終了\n"
+    "\t1 異常終了\n"
+    "\t2 使用方法に誤りがある場合\n"
+    "\t3 重複するレコードがある場合\n";
+
+  const char *env = "ENVIRONMENT\n"
+    "\tTM_DB_NUM データベース番号(1-5が使用可能)。dオプションが指定された場合は、そちらが優先される。\n";
+
+  const char *example = "EXAMPLE\n"
+    "\tRestore schedules after reset.\n"
+    "\t$ tm export > backup.txt\n"
+    "\t$ tm reset\n"
+    "\t$ tm import < backup.txt\n";
+
+  fprintf(stderr, "usage: %s\n%s\n%s\n%s\n%s\n%s\n", usage, description,
+	  optarg, exit_status, env, example);
+}
+
+
+/**
+ * @brief コマンドライン引数を解析する。
+ * @param[in]  argc     argc値
+ * @param[in]  argv     argv値
+ * @param[out] shm_name '-d'オプション(データベース番号)が反映される。
+ * @param[out] d_opt    '-d'オプション(データベース番号)が指定された場合、1が設定される。
+ * @param[out] verbose  '-v'オプション(verboseモード)の値が反映される。
+ * @return 成功時は0、'h'オプションが指定された場合は1、不正な値が与えられた場
+ * 合は2を返す。
+ */
+static int parse_arguments(int argc, char* *argv, char *shm_name, int *d_opt,
+			   int *verbose)
+{
+  // TimeManagerから呼ばれる場合、argvは{"tm", "import", "opt"...}となる。
+  // オプションを読み込むためには、optindを1つ進めて2にしておく必要がある。
+  opterr = 0;
+  optind = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:hv")) != -1) {
+    switch (opt) {
+    case 'd':
+      // データベース番号
+      if (atoi(optarg) < 1 || atoi(optarg) > MAX_NUM_DB) {
+	fprintf(stderr, "Error: Invalid database number. (Valid 1-%d)\n",
+		MAX_NUM_DB);
+	return 2;
+      }
+      strcat(shm_name, optarg);
+      *d_opt = 1;
+      break;
+    case 'h':
+      // ヘルプ
+      print_usage();
+      return 1;
+    case 'v':
+      // verboseモード
+      *verbose = 1;
+      break;
+    case '?':
+    default:
+      fprintf(stderr, "%s:%d: Error: Unknown option.\n", __FILE__, __LINE__);
+      return 2;
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief qsort()用の、pgid値を比較する関数。
+ */
+static int compare_pgid_val(const void *a, const void *b)
+{
+  pid_t x = (*(struct schedule**)a)->pgid;
+  pid_t y = (*(struct schedule**)b)->pgid;
+  return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief qsort()用の、走査するイベントを比較する関数。
+ *
+ * 同じ時刻では終了を先にする。終了時刻に始まるスケジュールは重ならない。
+ */
+static int compare_event_val(const void *a, const void *b)
+{
+  const struct sweep_event *x = a, *y = b;
+  if (x->time != y->time)
+    return (x->time > y->time) - (x->time < y->time);
+  return x->delta - y->delta;
+}
+
+
+/**
+ * @brief stdinからすべてのレコードを読み込む。
+ *
+ * lock値、terminator値は0にする。
+ *
+ * @param[out] records 読み込んだレコードが反映される。cleanup_schedules()と
+ * free()で解放する。
+ * @param[out] len     recordsの配列数が反映される。
+ * @return 成功時は0、失敗時には-1、レコードが不正な場合は1を返す。
+ */
+static int read_records(struct schedule* **records, size_t *len)
+{
+  char buf[MAX_SCHEDULE_STRING_LEN+1];
+  size_t cap = 0;
+  int line = 0;
+
+  *records = NULL;
+  *len = 0;
+  while (fgets(buf, MAX_SCHEDULE_STRING_LEN+1, stdin) != NULL) {
+    line++;
+    size_t n = strcspn(buf, "\n");
+    if (buf[n] != '\n' && !feof(stdin)) {
+      fprintf(stderr, "%s:%d: Error: Too long record. line:%d\n", __FILE__,
+	      __LINE__, line);
+      return 1;
+    }
+    buf[n] = '\0';
+    if (buf[0] == '\0' || buf[0] == HEADER_PREFIX)
+      continue;
+
+    struct schedule *s;
+    if (string_to_record(buf, &s) != 0) {
+      fprintf(stderr, "%s:%d: Error: Invalid record. line:%d\n", __FILE__,
+	      __LINE__, line);
+      return 1;
+    }
+
+    if (s->duration == 0) {
+      fprintf(stderr, "%s:%d: Error: Invalid duration. line:%d\n", __FILE__,
+	      __LINE__, line);
+      free(s);
+      return 1;
+    }
+
+    s->lock = 0;
+    s->terminator = 0;
+    s->id = 0;
+    s->leader_start = 0;
+
+    if (*len == cap) {
+      cap = (cap == 0) ? 256 : cap * 2;
+      struct schedule* *p = realloc(*records, cap * sizeof(struct schedule*));
+      if (p == NULL) {
+	fprintf(stderr, "%s:%d: Error: Faild to allocate memory.\n", __FILE__,
+		__LINE__);
+	free(s);
+	return -1;
+      }
+      *records = p;
+    }
+    (*records)[(*len)++] = s;
+  }
+
+  if (ferror(stdin)) {
+    fprintf(stderr, "%s:%d: Error: Reading stdin.\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief スケジュールが、繰り返し、資源を持たない単純なものか調べる。
+ */
+static int is_simple_schedule(const struct schedule *s)
+{
+  return (s->rule[0] == '\0' && s->resources[0] == '\0');
+}
+
+
+/**
+ * @brief 開始と終了を時刻順に1度走査して、同時に重なる数がcapacityを超え
+ * ないか確認する。
+ *
+ * すべてのスケジュールがis_simple_schedule()を満たす場合に使う。
+ *
+ * @param[in]  scheds   スケジュール群。
+ * @param[in]  len      schedsの配列数。
+ * @param[in]  capacity データベースのcapacity。
+ * @param[out] conflict 超えた場合、超えたときに開始したスケジュールが反映される。
+ * @return 超えない場合は0、超える場合は1、失敗時には-1を返す。
+ */
+static int sweep_schedules(struct schedule* *scheds, size_t len,
+			   unsigned int capacity,
+			   const struct schedule* *conflict)
+{
+  struct sweep_event *events = malloc(len * 2 * sizeof(struct sweep_event));
+  if (events == NULL) {
+    fprintf(stderr, "%s:%d: Error: Faild to allocate memory.\n", __FILE__,
+	    __LINE__);
+    return -1;
+  }
+
+  size_t i, n = 0;
+  for (i=0; i<len; i++) {
+    // ロックのためだけのレコードは、どのスケジュールとも重ならない。
+    if (scheds[i]->duration == 0)
+      continue;
+
+    struct sweep_event start = {scheds[i]->start, 1, scheds[i]};
+    struct sweep_event end = {scheds[i]->start + scheds[i]->duration, -1,
+			      scheds[i]};
+    events[n++] = start;
+    events[n++] = end;
+  }
+  qsort(events, n, sizeof(struct sweep_event), compare_event_val);
+
+  int ret = 0;
+  unsigned int count = 0;
+  for (i=0; i<n; i++) {
+    count += events[i].delta;
+    if (events[i].delta > 0 && count > capacity) {
+      *conflict = events[i].sched;
+      ret = 1;
+      break;
+    }
+  }
+
+  free(events);
+
+  return ret;
+}
+
+
+/**
+ * @brief 読み込んだレコードを1つずつ、既存と追加済みのスケジュールで確認する。
+ *
+ * 繰り返し、資源を持つスケジュールがある場合に使う。
+ *
+ * @param[in]  records  読み込んだレコード群。start値でソートしておく。
+ * @param[in]  len      recordsの配列数。
+ * @param[in]  pool     既存のスケジュール群。確認したレコードが追加される。
+ * len個分の領域を余分に確保しておく。
+ * @param[in]  pool_len poolの配列数。
+ * @param[in]  capacity データベースのcapacity。
+ * @param[out] conflict 重複した場合、重複したレコードが反映される。
+ * @return 重複しない場合は0、重複する場合は1、失敗時には-1を返す。
+ */
+static int check_records(struct schedule* *records, size_t len,
+			 struct schedule* *pool, size_t pool_len,
+			 unsigned int capacity,
+			 const struct schedule* *conflict)
+{
+  size_t i;
+  for (i=0; i<len; i++) {
+    int ret = check_sched_capacity(records[i], pool, pool_len, capacity);
+    if (ret != 0) {
+      *conflict = records[i];
+      return ret;
+    }
+    pool[pool_len++] = records[i];
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief 終了したプロセスグループのレコードを、spawn_holder()で作成した
+ * プロセスグループに引き継がせる。
+ *
+ * そのままではload_schedules()で取り除かれるので、保存する前に呼び出す。
+ * 失敗した場合は、作成したプロセスグループを終了させる。
+ *
+ * @param[in,out] records  読み込んだレコード群。
+ * @param[in]     len      recordsの配列数。
+ * @param[out]    old      引き継いだレコードの元のpgid値が反映される。
+ * @param[out]    holders  作成したプロセスグループのpgid値が反映される。
+ * @param[out]    nholders 作成したプロセスグループの数が反映される。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int adopt_orphans(struct schedule* *records, size_t len, pid_t *old,
+			 pid_t *holders, size_t *nholders)
+{
+  *nholders = 0;
+
+  size_t i, j, k;
+  for (i=0; i<len; i++) {
+    struct schedule *s = records[i];
+
+    // 同じプロセスグループのレコードは、同じプロセスグループに引き継ぐ。
+    for (k=0; k<*nholders && old[k] != s->pgid; k++)
+      ;
+    if (k < *nholders) {
+      s->pgid = holders[k];
+      continue;
+    }
+
+    if (killpg(s->pgid, 0) == 0 || errno != ESRCH)
+      continue;
+
+    // 伸縮するスケジュールは、最大まで延長されても保持できるようにする。
+    // 繰り返しのスケジュールがある場合は、終了しない。
+    time_t end = 0;
+    int forever = 0;
+    for (j=i; j<len; j++) {
+      const struct schedule *r = records[j];
+      if (r->pgid != s->pgid)
+	continue;
+      if (r->rule[0] != '\0')
+	forever = 1;
+      time_t e = r->start + ((r->max_duration > r->duration) ? r->max_duration
+			     : r->duration);
+      if (e > end)
+	end = e;
+    }
+
+    pid_t pgid;
+    if (spawn_holder(forever ? 0 : end, &pgid) != 0) {
+      while (*nholders > 0)
+	killpg(holders[--(*nholders)], SIGTERM);
+      return -1;
+    }
+    old[*nholders] = s->pgid;
+    holders[(*nholders)++] = pgid;
+    s->pgid = pgid;
+  }
+
+  return 0;
+}
+
+
+int import(int argc, char* argv[])
+{
+  char shm_name[NAME_MAX] = DEFAULT_SHARED_MEMORY_NAME;
+  int d_opt = 0;
+
+  // オプションチェック
+  switch (parse_arguments(argc, argv, shm_name, &d_opt, &verbose)) {
+  case 1:
+    return EXIT_SUCCESS;
+  case 2:
+    return EXIT_MISUSE;
+  }
+
+  // 'd'オプションが指定されていない場合は、環境変数を確認する。
+  if (!d_opt) {
+    if (get_env(NULL, shm_name) != 0)
+      return EXIT_FAILURE;
+  }
+
+  // ロックする前に、すべてのレコードを読み込んでおく。
+  struct schedule* *records;
+  size_t len;
+  int ret = read_records(&records, &len);
+  if (ret != 0) {
+    if (records != NULL)
+      cleanup_schedules(records, len);
+    free(records);
+    return (ret == 1) ? EXIT_MISUSE : EXIT_FAILURE;
+  }
+
+  if (len == 0) {
+    free(records);
+    return EXIT_SUCCESS;
+  }
+
+  // 既存のスケジュールと同じpgid値のレコードを探せるようにしておく。
+  size_t i;
+  qsort(records, len, sizeof(struct schedule*), compare_pgid_val);
+
+  if (len + 1 >= MAX_NUM_SCHEDULES) {
+    fprintf(stderr, "%s:%d: Error: Too many records.\n", __FILE__, __LINE__);
+    cleanup_schedules(records, len);
+    free(records);
+    return EXIT_FAILURE;
+  }
+
+  const char *db = NULL;
+  if (d_opt)
+    db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+
+  if (lock_database(db) != 0) {
+    cleanup_schedules(records, len);
+    free(records);
+    return EXIT_FAILURE;
+  }
+
+  // 既存のスケジュールの後ろに、読み込んだレコードを並べる。
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  static pid_t old[MAX_NUM_SCHEDULES], holders[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0, kept = 0, nholders = 0;
+  unsigned int capacity;
+  time_t released_start = 0, released_end = 0;
+  int simple = 1;
+  if (get_capacity(shm_name, &capacity) != 0 ||
+      load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		     &scheds_len) != 0) {
+    ret = EXIT_FAILURE;
+    goto cleanup;
+  }
+
+  // 読み込んだレコードと同じpgid値の既存のスケジュールは、上書きされる。
+  for (i=0; i<scheds_len; i++) {
+    struct schedule *s = scheds[i];
+    struct schedule key = {.pgid = s->pgid}, *pkey = &key;
+    struct schedule* *found = bsearch(&pkey, records, len,
+				      sizeof(struct schedule*),
+				      compare_pgid_val);
+    if (found == NULL) {
+      simple = simple && (s->duration == 0 || is_simple_schedule(s));
+      scheds[kept++] = s;
+      continue;
+    }
+
+    if (s->terminator != 0) {
+      fprintf(stderr, "%s:%d: Error: Schedule is already activated. pgid:%d\n",
+	      __FILE__, __LINE__, s->pgid);
+      scheds_len = kept + (scheds_len - i);
+      memmove(&scheds[kept], &scheds[i], (scheds_len - kept) * sizeof(scheds[0]));
+      ret = EXIT_CONFLICT;
+      goto cleanup;
+    }
+
+    // ロックは、そのプロセスグループで最も早いレコードが引き継ぐ。
+    // 同じpgid値のレコードは、recordsの中で連続している。
+    if (s->lock == 1) {
+      struct schedule* *head = found,* *p = found;
+      while (p > records && (*(p-1))->pgid == s->pgid)
+	p--;
+      for (; p < records + len && (*p)->pgid == s->pgid; p++) {
+	if ((*p)->start < (*head)->start)
+	  head = p;
+      }
+      (*head)->lock = 1;
+    }
+
+    if (s->duration != 0) {
+      time_t end = s->start + s->duration;
+      if (s->rule[0] != '\0')
+	end += RECUR_HORIZON;
+      if (released_end == 0 || s->start < released_start)
+	released_start = s->start;
+      if (end > released_end)
+	released_end = end;
+    }
+    free(s);
+  }
+  scheds_len = kept;
+
+  if (scheds_len + len + 1 >= MAX_NUM_SCHEDULES) {
+    fprintf(stderr, "%s:%d: Error: Database is full.\n", __FILE__, __LINE__);
+    ret = EXIT_FAILURE;
+    goto cleanup;
+  }
+
+  sort_schedules(records, len);
+  for (i=0; i<len; i++)
+    simple = simple && is_simple_schedule(records[i]);
+
+  if (verbose > 0) {
+    fprintf(stderr, "%s:%d: DEBUG: existing:%zu records:%zu simple:%d\n",
+	    __FILE__, __LINE__, scheds_len, len, simple);
+  }
+
+  // 単純なスケジュールだけの場合は、まとめて1度走査する。それ以外は、
+  // 繰り返しと資源を考慮して1つずつ確認する。
+  const struct schedule *conflict = NULL;
+  int checked;
+  if (simple) {
+    memcpy(&scheds[scheds_len], records, len * sizeof(scheds[0]));
+    checked = sweep_schedules(scheds, scheds_len + len, capacity, &conflict);
+  } else {
+    checked = check_records(records, len, scheds, scheds_len, capacity,
+			    &conflict);
+  }
+  if (checked != 0) {
+    if (checked == 1) {
+      char buff[MAX_RECORD_STRING_LEN+1];
+      if (record_to_string(conflict, buff, sizeof(buff)) == 0)
+	fprintf(stderr, "%s:%d: Error: Conflict. \"%s\"\n", __FILE__, __LINE__,
+		buff);
+    }
+    ret = (checked == 1) ? EXIT_CONFLICT : EXIT_FAILURE;
+    goto cleanup;
+  }
+
+  if (adopt_orphans(records, len, old, holders, &nholders) != 0) {
+    ret = EXIT_FAILURE;
+    goto cleanup;
+  }
+
+  // 読み込んだレコードの所有は、schedsに移る。
+  memcpy(&scheds[scheds_len], records, len * sizeof(scheds[0]));
+  scheds_len += len;
+  len = 0;
+
+  if (save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, scheds_len) != 0) {
+    for (i=0; i<nholders; i++)
+      killpg(holders[i], SIGTERM);
+    ret = EXIT_FAILURE;
+    goto cleanup;
+  }
+  ret = EXIT_SUCCESS;
+
+  for (i=0; i<nholders; i++)
+    fprintf(stdout, "%d:%d\n", old[i], holders[i]);
+  fflush(stdout);
+  if (verbose > 0) {
+    fprintf(stderr, "%s:%d: DEBUG: adopted:%zu\n", __FILE__, __LINE__,
+	    nholders);
+  }
+
+ cleanup:
+  cleanup_schedules(scheds, scheds_len);
+  cleanup_schedules(records, len);
+  free(records);
+
+  if (unlock_database(db) != 0)
+    ret = EXIT_FAILURE;
+
+  if (ret == EXIT_SUCCESS && released_end != 0)
+    notify_release(shm_name, released_start, released_end);
+
+  return ret;
+}
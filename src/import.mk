@@ -0,0 +1,8 @@
+OBJECTS += $(OBJ_DIR)/import.o
+
+$(OBJ_DIR)/import.o: $(SOURCE_DIR)/import.c \
+                     $(INCLUDE_DIR)/import.h \
+                     $(INCLUDE_DIR)/common.h \
+                     $(INCLUDE_DIR)/lock.h \
+                     $(INCLUDE_DIR)/notify.h \
+                     $(INCLUDE_DIR)/unlock.h
\ No newline at end of file
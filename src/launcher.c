@@ -0,0 +1,712 @@
+/*
+ * launcher.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file launcher.c
+ * @brief デーモンが予約されたコマンドを起動する機能(起動機能)に関する実装。
+ */
+
+#include "../include/launcher.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "../include/notify.h"
+
+/** 書きかけとみなし、削除しない一時ファイルの経過時間(sec) */
+#define SPOOL_TMP_AGE 60
+
+/**
+ * @struct leader
+ * @brief 起動したジョブのプロセスグループのリーダー。
+ */
+struct leader {
+  pid_t pid;  /**< pid値。プロセスグループのpgid値と同じ */
+  int pidfd;  /**< 終了を確認するpidfd。使えない環境では-1 */
+  int child;  /**< 自分が起動し、回収する子プロセスの場合は1 */
+};
+
+/** 終了を確認しているリーダーの一覧 */
+static struct leader g_leaders[MAX_NUM_SCHEDULES];
+
+/** g_leadersの要素数 */
+static size_t g_num_leaders = 0;
+
+
+/**
+ * @brief スプールディレクトリを確認する。
+ *
+ * スプールファイルのコマンドはデーモンの権限で起動されるため、他の
+ * ユーザーが作成したり、読み書きできたりするディレクトリは使わない。
+ *
+ * @param[in] dir    ディレクトリのパス。
+ * @param[in] create ディレクトリがない場合に作成する場合は1。
+ * @return 使える場合は0、使えない場合は-1を返す。
+ */
+static int check_spool_dir(const char *dir, int create)
+{
+  errno = 0;
+  if (create && mkdir(dir, S_IRWXU) == -1 && errno != EEXIST) {
+    fprintf(stderr, "%s:%d: Error: mkdir() %s. %s\n", __FILE__, __LINE__,
+	    strerror(errno), dir);
+    return -1;
+  }
+
+  struct stat st;
+  if (lstat(dir, &st) == -1)
+    return -1;
+
+  if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() ||
+      (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+    fprintf(stderr, "%s:%d: Error: Unsafe spool directory. %s\n", __FILE__,
+	    __LINE__, dir);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief データベースの共有メモリ名から、スプールディレクトリ名を作成する。
+ * @param[in]  shm_name データベースの共有メモリ名。
+ * @param[in]  create   ディレクトリがない場合に作成する場合は1。
+ * @param[out] dir      スプールディレクトリ名が反映される。PATH_MAXの領域が必要。
+ * @return 成功時は0、名前が長すぎる場合やディレクトリが使えない場合は-1を
+ * 返す。
+ */
+static int get_spool_dir(const char *shm_name, int create, char *dir)
+{
+  int n = snprintf(dir, PATH_MAX, "%s%u", DEFAULT_SPOOL_DIR,
+		   (unsigned int)getuid());
+  if (n < 0 || n >= PATH_MAX) {
+    fprintf(stderr, "%s:%d: Error: Too long spool directory.\n", __FILE__,
+	    __LINE__);
+    return -1;
+  }
+
+  if (check_spool_dir(dir, create) != 0)
+    return -1;
+
+  // データベース番号は、共有メモリ名の末尾に付加されている。
+  const char *db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+  int m = snprintf(dir + n, PATH_MAX - n, "/%s", db);
+  if (m < 0 || m >= PATH_MAX - n) {
+    fprintf(stderr, "%s:%d: Error: Too long spool directory.\n", __FILE__,
+	    __LINE__);
+    return -1;
+  }
+
+  return check_spool_dir(dir, create);
+}
+
+
+/**
+ * @brief ジョブのスプールファイル名を作成する。
+ * @param[in]  shm_name データベースの共有メモリ名。
+ * @param[in]  id       ジョブのスケジュールID。
+ * @param[in]  suffix   末尾に付加する文字列。
+ * @param[in]  create   スプールディレクトリがない場合に作成する場合は1。
+ * @param[out] path     スプールファイル名が反映される。PATH_MAXの領域が必要。
+ * @return 成功時は0、名前が長すぎる場合やディレクトリが使えない場合は-1を
+ * 返す。
+ */
+static int get_spool_path(const char *shm_name, uint64_t id,
+			  const char *suffix, int create, char *path)
+{
+  char dir[PATH_MAX];
+  if (get_spool_dir(shm_name, create, dir) != 0)
+    return -1;
+
+  int n = snprintf(path, PATH_MAX, "%s/%" PRIu64 "%s", dir, id, suffix);
+  if (n < 0 || n >= PATH_MAX) {
+    fprintf(stderr, "%s:%d: Error: Too long spool file name.\n", __FILE__,
+	    __LINE__);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief 文字列を終端文字まで書き込む。
+ * @param[in] fp  書き込み先。
+ * @param[in] str 書き込む文字列。
+ */
+static void write_field(FILE *fp, const char *str)
+{
+  fwrite(str, 1, strlen(str) + 1, fp);
+}
+
+
+pid_t job_pgid(uint64_t id)
+{
+  return -(pid_t)(1 + (id - 1) % INT_MAX);
+}
+
+
+int spool_job(const char *shm_name, uint64_t id, const struct job *job)
+{
+  assert(shm_name != NULL && job != NULL && job->argv[0] != NULL);
+
+  char tmp[PATH_MAX];
+  if (get_spool_path(shm_name, id, ".tmp", 1, tmp) != 0)
+    return -1;
+
+  // 環境変数を含むので、自分だけが読めるようにする。
+  errno = 0;
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  FILE *fp = (fd == -1) ? NULL : fdopen(fd, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "%s:%d: Error: open() %s. %s\n", __FILE__, __LINE__,
+	    strerror(errno), tmp);
+    if (fd != -1)
+      close(fd);
+    unlink(tmp);
+    return -1;
+  }
+
+  // 作業ディレクトリ、リダイレクト先、引数の数、引数、環境変数の順に、
+  // 終端文字で区切って書き込む。
+  int argc;
+  for (argc=0; job->argv[argc] != NULL; argc++)
+    ;
+  char num[16];
+  snprintf(num, sizeof(num), "%d", argc);
+
+  write_field(fp, job->cwd);
+  write_field(fp, job->in);
+  write_field(fp, job->out);
+  write_field(fp, job->err);
+  write_field(fp, num);
+
+  int i;
+  for (i=0; i<argc; i++)
+    write_field(fp, job->argv[i]);
+  for (i=0; job->envp[i] != NULL; i++)
+    write_field(fp, job->envp[i]);
+
+  int failed = ferror(fp);
+  if (fclose(fp) != 0 || failed) {
+    fprintf(stderr, "%s:%d: Error: Failed to write spool file. %s\n",
+	    __FILE__, __LINE__, tmp);
+    unlink(tmp);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int publish_spool(const char *shm_name, uint64_t id)
+{
+  assert(shm_name != NULL);
+
+  char path[PATH_MAX], tmp[PATH_MAX];
+  if (get_spool_path(shm_name, id, "", 0, path) != 0 ||
+      get_spool_path(shm_name, id, ".tmp", 0, tmp) != 0)
+    return -1;
+
+  errno = 0;
+  if (rename(tmp, path) == -1) {
+    fprintf(stderr, "%s:%d: Error: rename() %s. %s\n", __FILE__, __LINE__,
+	    strerror(errno), path);
+    unlink(tmp);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void unspool_job(const char *shm_name, uint64_t id)
+{
+  assert(shm_name != NULL);
+
+  char path[PATH_MAX];
+  if (get_spool_path(shm_name, id, "", 0, path) == 0)
+    unlink(path);
+  if (get_spool_path(shm_name, id, ".tmp", 0, path) == 0)
+    unlink(path);
+}
+
+
+/**
+ * @brief スプールファイルからジョブを読み込む。
+ * @param[in]  path スプールファイル名。
+ * @param[out] buf  ファイルの内容が反映される。jobの文字列はこの領域を指す。
+ * 使い終わったらfree()で解放する。
+ * @param[out] job  読み込んだジョブが反映される。argv、envpは使い終わったら
+ * free()で解放する。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int load_job(const char *path, char* *buf, struct job *job)
+{
+  errno = 0;
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "%s:%d: Error: fopen() %s. %s\n", __FILE__, __LINE__,
+	    strerror(errno), path);
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fileno(fp), &st) == -1 || st.st_uid != getuid()) {
+    fprintf(stderr, "%s:%d: Error: Unsafe spool file. %s\n", __FILE__,
+	    __LINE__, path);
+    fclose(fp);
+    return -1;
+  }
+
+  // 最後の文字列が終端していなくても読めるように、終端文字を加える。
+  *buf = malloc(st.st_size + 1);
+  if (*buf == NULL) {
+    fprintf(stderr, "%s:%d: Error: Faild to allocate memory.\n", __FILE__,
+	    __LINE__);
+    fclose(fp);
+    return -1;
+  }
+  size_t size = fread(*buf, 1, st.st_size, fp);
+  fclose(fp);
+  (*buf)[size] = '\0';
+
+  const char *end = *buf + size;
+  char *fields[5];
+  char *p = *buf;
+  int i;
+  for (i=0; i<5; i++) {
+    if (p >= end)
+      goto error;
+    fields[i] = p;
+    p += strlen(p) + 1;
+  }
+
+  int argc = atoi(fields[4]);
+  int envc = 0;
+  char *q;
+  for (q=p, i=0; q < end; q += strlen(q) + 1, i++) {
+    if (i >= argc)
+      envc++;
+  }
+  if (argc <= 0 || i < argc)
+    goto error;
+
+  job->argv = malloc((argc + 1) * sizeof(char*));
+  job->envp = malloc((envc + 1) * sizeof(char*));
+  if (job->argv == NULL || job->envp == NULL) {
+    free(job->argv);
+    free(job->envp);
+    goto error;
+  }
+
+  for (i=0; i<argc + envc; i++, p += strlen(p) + 1) {
+    if (i < argc)
+      job->argv[i] = p;
+    else
+      job->envp[i - argc] = p;
+  }
+  job->argv[argc] = NULL;
+  job->envp[envc] = NULL;
+
+  job->cwd = fields[0];
+  job->in = fields[1];
+  job->out = fields[2];
+  job->err = fields[3];
+
+  return 0;
+
+ error:
+  fprintf(stderr, "%s:%d: Error: Invalid spool file. %s\n", __FILE__,
+	  __LINE__, path);
+  free(*buf);
+  return -1;
+}
+
+
+/**
+ * @brief ジョブを新しいプロセスグループで起動する。
+ *
+ * デーモンが変更したシグナルの処理は、デフォルトに戻してから起動する。
+ *
+ * @param[in]  job 起動するジョブ。
+ * @param[out] pid 起動したプロセスのpid値が反映される。プロセスグループの
+ * pgid値と同じ。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int spawn_job(const struct job *job, pid_t *pid)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attr);
+
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, job->in, O_RDONLY,
+				   0);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, job->out,
+				   O_WRONLY | O_CREAT | O_APPEND,
+				   S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, job->err,
+				   O_WRONLY | O_CREAT | O_APPEND,
+				   S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+  sigset_t mask, def;
+  sigemptyset(&mask);
+  sigemptyset(&def);
+  sigaddset(&def, SIGTERM);
+  sigaddset(&def, SIGINT);
+  sigaddset(&def, SIGHUP);
+  sigaddset(&def, SIGALRM);
+  sigaddset(&def, SIGPIPE);
+  sigaddset(&def, SIGCHLD);
+  sigaddset(&def, RESIZE_SIGNO);
+  posix_spawnattr_setsigmask(&attr, &mask);
+  posix_spawnattr_setsigdefault(&attr, &def);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+			   POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+  // 作業ディレクトリは、起動する間だけデーモンのものを変える。
+  int ret = -1;
+  int cwd = open(".", O_RDONLY);
+  if (cwd == -1 || chdir(job->cwd) == -1) {
+    fprintf(stderr, "%s:%d: Error: chdir() %s. %s\n", __FILE__, __LINE__,
+	    strerror(errno), job->cwd);
+  } else {
+    int err = posix_spawn(pid, job->argv[0], &actions, &attr, job->argv,
+			  job->envp);
+    if (err != 0)
+      fprintf(stderr, "%s:%d: Error: posix_spawn() %s. %s\n", __FILE__,
+	      __LINE__, strerror(err), job->argv[0]);
+    else
+      ret = 0;
+  }
+  if (cwd != -1) {
+    if (fchdir(cwd) == -1)
+      fprintf(stderr, "%s:%d: Error: fchdir() %s.\n", __FILE__, __LINE__,
+	      strerror(errno));
+    close(cwd);
+  }
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+
+  return ret;
+}
+
+
+/**
+ * @brief スプールファイルのジョブを起動する。
+ * @param[in]  shm_name データベースの共有メモリ名。
+ * @param[in]  id       ジョブのスケジュールID。
+ * @param[out] pid      起動したプロセスのpid値が反映される。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int launch_job(const char *shm_name, uint64_t id, pid_t *pid)
+{
+  char path[PATH_MAX];
+  if (get_spool_path(shm_name, id, "", 0, path) != 0)
+    return -1;
+
+  char *buf;
+  struct job job;
+  if (load_job(path, &buf, &job) != 0)
+    return -1;
+
+  int ret = spawn_job(&job, pid);
+
+  free(job.argv);
+  free(job.envp);
+  free(buf);
+
+  return ret;
+}
+
+
+/**
+ * @brief スケジュールのないスプールファイルを削除する。
+ *
+ * runコマンドの途中で終了した場合や、起動前にスケジュールを削除された
+ * 場合に残る。書き込み中のrunコマンドのものかもしれないので、新しい
+ * 一時ファイルは削除しない。
+ *
+ * @param[in] shm_name データベースの共有メモリ名。
+ * @param[in] scheds   データベースのスケジュール群。
+ * @param[in] len      schedsの配列数。
+ */
+static void remove_orphan_spools(const char *shm_name,
+				 struct schedule* *scheds, size_t len)
+{
+  char dir[PATH_MAX];
+  if (get_spool_dir(shm_name, 0, dir) != 0)
+    return;
+
+  DIR *d = opendir(dir);
+  if (d == NULL)
+    return;
+
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    if (e->d_name[0] == '.')
+      continue;
+
+    char *endptr;
+    uint64_t id = strtoull(e->d_name, &endptr, 10);
+    struct schedule *s;
+    if (*endptr == '\0' && id != 0 &&
+	find_sched_by_id(id, scheds, len, &s) == 0)
+      continue;
+
+    char path[PATH_MAX];
+    int n = snprintf(path, PATH_MAX, "%s/%s", dir, e->d_name);
+    if (n < 0 || n >= PATH_MAX)
+      continue;
+
+    struct stat st;
+    if (strcmp(endptr, ".tmp") == 0 &&
+	(lstat(path, &st) == -1 || time(NULL) - st.st_mtime < SPOOL_TMP_AGE))
+      continue;
+    unlink(path);
+  }
+
+  closedir(d);
+}
+
+
+/**
+ * @brief プロセスを参照するpidfdを作成する。
+ * @param[in] pid 対象のプロセスのpid値。
+ * @return 成功時はpidfd、失敗時や使えない環境では-1を返す。
+ */
+static int open_pidfd(pid_t pid)
+{
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  return -1;
+#endif
+}
+
+
+/**
+ * @brief リーダーを、終了を確認する一覧に加える。
+ * @param[in] pid   リーダーのpid値。
+ * @param[in] child 自分が起動した子プロセスの場合は1。
+ */
+static void watch_leader(pid_t pid, int child)
+{
+  if (g_num_leaders >= MAX_NUM_SCHEDULES)
+    return;
+
+  struct leader *l = &g_leaders[g_num_leaders++];
+  l->pid = pid;
+  l->pidfd = open_pidfd(pid);
+  l->child = child;
+}
+
+
+/**
+ * @brief 終了を確認しているリーダーを探す。
+ * @param[in] pid リーダーのpid値。
+ * @return 見つかった場合はリーダーを、見つからない場合はNULLを返す。
+ */
+static struct leader* find_leader(pid_t pid)
+{
+  size_t i;
+  for (i=0; i<g_num_leaders; i++) {
+    if (g_leaders[i].pid == pid)
+      return &g_leaders[i];
+  }
+
+  return NULL;
+}
+
+
+/**
+ * @brief リーダーが終了しているかを調べる。
+ *
+ * 自分の子プロセスは、回収せずに調べる。
+ *
+ * @param[in] l 調べるリーダー。
+ * @return 終了している場合は1、続いている場合は0を返す。
+ */
+static int has_leader_exited(const struct leader *l)
+{
+  if (l->pidfd != -1) {
+    struct pollfd pfd = {l->pidfd, POLLIN, 0};
+    return poll(&pfd, 1, 0) == 1;
+  }
+
+  if (l->child) {
+    siginfo_t info;
+    info.si_pid = 0;
+    return waitid(P_PID, l->pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+      info.si_pid == l->pid;
+  }
+
+  return kill(l->pid, 0) == -1 && errno == ESRCH;
+}
+
+
+/**
+ * @brief リーダーのプロセスグループにSIGTERMを送る。
+ *
+ * 自分の子プロセスは回収するまでpid値が再利用されないので、そのまま送る。
+ * 引き継いだジョブは、リーダーが続いている間だけ送る。
+ *
+ * @param[in] l 対象のリーダー。
+ */
+static void terminate_leader(const struct leader *l)
+{
+  if (l->child || !has_leader_exited(l))
+    killpg(l->pid, SIGTERM);
+}
+
+
+/**
+ * @brief リーダーを回収し、終了を確認する一覧から取り除く。
+ * @param[in] l 取り除くリーダー。g_leadersの要素。
+ */
+static void release_leader(struct leader *l)
+{
+  if (l->child) {
+    siginfo_t info;
+    waitid(P_PID, l->pid, &info, WEXITED | WNOHANG);
+  }
+  if (l->pidfd != -1)
+    close(l->pidfd);
+
+  *l = g_leaders[--g_num_leaders];
+}
+
+
+size_t run_jobs(const char *shm_name, struct schedule* *scheds, size_t *len,
+		time_t now, int adopt)
+{
+  assert(shm_name != NULL && scheds != NULL && len != NULL);
+
+  pid_t self = getpid();
+  size_t i, changed = 0;
+  for (i=0; i<*len; i++) {
+    struct schedule *s = scheds[i];
+    time_t end = s->start + s->duration;
+
+    // 起動を待つジョブ
+    if (s->pgid < 0) {
+      if (s->start > now)
+	continue;
+
+      pid_t pid;
+      if (end <= now) {
+	fprintf(stderr, "%s:%d: Error: Missed the job. id:%" PRIu64 "\n",
+		__FILE__, __LINE__, s->id);
+      } else if (launch_job(shm_name, s->id, &pid) == 0) {
+	watch_leader(pid, 1);
+	s->pgid = pid;
+	s->leader_start = 0;
+	get_process_start(pid, &s->leader_start);
+	s->terminator = self;
+	changed++;
+	continue;
+      }
+
+      // 起動できなかったジョブは、スケジュールごと取り除く。
+      unspool_job(shm_name, s->id);
+      notify_release(shm_name, s->start, end);
+      remove_schedule(s, scheds, len);
+      i--;
+      changed++;
+      continue;
+    }
+
+    // 前のデーモンが起動したジョブを引き継ぐ。
+    if (adopt && s->id != 0 && s->terminator != self) {
+      char path[PATH_MAX];
+      if (get_spool_path(shm_name, s->id, "", 0, path) == 0 &&
+	  access(path, F_OK) == 0) {
+	watch_leader(s->pgid, 0);
+	s->terminator = self;
+	changed++;
+      }
+    }
+
+    if (s->terminator != self)
+      continue;
+
+    // リーダーが終了したジョブは、残ったプロセスを終了させて取り除く。
+    struct leader *l = find_leader(s->pgid);
+    if (l != NULL && has_leader_exited(l)) {
+      terminate_leader(l);
+      release_leader(l);
+      if (end > now)
+	notify_release(shm_name, s->start, end);
+      unspool_job(shm_name, s->id);
+      remove_schedule(s, scheds, len);
+      i--;
+      changed++;
+      continue;
+    }
+
+    if (end <= now) {
+      notify_release(shm_name, s->start, end);
+      if (l != NULL)
+	terminate_leader(l);
+      unspool_job(shm_name, s->id);
+      s->terminator = 0;
+      changed++;
+    }
+  }
+
+  // 終了時刻を過ぎたジョブや、取り消されたジョブのリーダーを回収する。
+  // スケジュールは、プロセスグループが終了した時に取り除かれる。
+  for (i=0; i<g_num_leaders; ) {
+    struct leader *l = &g_leaders[i];
+    struct schedule *s;
+    if ((find_sched_by_pgid(l->pid, scheds, *len, &s) != 0 ||
+	 s->terminator != self) && has_leader_exited(l)) {
+      release_leader(l);
+      continue;
+    }
+    i++;
+  }
+
+  if (adopt)
+    remove_orphan_spools(shm_name, scheds, *len);
+
+  return changed;
+}
\ No newline at end of file
@@ -0,0 +1,6 @@
+OBJECTS += $(OBJ_DIR)/launcher.o
+
+$(OBJ_DIR)/launcher.o: $(SOURCE_DIR)/launcher.c \
+                       $(INCLUDE_DIR)/launcher.h \
+                       $(INCLUDE_DIR)/common.h \
+                       $(INCLUDE_DIR)/notify.h
\ No newline at end of file
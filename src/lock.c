@@ -349,3 +349,10 @@ int lock(int argc, char* argv[])
 
   return EXIT_SUCCESS;
 }
+
+
+int lock_database(const char *db)
+{
+  char *argv[] = {"tm", "lock", "-d", (char*)db, NULL};
+  return lock((db != NULL) ? 4 : 2, argv);
+}
@@ -31,9 +31,17 @@
  *
  * TimeManagerは以下のコマンドから構成されています。\n
  * - set        スケジュールをデータベースに追加、有効化する\n
+ * - capacity   データベースで同時に重なれるスケジュール数を設定する\n
+ * - plan       複数のジョブをまとめて空き時間に配置する\n
+ * - probe      複数の候補の範囲が空いているかをまとめて調べる\n
+ * - batch      複数の操作をまとめて1度のロックで反映する\n
  * - schedule   データベース内のスケジュールを出力する\n
  * - unoccupied 空き時間のスケジュールを作成する\n
  * - crontab    crontab形式で指定した開始時刻をセットする\n
+ * - daemon     データベースを常駐して管理する\n
+ * - export     データベースのスケジュールをまとめて書き出す\n
+ * - import     スケジュールをまとめて読み込む\n
+ * - run        コマンドを予約し、デーモンに起動させる\n
  * - reset      データベース及びロックを初期化する\n
  * - terminate  自プロセスグループを終了させる
  *
@@ -101,10 +109,18 @@
 #include "../include/activate.h"
 #include "../include/add.h"
 #include "../include/autoextend.h"
+#include "../include/batch.h"
+#include "../include/capacity.h"
 #include "../include/common.h"
 #include "../include/crontab.h"
+#include "../include/daemon.h"
+#include "../include/export.h"
+#include "../include/import.h"
 #include "../include/lock.h"
+#include "../include/plan.h"
+#include "../include/probe.h"
 #include "../include/reset.h"
+#include "../include/run.h"
 #include "../include/schedule.h"
 #include "../include/set.h"
 #include "../include/terminate.h"
@@ -119,7 +135,7 @@ static void print_usage()
 {
   const char *usage = "usage: tm <command> [<args>] [-h]\n"
     "<command>\n"
-    "crontab|reset|schedule|set|terminate|unoccupied\n"
+    "batch|capacity|crontab|daemon|export|import|plan|probe|reset|run|schedule|set|terminate|unoccupied\n"
     "See 'tm <command> -h' for more information on a specific command.\n";
   
   const char *description = "任意のプログラムの開始時刻と終了時刻を管理する"
@@ -139,8 +155,16 @@ static void print_usage()
     "\n"
     "COMMAND\n"
     "\tset        スケジュールをデータベースに追加、有効化する\n"
+    "\tcapacity   データベースで同時に重なれるスケジュール数を設定する\n"
     "\tcrontab    crontab形式で指定した開始時刻をセットする\n"
+    "\tdaemon     データベースを常駐して管理する\n"
+    "\texport     データベースのスケジュールをまとめて書き出す\n"
+    "\timport     スケジュールをまとめて読み込む\n"
     "\tunoccupied 空き時間のスケジュールを作成する\n"
+    "\tplan       複数のジョブをまとめて空き時間に配置する\n"
+    "\tprobe      複数の候補の範囲が空いているかをまとめて調べる\n"
+    "\tbatch      複数の操作をまとめて1度のロックで反映する\n"
+    "\trun        コマンドを予約し、デーモンに起動させる\n"
     "\treset      データベース及びロックを初期化する\n"
     "\tschedule   データベース内のスケジュールを出力する\n"
     "\tterminate  自プロセスグループを終了させる\n"
@@ -158,6 +182,9 @@ static void print_usage()
 
 int main (int argc, char* argv[])
 {
+  // 共通部分のエラーは、コマンドでは標準エラー出力に出力する。
+  set_error_output(stderr);
+
   if (argc == 1 || strcmp(argv[1], "-h") == 0 ||
       strcmp(argv[1], "--help") == 0) {
     print_usage();
@@ -176,10 +203,30 @@ int main (int argc, char* argv[])
 
     return add(argc, argv);
 
+  } else if (strcmp(argv[1], "batch") == 0) {
+
+    return batch(argc, argv);
+
+  } else if (strcmp(argv[1], "capacity") == 0) {
+
+    return capacity(argc, argv);
+
   } else if (strcmp(argv[1], "crontab") == 0) {
 
     return crontab(argc, argv);
 
+  } else if (strcmp(argv[1], "daemon") == 0) {
+
+    return run_daemon(argc, argv);
+
+  } else if (strcmp(argv[1], "export") == 0) {
+
+    return export(argc, argv);
+
+  } else if (strcmp(argv[1], "import") == 0) {
+
+    return import(argc, argv);
+
   } else if (strcmp(argv[1], "unlock") == 0) {
 
     return  unlock(argc, argv);
@@ -188,10 +235,22 @@ int main (int argc, char* argv[])
 
     return lock(argc, argv);
 
+  } else if (strcmp(argv[1], "plan") == 0) {
+
+    return plan(argc, argv);
+
+  } else if (strcmp(argv[1], "probe") == 0) {
+
+    return probe(argc, argv);
+
   } else if (strcmp(argv[1], "reset") == 0) {
 
     return reset(argc, argv);
 
+  } else if (strcmp(argv[1], "run") == 0) {
+
+    return run(argc, argv);
+
   } else if (strcmp(argv[1], "schedule") == 0) {
 
     return schedule(argc, argv);
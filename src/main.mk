@@ -4,10 +4,18 @@ $(OBJ_DIR)/main.o: $(SOURCE_DIR)/main.c \
                  $(INCLUDE_DIR)/activate.h \
                  $(INCLUDE_DIR)/add.h \
                  $(INCLUDE_DIR)/autoextend.h \
+                 $(INCLUDE_DIR)/batch.h \
+                 $(INCLUDE_DIR)/capacity.h \
                  $(INCLUDE_DIR)/common.h \
                  $(INCLUDE_DIR)/crontab.h \
+                 $(INCLUDE_DIR)/daemon.h \
+                 $(INCLUDE_DIR)/export.h \
+                 $(INCLUDE_DIR)/import.h \
                  $(INCLUDE_DIR)/lock.h \
+                 $(INCLUDE_DIR)/plan.h \
+                 $(INCLUDE_DIR)/probe.h \
                  $(INCLUDE_DIR)/reset.h \
+                 $(INCLUDE_DIR)/run.h \
                  $(INCLUDE_DIR)/schedule.h \
                  $(INCLUDE_DIR)/set.h \
                  $(INCLUDE_DIR)/terminate.h \
@@ -0,0 +1,309 @@
+/*
+ * notify.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file notify.c
+ * @brief スケジュールの解放の通知に関する実装。
+ */
+
+#include "../include/notify.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "../include/common.h"
+
+/** futexが使えない環境で、通知を確認する間隔(nsec) */
+#define POLL_INTERVAL_NSEC (100 * 1000 * 1000)
+
+/**
+ * @struct wait_slot
+ * @brief 待機中のクライアント1つ分の情報。
+ */
+struct wait_slot {
+  pid_t pid;  /**< 待機中のプロセスのpid。未使用の場合は0 */
+  time_t start;  /**< 希望する範囲の開始時刻 */
+  time_t end;  /**< 希望する範囲の終了時刻 */
+  uint32_t seq;  /**< 通知番号。通知のたびに増える。futexとして使う。 */
+};
+
+/**
+ * @struct wait_table
+ * @brief 共有メモリ上の待機表。
+ */
+struct wait_table {
+  struct wait_slot slots[MAX_NUM_WAITERS];  /**< 待機中のクライアント */
+};
+
+
+/**
+ * @brief データベースの共有メモリ名から、待機表の共有メモリ名を作成する。
+ * @param[in]  shm_name データベースの共有メモリ名。
+ * @param[out] name     待機表の共有メモリ名が反映される。NAME_MAXの領域が必要。
+ */
+static void get_wait_table_name(const char *shm_name, char *name)
+{
+  // データベース番号は、共有メモリ名の末尾に付加されている。
+  const char *db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+  snprintf(name, NAME_MAX, "%s%s", DEFAULT_WAIT_TABLE_NAME, db);
+}
+
+
+/**
+ * @brief 待機表を共有メモリにマップする。
+ * @param[in]  shm_name データベースの共有メモリ名。
+ * @param[out] table    マップした待機表が反映される。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int map_wait_table(const char *shm_name, struct wait_table* *table)
+{
+  char name[NAME_MAX];
+  get_wait_table_name(shm_name, name);
+
+  errno = 0;
+  int fd = shm_open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    report_error(ERROR_SYSTEM, "%s:%d: Error: shm_open() %s\n", __FILE__,
+		 __LINE__, strerror(errno));
+    return -1;
+  }
+
+  struct stat mapstat;
+  if (fstat(fd, &mapstat) != -1 && mapstat.st_size == 0) {
+    errno = 0;
+    if (ftruncate(fd, sizeof(struct wait_table)) == -1) {
+      report_error(ERROR_SYSTEM, "%s:%d: Error: ftruncate. %s\n", __FILE__,
+		   __LINE__, strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+
+  errno = 0;
+  void *addr = mmap(NULL, sizeof(struct wait_table), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    report_error(ERROR_SYSTEM, "%s:%d: Error: mmap() %s.\n", __FILE__,
+		 __LINE__, strerror(errno));
+    return -1;
+  }
+
+  *table = addr;
+
+  return 0;
+}
+
+
+/**
+ * @brief 待機表のマップを解除する。
+ */
+static void unmap_wait_table(struct wait_table *table)
+{
+  munmap(table, sizeof(struct wait_table));
+}
+
+
+void wait_word(uint32_t *seq, uint32_t old, const struct timespec *timeout)
+{
+#if defined(__linux__)
+  // 値が変わっていれば、すぐに戻る。
+  syscall(SYS_futex, seq, FUTEX_WAIT, old, timeout, NULL, 0);
+#else
+  struct timespec remain = *timeout;
+  while (__atomic_load_n(seq, __ATOMIC_ACQUIRE) == old) {
+    if (remain.tv_sec == 0 && remain.tv_nsec == 0)
+      break;
+
+    struct timespec ts = {0, POLL_INTERVAL_NSEC};
+    if (remain.tv_sec == 0 && remain.tv_nsec < ts.tv_nsec)
+      ts.tv_nsec = remain.tv_nsec;
+    nanosleep(&ts, NULL);
+
+    remain.tv_nsec -= ts.tv_nsec;
+    if (remain.tv_nsec < 0) {
+      remain.tv_sec--;
+      remain.tv_nsec += 1000000000;
+    }
+  }
+#endif
+}
+
+
+void wake_word(uint32_t *seq)
+{
+#if defined(__linux__)
+  syscall(SYS_futex, seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+
+int notify_release(const char *shm_name, time_t start, time_t end)
+{
+  return notify_releases(shm_name, &start, &end, 1);
+}
+
+
+int notify_releases(const char *shm_name, const time_t *starts,
+		    const time_t *ends, size_t len)
+{
+  assert(shm_name != NULL && starts != NULL && ends != NULL);
+
+  struct wait_table *table;
+  if (map_wait_table(shm_name, &table) != 0)
+    return -1;
+
+  int i;
+  for (i=0; i<MAX_NUM_WAITERS; i++) {
+    struct wait_slot *s = &(table->slots[i]);
+    if (__atomic_load_n(&s->pid, __ATOMIC_ACQUIRE) == 0)
+      continue;
+
+    // 範囲の重なるクライアントだけを起こす。
+    size_t j;
+    for (j=0; j<len; j++) {
+      if (s->start < ends[j] && s->end > starts[j])
+	break;
+    }
+
+    if (j < len) {
+      __atomic_add_fetch(&s->seq, 1, __ATOMIC_RELEASE);
+      wake_word(&s->seq);
+    }
+  }
+
+  unmap_wait_table(table);
+
+  return 0;
+}
+
+
+int register_wait(const char *shm_name, time_t start, time_t end,
+		  struct wait_handle *h)
+{
+  assert(shm_name != NULL && h != NULL);
+
+  if (map_wait_table(shm_name, &h->table) != 0)
+    return -1;
+
+  pid_t pid = getpid();
+  int i;
+  for (i=0; i<MAX_NUM_WAITERS; i++) {
+    struct wait_slot *s = &(h->table->slots[i]);
+    pid_t old = __atomic_load_n(&s->pid, __ATOMIC_ACQUIRE);
+
+    // 終了したプロセスの登録は再利用する。
+    if (old != 0 && (kill(old, 0) == 0 || errno != ESRCH))
+      continue;
+
+    if (!__atomic_compare_exchange_n(&s->pid, &old, pid, 0, __ATOMIC_ACQ_REL,
+				     __ATOMIC_ACQUIRE))
+      continue;
+
+    s->start = start;
+    s->end = end;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    h->slot = i;
+    h->seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    return 0;
+  }
+
+  report_error(ERROR_FULL, "%s:%d: Error: Too many waiters.\n", __FILE__,
+	       __LINE__);
+  unmap_wait_table(h->table);
+  h->table = NULL;
+
+  return 1;
+}
+
+
+int wait_for_release(struct wait_handle *h, time_t deadline)
+{
+  assert(h != NULL && h->table != NULL);
+
+  time_t now = time(NULL);
+  if (deadline != 0 && now >= deadline)
+    return 2;
+
+  struct timespec timeout = {WAIT_RECHECK_INTERVAL, 0};
+  if (deadline != 0 && deadline - now < timeout.tv_sec)
+    timeout.tv_sec = deadline - now;
+
+  struct wait_slot *s = &(h->table->slots[h->slot]);
+  wait_word(&s->seq, h->seq, &timeout);
+
+  uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+  if (seq != h->seq) {
+    h->seq = seq;
+    return 0;
+  }
+
+  if (deadline != 0 && time(NULL) >= deadline)
+    return 2;
+
+  return 1;
+}
+
+
+void unregister_wait(struct wait_handle *h)
+{
+  assert(h != NULL);
+
+  if (h->table == NULL)
+    return;
+
+  struct wait_slot *s = &(h->table->slots[h->slot]);
+  __atomic_store_n(&s->pid, 0, __ATOMIC_RELEASE);
+
+  unmap_wait_table(h->table);
+  h->table = NULL;
+}
+
+
+int remove_wait_table(const char *shm_name)
+{
+  assert(shm_name != NULL);
+
+  char name[NAME_MAX];
+  get_wait_table_name(shm_name, name);
+
+  errno = 0;
+  if (shm_unlink(name) == -1 && errno != ENOENT && errno != EINVAL) {
+    report_error(ERROR_SYSTEM, "%s:%d: Error: %s\n", __FILE__, __LINE__,
+		 strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,5 @@
+LIB_OBJECTS += $(OBJ_DIR)/notify.o
+
+$(OBJ_DIR)/notify.o: $(SOURCE_DIR)/notify.c \
+                     $(INCLUDE_DIR)/notify.h \
+                     $(INCLUDE_DIR)/common.h
\ No newline at end of file
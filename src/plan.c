@@ -0,0 +1,723 @@
+/*
+ * plan.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file plan.c
+ * @brief 複数のジョブをまとめて空き時間に配置するコマンドに関する実装。
+ */
+
+#include "../include/plan.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/common.h"
+#include "../include/lock.h"
+#include "../include/unlock.h"
+
+/** 配置できないジョブがある場合の戻り値 */
+#define EXIT_NOT_PLACED 3
+
+/** latestが省略された場合の、earliestからの範囲(sec) */
+#define DEFAULT_WINDOW (60*60*24)
+
+static int verbose = 0;
+
+/**
+ * @struct job
+ * @brief 配置するジョブ1つ分の情報。
+ */
+struct job {
+  time_t earliest;  /**< 開始できる最も早い時刻 */
+  time_t latest;  /**< 終了していなければならない時刻 */
+  unsigned int duration;  /**< 継続時間(sec) */
+  unsigned int priority;  /**< 優先度。大きいほど優先される。 */
+  char caption[MAX_CAPTION_LEN];  /**< ジョブの簡単な説明 */
+  time_t start;  /**< 配置した開始時刻 */
+  int placed;  /**< 配置できた場合は1 */
+};
+
+/**
+ * @struct interval
+ * @brief 空き時間1つ分の範囲。
+ */
+struct interval {
+  time_t start;  /**< 開始時刻 */
+  time_t end;  /**< 終了時刻 */
+};
+
+/**
+ * @struct plan_score
+ * @brief 配置の良さ。\sa compare_score()
+ */
+struct plan_score {
+  unsigned long weight;  /**< 配置できたジョブの、優先度+1の合計 */
+  size_t count;  /**< 配置できたジョブの数 */
+  time_t lateness;  /**< 配置できたジョブの、earliestからの遅れの合計 */
+};
+
+
+/**
+ * @brief ヘルプをstderrに出力する。
+ */
+static void print_usage()
+{
+  const char *usage = "tm plan [-c] [-d database] [-R resources] "
+    "[-t budget] [-v] [-h]\n";
+
+  const char *description = "stdinのすべての行をジョブとして読み込み、"
+    "データベースの空き時間に、互いに重ならないように配置して、"
+    "start:duration:captionの書式でstdoutに出力します。出力の順番は"
+    "入力の順番です。\n"
+    "\n"
+    "ジョブの書式は earliest:latest:duration:priority:caption です。"
+    "earliestは開始できる最も早い時刻(time_t形式)、latestは終了していなければ"
+    "ならない時刻(time_t形式)、durationは継続時間(sec)、priorityは優先度(0以上。"
+    "大きいほど優先)です。earliestに0を指定した場合は現在時刻、latestに0を"
+    "指定した場合はearliestの1日後となります。現在時刻より前には配置しません。\n"
+    "\n"
+    "配置は、latestの早い順(同じ場合は優先度の高い順)に、配置できる最も早い"
+    "時刻に行います(EDF)。配置できないジョブがある場合は、優先度の高い順でも"
+    "試し、良い方を選びます。tオプションを指定すると、その時間(msec)の範囲で、"
+    "順番を入れ替えてさらに良い配置を探します。\n"
+    "\n"
+    "配置できないジョブがあった場合は、配置できたジョブだけをstdoutに出力し、"
+    "配置できないジョブをstderrに出力して、3を返します。\n"
+    "\n"
+    "cオプションを指定すると、データベースをロックしたまま配置を行い、"
+    "すべてのジョブを配置できた場合にだけ、すべての配置をまとめてデータベースに"
+    "追加します。1つのプロセスグループが持てるスケジュールは1つなので、配置ごとに"
+    "新しいプロセスグループを作成し、そのスケジュールとして追加します。"
+    "各プロセスグループは配置の終了時刻に終了し、スケジュールは解放されます。"
+    "配置を取り消す場合は、tm schedule -Aで確認したpgid値のプロセスグループを"
+    "終了させてください。\n";
+
+  const char *optarg = "OPTIONS\n"
+    "\t-c          すべての配置をデータベースに追加する。\n"
+    "\t-d database データベース番号(1-5が使用可能)\n"
+    "\t-R resources 空きを調べる資源の集合(カンマ区切り)\n"
+    "\t-t budget   より良い配置を探す時間(msec)\n"
+    "\t-v          verboseモード\n"
+    "\t-h          show this help message and exit\n";
+
+  const char *exit_status = "EXIT STATUS\n"
+    "\t0 正常終了\n"
+    "\t1 異常終了\n"
+    "\t2 使用方法に誤りがある場合\n"
+    "\t3 配置できないジョブがある場合\n";
+
+  const char *env = "ENVIRONMENT\n"
+    "\tTM_DB_NUM データベース番号(1-5が使用可能)。dオプションが指定された場合は、そちらが優先される。\n";
+
+  const char *example = "EXAMPLE\n"
+    "\t今日の3つのジョブを、空き時間に配置する。\n"
+    "\t$ printf \"0:1517230800:1800:1:A\\n0:1517220000:600:5:B\\n"
+    "1517212800:0:3600:0:C\\n\" | tm plan -t 100\n"
+    "\t1517189074:1800:A\n"
+    "\t1517188474:600:B\n"
+    "\t1517212800:3600:C\n";
+
+  fprintf(stderr, "usage: %s\n%s\n%s\n%s\n%s\n%s\n", usage, description,
+	  optarg, exit_status, env, example);
+}
+
+
+/**
+ * @brief コマンドライン引数を解析する。
+ * @param[in]  argc      argc値
+ * @param[in]  argv      argv値
+ * @param[out] shm_name  '-d'オプション(データベース番号)が反映される。
+ * @param[out] c_opt     '-c'オプション(追加)が指定された場合、1が設定される。
+ * @param[out] d_opt     '-d'オプション(データベース番号)が指定された場合、1が設定される。
+ * @param[out] resources '-R'オプション(資源の集合)の値が反映される。
+ * @param[out] budget    '-t'オプション(より良い配置を探す時間(msec))の値が反映される。
+ * @param[out] verbose   '-v'オプション(verboseモード)の値が反映される。
+ * @return 成功時は0、'h'オプションが指定された場合は1、不正な値が与えられた場
+ * 合は2を返す。
+ */
+static int parse_arguments(int argc, char* *argv, char *shm_name, int *c_opt,
+			   int *d_opt, char *resources, unsigned int *budget,
+			   int *verbose)
+{
+  // TimeManagerから呼ばれる場合、argvは{"tm", "plan", "opt"...}となる。
+  // オプションを読み込むためには、optindを1つ進めて2にしておく必要がある。
+  opterr = 0;
+  optind = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "cd:hR:t:v")) != -1) {
+    switch (opt) {
+    case 'c':
+      // データベースに追加する。
+      *c_opt = 1;
+      break;
+    case 'd':
+      // データベース番号
+      if (atoi(optarg) < 1 || atoi(optarg) > MAX_NUM_DB) {
+	fprintf(stderr, "Error: Invalid database number. (Valid 1-%d)\n",
+		MAX_NUM_DB);
+	return 2;
+      }
+      strcat(shm_name, optarg);
+      *d_opt = 1;
+      break;
+    case 'h':
+      // ヘルプ
+      print_usage();
+      return 1;
+    case 'R':
+      // 資源の集合
+      if (check_resource_set(optarg) != 0) {
+	fprintf(stderr, "Error: Invalid resources. \"%s\"\n", optarg);
+	return 2;
+      }
+      strcpy(resources, optarg);
+      break;
+    case 't':
+      // より良い配置を探す時間(msec)
+      if (atoi(optarg) < 0) {
+	fprintf(stderr, "Error: Invalid budget. \"%s\"\n", optarg);
+	return 2;
+      }
+      *budget = atoi(optarg);
+      break;
+    case 'v':
+      // verboseモード
+      *verbose = 1;
+      break;
+    case '?':
+    default:
+      fprintf(stderr, "%s:%d: Error: Unknown option.\n", __FILE__, __LINE__);
+      return 2;
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief stdinからすべてのジョブを読み込む。
+ * @param[out] jobs    読み込んだジョブが反映される。
+ * @param[in]  max_len jobsの配列数。
+ * @param[out] len     読み込んだジョブの数が反映される。
+ * @return 成功時は0、失敗時には-1、ジョブが不正な場合は1を返す。
+ */
+static int read_jobs(struct job *jobs, size_t max_len, size_t *len)
+{
+  time_t now = time(NULL);
+  char buf[MAX_SCHEDULE_STRING_LEN+1];
+
+  *len = 0;
+  while (fgets(buf, MAX_SCHEDULE_STRING_LEN+1, stdin) != NULL) {
+    if (buf[0] == '\n')
+      continue;
+
+    if (*len >= max_len) {
+      fprintf(stderr, "%s:%d: Error: Too many jobs.\n", __FILE__, __LINE__);
+      return 1;
+    }
+
+    struct job *j = &jobs[*len];
+    char sep[4] = {0};
+    j->caption[0] = '\0';
+    int n = sscanf(buf, "%ld%c%ld%c%u%c%u%c%255[^\n]", &j->earliest, &sep[0],
+		   &j->latest, &sep[1], &j->duration, &sep[2], &j->priority,
+		   &sep[3], j->caption);
+    if (n < 8 || sep[0] != ':' || sep[1] != ':' || sep[2] != ':' ||
+	sep[3] != ':') {
+      fprintf(stderr, "%s:%d: Error: Unknown job format. \"%s\"\n", __FILE__,
+	      __LINE__, buf);
+      return 1;
+    }
+
+    if (j->earliest == 0)
+      j->earliest = now;
+    if (j->latest == 0)
+      j->latest = j->earliest + DEFAULT_WINDOW;
+
+    if (j->earliest < 0 || j->duration == 0 ||
+	j->earliest + (time_t)j->duration > j->latest) {
+      fprintf(stderr, "%s:%d: Error: Invalid job. \"%s\"\n", __FILE__,
+	      __LINE__, j->caption);
+      return 1;
+    }
+
+    // 過去には配置しない。
+    if (j->earliest < now)
+      j->earliest = now;
+
+    j->start = 0;
+    j->placed = 0;
+    (*len)++;
+  }
+
+  if (ferror(stdin)) {
+    fprintf(stderr, "%s:%d: Error: Reading stdin.\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief EDFの順番で、ジョブaをジョブbより先に配置するか確認する。
+ */
+static int is_before_edf(const struct job *a, const struct job *b)
+{
+  if (a->latest != b->latest)
+    return a->latest < b->latest;
+  if (a->priority != b->priority)
+    return a->priority > b->priority;
+  return a->earliest < b->earliest;
+}
+
+
+/**
+ * @brief 優先度の順番で、ジョブaをジョブbより先に配置するか確認する。
+ */
+static int is_before_priority(const struct job *a, const struct job *b)
+{
+  if (a->priority != b->priority)
+    return a->priority > b->priority;
+  return is_before_edf(a, b);
+}
+
+
+/**
+ * @brief ジョブを配置する順番を並べる。
+ * @param[out] order  ジョブの添字の配列。
+ * @param[in]  jobs   ジョブ群。
+ * @param[in]  len    ジョブの数。
+ * @param[in]  before 先に配置するか確認する関数。
+ */
+static void sort_order(size_t *order, const struct job *jobs, size_t len,
+		       int (*before)(const struct job*, const struct job*))
+{
+  size_t i, j;
+  for (i=0; i<len; i++)
+    order[i] = i;
+
+  // 挿入ソート。同じ順番のジョブは、入力の順番を保つ。
+  for (i=1; i<len; i++) {
+    size_t x = order[i];
+    for (j=i; j>0 && before(&jobs[x], &jobs[order[j-1]]); j--)
+      order[j] = order[j-1];
+    order[j] = x;
+  }
+}
+
+
+/**
+ * @brief 配置の良さを比較する。
+ * @return aの方が良い場合は正の値、同じ場合は0、bの方が良い場合は負の値を
+ * 返す。
+ */
+static int compare_score(const struct plan_score *a, const struct plan_score *b)
+{
+  if (a->weight != b->weight)
+    return (a->weight > b->weight) ? 1 : -1;
+  if (a->count != b->count)
+    return (a->count > b->count) ? 1 : -1;
+  if (a->lateness != b->lateness)
+    return (a->lateness < b->lateness) ? 1 : -1;
+  return 0;
+}
+
+
+/**
+ * @brief ジョブを順番に、配置できる最も早い時刻に配置する。
+ * @param[in,out] jobs  ジョブ群。start、placed値が反映される。
+ * @param[in]     order 配置する順番。
+ * @param[in]     len   ジョブの数。
+ * @param[in]     gaps  空き時間。開始時刻の昇順。
+ * @param[in]     ngaps gapsの配列数。
+ * @param[out]    work  作業領域。ngaps+len個の領域が必要。
+ * @return 配置の良さを返す。
+ */
+static struct plan_score place_jobs(struct job *jobs, const size_t *order,
+				    size_t len, const struct interval *gaps,
+				    size_t ngaps, struct interval *work)
+{
+  struct plan_score score = {0, 0, 0};
+
+  memcpy(work, gaps, ngaps * sizeof(struct interval));
+  size_t nwork = ngaps;
+
+  size_t i;
+  for (i=0; i<len; i++) {
+    struct job *j = &jobs[order[i]];
+    j->placed = 0;
+
+    size_t k;
+    for (k=0; k<nwork; k++) {
+      time_t s = (work[k].start > j->earliest) ? work[k].start : j->earliest;
+      time_t e = s + j->duration;
+      if (e > work[k].end || e > j->latest)
+	continue;
+
+      j->start = s;
+      j->placed = 1;
+      score.weight += j->priority + 1;
+      score.count++;
+      score.lateness += s - j->earliest;
+
+      // 空き時間から、配置した範囲を取り除く。
+      if (s > work[k].start && e < work[k].end) {
+	memmove(&work[k+2], &work[k+1], (nwork-k-1) * sizeof(struct interval));
+	work[k+1].start = e;
+	work[k+1].end = work[k].end;
+	work[k].end = s;
+	nwork++;
+      } else if (s > work[k].start) {
+	work[k].end = s;
+      } else {
+	work[k].start = e;
+      }
+      break;
+    }
+  }
+
+  return score;
+}
+
+
+/**
+ * @brief 経過時間を求める。
+ * @return startからの経過時間(msec)を返す。
+ */
+static long elapsed_msec(const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000 +
+    (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+
+/**
+ * @brief ジョブ群の配置を求める。
+ *
+ * EDFの順番と優先度の順番で配置し、良い方を選ぶ。budgetが0でない場合は、
+ * その時間の範囲で、良い方の順番のうち2つのジョブを入れ替えて、悪くならない
+ * 限り採用することを繰り返す。
+ *
+ * @param[in,out] jobs   ジョブ群。start、placed値が反映される。
+ * @param[in]     len    ジョブの数。
+ * @param[in]     gaps   空き時間。開始時刻の昇順。
+ * @param[in]     ngaps  gapsの配列数。
+ * @param[in]     budget より良い配置を探す時間(msec)。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int plan_jobs(struct job *jobs, size_t len, const struct interval *gaps,
+		     size_t ngaps, unsigned int budget)
+{
+  if (len == 0)
+    return 0;
+
+  struct timespec started;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
+  size_t *order = malloc(len * sizeof(size_t));
+  size_t *best = malloc(len * sizeof(size_t));
+  struct interval *work = malloc((ngaps + len) * sizeof(struct interval));
+  if (order == NULL || best == NULL || work == NULL) {
+    fprintf(stderr, "%s:%d: Error: Faild to allocate memory.\n", __FILE__,
+	    __LINE__);
+    free(order);
+    free(best);
+    free(work);
+    return -1;
+  }
+
+  sort_order(best, jobs, len, is_before_edf);
+  struct plan_score best_score = place_jobs(jobs, best, len, gaps, ngaps,
+					    work);
+
+  if (best_score.count < len) {
+    sort_order(order, jobs, len, is_before_priority);
+    struct plan_score score = place_jobs(jobs, order, len, gaps, ngaps, work);
+    if (compare_score(&score, &best_score) > 0) {
+      memcpy(best, order, len * sizeof(size_t));
+      best_score = score;
+    }
+  }
+
+  // 時間の範囲で、順番を入れ替えて試す。
+  unsigned long tries = 0;
+  if (budget > 0 && len > 1) {
+    srand(time(NULL) ^ getpid());
+    memcpy(order, best, len * sizeof(size_t));
+    while (best_score.count < len || best_score.lateness > 0) {
+      if (elapsed_msec(&started) >= budget)
+	break;
+
+      size_t a = rand() % len, b = rand() % len;
+      size_t tmp = order[a];
+      order[a] = order[b];
+      order[b] = tmp;
+
+      struct plan_score score = place_jobs(jobs, order, len, gaps, ngaps,
+					   work);
+      if (compare_score(&score, &best_score) >= 0) {
+	memcpy(best, order, len * sizeof(size_t));
+	best_score = score;
+      } else {
+	memcpy(order, best, len * sizeof(size_t));
+      }
+      tries++;
+    }
+  }
+
+  // 最も良い順番で、配置し直す。
+  place_jobs(jobs, best, len, gaps, ngaps, work);
+
+  if (verbose > 0) {
+    fprintf(stderr, "%s:%d: Debug: placed:%zu/%zu weight:%lu lateness:%ld "
+	    "tries:%lu\n", __FILE__, __LINE__, best_score.count, len,
+	    best_score.weight, best_score.lateness, tries);
+  }
+
+  free(order);
+  free(best);
+  free(work);
+
+  return 0;
+}
+
+
+/**
+ * @brief スケジュール群から、範囲内の空き時間を取得する。
+ * @param[in]  shm_name  データベース名。
+ * @param[in]  scheds    データベースのスケジュール群。
+ * @param[in]  len       schedsの配列数。
+ * @param[in]  begin     範囲の開始時刻。
+ * @param[in]  end       範囲の終了時刻。
+ * @param[in]  resources 空きを調べる資源の集合。
+ * @param[out] gaps      取得した空き時間が反映される。free()で解放する。
+ * @param[out] ngaps     gapsの配列数が反映される。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int get_gaps(const char *shm_name, struct schedule* *scheds, size_t len,
+		    time_t begin, time_t end, const char *resources,
+		    struct interval* *gaps, size_t *ngaps)
+{
+  unsigned int capacity;
+  if (get_capacity(shm_name, &capacity) != 0)
+    return -1;
+
+  struct expansion ex;
+  if (expand_schedules(scheds, len, begin, end, &ex) != 0)
+    return -1;
+
+  struct gap_iterator it;
+  init_gap_iterator(&it, &ex, 0, begin, end, capacity, resources);
+
+  // 空き時間の数は、スケジュールの開始、終了時刻の数を超えない。
+  *gaps = malloc((2 * ex.len + 1) * sizeof(struct interval));
+  if (*gaps == NULL) {
+    fprintf(stderr, "%s:%d: Error: Faild to allocate memory.\n", __FILE__,
+	    __LINE__);
+    cleanup_expansion(&ex);
+    return -1;
+  }
+
+  *ngaps = 0;
+  time_t gap_start, gap_end;
+  while (next_gap(&it, &gap_start, &gap_end) == 0) {
+    (*gaps)[*ngaps].start = gap_start;
+    (*gaps)[*ngaps].end = gap_end;
+    (*ngaps)++;
+  }
+
+  cleanup_expansion(&ex);
+
+  return 0;
+}
+
+
+/**
+ * @brief 配置をデータベースのスケジュール群に反映する。
+ *
+ * 1つのプロセスグループが持てるスケジュールは1つなので、配置ごとに
+ * spawn_holder()でプロセスグループを作成し、そのスケジュールとして追加する。
+ * 失敗した場合は、作成したプロセスグループを終了させる。
+ *
+ * @param[in]     jobs      ジョブ群。
+ * @param[in]     len       ジョブの数。
+ * @param[in]     resources 占有する資源の集合。
+ * @param[in,out] scheds    データベースのスケジュール群。
+ * @param[in,out] scheds_len schedsの配列数。
+ * @param[out]    holders   作成したプロセスグループのpgid値が反映される。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int commit_jobs(const struct job *jobs, size_t len,
+		       const char *resources, struct schedule* *scheds,
+		       size_t *scheds_len, pid_t *holders)
+{
+  if (*scheds_len + len > MAX_NUM_SCHEDULES) {
+    fprintf(stderr, "%s:%d: Error: Too many schedules.\n", __FILE__,
+	    __LINE__);
+    return -1;
+  }
+
+  size_t i;
+  for (i=0; i<len; i++) {
+    struct schedule *s;
+    if (spawn_holder(jobs[i].start + jobs[i].duration, &holders[i]) != 0)
+      break;
+    if (create_schedule(holders[i], 0, 0, jobs[i].start, jobs[i].duration,
+			jobs[i].caption, &s) != 0) {
+      i++;
+      break;
+    }
+    strcpy(s->resources, resources);
+    scheds[(*scheds_len)++] = s;
+  }
+
+  if (i == len)
+    return 0;
+
+  while (i-- > 0)
+    killpg(holders[i], SIGTERM);
+  return -1;
+}
+
+
+int plan(int argc, char* argv[])
+{
+  char shm_name[NAME_MAX] = DEFAULT_SHARED_MEMORY_NAME;
+  char resources[MAX_RESOURCES_LEN] = "";
+  int c_opt = 0, d_opt = 0;
+  unsigned int budget = 0;
+
+  // オプションチェック
+  switch (parse_arguments(argc, argv, shm_name, &c_opt, &d_opt, resources,
+			  &budget, &verbose)) {
+  case 1:
+    return EXIT_SUCCESS;
+  case 2:
+    return EXIT_MISUSE;
+  }
+
+  // 'd'オプションが指定されていない場合は、環境変数を確認する。
+  if (!d_opt) {
+    if (get_env(NULL, shm_name) != 0)
+      return EXIT_FAILURE;
+  }
+
+  // stdinからジョブを読み込む。
+  static struct job jobs[MAX_NUM_SCHEDULES];
+  size_t len = 0;
+  switch (read_jobs(jobs, MAX_NUM_SCHEDULES, &len)) {
+  case -1:
+    return EXIT_FAILURE;
+  case 1:
+    return EXIT_MISUSE;
+  }
+
+  // ジョブの範囲全体で、空き時間を求める。
+  time_t begin = 0, end = 0;
+  size_t i;
+  for (i=0; i<len; i++) {
+    if (i == 0 || jobs[i].earliest < begin)
+      begin = jobs[i].earliest;
+    if (i == 0 || jobs[i].latest > end)
+      end = jobs[i].latest;
+  }
+
+  // 追加する場合は、読み込みから書き込みまでをロックする。
+  const char *db = NULL;
+  if (d_opt)
+    db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+  if (c_opt && lock_database(db) != 0)
+    return EXIT_FAILURE;
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  if (load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		     &scheds_len) != 0) {
+    if (c_opt)
+      unlock_database(db);
+    return EXIT_FAILURE;
+  }
+
+  struct interval *gaps = NULL;
+  size_t ngaps = 0;
+  if (get_gaps(shm_name, scheds, scheds_len, begin, end, resources, &gaps,
+	       &ngaps) != 0 ||
+      plan_jobs(jobs, len, gaps, ngaps, budget) != 0) {
+    free(gaps);
+    cleanup_schedules(scheds, scheds_len);
+    if (c_opt)
+      unlock_database(db);
+    return EXIT_FAILURE;
+  }
+  free(gaps);
+
+  size_t placed = 0;
+  for (i=0; i<len; i++) {
+    if (jobs[i].placed) {
+      placed++;
+    } else {
+      fprintf(stderr, "%s:%d: Error: Could not place \"%s\".\n", __FILE__,
+	      __LINE__, jobs[i].caption);
+    }
+  }
+
+  // すべてのジョブを配置できた場合にだけ、まとめて追加する。
+  static pid_t holders[MAX_NUM_SCHEDULES];
+  if (c_opt && placed == len) {
+    if (commit_jobs(jobs, len, resources, scheds, &scheds_len,
+		    holders) != 0) {
+      cleanup_schedules(scheds, scheds_len);
+      unlock_database(db);
+      return EXIT_FAILURE;
+    }
+    if (save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds,
+		       scheds_len) != 0) {
+      for (i=0; i<len; i++)
+	killpg(holders[i], SIGTERM);
+      cleanup_schedules(scheds, scheds_len);
+      unlock_database(db);
+      return EXIT_FAILURE;
+    }
+  }
+  cleanup_schedules(scheds, scheds_len);
+
+  if (c_opt && unlock_database(db) != 0)
+    return EXIT_FAILURE;
+
+  for (i=0; i<len; i++) {
+    if (jobs[i].placed) {
+      fprintf(stdout, "%ld:%u:%s\n", jobs[i].start, jobs[i].duration,
+	      jobs[i].caption);
+    }
+  }
+  fflush(stdout);
+
+  return (placed < len) ? EXIT_NOT_PLACED : EXIT_SUCCESS;
+}
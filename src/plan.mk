@@ -0,0 +1,7 @@
+OBJECTS += $(OBJ_DIR)/plan.o
+
+$(OBJ_DIR)/plan.o: $(SOURCE_DIR)/plan.c \
+                   $(INCLUDE_DIR)/plan.h \
+                   $(INCLUDE_DIR)/common.h \
+                   $(INCLUDE_DIR)/lock.h \
+                   $(INCLUDE_DIR)/unlock.h
\ No newline at end of file
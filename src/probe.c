@@ -0,0 +1,293 @@
+/*
+ * probe.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file probe.c
+ * @brief 複数の候補の範囲が空いているかをまとめて調べるコマンドに関する実装。
+ */
+
+#include "../include/probe.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/common.h"
+#include "../include/daemon.h"
+
+/** 重複する候補がある場合の戻り値 */
+#define EXIT_CONFLICT 3
+
+static int verbose = 0;
+
+
+/**
+ * @brief ヘルプをstderrに出力する。
+ */
+static void print_usage()
+{
+  const char *usage = "tm probe [-d database] [-R resources] [-v] [-h]\n";
+
+  const char *description = "stdinのすべての行を候補の範囲として読み込み、"
+    "データベースのスケジュールと重複するかを調べて、入力の順番にstdoutに"
+    "出力します。\n"
+    "\n"
+    "候補の書式は start:duration です。startは開始時刻(time_t形式)、"
+    "durationは継続時間(sec)です。\n"
+    "\n"
+    "重複しない候補は start:duration:free 、重複する候補は "
+    "start:duration:conflict:pgid:caption の書式で出力します。pgidとcaptionは"
+    "重複するスケジュールの1つです。\n"
+    "\n"
+    "データベースの読み込みは1度だけで、すべての候補を同じ時点の"
+    "スケジュールで調べます。自プロセスグループのスケジュールは調べません。"
+    "データベースは変更しません。\n";
+
+  const char *optarg = "OPTIONS\n"
+    "\t-d database データベース番号(1-5が使用可能)\n"
+    "\t-R resources 候補が占有する資源の集合(カンマ区切り)\n"
+    "\t-v          verboseモード\n"
+    "\t-h          show this help message and exit\n";
+
+  const char *exit_status = "EXIT STATUS\n"
+    "\t0 正常終了\n"
+    "\t1 異常終了\n"
+    "\t2 使用方法に誤りがある場合\n"
+    "\t3 重複する候補がある場合\n";
+
+  const char *env = "ENVIRONMENT\n"
+    "\tTM_DB_NUM データベース番号(1-5が使用可能)。dオプションが指定された場合は、そちらが優先される。\n";
+
+  const char *example = "EXAMPLE\n"
+    "\t$ printf \"1517188474:600\\n1517189074:600\\n\" | tm probe\n"
+    "\t1517188474:600:conflict:1234:caption\n"
+    "\t1517189074:600:free\n";
+
+  fprintf(stderr, "usage: %s\n%s\n%s\n%s\n%s\n%s\n", usage, description,
+	  optarg, exit_status, env, example);
+}
+
+
+/**
+ * @brief コマンドライン引数を解析する。
+ * @param[in]  argc      argc値
+ * @param[in]  argv      argv値
+ * @param[out] shm_name  '-d'オプション(データベース番号)が反映される。
+ * @param[out] d_opt     '-d'オプション(データベース番号)が指定された場合、1が設定される。
+ * @param[out] resources '-R'オプション(資源の集合)の値が反映される。
+ * @param[out] verbose   '-v'オプション(verboseモード)の値が反映される。
+ * @return 成功時は0、'h'オプションが指定された場合は1、不正な値が与えられた場
+ * 合は2を返す。
+ */
+static int parse_arguments(int argc, char* *argv, char *shm_name, int *d_opt,
+			   char *resources, int *verbose)
+{
+  // TimeManagerから呼ばれる場合、argvは{"tm", "probe", "opt"...}となる。
+  // オプションを読み込むためには、optindを1つ進めて2にしておく必要がある。
+  opterr = 0;
+  optind = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:hR:v")) != -1) {
+    switch (opt) {
+    case 'd':
+      // データベース番号
+      if (atoi(optarg) < 1 || atoi(optarg) > MAX_NUM_DB) {
+	fprintf(stderr, "Error: Invalid database number. (Valid 1-%d)\n",
+		MAX_NUM_DB);
+	return 2;
+      }
+      strcat(shm_name, optarg);
+      *d_opt = 1;
+      break;
+    case 'h':
+      // ヘルプ
+      print_usage();
+      return 1;
+    case 'R':
+      // 資源の集合
+      if (check_resource_set(optarg) != 0) {
+	fprintf(stderr, "Error: Invalid resources. \"%s\"\n", optarg);
+	return 2;
+      }
+      strcpy(resources, optarg);
+      break;
+    case 'v':
+      // verboseモード
+      *verbose = 1;
+      break;
+    case '?':
+    default:
+      fprintf(stderr, "%s:%d: Error: Unknown option.\n", __FILE__, __LINE__);
+      return 2;
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief stdinからすべての候補を読み込む。
+ * @param[out] probes 読み込んだ候補が反映される。free()で解放する。
+ * @param[out] len    読み込んだ候補の数が反映される。
+ * @return 成功時は0、失敗時には-1、候補が不正な場合は1を返す。
+ */
+static int read_probes(struct probe* *probes, size_t *len)
+{
+  char buf[MAX_SCHEDULE_STRING_LEN+1];
+  size_t cap = 0;
+
+  *probes = NULL;
+  *len = 0;
+  while (fgets(buf, MAX_SCHEDULE_STRING_LEN+1, stdin) != NULL) {
+    if (buf[0] == '\n')
+      continue;
+
+    if (*len == cap) {
+      cap = (cap == 0) ? 256 : cap * 2;
+      struct probe *p = realloc(*probes, cap * sizeof(struct probe));
+      if (p == NULL) {
+	fprintf(stderr, "%s:%d: Error: Faild to allocate memory.\n", __FILE__,
+		__LINE__);
+	return -1;
+      }
+      *probes = p;
+    }
+
+    struct probe *p = &(*probes)[*len];
+    char sep = 0, rest = 0;
+    int n = sscanf(buf, "%ld%c%u%c", &p->start, &sep, &p->duration, &rest);
+    if (n < 3 || sep != ':' || p->start <= 0 ||
+	(n == 4 && rest != '\n')) {
+      fprintf(stderr, "%s:%d: Error: Unknown probe format. \"%s\"\n",
+	      __FILE__, __LINE__, buf);
+      return 1;
+    }
+
+    p->conflict = NULL;
+    (*len)++;
+  }
+
+  if (ferror(stdin)) {
+    fprintf(stderr, "%s:%d: Error: Reading stdin.\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int probe(int argc, char* argv[])
+{
+  char shm_name[NAME_MAX] = DEFAULT_SHARED_MEMORY_NAME;
+  char resources[MAX_RESOURCES_LEN] = "";
+  int d_opt = 0;
+
+  // オプションチェック
+  switch (parse_arguments(argc, argv, shm_name, &d_opt, resources, &verbose)) {
+  case 1:
+    return EXIT_SUCCESS;
+  case 2:
+    return EXIT_MISUSE;
+  }
+
+  // 'd'オプションが指定されていない場合は、環境変数を確認する。
+  if (!d_opt) {
+    if (get_env(NULL, shm_name) != 0)
+      return EXIT_FAILURE;
+  }
+
+  // stdinから候補を読み込む。
+  struct probe *probes;
+  size_t len;
+  switch (read_probes(&probes, &len)) {
+  case -1:
+    free(probes);
+    return EXIT_FAILURE;
+  case 1:
+    free(probes);
+    return EXIT_MISUSE;
+  }
+
+  // 候補の範囲全体で、繰り返しスケジュールを展開する。
+  time_t begin = 0, end = 0;
+  size_t i;
+  for (i=0; i<len; i++) {
+    if (i == 0 || probes[i].start < begin)
+      begin = probes[i].start;
+    if (i == 0 || probes[i].start + probes[i].duration > end)
+      end = probes[i].start + probes[i].duration;
+  }
+
+  unsigned int capacity;
+  if (get_capacity(shm_name, &capacity) != 0) {
+    free(probes);
+    return EXIT_FAILURE;
+  }
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  if (fetch_schedules(shm_name, scheds, MAX_NUM_SCHEDULES, &scheds_len) != 0) {
+    free(probes);
+    return EXIT_FAILURE;
+  }
+
+  struct expansion ex;
+  if (expand_schedules(scheds, scheds_len, begin, end, &ex) != 0) {
+    cleanup_schedules(scheds, scheds_len);
+    free(probes);
+    return EXIT_FAILURE;
+  }
+
+  if (verbose > 0) {
+    fprintf(stderr, "%s:%d: Debug: probes:%zu schedules:%zu capacity:%u\n",
+	    __FILE__, __LINE__, len, ex.len, capacity);
+  }
+
+  if (probe_schedules(ex.scheds, ex.len, getpgid(0), capacity, resources,
+		      probes, len) != 0) {
+    cleanup_expansion(&ex);
+    cleanup_schedules(scheds, scheds_len);
+    free(probes);
+    return EXIT_FAILURE;
+  }
+
+  int ret = EXIT_SUCCESS;
+  for (i=0; i<len; i++) {
+    struct schedule *s = probes[i].conflict;
+    if (s == NULL) {
+      fprintf(stdout, "%ld:%u:free\n", probes[i].start, probes[i].duration);
+    } else {
+      fprintf(stdout, "%ld:%u:conflict:%d:%s\n", probes[i].start,
+	      probes[i].duration, s->pgid, s->caption);
+      ret = EXIT_CONFLICT;
+    }
+  }
+  fflush(stdout);
+
+  cleanup_expansion(&ex);
+  cleanup_schedules(scheds, scheds_len);
+  free(probes);
+
+  return ret;
+}
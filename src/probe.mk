@@ -0,0 +1,6 @@
+OBJECTS += $(OBJ_DIR)/probe.o
+
+$(OBJ_DIR)/probe.o: $(SOURCE_DIR)/probe.c \
+                    $(INCLUDE_DIR)/probe.h \
+                    $(INCLUDE_DIR)/common.h \
+                    $(INCLUDE_DIR)/daemon.h
\ No newline at end of file
@@ -0,0 +1,305 @@
+/*
+ * reaper.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file reaper.c
+ * @brief 終了したプロセスグループのスケジュールを取り除く機能(reaper)に関する
+ * 実装。
+ */
+
+#include "../include/reaper.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
+
+#include "../include/notify.h"
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+#define USE_PIDFD 1
+
+/** 1度に受け取る終了の通知の数 */
+#define MAX_EVENTS 64
+
+/**
+ * @struct watch
+ * @brief pidfdで監視しているプロセスグループのリーダー。
+ */
+struct watch {
+  pid_t pgid;  /**< リーダーのpid値 */
+  uint64_t start;  /**< リーダーの開始時刻 */
+  int fd;  /**< リーダーのpidfd */
+  int exited;  /**< リーダーの終了を通知された場合は1 */
+  int seen;  /**< 今回調べたスケジュールにあった場合は1 */
+};
+
+/** pgid値の昇順に並べた監視の一覧 */
+static struct watch g_watches[MAX_NUM_SCHEDULES];
+static size_t g_nwatches = 0;
+static int g_epfd = -1;
+
+
+/**
+ * @brief 監視の一覧から、リーダーを探す。
+ * @param[in]  pgid 探すpgid値。
+ * @param[out] pos  見つかった位置、見つからない場合は挿入する位置が反映される。
+ * @return 見つかった場合は監視を、見つからない場合はNULLを返す。
+ */
+static struct watch* find_watch(pid_t pgid, size_t *pos)
+{
+  size_t lo = 0, hi = g_nwatches;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (g_watches[mid].pgid == pgid) {
+      *pos = mid;
+      return &g_watches[mid];
+    }
+    if (g_watches[mid].pgid < pgid)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *pos = lo;
+
+  return NULL;
+}
+
+
+/**
+ * @brief 監視を取り除き、pidfdを閉じる。
+ * @param[in] i 取り除く監視の位置。
+ */
+static void remove_watch(size_t i)
+{
+  close(g_watches[i].fd);
+  memmove(&g_watches[i], &g_watches[i+1],
+	  (g_nwatches - i - 1) * sizeof(g_watches[0]));
+  g_nwatches--;
+}
+
+
+/**
+ * @brief スケジュールのリーダーの監視を始める。
+ *
+ * 開いたpidfdのプロセスの開始時刻を確かめるので、pgid値が再利用された
+ * 別のプロセスを監視することはない。
+ *
+ * @param[in] sched 監視するスケジュール。
+ * @return 監視を始めた場合は監視を、それ以外の場合はNULLを返す。
+ */
+static struct watch* add_watch(const struct schedule *sched)
+{
+  size_t pos = 0;
+  struct watch *w = find_watch(sched->pgid, &pos);
+  if (w != NULL) {
+    if (w->start == sched->leader_start)
+      return w;
+    // 同じpgid値の別のプロセスを監視している。取り除いた位置に挿入する。
+    remove_watch(pos);
+  }
+
+  if (g_nwatches >= MAX_NUM_SCHEDULES)
+    return NULL;
+
+  int fd = syscall(SYS_pidfd_open, sched->pgid, 0);
+  if (fd == -1)
+    return NULL;
+
+  uint64_t start;
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (get_process_start(sched->pgid, &start) != 0 ||
+      start != sched->leader_start ||
+      epoll_ctl(g_epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  memmove(&g_watches[pos+1], &g_watches[pos],
+	  (g_nwatches - pos) * sizeof(g_watches[0]));
+  g_nwatches++;
+  w = &g_watches[pos];
+  w->pgid = sched->pgid;
+  w->start = sched->leader_start;
+  w->fd = fd;
+  w->exited = 0;
+  w->seen = 0;
+
+  return w;
+}
+
+
+/**
+ * @brief 終了を通知されたリーダーの監視に印をつける。
+ *
+ * 通知されたpidfdは、繰り返し通知されないようにepollから外す。
+ */
+static void collect_exits()
+{
+  struct epoll_event events[MAX_EVENTS];
+  int n;
+  do {
+    n = epoll_wait(g_epfd, events, MAX_EVENTS, 0);
+
+    int i;
+    size_t j;
+    for (i=0; i<n; i++) {
+      epoll_ctl(g_epfd, EPOLL_CTL_DEL, events[i].data.fd, NULL);
+      for (j=0; j<g_nwatches; j++) {
+	if (g_watches[j].fd == events[i].data.fd) {
+	  g_watches[j].exited = 1;
+	  break;
+	}
+      }
+    }
+  } while (n == MAX_EVENTS);
+}
+
+
+/**
+ * @brief 監視しているリーダーが続いているかを調べる。
+ * @param[in] sched 調べるスケジュール。
+ * @return 続いている場合は1、監視できない場合やリーダーが終了した場合は0を
+ * 返す。
+ */
+static int is_watched_alive(const struct schedule *sched)
+{
+  if (g_epfd == -1 || sched->pgid <= 0 || sched->leader_start == 0)
+    return 0;
+
+  struct watch *w = add_watch(sched);
+  if (w == NULL)
+    return 0;
+  w->seen = 1;
+
+  return !w->exited;
+}
+
+
+/**
+ * @brief スケジュールのなくなったリーダーの監視をやめる。
+ */
+static void sweep_watches()
+{
+  size_t i = 0;
+  while (i < g_nwatches) {
+    if (!g_watches[i].seen) {
+      remove_watch(i);
+      continue;
+    }
+    g_watches[i].seen = 0;
+    i++;
+  }
+}
+#endif
+
+
+int publish_reaper(const char *shm_name)
+{
+  assert(shm_name != NULL);
+
+  long pid = 0;
+  if (get_header_value(shm_name, REAPER_KEY, &pid) != 0)
+    return -1;
+  if (pid == getpid())
+    return 0;
+
+  // 開始時刻が取得できない環境では、pid値だけを記録する。
+  uint64_t start = 0;
+  get_process_start(getpid(), &start);
+  if (set_header_value(shm_name, REAPER_START_KEY, start) != 0 ||
+      set_header_value(shm_name, REAPER_KEY, getpid()) != 0)
+    return -1;
+
+  return 1;
+}
+
+
+void withdraw_reaper(const char *shm_name)
+{
+  assert(shm_name != NULL);
+
+  long pid = 0;
+  if (get_header_value(shm_name, REAPER_KEY, &pid) == 0 && pid == getpid())
+    set_header_value(shm_name, REAPER_KEY, 0);
+
+#if defined(USE_PIDFD)
+  while (g_nwatches > 0)
+    remove_watch(g_nwatches - 1);
+  if (g_epfd != -1) {
+    close(g_epfd);
+    g_epfd = -1;
+  }
+#endif
+}
+
+
+size_t reap_schedules(const char *shm_name, struct schedule* *scheds,
+		      size_t *len)
+{
+  assert(shm_name != NULL && scheds != NULL && len != NULL);
+
+#if defined(USE_PIDFD)
+  if (g_epfd == -1)
+    g_epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (g_epfd != -1)
+    collect_exits();
+#endif
+
+  size_t i, n = 0;
+  for (i=0; i<*len; i++) {
+    struct schedule *s = scheds[i];
+#if defined(USE_PIDFD)
+    if (is_watched_alive(s)) {
+      scheds[n++] = s;
+      continue;
+    }
+#endif
+    if (is_group_alive(s)) {
+      scheds[n++] = s;
+      continue;
+    }
+
+    time_t end = s->start + s->duration;
+    if (s->rule[0] != '\0')
+      end += RECUR_HORIZON;
+    if (s->duration != 0)
+      notify_release(shm_name, s->start, end);
+    free(s);
+  }
+
+  size_t reaped = *len - n;
+  *len = n;
+
+#if defined(USE_PIDFD)
+  sweep_watches();
+#endif
+
+  return reaped;
+}
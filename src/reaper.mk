@@ -0,0 +1,6 @@
+OBJECTS += $(OBJ_DIR)/reaper.o
+
+$(OBJ_DIR)/reaper.o: $(SOURCE_DIR)/reaper.c \
+                     $(INCLUDE_DIR)/reaper.h \
+                     $(INCLUDE_DIR)/common.h \
+                     $(INCLUDE_DIR)/notify.h
\ No newline at end of file
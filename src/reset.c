@@ -35,6 +35,7 @@
 #include <unistd.h>
 
 #include "../include/common.h"
+#include "../include/notify.h"
 
 static int verbose = 0;
 
@@ -44,8 +45,8 @@ static int verbose = 0;
 static void print_usage()
 {
   const char *usage = "tm reset [-d database] [-v] [-h]\n";
-  const char *description = "スケジュール、及びロックを管理しているファイルを"
-    "削除します。\n";
+  const char *description = "スケジュール、ロック、及び待機表を管理している"
+    "ファイルを削除します。\n";
 
   const char *optarg = "OPTIONS\n"
     "\t-d database データベース番号(1-5が使用可能)\n"
@@ -158,6 +159,10 @@ int reset(int argc, char* argv[])
     }
   }
 
+  // 待機表を削除
+  if (remove_wait_table(shm_name) != 0)
+    return EXIT_FAILURE;
+
   // セマフォを削除
   errno = 0;
   if (sem_unlink(sem_name) == -1) {
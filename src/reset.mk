@@ -2,4 +2,5 @@ OBJECTS += $(OBJ_DIR)/reset.o
 
 $(OBJ_DIR)/reset.o: $(SOURCE_DIR)/reset.c \
                     $(INCLUDE_DIR)/reset.h \
-                    $(INCLUDE_DIR)/common.h
\ No newline at end of file
+                    $(INCLUDE_DIR)/common.h \
+                    $(INCLUDE_DIR)/notify.h
\ No newline at end of file
@@ -0,0 +1,465 @@
+/*
+ * run.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file run.c
+ * @brief コマンドを予約し、デーモンに起動させるコマンドに関する実装。
+ */
+
+#include "../include/run.h"
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/common.h"
+#include "../include/daemon.h"
+#include "../include/launcher.h"
+#include "../include/lock.h"
+#include "../include/unlock.h"
+
+/** 重複のため予約できなかった場合の戻り値 */
+#define EXIT_CONFLICT 3
+
+/** PATHが設定されていない場合に、コマンドを探すディレクトリ */
+#define DEFAULT_PATH "/usr/bin:/bin"
+
+extern char **environ;
+
+static int verbose = 0;
+
+
+/**
+ * @brief ヘルプをstderrに出力する。
+ */
+static void print_usage()
+{
+  const char *usage = "tm run [-d database] [-i file] [-o file] [-e file] "
+    "[-R resources] [-v] [-h] -- command [args...]\n";
+
+  const char *description = "stdinからスケジュール文字列を読み取り、"
+    "commandを開始時刻に起動するジョブとして予約します。\n"
+    "\n"
+    "スケジュール文字列の書式は start:duration:caption です。"
+    "startは、スケジュールの開始時刻(time_t形式)、durationは、継続時間(sec)、"
+    "captionは、スケジュールの簡単な説明です。\n"
+    "\n"
+    "コマンドライン、環境変数、作業ディレクトリ、標準入出力のリダイレクト先を"
+    "スプールファイルに書き込み、スケジュールを追加します。開始時刻になると、"
+    "daemonコマンドが新しいプロセスグループでcommandを起動し、終了時刻に"
+    "プロセスグループへSIGTERMを送ります。終了時刻の前にcommandが終了した"
+    "場合は、プロセスグループに残ったプロセスにSIGTERMを送り、スケジュールを"
+    "取り除きます。開始時刻まではcommandのプロセスは"
+    "存在せず、予約したジョブはデータベースのレコードとスプールファイルだけを"
+    "使います。スプールファイルは、所有者だけが読み書きできる"
+    "/tmp/tm_spool-<uid>ディレクトリに置きます。daemonコマンドが動いている"
+    "必要があります。\n"
+    "\n"
+    "commandにスラッシュが含まれない場合は、予約する時のPATHから探します。"
+    "リダイレクト先を指定しない場合は/dev/nullになります。出力は追記されます。\n"
+    "\n"
+    "予約したジョブのスケジュールIDをstdoutに出力します。起動するまでの"
+    "スケジュールは、負のpgid値で記録されます。batchコマンドのcancel操作で"
+    "取り消せます。\n"
+    "\n"
+    "重複のため予約できなかった場合は3を返します。\n";
+
+  const char *optarg = "OPTIONS\n"
+    "\t-d database データベース番号(1-5が使用可能)\n"
+    "\t-i file     標準入力のリダイレクト元\n"
+    "\t-o file     標準出力のリダイレクト先\n"
+    "\t-e file     標準エラー出力のリダイレクト先\n"
+    "\t-R resources 占有する資源の集合(カンマ区切り。例: tuner,speaker)\n"
+    "\t-v          verboseモード\n"
+    "\t-h          show this help message and exit\n";
+
+  const char *exit_status = "EXIT STATUS\n"
+    "\t0 正常終了\n"
+    "\t1 異常終了\n"
+    "\t2 使用方法に誤りがある場合\n"
+    "\t3 重複のため予約できなかった場合\n";
+
+  const char *env = "ENVIRONMENT\n"
+    "\tTM_DB_NUM データベース番号(1-5が使用可能)。dオプションが指定された場合は、そちらが優先される。\n";
+
+  const char *example = "EXAMPLE\n"
+    "\t$ tm daemon -d 1 &\n"
+    "\t$ echo \"1503180600:600:今朝のニュース\" | tm run -d 1 -o news.log -- recorder --channel 1\n";
+
+  fprintf(stderr, "usage: %s\n%s\n%s\n%s\n%s\n%s\n", usage, description,
+	  optarg, exit_status, env, example);
+}
+
+
+/**
+ * @brief コマンドライン引数を解析する。
+ * @param[in]  argc      argc値
+ * @param[in]  argv      argv値
+ * @param[out] shm_name  '-d'オプション(データベース番号)が反映される。
+ * @param[out] d_opt     '-d'オプション(データベース番号)が指定された場合、1が設定される。
+ * @param[out] in        '-i'オプション(標準入力のリダイレクト元)が反映される。
+ * @param[out] out       '-o'オプション(標準出力のリダイレクト先)が反映される。
+ * @param[out] err       '-e'オプション(標準エラー出力のリダイレクト先)が反映される。
+ * @param[out] resources '-R'オプション(資源の集合)の値が反映される。
+ * @param[out] verbose   '-v'オプション(verboseモード)の値が反映される。
+ * @return 成功時は0、'h'オプションが指定された場合は1、不正な値が与えられた場
+ * 合は2を返す。
+ */
+static int parse_arguments(int argc, char* *argv, char *shm_name, int *d_opt,
+			   const char* *in, const char* *out, const char* *err,
+			   char *resources, int *verbose)
+{
+  // TimeManagerから呼ばれる場合、argvは{"tm", "run", "opt"...}となる。
+  // オプションを読み込むためには、optindを1つ進めて2にしておく必要がある。
+  opterr = 0;
+  optind = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:e:hi:o:R:v")) != -1) {
+    switch (opt) {
+    case 'd':
+      // データベース番号
+      if (atoi(optarg) < 1 || atoi(optarg) > MAX_NUM_DB) {
+	fprintf(stderr, "Error: Invalid database number. (Valid 1-%d)\n",
+		MAX_NUM_DB);
+	return 2;
+      }
+      strcat(shm_name, optarg);
+      *d_opt = 1;
+      break;
+    case 'e':
+      // 標準エラー出力のリダイレクト先
+      *err = optarg;
+      break;
+    case 'h':
+      // ヘルプ
+      print_usage();
+      return 1;
+    case 'i':
+      // 標準入力のリダイレクト元
+      *in = optarg;
+      break;
+    case 'o':
+      // 標準出力のリダイレクト先
+      *out = optarg;
+      break;
+    case 'R':
+      // 資源の集合
+      if (check_resource_set(optarg) != 0) {
+	fprintf(stderr, "Error: Invalid resources. \"%s\"\n", optarg);
+	return 2;
+      }
+      strcpy(resources, optarg);
+      break;
+    case 'v':
+      // verboseモード
+      *verbose = 1;
+      break;
+    case '?':
+    default:
+      fprintf(stderr, "%s:%d: Error: Unknown option.\n", __FILE__, __LINE__);
+      return 2;
+    }
+  }
+
+  if (optind >= argc) {
+    fprintf(stderr, "%s:%d: Error: No command.\n", __FILE__, __LINE__);
+    return 2;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief 相対パスを、作業ディレクトリからの絶対パスにする。
+ * @param[in]  cwd  作業ディレクトリ。
+ * @param[in]  name パス。
+ * @param[out] path 絶対パスが反映される。PATH_MAXの領域が必要。
+ * @return 成功時は0、長すぎる場合は-1を返す。
+ */
+static int make_absolute(const char *cwd, const char *name, char *path)
+{
+  int n = (name[0] == '/') ? snprintf(path, PATH_MAX, "%s", name) :
+    snprintf(path, PATH_MAX, "%s/%s", cwd, name);
+  if (n < 0 || n >= PATH_MAX) {
+    fprintf(stderr, "%s:%d: Error: Too long path. \"%s\"\n", __FILE__,
+	    __LINE__, name);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief コマンドの絶対パスを探す。
+ *
+ * デーモンはジョブのPATHを使わずに起動するので、予約する時に決めておく。
+ *
+ * @param[in]  cwd  作業ディレクトリ。
+ * @param[in]  name コマンド名。
+ * @param[out] path コマンドの絶対パスが反映される。PATH_MAXの領域が必要。
+ * @return 見つかった場合は0、見つからない場合は-1を返す。
+ */
+static int resolve_command(const char *cwd, const char *name, char *path)
+{
+  if (strchr(name, '/') != NULL) {
+    if (make_absolute(cwd, name, path) == 0 && access(path, X_OK) == 0)
+      return 0;
+  } else {
+    const char *dirs = getenv("PATH");
+    if (dirs == NULL)
+      dirs = DEFAULT_PATH;
+
+    // 空の要素は作業ディレクトリを表す。
+    while (1) {
+      size_t n = strcspn(dirs, ":");
+      char dir[PATH_MAX];
+      snprintf(dir, PATH_MAX, "%.*s", (int)n, (n == 0) ? "." : dirs);
+      char file[PATH_MAX];
+      if (snprintf(file, PATH_MAX, "%s/%s", dir, name) < PATH_MAX &&
+	  make_absolute(cwd, file, path) == 0 && access(path, X_OK) == 0)
+	return 0;
+
+      if (dirs[n] == '\0')
+	break;
+      dirs += n + 1;
+    }
+  }
+
+  fprintf(stderr, "%s:%d: Error: Command not found. \"%s\"\n", __FILE__,
+	  __LINE__, name);
+  return -1;
+}
+
+
+/**
+ * @brief stdinからスケジュールを読み込む。
+ *
+ * 読み込んだスケジュールの終了時刻が、現在時刻よりも過去の場合は1を返す。
+ *
+ * @param[out] sched 読み込んだスケジュールが反映される。pgid値は0。
+ * @return 成功時は0、失敗時には-1、不正なスケジュールの場合は1を返す。
+ */
+static int read_schedule(struct schedule* *sched)
+{
+  // stdinから1行読み取る。
+  char buf[MAX_SCHEDULE_STRING_LEN+1] = "";
+  if (fgets(buf, MAX_SCHEDULE_STRING_LEN+1 , stdin) == NULL) {
+    if (feof(stdin) == 0) {
+      fprintf(stderr, "%s:%d: Error: while reading stdin.\n", __FILE__,
+	      __LINE__);
+      return -1;
+    }
+  }
+
+  char str[MAX_SCHEDULE_STRING_LEN];
+  int n = snprintf(str, sizeof(str), "%d:%d:%d:%s", 0, 0, 0, buf);
+  if (n < 0 || (size_t)n >= sizeof(str)) {
+    fprintf(stderr, "%s:%d: Error: Too long schedule.\n", __FILE__, __LINE__);
+    return 1;
+  }
+
+  if (string_to_schedule(str, sched) != 0)
+    return 1;
+
+  time_t current = time(NULL);
+  if ((*sched)->duration == 0 ||
+      (*sched)->start + (*sched)->duration <= current) {
+    fprintf(stderr, "%s:%d: Error: past schedule. current:%ld, new_end:%ld\n",
+	    __FILE__, __LINE__, current, ((*sched)->start+(*sched)->duration));
+    free(*sched);
+    return 1;
+  }
+
+  if (verbose > 0) {
+    fprintf(stderr,
+	    "%s:%d: debug: in start:%ld, duration:%d, caption:%s\n", __FILE__,
+	    __LINE__, (*sched)->start, (*sched)->duration, (*sched)->caption);
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief ジョブを予約する。
+ *
+ * データベースをロックした状態で、スケジュールIDを決めてスプールファイルを
+ * 書き込み、スケジュールを追加する。スケジュールIDは、他のジョブと重ならない
+ * pgid値を作るために、データベースに書き込む前に決める。
+ *
+ * @param[in]     shm_name データベースの共有メモリ名。
+ * @param[in]     db       データベース番号。環境変数を使う場合はNULL。
+ * @param[in,out] new      追加するスケジュール。id、pgid値が反映される。
+ * @param[in]     job      スプールファイルに書き込むジョブ。
+ * @return 成功時は0、失敗時には-1、重複のため予約できなかった場合は1を返す。
+ */
+static int reserve_job(const char *shm_name, const char *db,
+		       struct schedule *new, const struct job *job)
+{
+  if (lock_database(db) != 0)
+    return -1;
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t len = 0;
+  unsigned int capacity;
+  if (load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		     &len) != 0) {
+    unlock_database(db);
+    return -1;
+  }
+
+  int ret = -1;
+  if (get_capacity(shm_name, &capacity) != 0)
+    goto cleanup;
+
+  switch (check_sched_capacity(new, scheds, len, capacity)) {
+  case 0:
+    break;
+  case 1:
+    fprintf(stderr, "%s:%d: Error: Double booking.\n", __FILE__, __LINE__);
+    ret = 1;
+    goto cleanup;
+  default:
+    goto cleanup;
+  }
+
+  if (len + 1 >= MAX_NUM_SCHEDULES) {
+    fprintf(stderr, "%s:%d: Error: Too many schedules.\n", __FILE__, __LINE__);
+    goto cleanup;
+  }
+
+  long next_id = 1;
+  if (get_header_value(shm_name, NEXT_ID_KEY, &next_id) != 0 ||
+      set_header_value(shm_name, NEXT_ID_KEY, next_id + 1) != 0)
+    goto cleanup;
+  new->id = next_id;
+  new->pgid = job_pgid(new->id);
+
+  if (spool_job(shm_name, new->id, job) != 0)
+    goto cleanup;
+
+  // スケジュールを書き込んでからスプールファイルにするので、デーモンが
+  // スケジュールのないスプールファイルとして削除することはない。
+  scheds[len++] = new;
+  if (save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, len) != 0) {
+    len--;
+    unspool_job(shm_name, new->id);
+    goto cleanup;
+  }
+  len--;
+
+  // スプールファイルにできなかった場合は、スケジュールも取り除く。
+  if (publish_spool(shm_name, new->id) != 0) {
+    save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, len);
+    goto cleanup;
+  }
+  ret = 0;
+
+ cleanup:
+  cleanup_schedules(scheds, len);
+  if (unlock_database(db) != 0)
+    ret = -1;
+
+  return ret;
+}
+
+
+int run(int argc, char* argv[])
+{
+  char shm_name[NAME_MAX] = DEFAULT_SHARED_MEMORY_NAME;
+  char resources[MAX_RESOURCES_LEN] = "";
+  const char *in = "/dev/null", *out = "/dev/null", *err = "/dev/null";
+  int d_opt = 0;
+
+  // オプションチェック
+  switch (parse_arguments(argc, argv, shm_name, &d_opt, &in, &out, &err,
+			  resources, &verbose)) {
+  case 1:
+    return EXIT_SUCCESS;
+  case 2:
+    return EXIT_MISUSE;
+  }
+
+  // 'd'オプションが指定されていない場合は、環境変数を確認する。
+  if (!d_opt) {
+    if (get_env(NULL, shm_name) != 0)
+      return EXIT_FAILURE;
+  }
+
+  if (verbose > 0)
+    fprintf(stderr, "%s:%d: shm_name:%s\n", __FILE__, __LINE__, shm_name);
+
+  // コマンドのパスとリダイレクト先は、予約した時の作業ディレクトリで決める。
+  char cwd[PATH_MAX], command[PATH_MAX];
+  char in_path[PATH_MAX], out_path[PATH_MAX], err_path[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    fprintf(stderr, "%s:%d: Error: getcwd()\n", __FILE__, __LINE__);
+    return EXIT_FAILURE;
+  }
+  if (make_absolute(cwd, in, in_path) != 0 ||
+      make_absolute(cwd, out, out_path) != 0 ||
+      make_absolute(cwd, err, err_path) != 0 ||
+      resolve_command(cwd, argv[optind], command) != 0)
+    return EXIT_MISUSE;
+
+  // 起動するのはデーモンなので、動いていない場合は予約しない。
+  if (!is_daemon_running(shm_name)) {
+    fprintf(stderr, "%s:%d: Error: Daemon is not running.\n", __FILE__,
+	    __LINE__);
+    return EXIT_FAILURE;
+  }
+
+  struct schedule* new;
+  switch (read_schedule(&new)) {
+  case -1:
+    return EXIT_FAILURE;
+  case 1:
+    return EXIT_MISUSE;
+  }
+  strcpy(new->resources, resources);
+
+  // argv[0]は、探したコマンドの絶対パスにする。
+  char* *args = &argv[optind];
+  char *name = args[0];
+  args[0] = command;
+  struct job job = {args, environ, cwd, in_path, out_path, err_path};
+
+  // lock_database()には、データベース番号のみ渡す。
+  const char *db = NULL;
+  if (d_opt)
+    db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+
+  int ret = reserve_job(shm_name, db, new, &job);
+  args[0] = name;
+  if (ret != 0) {
+    free(new);
+    return (ret == 1) ? EXIT_CONFLICT : EXIT_FAILURE;
+  }
+
+  fprintf(stdout, "%" PRIu64 "\n", new->id);
+  free(new);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,9 @@
+OBJECTS += $(OBJ_DIR)/run.o
+
+$(OBJ_DIR)/run.o: $(SOURCE_DIR)/run.c \
+                  $(INCLUDE_DIR)/run.h \
+                  $(INCLUDE_DIR)/common.h \
+                  $(INCLUDE_DIR)/daemon.h \
+                  $(INCLUDE_DIR)/launcher.h \
+                  $(INCLUDE_DIR)/lock.h \
+                  $(INCLUDE_DIR)/unlock.h
\ No newline at end of file
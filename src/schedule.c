@@ -33,6 +33,7 @@
 #include <unistd.h>
 
 #include "../include/common.h"
+#include "../include/daemon.h"
 
 static int verbose = 0;
 
@@ -41,14 +42,26 @@ static int verbose = 0;
  */
 static void print_usage()
 {
-  const char *usage = "tm schedule [-a] [-d database] [-r] [-v] [-h]\n";
+  const char *usage = "tm schedule [-a | -A] [-b begin] [-d database] [-r] "
+    "[-w window] [-v] [-h]\n";
   const char *description = "データベースにある有効なスケジュールをstdoutに出"
-    "力します。\n";
+    "力します。\n"
+    "\n"
+    "繰り返しスケジュールは、beginからwindow秒間の範囲で展開して出力します。"
+    "aオプションを指定した場合は、展開せずにデータベースのレコードを"
+    "pgid:lock:terminator:start:duration:captionの書式で出力します。"
+    "Aオプションを指定した場合は、繰り返しの規則やスケジュールIDなどの属性を"
+    "含めて、データベースのレコードをそのまま出力します。\n";
 
   const char *optarg = "OPTIONS\n"
     "\t-a          アクティベートされていないスケジュールも出力する。\n"
+    "\t-A          属性を含むデータベースのレコードをそのまま出力する。\n"
+    "\t-b begin    繰り返しスケジュールを展開する範囲の開始時刻(time_t形式)。"
+    "デフォルトは現在時刻\n"
     "\t-d database データベース番号(1-5が使用可能)\n"
     "\t-r          データベースの内容をスケジュールフォーマットで出力する。\n"
+    "\t-w window   繰り返しスケジュールを展開する範囲(sec)。"
+    "デフォルトは86400\n"
     "\t-v          verboseモード\n"
     "\t-h          show this help message and exit\n";
   
@@ -78,28 +91,44 @@ static void print_usage()
  * @param[in]  argc     argc値
  * @param[in]  argv     argv値
  * @param[out] shm_name '-d'オプション(データベース番号)が反映される。
- * @param[out] opt_a    '-a'オプション(allモード)の値が反映される。
+ * @param[out] opt_a    '-a'オプション(allモード)の値が反映される。'-A'
+ * オプション(recordモード)の場合は2が設定される。
  * @param[out] opt_d    '-d'オプション(データベース番号)が指定された場合、1が設
  * 定される。
  * @param[out] opt_r    '-r'オプション(rawモード)の値が反映される。
+ * @param[out] begin    '-b'オプション(展開範囲の開始時刻)の値が反映される。
+ * @param[out] window   '-w'オプション(展開範囲)の値が反映される。
  * @param[out] verbose  '-v'オプション(verboseモード)の値が反映される。
  * @return 成功時は0、'h'オプションが指定された場合は1、不正な値が与えられた場
  * 合は2を返す。
  */
 static int parse_arguments(int argc, char* *argv, char *shm_name, int *opt_a,
-			   int *opt_d, int *opt_r, int *verbose)
+			   int *opt_d, int *opt_r, time_t *begin,
+			   unsigned int *window, int *verbose)
 {  
   // TimeManagerから呼ばれる場合、argvは{"tm", "unoccupied". "opt"...}となる。
   // オプションを読み込むためには、optindを1つ進めて2にしておく必要がある。
   opterr = 0;
   optind = 2;
   int opt;
-  while ((opt = getopt(argc, argv, "ad:rhv")) != -1) {
+  while ((opt = getopt(argc, argv, "aAb:d:rhvw:")) != -1) {
     switch (opt) {
     case 'a':
       // allモード
       *opt_a = 1;
       break;
+    case 'A':
+      // recordモード
+      *opt_a = 2;
+      break;
+    case 'b':
+      // 展開範囲の開始時刻
+      *begin = atol(optarg);
+      if (*begin <= 0) {
+	fprintf(stderr, "Error: Invalid begin value. \"%s\"\n", optarg);
+	return 2;
+      }
+      break;
     case 'd':
       // データベース番号
       if (atoi(optarg) < 1 || atoi(optarg) > MAX_NUM_DB) {
@@ -122,6 +151,14 @@ static int parse_arguments(int argc, char* *argv, char *shm_name, int *opt_a,
       // verboseモード
       *verbose = 1;
       break;
+    case 'w':
+      // 展開範囲
+      if (atoi(optarg) <= 0) {
+	fprintf(stderr, "Error: Invalid window value. \"%s\"\n", optarg);
+	return 2;
+      }
+      *window = atoi(optarg);
+      break;
     case '?':
       //fprintf(stderr, "%s:%d: Error: Unknown option.\n", __FILE__, __LINE__);
       //return -1;
@@ -146,10 +183,12 @@ int schedule(int argc, char* argv[])
 {
   char shm_name[NAME_MAX] = DEFAULT_SHARED_MEMORY_NAME;
   int opt_a = 0, opt_d = 0, opt_r = 0;
+  time_t begin = time(NULL);
+  unsigned int window = 60 * 60 * 24;
 
   // オプションチェック
-  switch (parse_arguments(argc, argv, shm_name, &opt_a, &opt_d, &opt_r,
-			  &verbose)) {
+  switch (parse_arguments(argc, argv, shm_name, &opt_a, &opt_d, &opt_r, &begin,
+			  &window, &verbose)) {
   case 1:
     return EXIT_SUCCESS;
   case 2:
@@ -168,40 +207,67 @@ int schedule(int argc, char* argv[])
   // スケジュールデータベースからレコードを読み込む
   struct schedule* scheds[MAX_NUM_SCHEDULES];
   size_t scheds_len = 0;
-  if (load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
-		     &scheds_len) != 0) {
+  if (fetch_schedules(shm_name, scheds, MAX_NUM_SCHEDULES, &scheds_len) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  // a、Aオプションの場合は、展開せずにレコードを書き出す。
+  size_t i;
+  if (opt_a) {
+    sort_schedules(scheds, scheds_len);
+    for (i=0; i<scheds_len; i++) {
+      struct schedule* s = scheds[i];
+      if (opt_a == 1) {
+	fprintf(stdout, "%d:%d:%d:%ld:%d:%s\n", s->pgid, s->lock,
+		s->terminator, s->start, s->duration, s->caption);
+	continue;
+      }
+
+      char buff[MAX_RECORD_STRING_LEN+1];
+      if (record_to_string(s, buff, sizeof(buff)) != 0) {
+	cleanup_schedules(scheds, scheds_len);
+	return EXIT_FAILURE;
+      }
+      fprintf(stdout, "%s\n", buff);
+    }
+    fflush(stdout);
+    cleanup_schedules(scheds, scheds_len);
+    return EXIT_SUCCESS;
+  }
+
+  // 繰り返しスケジュールを展開する。
+  struct expansion ex;
+  if (expand_schedules(scheds, scheds_len, begin, begin + window, &ex) != 0) {
+    cleanup_schedules(scheds, scheds_len);
     return EXIT_FAILURE;
   }
+  struct schedule* *list = ex.scheds;
+  size_t list_len = ex.len;
 
   // スケジュールをstart値で昇順ソート
-  sort_schedules(scheds, scheds_len);
+  sort_schedules(list, list_len);
 
   // 書き出し
-  int i;
-  for (i=0; i<scheds_len; i++) {
+  for (i=0; i<list_len; i++) {
 
     // アクティベートされていないスケジュールは飛ばす。
-    if (!opt_a && scheds[i]->terminator == 0) {
+    if (list[i]->terminator == 0) {
       continue;
     }
     
-    if (opt_a) {
-      struct schedule* s = scheds[i];
-      fprintf(stdout, "%d:%d:%d:%ld:%d:%s\n", s->pgid, s->lock, s->terminator,
-	      s->start, s->duration, s->caption);
-    } else if (opt_r) {
-      fprintf(stdout, "%ld:%d:%s\n", scheds[i]->start, scheds[i]->duration,
-	      scheds[i]->caption);
+    if (opt_r) {
+      fprintf(stdout, "%ld:%d:%s\n", list[i]->start, list[i]->duration,
+	      list[i]->caption);
     } else {
       // schedule
-      struct tm *tm = localtime(&(scheds[i]->start));
+      struct tm *tm = localtime(&(list[i]->start));
       char buf[512];
       if (strftime(buf, sizeof(buf), "%m/%d %H:%M", tm) == 0) {
 	fprintf(stderr, "strftime returned 0");
       }
       fprintf(stdout, "%s-", buf);
 
-      time_t end = scheds[i]->start + scheds[i]->duration;
+      time_t end = list[i]->start + list[i]->duration;
       tm = localtime(&end);
       if (strftime(buf, sizeof(buf), "%H:%M", tm) == 0) {
 	fprintf(stderr, "strftime returned 0");
@@ -210,7 +276,7 @@ int schedule(int argc, char* argv[])
 
       // duration
       fprintf(stdout, " (");
-      div_t d = div(scheds[i]->duration, 3600);
+      div_t d = div(list[i]->duration, 3600);
       if (d.quot != 0)
 	fprintf(stdout, "%dh", d.quot);
       
@@ -224,13 +290,14 @@ int schedule(int argc, char* argv[])
       fprintf(stdout, ")");
 
       // caption
-      fprintf(stdout, " %s\n", scheds[i]->caption);
+      fprintf(stdout, " %s\n", list[i]->caption);
     }
   }
 
   fflush(stdout);
 
   //
+  cleanup_expansion(&ex);
   cleanup_schedules(scheds, scheds_len);
 
   return EXIT_SUCCESS;
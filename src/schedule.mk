@@ -2,4 +2,5 @@ OBJECTS += $(OBJ_DIR)/schedule.o
 
 $(OBJ_DIR)/schedule.o: $(SOURCE_DIR)/schedule.c \
                        $(INCLUDE_DIR)/schedule.h \
-                       $(INCLUDE_DIR)/common.h
\ No newline at end of file
+                       $(INCLUDE_DIR)/common.h \
+                       $(INCLUDE_DIR)/daemon.h
\ No newline at end of file
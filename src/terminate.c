@@ -34,6 +34,9 @@
 #include <unistd.h>
 
 #include "../include/common.h"
+#include "../include/lock.h"
+#include "../include/notify.h"
+#include "../include/unlock.h"
 
 static int verbose = 0;
 
@@ -152,6 +155,8 @@ int terminate(int argc, char* argv[])
     fprintf(stderr, "%s:%d: shm_name:%s\n", __FILE__, __LINE__, shm_name);
   }
 
+  // lock()はスケジュールのないプロセスグループのレコードも作成するので、
+  // ロックする前に確認する。
   struct schedule* scheds[MAX_NUM_SCHEDULES];
   size_t scheds_len = 0;
   if (load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
@@ -160,16 +165,63 @@ int terminate(int argc, char* argv[])
   }
 
   struct schedule *s = NULL;
-  if (find_sched_by_pgid(getpgid(0), scheds, scheds_len, &s) != 0) {
+  int found = find_sched_by_pgid(getpgid(0), scheds, scheds_len, &s);
+  cleanup_schedules(scheds, scheds_len);
+  if (found != 0) {
     fprintf(stderr, "%s:%d: Error: Could not found schedule for pgid %d.\n",
 	    __FILE__, __LINE__, getpgid(0));
-    cleanup_schedules(scheds, scheds_len);
     return EXIT_MISUSE;
   }
 
+  // lock()はデータベース番号のみ解釈する。
+  const char *db = NULL;
+  if (opt_d)
+    db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+
+  if (lock_database(db) != 0)
+    return EXIT_FAILURE;
+
+  scheds_len = 0;
+  if (load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
+		     &scheds_len) != 0) {
+    unlock_database(db);
+    return EXIT_FAILURE;
+  }
+
+  if (find_sched_by_pgid(getpgid(0), scheds, scheds_len, &s) != 0) {
+    cleanup_schedules(scheds, scheds_len);
+    unlock_database(db);
+    return EXIT_FAILURE;
+  }
+
   pid_t pgid = s->pgid;
+  time_t start = s->start;
+  time_t end = s->start + s->duration;
+  if (s->rule[0] != '\0')
+    end += RECUR_HORIZON;
+
+  // 継続時間を0にして、範囲を解放する。プロセスグループの終了を待たずに、
+  // 待機中のクライアントが再確認できる。
+  s->start = 0;
+  s->duration = 0;
+  s->terminator = 0;
+  s->rule[0] = '\0';
+  if (save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, scheds_len) != 0) {
+    cleanup_schedules(scheds, scheds_len);
+    unlock_database(db);
+    return EXIT_FAILURE;
+  }
   cleanup_schedules(scheds, scheds_len);
 
+  if (unlock_database(db) != 0)
+    return EXIT_FAILURE;
+
+  // 通知を最後にするため、自身へのシグナルを保留してから送信する。
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGTERM);
+  sigprocmask(SIG_BLOCK, &set, NULL);
+
   errno = 0;
   if (killpg(pgid, SIGTERM) == -1) {
     fprintf(stderr, "%s:%d: Error: %s. to:%d, sig:%d\n", __FILE__, __LINE__,
@@ -177,5 +229,8 @@ int terminate(int argc, char* argv[])
     return EXIT_FAILURE;
   }
 
+  // 待機中のクライアントに、スケジュールの終了を通知する。
+  notify_release(shm_name, start, end);
+
   return EXIT_SUCCESS;
 }
@@ -4,4 +4,7 @@ OBJECTS += $(OBJ_DIR)/terminate.o
 # 依存関係を絶対パスで書く。(依存関係の一番最初は必ずソースファイルにする)
 $(OBJ_DIR)/terminate.o: $(SOURCE_DIR)/terminate.c \
                         $(INCLUDE_DIR)/terminate.h \
-                        $(INCLUDE_DIR)/common.h
\ No newline at end of file
+                        $(INCLUDE_DIR)/common.h \
+                        $(INCLUDE_DIR)/lock.h \
+                        $(INCLUDE_DIR)/notify.h \
+                        $(INCLUDE_DIR)/unlock.h
\ No newline at end of file
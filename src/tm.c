@@ -0,0 +1,1000 @@
+/*
+ * tm.c
+ * This file is part of TimeManager.
+ *
+ * Copyright (C) 2018  Shun ITO <shunito.s110@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tm.c
+ * @brief TimeManagerをプログラムから使うためのライブラリに関する実装。
+ */
+
+#include "../include/tm.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/common.h"
+#include "../include/crontab_mask.h"
+#include "../include/notify.h"
+
+#if TM_CAPTION_LEN != MAX_CAPTION_LEN || TM_RULE_LEN != MAX_RULE_LEN || \
+  TM_RESOURCES_LEN != MAX_RESOURCES_LEN
+#error "tm_schedule must have the same string sizes as schedule."
+#endif
+
+/** セマフォの獲得を再試行する間隔(nsec)。sem_timedwait()がない環境で使う。 */
+#define LOCK_RETRY_INTERVAL_NSEC (10 * 1000 * 1000)
+
+/**
+ * データベースごとに、プロセス内でトランザクションを排他するためのmutex。
+ * 添字はデータベース番号で、番号のないデータベースは0。
+ * lockコマンドでロックしている場合はセマフォを待たないので、スレッド間の
+ * 排他はこれで行う。
+ */
+static pthread_mutex_t g_transaction_mutex[MAX_NUM_DB + 1];
+static pthread_once_t g_transaction_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @struct tm_handle
+ * @brief 開いたデータベース。
+ */
+struct tm_handle {
+  char sem_name[NAME_MAX];  /**< セマフォ名 */
+  char shm_name[NAME_MAX];  /**< 共有メモリ名 */
+  pthread_mutex_t *mutex;  /**< データベースのトランザクションを排他するmutex */
+};
+
+/**
+ * @struct release
+ * @brief スケジュールを追加した後、ロックを解放してから知らせる内容。
+ */
+struct release {
+  time_t start;  /**< 上書きで解放した範囲の開始時刻 */
+  time_t end;  /**< 上書きで解放した範囲の終了時刻。解放していない場合は0 */
+};
+
+
+/**
+ * @brief データベースごとのmutexを初期化する。pthread_once()から1度だけ
+ * 呼び出す。
+ */
+static void init_transaction_mutex(void)
+{
+  int i;
+  for (i=0; i<=MAX_NUM_DB; i++)
+    pthread_mutex_init(&g_transaction_mutex[i], NULL);
+}
+
+
+/**
+ * @brief データベースをロックする。
+ *
+ * 先にプロセス内のデータベースのmutexを獲得する。呼び出したプロセスのプロセスグループが、
+ * lockコマンドでロックしている場合は、lock()と同じくセマフォを待たない。
+ *
+ * @param[in]  h   ハンドル。
+ * @param[out] sem 獲得したセマフォが反映される。待たなかった場合はNULL。
+ * @return 成功時は0、失敗時には-1、タイムアウトした場合は1を返す。
+ */
+static int lock_handle(const struct tm_handle *h, sem_t* *sem)
+{
+  *sem = NULL;
+
+  // lock()のようにSIGALRMは使えないので、時刻を指定して待つ。
+  // mutexとセマフォは、同じ期限までに獲得する。
+  int ret;
+#if defined(__APPLE__)
+  time_t deadline = time(NULL) + TM_LOCK_TIMEOUT;
+  while ((ret = pthread_mutex_trylock(h->mutex)) == EBUSY) {
+    if (time(NULL) >= deadline) {
+      ret = ETIMEDOUT;
+      break;
+    }
+    struct timespec ts = {0, LOCK_RETRY_INTERVAL_NSEC};
+    nanosleep(&ts, NULL);
+  }
+#else
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += TM_LOCK_TIMEOUT;
+  ret = pthread_mutex_timedlock(h->mutex, &deadline);
+#endif
+  if (ret == ETIMEDOUT)
+    return 1;
+  if (ret != 0) {
+    report_error(ERROR_SYSTEM, "%s:%d: Error: pthread_mutex_lock() %s.\n",
+		 __FILE__, __LINE__, strerror(ret));
+    return -1;
+  }
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t len = 0;
+  if (load_schedules(h->shm_name, SHARED_MEMORY_SIZE, scheds,
+		     MAX_NUM_SCHEDULES, &len) != 0) {
+    pthread_mutex_unlock(h->mutex);
+    return -1;
+  }
+
+  struct schedule *s = NULL;
+  int held = (find_sched_by_pgid(getpgid(0), scheds, len, &s) == 0 &&
+	      s->lock == 1);
+  cleanup_schedules(scheds, len);
+  if (held)
+    return 0;
+
+  errno = 0;
+  *sem = sem_open(h->sem_name, O_CREAT, S_IRUSR | S_IWUSR, 1);
+  if (*sem == SEM_FAILED) {
+    report_error(ERROR_SYSTEM, "%s:%d: Error: sem_open() %s.\n", __FILE__,
+		 __LINE__, strerror(errno));
+    *sem = NULL;
+    pthread_mutex_unlock(h->mutex);
+    return -1;
+  }
+
+#if defined(__APPLE__)
+  while ((ret = sem_trywait(*sem)) == -1 &&
+	 (errno == EAGAIN || errno == EINTR)) {
+    if (time(NULL) >= deadline) {
+      errno = ETIMEDOUT;
+      break;
+    }
+    struct timespec ts = {0, LOCK_RETRY_INTERVAL_NSEC};
+    nanosleep(&ts, NULL);
+  }
+#else
+  while ((ret = sem_timedwait(*sem, &deadline)) == -1 && errno == EINTR)
+    ;
+#endif
+
+  if (ret == -1) {
+    int err = errno;
+    sem_close(*sem);
+    *sem = NULL;
+    pthread_mutex_unlock(h->mutex);
+    if (err == ETIMEDOUT)
+      return 1;
+    report_error(ERROR_SYSTEM, "%s:%d: Error: sem_wait() %s.\n", __FILE__,
+		 __LINE__, strerror(err));
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief データベースのロックを解除し、プロセス内のmutexを解放する。
+ * @param[in] h   ハンドル。
+ * @param[in] sem lock_handle()で獲得したセマフォ。NULLの場合はmutexだけを
+ * 解放する。
+ */
+static void unlock_handle(const struct tm_handle *h, sem_t *sem)
+{
+  if (sem != NULL) {
+    if (sem_post(sem) == -1)
+      report_error(ERROR_SYSTEM, "%s:%d: Error: sem_post() %s.\n", __FILE__,
+		   __LINE__, strerror(errno));
+    sem_close(sem);
+  }
+
+  pthread_mutex_unlock(h->mutex);
+}
+
+
+/**
+ * @brief 最後に報告されたエラーを、ライブラリが返す値に変換する。
+ *
+ * 共通部分はエラーを出力せずに、report_error()で種類だけを記録している。
+ *
+ * @return tm_status列挙型の負の値を返す。
+ */
+static int error_status()
+{
+  switch (get_last_error()) {
+  case ERROR_SYSTEM:
+    return TM_ESYSTEM;
+  case ERROR_MEMORY:
+    return TM_ENOMEM;
+  case ERROR_INVALID:
+    return TM_EINVAL;
+  case ERROR_FORMAT:
+    return TM_EFORMAT;
+  case ERROR_FULL:
+    return TM_EFULL;
+  default:
+    return TM_ERROR;
+  }
+}
+
+
+/**
+ * @brief スケジュール構造体を、ライブラリが返すスケジュールに変換する。
+ * @param[in]  s   変換するスケジュール。
+ * @param[out] out 変換したスケジュールが反映される。
+ */
+static void to_tm_schedule(const struct schedule *s, struct tm_schedule *out)
+{
+  out->pgid = s->pgid;
+  out->terminator = s->terminator;
+  out->start = s->start;
+  out->duration = s->duration;
+  strcpy(out->caption, s->caption);
+  strcpy(out->resources, s->resources);
+  strcpy(out->rule, s->rule);
+  out->min_duration = s->min_duration;
+  out->max_duration = s->max_duration;
+  out->early = s->early;
+  strcpy(out->after, s->after);
+  out->id = s->id;
+}
+
+
+/**
+ * @brief ライブラリが受け取ったスケジュールを、スケジュール構造体に変換する。
+ *
+ * 繰り返しスケジュールのstart値が0の場合は、現在時刻とする。
+ *
+ * @attention 作成したスケジュールは、不要時にfree()で解放する必要がある。
+ * @param[in]  sched 変換するスケジュール。check_schedule()で確認済みのもの。
+ * @param[out] new   作成したスケジュールが反映される。
+ * @return 成功時は0、失敗時には-1を返す。
+ */
+static int from_tm_schedule(const struct tm_schedule *sched,
+			    struct schedule* *new)
+{
+  pid_t pgid = (sched->pgid != 0) ? sched->pgid : getpgid(0);
+  time_t start = sched->start;
+  if (sched->rule[0] != '\0' && start == 0)
+    start = time(NULL);
+
+  if (create_schedule(pgid, 0, 0, start, sched->duration, sched->caption,
+		      new) != 0)
+    return -1;
+
+  strcpy((*new)->resources, sched->resources);
+  strcpy((*new)->rule, sched->rule);
+  if (sched->max_duration != 0) {
+    (*new)->min_duration = sched->min_duration;
+    (*new)->max_duration = sched->max_duration;
+  }
+  (*new)->early = (sched->early != 0);
+  strcpy((*new)->after, sched->after);
+
+  return 0;
+}
+
+
+/**
+ * @brief 追加するスケジュールの値を確認する。start値は確認しない。
+ * @param[in] sched 確認するスケジュール。
+ * @param[in] flags tm_add()のflags値。
+ * @return 正しい場合はTM_OK、不正な場合はTM_EINVAL、失敗時には負の値を返す。
+ */
+static int check_schedule(const struct tm_schedule *sched, int flags)
+{
+  // 文字列は終端されているとは限らない。
+  if (strnlen(sched->caption, TM_CAPTION_LEN) == TM_CAPTION_LEN ||
+      strchr(sched->caption, '\n') != NULL ||
+      strnlen(sched->resources, TM_RESOURCES_LEN) == TM_RESOURCES_LEN ||
+      (sched->resources[0] != '\0' &&
+       check_resource_set(sched->resources) != 0) ||
+      strnlen(sched->rule, TM_RULE_LEN) == TM_RULE_LEN ||
+      strpbrk(sched->rule, ":;\n") != NULL ||
+      strnlen(sched->after, TM_CAPTION_LEN) == TM_CAPTION_LEN ||
+      strpbrk(sched->after, ":;=\n") != NULL) {
+    report_error(ERROR_INVALID, "%s:%d: Error: Invalid schedule.\n", __FILE__,
+		 __LINE__);
+    return TM_EINVAL;
+  }
+
+  if (sched->rule[0] != '\0') {
+    struct cron_mask *m;
+    switch (crontab_compile(sched->rule, &m)) {
+    case -1:
+      return error_status();
+    case 1:
+      report_error(ERROR_INVALID, "%s:%d: Error: Invalid expression. \"%s\"\n",
+		   __FILE__, __LINE__, sched->rule);
+      return TM_EINVAL;
+    }
+    crontab_release(m);
+  }
+
+  // 伸縮するスケジュールは、継続時間が範囲内である必要がある。
+  if (sched->max_duration != 0 &&
+      (sched->rule[0] != '\0' || sched->min_duration == 0 ||
+       sched->duration < sched->min_duration ||
+       sched->duration > sched->max_duration)) {
+    report_error(ERROR_INVALID, "%s:%d: Error: Invalid elastic schedule. "
+		 "min:%u max:%u dur:%u\n", __FILE__, __LINE__,
+		 sched->min_duration, sched->max_duration, sched->duration);
+    return TM_EINVAL;
+  }
+
+  // 予約するスケジュールは、開始時刻が決まっている必要がある。
+  if ((flags & TM_ADD_QUEUE) &&
+      (sched->rule[0] != '\0' || sched->max_duration != 0 || sched->early ||
+       sched->after[0] != '\0')) {
+    report_error(ERROR_INVALID, "%s:%d: Error: Queued schedule must not be "
+		 "recurring, elastic, early or after another.\n", __FILE__,
+		 __LINE__);
+    return TM_EINVAL;
+  }
+
+  return TM_OK;
+}
+
+
+/**
+ * @brief ロックしたデータベースのスケジュール群に、スケジュールを追加して
+ * 保存する。
+ *
+ * addコマンドと同じく、伸縮するスケジュールを縮めて空きを作り、追加した
+ * プロセスグループのスケジュールが伸縮する場合は、後ろの空き時間に延長する。
+ *
+ * @param[in]     h        ハンドル。
+ * @param[in]     new      追加するスケジュール。成否にかかわらず、この関数が
+ * 解放するか、schedsに含める。
+ * @param[in]     flags    tm_add()のflags値。
+ * @param[in,out] scheds   データベースのスケジュール群。
+ * @param[in,out] len      schedsの配列数。
+ * @param[in]     capacity データベースのcapacity。
+ * @param[out]    conflict 重複した場合、重なるスケジュールの1つが反映される。
+ * NULLでもよい。
+ * @param[out]    rel      ロックの解放後に知らせる内容が反映される。
+ * @return 追加した場合はTM_OK、重複した場合はTM_CONFLICT、失敗時には負の値
+ * を返す。
+ */
+static int insert_schedule(const struct tm_handle *h, struct schedule *new,
+			   int flags, struct schedule* *scheds, size_t *len,
+			   unsigned int capacity, struct tm_schedule *conflict,
+			   struct release *rel)
+{
+  rel->start = 0;
+  rel->end = 0;
+
+  // 伸縮するスケジュールを縮めて、空きを作れるか確認する。
+  struct schedule* resized[MAX_NUM_SCHEDULES];
+  size_t nresized = 0;
+  int ret = check_sched_capacity(new, scheds, *len, capacity);
+  if (ret == 1)
+    ret = shrink_elastic_schedules(new, scheds, *len, capacity, resized,
+				   &nresized);
+
+  if (ret != 0) {
+    struct schedule c;
+    if (ret == 1 && conflict != NULL &&
+	find_conflicting_schedule(new, scheds, *len, capacity, &c) == 0)
+      to_tm_schedule(&c, conflict);
+    ret = (ret == 1) ? TM_CONFLICT : error_status();
+    free(new);
+    return ret;
+  }
+
+  // 予約する場合は、最後のスケジュールの後ろに追加する。先頭のスケジュールが
+  // ない場合は、通常どおり追加する。
+  pid_t pgid = new->pgid;
+  struct schedule *old = NULL;
+  int exists = (find_sched_by_pgid(pgid, scheds, *len, &old) == 0 &&
+		old->duration != 0);
+  if ((flags & TM_ADD_QUEUE) && exists) {
+    struct schedule *next;
+    while (find_next_sched_by_pgid(old, scheds, *len, &next) == 0)
+      old = next;
+
+    if (new->start < old->start + old->duration) {
+      report_error(ERROR_INVALID, "%s:%d: Error: Must start after the last "
+		   "schedule. last_end:%ld\n", __FILE__, __LINE__,
+		   old->start + old->duration);
+      free(new);
+      return TM_EINVAL;
+    }
+    if (*len >= MAX_NUM_SCHEDULES) {
+      report_error(ERROR_FULL, "%s:%d: Error: Too many schedules.\n",
+		   __FILE__, __LINE__);
+      free(new);
+      return TM_EFULL;
+    }
+    scheds[(*len)++] = new;
+  } else {
+    // 上書きする場合は、元のスケジュールの範囲を解放する。
+    if (exists) {
+      rel->start = old->start;
+      rel->end = old->start + old->duration;
+      if (old->rule[0] != '\0')
+	rel->end += RECUR_HORIZON;
+    }
+
+    // newは、上書きした場合は解放され、追加した場合はschedsに含まれる。
+    if (update_sched_by_pgid(new, scheds, len, MAX_NUM_SCHEDULES) != 0) {
+      free(new);
+      return error_status();
+    }
+  }
+
+  // 伸縮するスケジュールは、後ろの空き時間に延長しておく。
+  struct schedule *own = NULL;
+  if (find_sched_by_pgid(pgid, scheds, *len, &own) == 0 &&
+      grow_elastic_schedule(own, scheds, *len, capacity) == -1)
+    return error_status();
+
+  if (save_schedules(h->shm_name, SHARED_MEMORY_SIZE, scheds, *len) != 0)
+    return error_status();
+
+  // 縮めたスケジュールの終了機能に、終了時刻の変更を知らせる。
+  // 終了機能のpid値は、ロックしている間だけ信頼できる。
+  size_t i;
+  for (i=0; i<nresized; i++)
+    signal_terminator(resized[i], RESIZE_SIGNO);
+
+  return TM_OK;
+}
+
+
+/**
+ * @brief スケジュールを追加した後、待機中のクライアントに上書きで解放した範囲を
+ * 知らせる。
+ * @attention データベースのロックを解放してから呼び出す。
+ * @param[in] h   ハンドル。
+ * @param[in] rel insert_schedule()が反映した内容。
+ */
+static void send_release(const struct tm_handle *h, const struct release *rel)
+{
+  if (rel->end != 0)
+    notify_release(h->shm_name, rel->start, rel->end);
+}
+
+
+int tm_open(const char *db, struct tm_handle* *h)
+{
+  assert(h != NULL);
+
+  clear_last_error();
+  *h = malloc(sizeof(struct tm_handle));
+  if (*h == NULL)
+    return TM_ENOMEM;
+  strcpy((*h)->sem_name, DEFAULT_SEMAPHORE_NAME);
+  strcpy((*h)->shm_name, DEFAULT_SHARED_MEMORY_NAME);
+
+  if (db == NULL) {
+    if (get_env((*h)->sem_name, (*h)->shm_name) != 0)
+      goto error;
+  } else {
+    if (strlen(db) != 1 || atoi(db) < 1 || atoi(db) > MAX_NUM_DB) {
+      report_error(ERROR_INVALID, "%s:%d: Error: Invalid database number.\n",
+		   __FILE__, __LINE__);
+      goto error;
+    }
+    strcat((*h)->sem_name, db);
+    strcat((*h)->shm_name, db);
+  }
+
+  // 同じデータベースのハンドルは、同じmutexを使う。
+  pthread_once(&g_transaction_once, init_transaction_mutex);
+  int n = atoi((*h)->shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME));
+  (*h)->mutex = &g_transaction_mutex[n];
+
+  return TM_OK;
+
+ error:
+  free(*h);
+  *h = NULL;
+  return error_status();
+}
+
+
+void tm_close(struct tm_handle *h)
+{
+  free(h);
+}
+
+
+int tm_add(struct tm_handle *h, const struct tm_schedule *sched, int flags,
+	   struct tm_schedule *conflict)
+{
+  assert(h != NULL && sched != NULL);
+
+  clear_last_error();
+  if (conflict != NULL)
+    memset(conflict, 0, sizeof(*conflict));
+
+  int ret = check_schedule(sched, flags);
+  if (ret != TM_OK)
+    return ret;
+  if (sched->start <= 0 && sched->rule[0] == '\0') {
+    report_error(ERROR_INVALID, "%s:%d: Error: Invalid start value.\n",
+		 __FILE__, __LINE__);
+    return TM_EINVAL;
+  }
+
+  struct schedule* new;
+  if (from_tm_schedule(sched, &new) != 0)
+    return error_status();
+
+  sem_t *sem;
+  switch (lock_handle(h, &sem)) {
+  case -1:
+    free(new);
+    return error_status();
+  case 1:
+    free(new);
+    return TM_TIMEOUT;
+  }
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t len = 0;
+  unsigned int capacity;
+  if (load_schedules(h->shm_name, SHARED_MEMORY_SIZE, scheds,
+		     MAX_NUM_SCHEDULES, &len) != 0) {
+    free(new);
+    unlock_handle(h, sem);
+    return error_status();
+  }
+
+  struct release rel;
+  if (get_capacity(h->shm_name, &capacity) != 0) {
+    free(new);
+    ret = error_status();
+  } else {
+    ret = insert_schedule(h, new, flags, scheds, &len, capacity, conflict,
+			  &rel);
+  }
+
+  cleanup_schedules(scheds, len);
+  unlock_handle(h, sem);
+
+  if (ret == TM_OK)
+    send_release(h, &rel);
+
+  return ret;
+}
+
+
+/**
+ * @brief スケジュールを見つける。
+ * @param[in]  pgid   見つけるスケジュールのpgid値。idが0の場合に使う。
+ * @param[in]  id     見つけるスケジュールID。0の場合はpgidで探す。
+ * @param[in]  scheds 対象のスケジュール群。
+ * @param[in]  len    schedsの配列数。
+ * @param[out] sched  見つかったスケジュールが反映される。
+ * @return 見つかった場合0、見つからない場合-1。
+ */
+static int find_sched(pid_t pgid, uint64_t id, struct schedule* *scheds,
+		      size_t len, struct schedule* *sched)
+{
+  if (id != 0)
+    return find_sched_by_id(id, scheds, len, sched);
+
+  return find_sched_by_pgid(pgid, scheds, len, sched);
+}
+
+
+/**
+ * @brief tm_activate()とtm_activate_by_id()の処理。
+ * @param[in] h          ハンドル。
+ * @param[in] pgid       有効にするスケジュールのpgid値。idが0の場合に使う。
+ * @param[in] id         有効にするスケジュールID。0の場合はpgidで探す。
+ * @param[in] terminator 終了機能のpid値。
+ * @return tm_activate()と同じ。
+ */
+static int activate_sched(struct tm_handle *h, pid_t pgid, uint64_t id,
+			  pid_t terminator)
+{
+  sem_t *sem;
+  switch (lock_handle(h, &sem)) {
+  case -1:
+    return error_status();
+  case 1:
+    return TM_TIMEOUT;
+  }
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t len = 0;
+  if (load_schedules(h->shm_name, SHARED_MEMORY_SIZE, scheds,
+		     MAX_NUM_SCHEDULES, &len) != 0) {
+    unlock_handle(h, sem);
+    return error_status();
+  }
+
+  // デーモンの有効化と同じく、繰り返し、伸縮するスケジュールは受け付けない。
+  // 予約されたスケジュールは、先頭のスケジュールが終わるまで有効にできない。
+  struct schedule *s = NULL, *head = NULL;
+  int ret = TM_NOT_FOUND;
+  if (find_sched(pgid, id, scheds, len, &s) == 0 && s->duration != 0) {
+    ret = TM_REFUSED;
+    if (find_sched_by_pgid(s->pgid, scheds, len, &head) == 0 && head == s &&
+	s->rule[0] == '\0' && s->max_duration == 0 && s->terminator == 0) {
+      s->terminator = terminator;
+      ret = TM_OK;
+      if (save_schedules(h->shm_name, SHARED_MEMORY_SIZE, scheds, len) != 0)
+	ret = error_status();
+    }
+  }
+
+  cleanup_schedules(scheds, len);
+  unlock_handle(h, sem);
+
+  return ret;
+}
+
+
+int tm_activate(struct tm_handle *h, pid_t pgid, pid_t terminator)
+{
+  assert(h != NULL);
+
+  clear_last_error();
+  if (pgid == 0)
+    pgid = getpgid(0);
+
+  return activate_sched(h, pgid, 0, terminator);
+}
+
+
+int tm_activate_by_id(struct tm_handle *h, uint64_t id, pid_t terminator)
+{
+  assert(h != NULL);
+
+  clear_last_error();
+  if (id == 0)
+    return TM_EINVAL;
+
+  return activate_sched(h, 0, id, terminator);
+}
+
+
+/**
+ * @brief tm_get()とtm_get_by_id()の処理。
+ * @param[in]  h    ハンドル。
+ * @param[in]  pgid 取得するスケジュールのpgid値。idが0の場合に使う。
+ * @param[in]  id   取得するスケジュールID。0の場合はpgidで探す。
+ * @param[out] out  取得したスケジュールが反映される。
+ * @return tm_get()と同じ。
+ */
+static int get_sched(struct tm_handle *h, pid_t pgid, uint64_t id,
+		     struct tm_schedule *out)
+{
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t len = 0;
+  if (load_schedules(h->shm_name, SHARED_MEMORY_SIZE, scheds,
+		     MAX_NUM_SCHEDULES, &len) != 0)
+    return error_status();
+
+  struct schedule *s = NULL;
+  int ret = TM_NOT_FOUND;
+  if (find_sched(pgid, id, scheds, len, &s) == 0) {
+    to_tm_schedule(s, out);
+    ret = TM_OK;
+  }
+
+  cleanup_schedules(scheds, len);
+
+  return ret;
+}
+
+
+int tm_get(struct tm_handle *h, pid_t pgid, struct tm_schedule *out)
+{
+  assert(h != NULL && out != NULL);
+
+  clear_last_error();
+  if (pgid == 0)
+    pgid = getpgid(0);
+
+  return get_sched(h, pgid, 0, out);
+}
+
+
+int tm_get_by_id(struct tm_handle *h, uint64_t id, struct tm_schedule *out)
+{
+  assert(h != NULL && out != NULL);
+
+  clear_last_error();
+  if (id == 0)
+    return TM_EINVAL;
+
+  return get_sched(h, 0, id, out);
+}
+
+
+int tm_query_range(struct tm_handle *h, time_t begin, time_t end,
+		   struct tm_schedule *out, size_t max, size_t *len)
+{
+  assert(h != NULL && len != NULL);
+  assert(out != NULL || max == 0);
+
+  clear_last_error();
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  if (load_schedules(h->shm_name, SHARED_MEMORY_SIZE, scheds,
+		     MAX_NUM_SCHEDULES, &scheds_len) != 0)
+    return error_status();
+
+  struct expansion ex;
+  if (expand_schedules(scheds, scheds_len, begin, end, &ex) != 0) {
+    cleanup_schedules(scheds, scheds_len);
+    return error_status();
+  }
+  sort_schedules(ex.scheds, ex.len);
+
+  // 繰り返しでないスケジュールは、範囲外のものもそのまま含まれている。
+  size_t i, n = 0;
+  for (i=0; i<ex.len; i++) {
+    struct schedule *s = ex.scheds[i];
+    if (s->duration == 0 || s->start >= end || s->start + s->duration <= begin)
+      continue;
+    if (n < max)
+      to_tm_schedule(s, &out[n]);
+    n++;
+  }
+  *len = n;
+
+  cleanup_expansion(&ex);
+  cleanup_schedules(scheds, scheds_len);
+
+  return (n > max) ? TM_TRUNCATED : TM_OK;
+}
+
+
+int tm_find_free(struct tm_handle *h, time_t begin, time_t end,
+		 unsigned int duration, const char *resources, int flags,
+		 time_t *start, time_t *free_end)
+{
+  assert(h != NULL && start != NULL);
+
+  clear_last_error();
+  if (resources != NULL && resources[0] != '\0' &&
+      check_resource_set(resources) != 0)
+    return TM_EINVAL;
+
+  unsigned int capacity;
+  if (get_capacity(h->shm_name, &capacity) != 0)
+    return error_status();
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  if (load_schedules(h->shm_name, SHARED_MEMORY_SIZE, scheds,
+		     MAX_NUM_SCHEDULES, &scheds_len) != 0)
+    return error_status();
+
+  struct expansion ex;
+  if (expand_schedules(scheds, scheds_len, begin, end, &ex) != 0) {
+    cleanup_schedules(scheds, scheds_len);
+    return error_status();
+  }
+
+  // TM_FREE_OWNがない場合は、自プロセスグループのスケジュールは空きと
+  // みなす。
+  pid_t pgid = (flags & TM_FREE_OWN) ? 0 : getpgid(0);
+  struct gap_iterator it;
+  init_gap_iterator(&it, &ex, pgid, begin, end, capacity, resources);
+
+  int ret = TM_NOT_FOUND;
+  time_t gap_start, gap_end;
+  while (next_gap(&it, &gap_start, &gap_end) == 0) {
+    if (gap_end - gap_start >= duration) {
+      *start = gap_start;
+      if (free_end != NULL)
+	*free_end = gap_end;
+      ret = TM_OK;
+      break;
+    }
+  }
+
+  cleanup_expansion(&ex);
+  cleanup_schedules(scheds, scheds_len);
+
+  return ret;
+}
+
+
+
+int tm_find_nearest(struct tm_handle *h, const struct tm_schedule *sched,
+		    unsigned int range, time_t *earlier, time_t *later)
+{
+  assert(h != NULL && sched != NULL && earlier != NULL && later != NULL);
+
+  clear_last_error();
+  *earlier = -1;
+  *later = -1;
+  if (sched->rule[0] != '\0')
+    return TM_OK;
+
+  unsigned int capacity;
+  if (get_capacity(h->shm_name, &capacity) != 0)
+    return error_status();
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  if (load_schedules(h->shm_name, SHARED_MEMORY_SIZE, scheds,
+		     MAX_NUM_SCHEDULES, &scheds_len) != 0)
+    return error_status();
+
+  time_t now = time(NULL);
+  time_t begin = sched->start - range;
+  if (begin < now)
+    begin = now;
+  time_t end = sched->start + sched->duration + range;
+
+  struct expansion ex;
+  if (expand_schedules(scheds, scheds_len, begin, end, &ex) != 0) {
+    cleanup_schedules(scheds, scheds_len);
+    return error_status();
+  }
+
+  // 追加するプロセスグループのスケジュールは上書きされるので除く。
+  pid_t pgid = (sched->pgid != 0) ? sched->pgid : getpgid(0);
+  struct gap_iterator it;
+  init_gap_iterator(&it, &ex, pgid, begin, end, capacity, sched->resources);
+
+  // 前は、開始時刻より前で最も遅い時刻。後は、開始時刻より後で最も早い時刻。
+  time_t gap_start, gap_end;
+  while (next_gap(&it, &gap_start, &gap_end) == 0) {
+    if (gap_end - gap_start < sched->duration)
+      continue;
+
+    time_t t = gap_end - sched->duration;
+    if (t > sched->start)
+      t = sched->start;
+    if (t < sched->start)
+      *earlier = t;
+
+    if (gap_start > sched->start) {
+      *later = gap_start;
+      break;
+    }
+  }
+
+  cleanup_expansion(&ex);
+  cleanup_schedules(scheds, scheds_len);
+
+  return TM_OK;
+}
+
+
+int tm_reserve(struct tm_handle *h, const struct tm_schedule *sched,
+	       time_t begin, time_t end, unsigned int min, time_t *free_start,
+	       time_t *free_end)
+{
+  assert(h != NULL && sched != NULL && free_start != NULL &&
+	 free_end != NULL);
+
+  clear_last_error();
+  int ret = check_schedule(sched, 0);
+  if (ret != TM_OK)
+    return ret;
+  if (sched->rule[0] != '\0' || sched->max_duration != 0) {
+    report_error(ERROR_INVALID, "%s:%d: Error: Cannot reserve recurring or "
+		 "elastic schedule.\n", __FILE__, __LINE__);
+    return TM_EINVAL;
+  }
+
+  struct schedule* new;
+  if (from_tm_schedule(sched, &new) != 0)
+    return error_status();
+
+  sem_t *sem;
+  switch (lock_handle(h, &sem)) {
+  case -1:
+    free(new);
+    return error_status();
+  case 1:
+    free(new);
+    return TM_TIMEOUT;
+  }
+
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t len = 0;
+  unsigned int capacity;
+  struct expansion ex;
+  if (get_capacity(h->shm_name, &capacity) != 0 ||
+      load_schedules(h->shm_name, SHARED_MEMORY_SIZE, scheds,
+		     MAX_NUM_SCHEDULES, &len) != 0) {
+    free(new);
+    unlock_handle(h, sem);
+    return error_status();
+  }
+  if (expand_schedules(scheds, len, begin, end, &ex) != 0) {
+    ret = error_status();
+    free(new);
+    cleanup_schedules(scheds, len);
+    unlock_handle(h, sem);
+    return ret;
+  }
+
+  unsigned int need = (sched->duration > min) ? sched->duration : min;
+
+  // 追加するプロセスグループのスケジュールは上書きされるので除く。
+  struct gap_iterator it;
+  init_gap_iterator(&it, &ex, new->pgid, begin, end, capacity,
+		    sched->resources);
+
+  time_t gap_start, gap_end;
+  ret = TM_NOT_FOUND;
+  while (next_gap(&it, &gap_start, &gap_end) == 0) {
+    if (gap_end - gap_start > 0 && gap_end - gap_start >= need) {
+      ret = TM_OK;
+      break;
+    }
+  }
+  cleanup_expansion(&ex);
+
+  // 見つかった空き時間の先頭に追加する。継続時間が0の場合は全体を使う。
+  struct release rel;
+  if (ret == TM_OK) {
+    new->start = gap_start;
+    if (new->duration == 0)
+      new->duration = gap_end - gap_start;
+    ret = insert_schedule(h, new, 0, scheds, &len, capacity, NULL, &rel);
+  } else {
+    free(new);
+  }
+
+  cleanup_schedules(scheds, len);
+  unlock_handle(h, sem);
+
+  if (ret != TM_OK)
+    return ret;
+
+  send_release(h, &rel);
+  *free_start = gap_start;
+  *free_end = gap_end;
+
+  return TM_OK;
+}
+
+
+const char* tm_strerror(int status)
+{
+  switch (status) {
+  case TM_OK:
+    return "Success";
+  case TM_CONFLICT:
+    return "Conflicts with another schedule";
+  case TM_TIMEOUT:
+    return "Timed out waiting for the database lock";
+  case TM_NOT_FOUND:
+    return "No such schedule or free time";
+  case TM_REFUSED:
+    return "The schedule does not accept the operation";
+  case TM_TRUNCATED:
+    return "Too many results";
+  case TM_ESYSTEM:
+    return "System call failed";
+  case TM_ENOMEM:
+    return "Out of memory";
+  case TM_EINVAL:
+    return "Invalid argument";
+  case TM_EFORMAT:
+    return "Broken database";
+  case TM_EFULL:
+    return "Database is full";
+  default:
+    return "Unknown error";
+  }
+}
\ No newline at end of file
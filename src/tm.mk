@@ -0,0 +1,7 @@
+LIB_OBJECTS += $(OBJ_DIR)/tm.o
+
+$(OBJ_DIR)/tm.o: $(SOURCE_DIR)/tm.c \
+                 $(INCLUDE_DIR)/tm.h \
+                 $(INCLUDE_DIR)/common.h \
+                 $(INCLUDE_DIR)/crontab_mask.h \
+                 $(INCLUDE_DIR)/notify.h
\ No newline at end of file
@@ -242,3 +242,10 @@ int unlock(int argc, char* argv[])
 
   return EXIT_SUCCESS;
 }
+
+
+int unlock_database(const char *db)
+{
+  char *argv[] = {"tm", "unlock", "-d", (char*)db, NULL};
+  return unlock((db != NULL) ? 4 : 2, argv);
+}
@@ -26,6 +26,7 @@
 #include "../include/unoccupied.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,6 +35,7 @@
 #include <unistd.h>
 
 #include "../include/common.h"
+#include "../include/tm.h"
 
 /** 空き時間を検索する範囲の初期値(sec) */
 #define DEFAULT_RANGE 3600
@@ -44,64 +46,199 @@
 static int verbose = 0;
 
 /**
- * @brief 指定された条件から、空き時間のスケジュールを作成する。
- * @param[in]  shm_name データベース名。
- * @param[in]  begin    開始時刻(time_t)。
- * @param[in]  range    検索範囲(sec)。
- * @param[out] sched    作成したスケジュールが反映される。
- * @return 成功時は0、失敗時には-1、空き時間が見つからない場合は1を返す。
+ * @brief データベースのスケジュールを読み込み、空き時間を取得する準備をする。
+ *
+ * データベースはロックせずに読み込むだけで、更新しない。繰り返しスケジュール
+ * は検索範囲内で展開し、start値で昇順ソートする。データベースのcapacityも
+ * 合わせて取得する。
+ *
+ * @param[in]  shm_name   データベース名。
+ * @param[in]  begin      開始時刻(time_t)。
+ * @param[in]  range      検索範囲(sec)。
+ * @param[out] scheds     読み込んだスケジュールが反映される。
+ * @param[out] scheds_len schedsの配列数が反映される。
+ * @param[out] ex         展開したスケジュールが反映される。
+ * @param[out] capacity   データベースのcapacityが反映される。
+ * @return 成功時は0、失敗時には-1を返す。
  */
-static int generate_unoccupied_sched(const char *shm_name, time_t begin,
-				     unsigned int range,
-				     struct schedule* sched)
-{ 
-  // スケジュールデータベースからレコードを読み込む
-  struct schedule* scheds[MAX_NUM_SCHEDULES];
-  size_t scheds_len = 0;
+static int load_snapshot(const char *shm_name, time_t begin,
+			 unsigned int range, struct schedule* *scheds,
+			 size_t *scheds_len, struct expansion *ex,
+			 unsigned int *capacity)
+{
+  if (get_capacity(shm_name, capacity) != 0)
+    return -1;
+
   if (load_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, MAX_NUM_SCHEDULES,
-		     &scheds_len) != 0) {
+		     scheds_len) != 0) {
     return -1;
   }
 
-  // load_schedules()で不要なスケジュールが削除されるので、
-  // ついでにデータベースファイルを更新する。
-  if (save_schedules(shm_name, SHARED_MEMORY_SIZE, scheds, scheds_len) != 0) {
-    cleanup_schedules(scheds, scheds_len);
+  if (expand_schedules(scheds, *scheds_len, begin, begin + range, ex) != 0) {
+    cleanup_schedules(scheds, *scheds_len);
     return -1;
   }
-
-  // 空きスケジュールを取得。
-  struct schedule* uo_scheds[MAX_NUM_SCHEDULES];
-  size_t uo_len = generate_unoccupied_scheds_from_scheds(scheds,
-							 scheds_len,
-							 uo_scheds,
-							 MAX_NUM_SCHEDULES,
-							 begin,
-							 range,
-							DEFAULT_SCHED_CAPTION);
+  return 0;
+}
 
 
-  if (uo_len == 0) {
+/**
+ * @brief 指定された条件から、空き時間のスケジュールを作成する。
+ * @param[in]  h         ハンドル。
+ * @param[in]  begin     開始時刻(time_t)。
+ * @param[in]  range     検索範囲(sec)。
+ * @param[in]  min       空き時間の最小の継続時間(sec)。
+ * @param[in]  resources 空きを調べる資源の集合。空文字列の場合はデータベース全体。
+ * @param[out] sched     作成したスケジュールが反映される。
+ * @return 成功時は0、失敗時には-1、空き時間が見つからない場合は1を返す。
+ */
+static int generate_unoccupied_sched(struct tm_handle *h, time_t begin,
+				     unsigned int range, unsigned int min,
+				     const char *resources,
+				     struct schedule* sched)
+{
+  // 自プロセスグループのスケジュールも、空きとみなさない。
+  time_t gap_start, gap_end;
+  switch (tm_find_free(h, begin, begin + range, min, resources, TM_FREE_OWN,
+		       &gap_start, &gap_end)) {
+  case TM_OK:
+    break;
+  case TM_NOT_FOUND:
     if (verbose) {
       fprintf(stderr, "%s:%d: No unoccupied schedule found.\n", __FILE__,
 	      __LINE__);
     }
-    cleanup_schedules(scheds, scheds_len);
     return 1;
+  default:
+    return -1;
   }
 
   // 作成したスケジュールを引数に反映。
-  sched->start = uo_scheds[0]->start;
-  sched->duration = uo_scheds[0]->duration;
-  strcpy(sched->caption, uo_scheds[0]->caption);
+  sched->start = gap_start;
+  sched->duration = gap_end - gap_start;
+  strcpy(sched->caption, DEFAULT_SCHED_CAPTION);
 
-  cleanup_schedules(scheds, scheds_len);
-  cleanup_schedules(uo_scheds, uo_len);
+  return 0;
+}
+
+
+/**
+ * @brief 空き時間を検索し、そこに自プロセスグループのスケジュールを追加する。
+ *
+ * 検索からデータベースの更新までを、tm_reserve()が1度のロックの中で行う。
+ * 自プロセスグループの既存のスケジュールは上書きされるので、検索の対象から
+ * 除く。空き時間は、継続時間がminとinのduration値の両方以上のものを選ぶ。
+ *
+ * @param[in]  h         ハンドル。
+ * @param[in]  begin     開始時刻(time_t)。
+ * @param[in]  range     検索範囲(sec)。
+ * @param[in]  min       空き時間の最小の継続時間(sec)。
+ * @param[in]  resources 確保する資源の集合。空文字列の場合はデータベース全体。
+ * @param[in]  in        stdinから読み込んだスケジュール。
+ * @param[out] sched     確保した空き時間のスケジュールが反映される。
+ * @return 成功時は0、失敗時には-1、空き時間が見つからない場合は1を返す。
+ */
+static int reserve_unoccupied_sched(struct tm_handle *h, time_t begin,
+				    unsigned int range, unsigned int min,
+				    const char *resources,
+				    const struct schedule *in,
+				    struct schedule *sched)
+{
+  struct tm_schedule new;
+  memset(&new, 0, sizeof(new));
+  new.duration = in->duration;
+  strcpy(new.caption, in->caption);
+  strcpy(new.resources, resources);
+
+  time_t gap_start, gap_end;
+  int ret = tm_reserve(h, &new, begin, begin + range, min, &gap_start,
+		       &gap_end);
+  switch (ret) {
+  case TM_OK:
+    break;
+  case TM_NOT_FOUND:
+    if (verbose) {
+      fprintf(stderr, "%s:%d: No unoccupied schedule found.\n", __FILE__,
+	      __LINE__);
+    }
+    return 1;
+  case TM_TIMEOUT:
+    fprintf(stderr, "%s:%d: Error: %s.\n", __FILE__, __LINE__,
+	    tm_strerror(ret));
+    return -1;
+  default:
+    return -1;
+  }
+
+  if (verbose > 0) {
+    fprintf(stderr, "%s:%d: Debug: reserve pgid:%d start:%ld\n", __FILE__,
+	    __LINE__, getpgid(0), gap_start);
+  }
+
+  // 確保した空き時間を引数に反映。
+  sched->start = gap_start;
+  sched->duration = gap_end - gap_start;
+  strcpy(sched->caption, DEFAULT_SCHED_CAPTION);
 
   return 0;
 }
 
 
+/**
+ * @brief 指定された条件に合う空き時間を、すべてstdoutに出力する。
+ *
+ * 空き時間は1つ見つかるごとに出力する。
+ *
+ * @param[in] shm_name データベース名。
+ * @param[in] begin    開始時刻(time_t)。
+ * @param[in] range    検索範囲(sec)。
+ * @param[in] min      空き時間の最小の継続時間(sec)。
+ * @param[in] resources 空きを調べる資源の集合。空文字列の場合はデータベース全体。
+ * @param[in] limit    出力する最大数。0の場合は無制限。
+ * @param[in] json     1の場合は、JSON形式で出力する。
+ * @return 成功時は0、失敗時には-1、空き時間が見つからない場合は1を返す。
+ */
+static int output_all_gaps(const char *shm_name, time_t begin,
+			   unsigned int range, unsigned int min,
+			   const char *resources, unsigned int limit, int json)
+{
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  struct expansion ex;
+  unsigned int capacity;
+  if (load_snapshot(shm_name, begin, range, scheds, &scheds_len, &ex,
+		    &capacity) != 0)
+    return -1;
+
+  struct gap_iterator it;
+  init_gap_iterator(&it, &ex, 0, begin, begin + range, capacity,
+		    resources);
+
+  unsigned int count = 0;
+  time_t gap_start, gap_end;
+  while ((limit == 0 || count < limit) &&
+	 next_gap(&it, &gap_start, &gap_end) == 0) {
+    if (gap_end - gap_start < min)
+      continue;
+
+    if (json) {
+      fprintf(stdout, "{\"start\":%ld,\"end\":%ld,\"duration\":%ld}\n",
+	      gap_start, gap_end, gap_end - gap_start);
+    } else {
+      fprintf(stdout, "%ld:%ld:%s\n", gap_start, gap_end - gap_start,
+	      DEFAULT_SCHED_CAPTION);
+    }
+    count++;
+  }
+  fflush(stdout);
+
+  cleanup_expansion(&ex);
+  cleanup_schedules(scheds, scheds_len);
+
+  return (count == 0) ? 1 : 0;
+}
+
+
 /**
  * @brief stdinの内容をstdoutに受け流す。
  * @return 成功時は0、失敗時には-1を返す。
@@ -170,8 +307,10 @@ static int output_schedule(struct schedule *in, struct schedule *uo)
  */
 static void print_usage()
 {
-  const char *usage = "tm unoccupied [-b begin] [-d database] [-r range] [-v] "
-    "[-h]\n";
+  const char *usage = "tm unoccupied [-b begin] [-d database] [-e | -k] "
+    "[-m min] [-r range] [-R resources] [-v] [-h]\n"
+    "       tm unoccupied -a [-b begin] [-d database] [-j] [-m min] [-n limit] "
+    "[-r range] [-R resources] [-v] [-h]\n";
 
   const char *description = "スケジュールが入っていない時間(空き時間)の"
     "スケジュールを作成します。作成したスケジュールは、stdinから読み込んだ"
@@ -184,12 +323,39 @@ static void print_usage()
     "スケジュールの継続時間を反映しません。\n"
     "\n"
     "デフォルトの検索開始時刻は、プログラムが実行された時刻です。 また、"
-    "デフォルトの検索範囲は3600秒です。\n";
+    "デフォルトの検索範囲は3600秒です。\n"
+    "\n"
+    "eオプションを指定すると、stdinのすべての行をスケジュールとして読み込み、"
+    "先頭から順に、配置済みのスケジュールの後ろの、継続時間が収まる空き時間に"
+    "配置します。データベースの読み込みは1度だけです。継続時間が0のスケジュール"
+    "は、空き時間全体を使用します。配置できないスケジュールがあった場合は、"
+    "そこで終了し、3を返します。\n"
+    "\n"
+    "kオプションを指定すると、データベースをロックしたまま、継続時間が収まる"
+    "最初の空き時間を検索し、その時刻のスケジュールを自プロセスグループの"
+    "スケジュールとしてデータベースに追加します。自プロセスグループの既存の"
+    "スケジュールは上書きされます。\n"
+    "\n"
+    "aオプションを指定すると、stdinは読み込まず、検索範囲内のすべての空き時間"
+    "を、見つかった順にstdoutに出力します。出力の書式は start:duration:caption"
+    "で、jオプションを指定した場合は、1行に1つのJSONオブジェクトです。\n"
+    "\n"
+    "Rオプションを指定すると、カンマ区切りで指定したすべての資源が空いている"
+    "時間を、空き時間とします。資源を指定しないスケジュールは、すべての資源を"
+    "占有します。kオプションと合わせて指定すると、すべての資源をまとめて"
+    "確保します。\n";
   
   const char *optarg = "OPTIONS\n"
+    "\t-a          すべての空き時間を出力する。\n"
     "\t-b begin    検索開始時刻(time_t形式)\n"
     "\t-d database データベース番号(1-5が使用可能)\n"
+    "\t-e          stdinのすべての行を、順に空き時間に配置する。\n"
+    "\t-j          aオプションの出力をJSON形式にする。\n"
+    "\t-k          見つかった空き時間にスケジュールを追加する。\n"
+    "\t-m min      継続時間がmin秒未満の空き時間を除外する。\n"
+    "\t-n limit    aオプションで出力する空き時間の最大数\n"
     "\t-r range    空き時間を検索する範囲(sec)\n"
+    "\t-R resources 空きを調べる資源の集合(カンマ区切り。例: tuner,speaker)\n"
     "\t-v          verboseモード\n"
     "\t-h          show this help message and exit\n";
 
@@ -209,35 +375,88 @@ static void print_usage()
     "\t始めの1行をスケジュールとして読み込み、それ以降はそのまま出力される。\n"
     "\t$ echo -e \"0:0:caption\\nABCDEFG\" | tm unoccupied\n"
     "\t1517188474:3600:caption\n"
-    "\tABCDEFG\n";
+    "\tABCDEFG\n"
+    "\n"
+    "\tプレイリストの各項目を、空き時間に順に配置する。\n"
+    "\t$ printf \"0:600:A\\n0:300:B\\n\" | tm unoccupied -e -r 86400\n"
+    "\t1517188474:600:A\n"
+    "\t1517189074:300:B\n"
+    "\n"
+    "\t直近の空き時間に10分間のスケジュールを確保して、実行する。\n"
+    "\t$ sh -c 'echo \"0:600:News\" | tm unoccupied -k -r 86400 && tm activate"
+    " && myprogram'\n"
+    "\n"
+    "\t今後1日の、30分以上の空き時間を3つまで出力する。\n"
+    "\t$ tm unoccupied -a -j -m 1800 -n 3 -r 86400\n"
+    "\t{\"start\":1517188474,\"end\":1517194800,\"duration\":6326}\n"
+    "\n"
+    "\tチューナーとスピーカーの両方が空いている時間に、まとめて確保する。\n"
+    "\t$ sh -c 'echo \"0:600:Radio\" | tm unoccupied -k -R tuner,speaker"
+    " -r 86400 && tm activate && myprogram'\n";
 
   fprintf(stderr, "usage: %s\n%s\n%s\n%s\n%s\n%s\n", usage, description,
 	  optarg, exit_status, env, example);
 }
 
 
+/**
+ * @brief 0以上の整数の文字列を、unsigned int値に変換する。
+ * @param[in]  str   変換する文字列。
+ * @param[out] value 変換した値が反映される。
+ * @return 成功時は0、数値でない場合や範囲外の場合は-1を返す。
+ */
+static int parse_uint(const char *str, unsigned int *value)
+{
+  if (*str < '0' || *str > '9')
+    return -1;
+
+  char *endptr;
+  errno = 0;
+  unsigned long v = strtoul(str, &endptr, 10);
+  if (errno != 0 || *endptr != '\0' || v > UINT_MAX)
+    return -1;
+
+  *value = v;
+  return 0;
+}
+
+
 /**
  * @brief コマンドライン引数を解析する。
  * @param[in]  argc     argc値
  * @param[in]  argv     argv値
  * @param[out] shm_name '-i'オプション(id値)が反映される。
+ * @param[out] opt_a    '-a'オプション(全空き時間出力モード)の値が反映される。
  * @param[out] opt_d    '-d'オプション(データベース番号)が指定された場合、1が設定される。
+ * @param[out] opt_e    '-e'オプション(全行処理モード)の値が反映される。
+ * @param[out] opt_j    '-j'オプション(JSON出力)の値が反映される。
+ * @param[out] opt_k    '-k'オプション(空き時間確保)の値が反映される。
  * @param[out] begin    '-b'オプション(検索開始時刻(time_t))の値が反映される。
  * @param[out] range    '-r'オプション(空き時間を検索する範囲(sec))の値が反映される。
+ * @param[out] min      '-m'オプション(最小の継続時間(sec))の値が反映される。
+ * @param[out] limit    '-n'オプション(出力する最大数)の値が反映される。
+ * @param[out] resources '-R'オプション(資源の集合)の値が反映される。
  * @param[out] verbose  '-v'オプション(verboseモード)の値が反映される。
  * @return 成功時は0、'h'オプションが指定された場合は1、不正な値が与えられた場
  * 合は2を返す。
  */
-static int parse_arguments(int argc, char* *argv, char *shm_name, int *opt_d, 
-			   time_t* begin, unsigned int *range, int *verbose)
+static int parse_arguments(int argc, char* *argv, char *shm_name, int *opt_a,
+			   int *opt_d, int *opt_e, int *opt_j, int *opt_k,
+			   time_t* begin,
+			   unsigned int *range, unsigned int *min,
+			   unsigned int *limit, char *resources, int *verbose)
 {  
   // TimeManagerから呼ばれる場合、argvは{"tm", "unoccupied". "opt"...}となる。
   // オプションを読み込むためには、optindを1つ進めて2にしておく必要がある。
   opterr = 0;
   optind = 2;
   int opt;
-  while ((opt = getopt(argc, argv, "b:d:hr:v")) != -1) {
+  while ((opt = getopt(argc, argv, "ab:d:ehjkm:n:r:R:v")) != -1) {
     switch (opt) {
+    case 'a':
+      // 全空き時間出力モード
+      *opt_a = 1;
+      break;
     case 'b':
       // 検索開始時刻(time_t)
       *begin = atoi(optarg);
@@ -252,14 +471,48 @@ static int parse_arguments(int argc, char* *argv, char *shm_name, int *opt_d,
       strcat(shm_name, optarg);
       *opt_d = 1;
       break;
+    case 'e':
+      // 全行処理モード
+      *opt_e = 1;
+      break;
     case 'h':
       // ヘルプ
       print_usage();
       return 1;
+    case 'j':
+      // JSON出力
+      *opt_j = 1;
+      break;
+    case 'k':
+      // 空き時間を検索して確保する。
+      *opt_k = 1;
+      break;
+    case 'm':
+      // 最小の継続時間(sec)
+      if (parse_uint(optarg, min) != 0) {
+	fprintf(stderr, "Error: Invalid min value. \"%s\"\n", optarg);
+	return 2;
+      }
+      break;
+    case 'n':
+      // 出力する最大数
+      if (parse_uint(optarg, limit) != 0) {
+	fprintf(stderr, "Error: Invalid limit value. \"%s\"\n", optarg);
+	return 2;
+      }
+      break;
     case 'r':
       // 空き時間を検索する範囲(sec)
       *range = atoi(optarg);
       break;
+    case 'R':
+      // 資源の集合
+      if (check_resource_set(optarg) != 0) {
+	fprintf(stderr, "Error: Invalid resources. \"%s\"\n", optarg);
+	return 2;
+      }
+      strcpy(resources, optarg);
+      break;
     case 'v':
       // verboseモード
       *verbose = 1;
@@ -273,6 +526,22 @@ static int parse_arguments(int argc, char* *argv, char *shm_name, int *opt_d,
     }    
   }
 
+  if (*opt_a && *opt_e) {
+    fprintf(stderr, "Error: -a can not be used with -e.\n");
+    return 2;
+  }
+
+  // 確保できるスケジュールは、1プロセスグループにつき1つ。
+  if (*opt_k && (*opt_a || *opt_e)) {
+    fprintf(stderr, "Error: -k can not be used with -a or -e.\n");
+    return 2;
+  }
+
+  if (!*opt_a && (*opt_j || *limit != 0)) {
+    fprintf(stderr, "Error: -j and -n require -a.\n");
+    return 2;
+  }
+
   return 0;
 }
 
@@ -280,7 +549,8 @@ static int parse_arguments(int argc, char* *argv, char *shm_name, int *opt_d,
 /**
  * @brief stdinからスケジュールを読み込む。スケジュールはバリデートされる。
  * @param[out] sched 読み込んだスケジュールが反映される。
- * @return 成功時は0、失敗時には-1、スケジュールが不正な場合は1を返す。
+ * @return 成功時は0、失敗時には-1、スケジュールが不正な場合は1、stdinの終わり
+ * に達した場合は2を返す。
  */
 static int read_schedule(struct schedule *sched)
 {
@@ -290,8 +560,9 @@ static int read_schedule(struct schedule *sched)
     if (feof(stdin) == 0) {
       fprintf(stderr, "%s:%d: Error: while reading stdin.\n", __FILE__,
 	      __LINE__);
+      return -1;
     }
-    return -1;
+    return 2;
   }
 
   // 文字列から要素を取得
@@ -322,16 +593,93 @@ static int read_schedule(struct schedule *sched)
 }
 
 
+/**
+ * @brief stdinのすべてのスケジュールを、先頭から順に空き時間に配置して
+ * stdoutに出力する。
+ *
+ * データベースは1度だけ読み込み、空き時間は先頭から1度だけ走査する。
+ * 各スケジュールは、前のスケジュールを配置した時刻以降の、継続時間が収まる
+ * 最初の空き時間の先頭に配置する。継続時間が0の場合は、空き時間全体を使用
+ * する。
+ *
+ * @param[in] shm_name データベース名。
+ * @param[in] begin    開始時刻(time_t)。
+ * @param[in] range    検索範囲(sec)。
+ * @param[in] resources 空きを調べる資源の集合。空文字列の場合はデータベース全体。
+ * @return 成功時は0、失敗時には-1、スケジュールが不正な場合は1、
+ * 配置できない場合は2を返す。
+ */
+static int place_each(const char *shm_name, time_t begin, unsigned int range,
+		      const char *resources)
+{
+  struct schedule* scheds[MAX_NUM_SCHEDULES];
+  size_t scheds_len = 0;
+  struct expansion ex;
+  unsigned int capacity;
+  if (load_snapshot(shm_name, begin, range, scheds, &scheds_len, &ex,
+		    &capacity) != 0)
+    return -1;
+
+  struct gap_iterator it;
+  init_gap_iterator(&it, &ex, 0, begin, begin + range, capacity,
+		    resources);
+
+  // 現在の空き時間のうち、まだ配置していない部分。
+  time_t gap_start = 0, gap_end = 0;
+
+  int ret = 0;
+  while (1) {
+    struct schedule in;
+    int r = read_schedule(&in);
+    if (r == 2)
+      break;
+    if (r != 0) {
+      ret = r;
+      break;
+    }
+
+    // 継続時間が収まる空き時間まで進める。
+    while (gap_end <= gap_start || (gap_end - gap_start) < in.duration) {
+      if (next_gap(&it, &gap_start, &gap_end) != 0) {
+	fprintf(stderr, "%s:%d: Error: No unoccupied time for \"%s\".\n",
+		__FILE__, __LINE__, in.caption);
+	ret = 2;
+	break;
+      }
+    }
+    if (ret != 0)
+      break;
+
+    struct schedule uo;
+    uo.start = gap_start;
+    uo.duration = gap_end - gap_start;
+    output_schedule(&in, &uo);
+
+    if (in.duration == 0)
+      gap_start = gap_end;
+    else
+      gap_start += in.duration;
+  }
+
+  cleanup_expansion(&ex);
+  cleanup_schedules(scheds, scheds_len);
+
+  return ret;
+}
+
+
 int unoccupied(int argc, char* argv[])
 {
   char shm_name[NAME_MAX] = DEFAULT_SHARED_MEMORY_NAME;
   time_t begin = time(NULL);
-  unsigned int range = DEFAULT_RANGE;
-  int opt_d = 0;
+  unsigned int range = DEFAULT_RANGE, min = 0, limit = 0;
+  char resources[MAX_RESOURCES_LEN] = "";
+  int opt_a = 0, opt_d = 0, opt_e = 0, opt_j = 0, opt_k = 0;
 
   // オプションチェック
-  switch (parse_arguments(argc, argv, shm_name, &opt_d, &begin, &range,
-			 &verbose)) {
+  switch (parse_arguments(argc, argv, shm_name, &opt_a, &opt_d, &opt_e, &opt_j,
+			  &opt_k, &begin, &range, &min, &limit, resources,
+			  &verbose)) {
   case 1:
     return EXIT_SUCCESS;
   case 2:
@@ -344,10 +692,36 @@ int unoccupied(int argc, char* argv[])
       return EXIT_FAILURE;
   }
 
+  // 全空き時間出力モード
+  if (opt_a) {
+    switch (output_all_gaps(shm_name, begin, range, min, resources, limit,
+			    opt_j)) {
+    case -1:
+      return EXIT_FAILURE;
+    case 1:
+      return EXIT_NOT_FOUND;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  // 全行処理モード
+  if (opt_e) {
+    switch (place_each(shm_name, begin, range, resources)) {
+    case -1:
+      return EXIT_FAILURE;
+    case 1:
+      return EXIT_MISUSE;
+    case 2:
+      return EXIT_NOT_FOUND;
+    }
+    return EXIT_SUCCESS;
+  }
+
   // stdinからスケジュールを取得する。
   struct schedule sched_in;
   switch (read_schedule(&sched_in)) {
   case -1:
+  case 2:
     return EXIT_FAILURE;
   case 1:
     return EXIT_MISUSE;
@@ -358,9 +732,27 @@ int unoccupied(int argc, char* argv[])
 	    __LINE__, shm_name, begin, range);
   }
 
-  // 空き時間のスケジュールを作成。
+  const char *db = NULL;
+  if (opt_d)
+    db = shm_name + strlen(DEFAULT_SHARED_MEMORY_NAME);
+
+  struct tm_handle *h;
+  if (tm_open(db, &h) != TM_OK)
+    return EXIT_FAILURE;
+
+  // 空き時間のスケジュールを作成。確保する場合は、ロックの中で追加まで行う。
   struct schedule sched_uo;
-  switch (generate_unoccupied_sched(shm_name, begin, range, &sched_uo)) {
+  int ret;
+  if (opt_k) {
+    ret = reserve_unoccupied_sched(h, begin, range, min, resources, &sched_in,
+				   &sched_uo);
+  } else {
+    ret = generate_unoccupied_sched(h, begin, range, min, resources,
+				    &sched_uo);
+  }
+  tm_close(h);
+
+  switch (ret) {
   case -1:
     return EXIT_FAILURE;
   case 1:
@@ -2,4 +2,5 @@ OBJECTS += $(OBJ_DIR)/unoccupied.o
 
 $(OBJ_DIR)/unoccupied.o: $(SOURCE_DIR)/unoccupied.c \
                          $(INCLUDE_DIR)/unoccupied.h \
-                         $(INCLUDE_DIR)/common.h
\ No newline at end of file
+                         $(INCLUDE_DIR)/common.h \
+                         $(INCLUDE_DIR)/tm.h
\ No newline at end of file
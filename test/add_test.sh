@@ -0,0 +1,177 @@
+#!/bin/sh
+#
+# tm add -cのスモークテスト。
+#
+
+. "$(dirname "$0")/common.sh"
+
+TMP_FILE=$(mktemp) || fail "mktemp"
+trap 'cleanup; rm -f "$TMP_FILE"' EXIT
+
+reset_db
+
+# 繰り返しスケジュールは、規則を属性としてデータベースに保存する。
+hold "0:600:hourly" -c "0 * * * *"
+rec=$("$TM" schedule -A | grep ":hourly\$") || fail "schedule -A"
+case "$rec" in
+  *":600:rule=0 * * * *;id="*":hourly") ;;
+  *) fail "record: $rec" ;;
+esac
+
+# 繰り返しのどの回と重なる場合も、追加できない。
+next=$(( ($(date +%s) / 3600 + 5) * 3600 + 300 ))
+expect_status 4 sh -c 'echo "$1:60:x" | "$0" add' "$TM" "$next"
+out=$(echo "$next:60:x" | "$TM" add 2>&1 >/dev/null | grep "^later:")
+expect_eq "$out" "later:$((next + 300)):60:x" "alternative"
+expect_status 0 sh -c 'echo "$1:60:x" | "$0" add' "$TM" $((next + 600))
+
+# 有効にした回の終了前に再度activateすると、次の回に進む。
+reset_db
+setsid sh -c 'tm=$1
+  trap : TERM
+  echo "0:600:again" | "$tm" add -c "0 * * * *" || exit 1
+  "$tm" activate </dev/null >/dev/null 2>&1 &
+  until "$tm" schedule -A | grep -q "^[0-9]*:[0-9]*:[1-9][0-9]*:.*:again\$"; do
+    sleep 0.1
+  done
+  "$tm" schedule -A | grep ":again\$" | cut -d: -f4 >"$2"
+  "$tm" activate </dev/null >/dev/null 2>&1 &
+  exec sleep 600 >/dev/null 2>&1' sh "$TM" "$TMP_FILE" &
+HOLDERS="$HOLDERS $!"
+
+i=0
+until [ -s "$TMP_FILE" ] &&
+    rec=$("$TM" schedule -A | grep ":again\$") &&
+    [ "$(echo "$rec" | cut -d: -f4)" = $(($(cat "$TMP_FILE") + 3600)) ]; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "second activate: $rec"
+  sleep 0.1
+done
+
+# 有効にした繰り返しスケジュールは、1時間ごとに展開される。
+out=$("$TM" schedule -r -w 86399 | grep ":again\$") || fail "schedule -r"
+expect_eq "$(echo "$out" | head -n 1)" "$(($(cat "$TMP_FILE") + 3600)):600:again" \
+  "first occurrence"
+echo "$out" | while IFS=: read -r s dur caption; do
+  [ $((s % 3600)) -eq 0 ] || false
+done || fail "bad occurrence: $out"
+
+# -wは、重なるスケジュールの終了の通知を受けて、すぐに追加する。
+reset_db
+now=$(date +%s)
+setsid sh -c 'echo "$1:3:busy" | "$0" add && "$0" activate >/dev/null &&
+  exec sleep 600 >/dev/null 2>&1' "$TM" "$now" &
+HOLDERS="$HOLDERS $!"
+i=0
+until "$TM" schedule -r | grep -q ":busy\$"; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "activate busy"
+  sleep 0.1
+done
+expect_status 4 sh -c 'echo "$1:60:later" | "$0" add' "$TM" $((now + 1))
+hold "$((now + 1)):60:later" -w 30
+elapsed=$(( $(date +%s) - now ))
+[ $elapsed -lt 8 ] || fail "add -w took $elapsed sec"
+
+# tm terminateも、プロセスグループの終了を待たずに範囲を解放する。
+reset_db
+now=$(date +%s)
+setsid sh -c 'trap : TERM; echo "$1:600:busy" | "$0" add || exit 1
+  sleep 2; "$0" terminate; exec sleep 600 >/dev/null 2>&1' "$TM" "$now" &
+HOLDERS="$HOLDERS $!"
+i=0
+until "$TM" schedule -a -r | grep -q ":busy\$"; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "add busy"
+  sleep 0.1
+done
+hold "$((now + 60)):60:later" -w 30
+elapsed=$(( $(date +%s) - now ))
+[ $elapsed -lt 8 ] || fail "add -w after terminate took $elapsed sec"
+
+# -Rは、指定した資源だけを占有する。
+reset_db
+begin=$(( ($(date +%s) / 60 + 10) * 60 ))
+hold "$begin:600:tuner" -R tuner
+hold "$begin:600:speaker" -R speaker
+"$TM" schedule -A | grep -q ":res=speaker;id=[0-9][^:]*:speaker\$" || fail "res attribute"
+expect_status 4 sh -c 'echo "$1:60:x" | "$0" add -R tuner,disk' "$TM" "$begin"
+expect_status 4 sh -c 'echo "$1:60:x" | "$0" add' "$TM" "$begin"
+expect_status 2 sh -c 'echo "$1:60:x" | "$0" add -R "a,,b"' "$TM" "$begin"
+out=$(echo "0:0:x" | "$TM" unoccupied -R disk -b "$begin" -r 600) ||
+  fail "unoccupied -R"
+expect_eq "$out" "$begin:600:x" "unoccupied -R"
+
+# -Eは、後ろの空き時間に延長し、後から追加されるスケジュールに合わせて短縮する。
+reset_db
+setsid sh -c 'echo "$1:300:elastic" | "$0" add -E 60:600 &&
+  exec sleep 600 >/dev/null 2>&1' "$TM" "$begin" &
+HOLDERS="$HOLDERS $!"
+i=0
+until rec=$("$TM" schedule -A | grep ":elastic\$"); do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "add -E"
+  sleep 0.1
+done
+case "$rec" in
+  *":$begin:600:min=60;max=600;id="*":elastic") ;;
+  *) fail "grow: $rec" ;;
+esac
+hold "$((begin + 120)):60:booking"
+rec=$("$TM" schedule -A | grep ":elastic\$")
+case "$rec" in
+  *":$begin:120:min=60;max=600;id="*":elastic") ;;
+  *) fail "shrink: $rec" ;;
+esac
+expect_status 4 sh -c 'echo "$1:60:x" | "$0" add' "$TM" $((begin + 30))
+expect_status 2 sh -c 'echo "$1:60:x" | "$0" add -E 120:60' "$TM" $((begin + 900))
+
+# -eは、前の範囲が解放されたら、開始時刻を早める。
+reset_db
+: >"$TMP_FILE"
+now=$(date +%s)
+setsid sh -c 'trap : TERM; echo "$1:600:busy" | "$0" add || exit 1
+  sleep 2; "$0" terminate; exec sleep 600 >/dev/null 2>&1' "$TM" "$now" &
+HOLDERS="$HOLDERS $!"
+i=0
+until "$TM" schedule -a -r | grep -q ":busy\$"; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "add busy"
+  sleep 0.1
+done
+setsid sh -c 'echo "$1:60:early" | "$0" add -e && "$0" activate >/dev/null &&
+  date +%s >"$2" && exec sleep 600 >/dev/null 2>&1' \
+  "$TM" $((now + 600)) "$TMP_FILE" &
+HOLDERS="$HOLDERS $!"
+i=0
+until [ -s "$TMP_FILE" ]; do
+  i=$((i + 1))
+  [ $i -lt 80 ] || fail "add -e did not start early"
+  sleep 0.1
+done
+
+# -aは、先のスケジュールが終わるのを待ち、終わった時点から開始する。
+reset_db
+: >"$TMP_FILE"
+now=$(date +%s)
+setsid sh -c 'trap : TERM; echo "$1:600:first" | "$0" add || exit 1
+  sleep 2; "$0" terminate; exec sleep 600 >/dev/null 2>&1' "$TM" "$now" &
+HOLDERS="$HOLDERS $!"
+i=0
+until "$TM" schedule -a -r | grep -q ":first\$"; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "add first"
+  sleep 0.1
+done
+setsid sh -c 'echo "$1:60:second" | "$0" add -a first && "$0" activate >/dev/null &&
+  date +%s >"$2" && exec sleep 600 >/dev/null 2>&1' \
+  "$TM" $((now + 600)) "$TMP_FILE" &
+HOLDERS="$HOLDERS $!"
+i=0
+until [ -s "$TMP_FILE" ]; do
+  i=$((i + 1))
+  [ $i -lt 80 ] || fail "add -a did not start after first"
+  sleep 0.1
+done
+
+exit 0
@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# tm batchのスモークテスト。
+#
+
+. "$(dirname "$0")/common.sh"
+
+reset_db
+begin=$(( ($(date +%s) / 60 + 10) * 60 ))
+hold "$begin:600:a"
+A=$HOLDER
+hold "$((begin + 1200)):600:b"
+B=$HOLDER
+
+# 後の操作は、前の操作を適用したスケジュールで確認する。
+out=$(printf "move %s %s\nquery %s:600\nquery %s:60\n" \
+  "$B" $((begin + 600)) "$begin" $((begin + 1800)) | "$TM" batch) ||
+  fail "batch"
+expect_eq "$out" "$(printf "1:ok\n2:conflict:%s:a\n3:free" "$A")" "move"
+rec=$("$TM" schedule -a -r | grep ":b\$")
+expect_eq "$rec" "$B:0:0:$((begin + 600)):600:b" "moved record"
+
+# 失敗した操作がある場合は、終了ステータスで知らせる。
+expect_status 3 sh -c 'echo "extend $1 300" | "$0" batch' "$TM" "$A"
+out=$(echo "extend $A 300" | "$TM" batch)
+expect_eq "$out" "1:conflict:$B:b" "extend"
+
+# aオプションでは、成功した操作も取り消す。
+out=$(printf "extend %s 60\nremove 99999\n" "$B" | "$TM" batch -a 2>/dev/null)
+expect_eq "$out" "$(printf "1:rolledback\n2:notfound")" "atomic"
+rec=$("$TM" schedule -a -r | grep ":b\$")
+expect_eq "$rec" "$B:0:0:$((begin + 600)):600:b" "rolled back record"
+
+# 削除する。
+out=$(echo "remove $A" | "$TM" batch) || fail "remove"
+expect_eq "$out" "1:ok" "remove"
+"$TM" schedule -a -r | grep -q ":a\$" && fail "removed record remains"
+
+# 書式の誤りは、何も適用しない。
+expect_status 2 sh -c 'printf "remove $1\nfoo\n" | "$0" batch' "$TM" "$B"
+"$TM" schedule -a -r | grep -q ":b\$" || fail "applied before format error"
+
+exit 0
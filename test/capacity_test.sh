@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# tm capacityのスモークテスト。
+#
+
+. "$(dirname "$0")/common.sh"
+
+reset_db
+expect_eq "$("$TM" capacity)" "1" "default capacity"
+expect_status 2 "$TM" capacity 0
+expect_status 2 "$TM" capacity 65
+
+"$TM" capacity 2 || fail "capacity 2"
+expect_eq "$("$TM" capacity)" "2" "capacity"
+
+# capacity未満の重なりであれば、追加できる。
+begin=$(( ($(date +%s) / 60 + 10) * 60 ))
+hold "$begin:600:a"
+hold "$((begin + 300)):600:b"
+expect_status 4 sh -c 'echo "$1:60:c" | "$0" add' "$TM" $((begin + 400))
+expect_status 0 sh -c 'echo "$1:60:c" | "$0" add' "$TM" $((begin + 600))
+
+# 継続時間が0のスケジュールは、重なりに数えない。
+hold "$((begin + 200)):0:zero"
+out=$("$TM" unoccupied -a -b "$begin" -r 1200) || fail "unoccupied -a"
+expected="$begin:300:TimeManager.
+$((begin + 660)):540:TimeManager."
+expect_eq "$out" "$expected" "unoccupied with capacity"
+
+# 既に重なっている数より小さい値は設定できない。
+expect_status 1 "$TM" capacity 1
+expect_eq "$("$TM" capacity)" "2" "capacity after refusal"
+
+exit 0
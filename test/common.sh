@@ -0,0 +1,75 @@
+# 各テストから読み込む、共通の変数と関数。
+#
+# テストはbin/tmを実行する。データベースを使うテストは、TM_TEST_DB_NUMで
+# 指定した番号(デフォルトは5)のデータベースを初期化して使う。
+
+TOP_DIR=$(cd "$(dirname "$0")/.." && pwd)
+TM="$TOP_DIR/bin/tm"
+
+# 時刻の計算を、実行環境のタイムゾーンに依存させない。
+TZ=UTC
+export TZ
+
+TM_DB_NUM=${TM_TEST_DB_NUM:-5}
+export TM_DB_NUM
+
+# テストを失敗として終了する。
+fail()
+{
+  echo "$0: FAIL: $*" >&2
+  exit 1
+}
+
+# $1が$2と等しいことを確認する。$3は失敗時に表示する説明。
+expect_eq()
+{
+  [ "$1" = "$2" ] || fail "$3: expected '$2', got '$1'"
+}
+
+# コマンドの終了ステータスが$1であることを確認する。
+expect_status()
+{
+  expected=$1
+  shift
+  "$@" >/dev/null 2>&1
+  status=$?
+  [ $status -eq "$expected" ] || fail "$*: expected status $expected, got $status"
+}
+
+# データベースを初期化する。
+reset_db()
+{
+  "$TM" reset || fail "reset"
+}
+
+HOLDERS=""
+
+# 新しいプロセスグループから、$1のスケジュールをtm addで追加する。$2以降は
+# tm addのオプション。プロセスグループはテストの終了まで残り、そのpgid値を
+# HOLDERに設定する。
+hold()
+{
+  setsid sh -c 'tm=$1; sched=$2; shift 2
+    echo "$sched" | "$tm" add "$@" || exit 1
+    exec sleep 600 >/dev/null 2>&1' sh "$TM" "$@" &
+  HOLDER=$!
+  HOLDERS="$HOLDERS $HOLDER"
+
+  i=0
+  until "$TM" schedule -a -r | grep -q -F ":${1#*:}" ; do
+    i=$((i + 1))
+    [ $i -lt 50 ] || fail "hold $*"
+    sleep 0.1
+  done
+}
+
+# holdで作ったプロセスグループを終了させる。
+cleanup()
+{
+  for pgid in $HOLDERS; do
+    kill -TERM -"$pgid" 2>/dev/null
+  done
+  HOLDERS=""
+}
+
+trap cleanup EXIT
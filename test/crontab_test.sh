@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# tm crontabのスモークテスト。
+#
+
+. "$(dirname "$0")/common.sh"
+
+# 1つの時刻指定では、直近の時刻をスケジュールに反映する。
+now=$(date +%s)
+out=$(echo "0:600:news" | "$TM" crontab "* * * * *") || fail "crontab"
+start=${out%%:*}
+[ $((start % 60)) -eq 0 ] && [ "$start" -gt $((now - 60)) ] &&
+  [ "$start" -le $((now + 60)) ] || fail "nearest minute: $out"
+expect_eq "${out#*:}" "600:news" "schedule"
+
+expect_status 3 sh -c 'echo "0:600:x" | "$0" crontab "0 0 31 2 *"' "$TM"
+
+# データベースを使わない場合は、TM_DB_NUMを読まない。
+expect_status 0 sh -c 'echo "0:600:x" | TM_DB_NUM=99 "$0" crontab "* * * * *"' \
+  "$TM"
+
+# 一括処理モードでは、すべての時刻指定の開始時刻を時刻順にまとめて出力する。
+# 範囲には実行時刻の分も含むので、ちょうど1日分になるように1分短くする。
+exprs=$(printf '0 * * * *\t600:A\n30 * * * *\t300:B\n15 */2 * * *\t60:C')
+out=$(echo "$exprs" | "$TM" crontab -b -R 86340) || fail "crontab -b"
+expect_eq "$(echo "$out" | wc -l)" "60" "number of starts"
+echo "$out" | cut -d: -f1 | sort -n -c || fail "not sorted"
+echo "$out" | while IFS=: read -r start dur caption; do
+  case "$caption" in
+    A) [ $((start % 3600)) -eq 0 ] ;;
+    B) [ $((start % 3600)) -eq 1800 ] ;;
+    C) [ $((start % 7200)) -eq 900 ] ;;
+    *) false ;;
+  esac || fail "bad start: $start:$dur:$caption"
+done || exit 1
+
+# スレッドを分けても、出力は変わらない。
+out4=$(echo "$exprs" | "$TM" crontab -b -j 4 -R 86340) || fail "crontab -b -j 4"
+expect_eq "$out4" "$out" "-j 4"
+
+# -eは、各行を前の行の終了後の直近の時刻に配置する。
+out=$(printf '0:300:a\n0:300:b\n' | "$TM" crontab -e "*/10 * * * *") ||
+  fail "crontab -e"
+a=$(echo "$out" | sed -n 1p | cut -d: -f1)
+[ $((a % 600)) -eq 0 ] || fail "crontab -e: $out"
+expect_eq "$(echo "$out" | sed -n 2p)" "$((a + 600)):300:b" "crontab -e"
+expect_status 2 sh -c 'echo "0:600:x" | "$0" crontab -e -k "* * * * *"' "$TM"
+
+# 不正な行は、使用方法の誤りとする。
+expect_status 2 sh -c 'printf "0 * * 99 *\t600:A\n" | "$0" crontab -b' "$TM"
+expect_status 2 sh -c 'printf "no tab\n" | "$0" crontab -b' "$TM"
+
+# -fは、スケジュールと重ならない直近の時刻を取得する。-kは、さらに追加する。
+reset_db
+minute=$(( $(date +%s) / 60 * 60 ))
+hold "$minute:3600:busy"
+out=$(echo "0:600:free" | "$TM" crontab -f "* * * * *") || fail "crontab -f"
+expect_eq "$out" "$((minute + 3600)):600:free" "crontab -f"
+"$TM" schedule -a -r | grep -q ":free\$" && fail "-f must not add"
+out=$(echo "0:600:kept" | "$TM" crontab -k "* * * * *") || fail "crontab -k"
+expect_eq "$out" "$((minute + 3600)):600:kept" "crontab -k"
+"$TM" schedule -a -r | grep -q ":$out\$" || fail "-k must add"
+
+exit 0
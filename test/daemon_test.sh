@@ -0,0 +1,120 @@
+#!/bin/sh
+#
+# tm daemonのスモークテスト。
+#
+
+. "$(dirname "$0")/common.sh"
+
+SOCK_DIR="/tmp/tmd-$(id -u)"
+SOCK="$SOCK_DIR/timemanager$TM_DB_NUM"
+LOG="${TMPDIR:-/tmp}/tm_daemon_test.$$"
+LOG2="$LOG.new"
+
+# デーモンが反映した変更の要求の数。$1はログ(デフォルトは$LOG)。
+daemon_changes()
+{
+  sed -n 's/.*DEBUG: batch:\([0-9]*\) changed:1$/\1/p' "${1:-$LOG}" |
+    awk '{ n += $1 } END { print n + 0 }'
+}
+
+reset_db
+
+"$TM" daemon -v 2>"$LOG" &
+DAEMON=$!
+NEW_DAEMON=""
+trap 'cleanup; kill -TERM $DAEMON $NEW_DAEMON 2>/dev/null; rm -f "$LOG" "$LOG2"' EXIT
+
+i=0
+until [ -S "$SOCK" ]; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "socket"
+  sleep 0.1
+done
+
+# ソケットは、所有者だけが読み書きできるディレクトリに置く。
+expect_eq "$(stat -c %a "$SOCK_DIR")" 700 "socket directory mode"
+
+# 2つ目のデーモンは起動できない。
+expect_status 1 "$TM" daemon
+
+# 追加と読み込みは、デーモンが処理する。
+begin=$(( ($(date +%s) / 60 + 10) * 60 ))
+hold "$begin:600:by daemon"
+[ "$(daemon_changes)" -eq 1 ] || fail "not added by daemon"
+expect_status 4 sh -c 'echo "$1:60:x" | "$0" add' "$TM" $((begin + 60))
+
+# デーモンを使わずに書き込んだ変更も、読み込み直す。
+"$TM" capacity 2 || fail "capacity"
+hold "$((begin + 60)):60:second"
+out=$("$TM" schedule -a -r | grep -c ":by daemon\$\|:second\$")
+expect_eq "$out" 2 "schedules"
+
+# 有効化も、デーモンが処理する。
+reset_db
+now=$(date +%s)
+setsid sh -c 'echo "$1:600:activated" | "$0" add && "$0" activate >/dev/null &&
+  exec sleep 600 >/dev/null 2>&1' "$TM" "$now" &
+HOLDERS="$HOLDERS $!"
+i=0
+until rec=$("$TM" schedule -A | grep ":activated\$") &&
+    [ "$(echo "$rec" | cut -d: -f3)" != 0 ]; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "activate: $rec"
+  sleep 0.1
+done
+[ "$(daemon_changes)" -eq 4 ] || fail "not activated by daemon"
+
+# 同時に追加しても、受付列で順に処理する。
+for n in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+  setsid sh -c 'echo "$1:60:ring" | "$0" add && exec sleep 600 >/dev/null 2>&1' \
+    "$TM" $((now + 600 + n * 60)) &
+  HOLDERS="$HOLDERS $!"
+done
+i=0
+until [ "$("$TM" schedule -a -r | grep -c ":ring\$")" -eq 20 ]; do
+  i=$((i + 1))
+  [ $i -lt 100 ] || fail "concurrent add"
+  sleep 0.1
+done
+[ "$(daemon_changes)" -eq 24 ] || fail "not added by daemon"
+
+# -uは、動いているデーモンからソケットを引き継ぎ、古いデーモンは終了する。
+"$TM" daemon -u -v 2>"$LOG2" &
+NEW_DAEMON=$!
+i=0
+until grep -q "DEBUG: Took over\.$" "$LOG2"; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "take over: $(cat "$LOG2")"
+  sleep 0.1
+done
+wait $DAEMON
+[ -S "$SOCK" ] || fail "socket removed by old daemon"
+
+# 引き継いだ後の変更は、新しいデーモンが処理する。
+hold "$((now + 3000)):60:after handover"
+[ "$(daemon_changes "$LOG2")" -eq 1 ] || fail "not added by new daemon"
+out=$("$TM" schedule -a -r | grep -c ":ring\$\|:after handover\$")
+expect_eq "$out" 21 "schedules after handover"
+
+# 終了すると、ソケットを削除する。
+DAEMON=$NEW_DAEMON
+kill -TERM $DAEMON
+wait $DAEMON
+[ -e "$SOCK" ] && fail "socket remains"
+
+# 置き換えるデーモンがいなければ、そのまま起動する。
+"$TM" daemon -u 2>/dev/null &
+DAEMON=$!
+i=0
+until [ -S "$SOCK" ]; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "daemon -u without daemon"
+  sleep 0.1
+done
+kill -TERM $DAEMON
+wait $DAEMON
+
+# デーモンがいなくても、直接読み書きする。
+expect_status 4 sh -c 'echo "$1:60:x" | "$0" add' "$TM" $((now + 60))
+
+exit 0
@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# tm importとtm exportのスモークテスト。
+#
+
+. "$(dirname "$0")/common.sh"
+
+TMP_FILE=$(mktemp) || fail "mktemp"
+trap 'cleanup; rm -f "$TMP_FILE"' EXIT
+
+reset_db
+begin=$(( ($(date +%s) / 60 + 10) * 60 ))
+hold "$((begin + 600)):600:second"
+B=$HOLDER
+hold "$begin:600:first" -R tuner
+A=$HOLDER
+
+# start値の順に、ロックと有効化の状態を除いて出力する。
+"$TM" export >"$TMP_FILE" || fail "export"
+expect_eq "$(cat "$TMP_FILE")" "$(printf "%s\n%s" \
+  "$A:0:0:$begin:600:res=tuner:first" "$B:0:0:$((begin + 600)):600::second")" \
+  "export"
+
+# 初期化したデータベースに戻す。プロセスグループが残っていれば、そのまま使う。
+reset_db
+out=$("$TM" import <"$TMP_FILE") || fail "import"
+expect_eq "$out" "" "import output"
+"$TM" export | cmp -s - "$TMP_FILE" || fail "restored records"
+
+# 1つでも重複する場合は、何も追加しない。
+expect_status 3 sh -c 'printf "1:0:0:$1:60:x\n2:0:0:$2:60:y\n" | "$0" import' \
+  "$TM" $((begin + 1800)) $((begin + 60))
+"$TM" schedule -a -r | grep -q ":x\$" && fail "imported on conflict"
+
+# 不正なレコードは、何も追加しない。
+expect_status 2 sh -c 'echo "foo" | "$0" import' "$TM"
+
+# 終了したプロセスグループのレコードは、新しいプロセスグループに引き継ぐ。
+cleanup
+reset_db
+out=$("$TM" import <"$TMP_FILE") || fail "import orphans"
+[ "$(echo "$out" | wc -l)" -eq 2 ] || fail "adopted: $out"
+for map in $out; do
+  old=${map%%:*}
+  new=${map#*:}
+  HOLDERS="$HOLDERS $new"
+  [ "$old" = "$A" ] || [ "$old" = "$B" ] || fail "old pgid: $map"
+  kill -0 -"$new" 2>/dev/null || fail "holder: $map"
+done
+out=$("$TM" schedule -a -r | grep -c ":first\$\|:second\$")
+expect_eq "$out" 2 "adopted records"
+
+exit 0
@@ -0,0 +1,192 @@
+/*
+ * libtmのスモークテスト。
+ *
+ * bin/libtm.aをリンクして、公開している関数だけを使う。データベースは
+ * 環境変数TM_DB_NUMの番号のものを使うので、test/libtm_test.shから実行する。
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/tm.h"
+
+/** 同時に追加するスレッドの数 */
+#define NUM_THREADS 4
+
+/** 条件が成り立たない場合は、行番号を出力して失敗する。 */
+#define CHECK(cond)							\
+  do {									\
+    if (!(cond)) {							\
+      fprintf(stderr, "%s:%d: FAIL: %s\n", __FILE__, __LINE__, #cond);	\
+      cleanup();							\
+      exit(EXIT_FAILURE);						\
+    }									\
+  } while (0)
+
+static pid_t children[NUM_THREADS + 3];
+static size_t nchildren = 0;
+static struct tm_handle *g_handle;
+
+/**
+ * @struct adder
+ * @brief スレッドで追加するスケジュールと、その結果。
+ */
+struct adder {
+  struct tm_schedule sched;  /**< 追加するスケジュール */
+  int status;  /**< tm_add()の戻り値 */
+};
+
+
+/**
+ * @brief テストで作成したプロセスグループを終了させる。
+ */
+static void cleanup()
+{
+  size_t i;
+  for (i=0; i<nchildren; i++)
+    killpg(children[i], SIGKILL);
+}
+
+
+/**
+ * @brief スケジュールを所有させるプロセスグループを作成する。
+ * @return 作成したプロセスグループのpgid値を返す。
+ */
+static pid_t spawn_group()
+{
+  pid_t pid = fork();
+  CHECK(pid != -1);
+  if (pid == 0) {
+    setpgid(0, 0);
+    pause();
+    _exit(0);
+  }
+  setpgid(pid, pid);
+  children[nchildren++] = pid;
+
+  return pid;
+}
+
+
+/**
+ * @brief スケジュールを作成する。
+ */
+static void make_schedule(struct tm_schedule *s, pid_t pgid, time_t start,
+			  unsigned int duration, const char *caption)
+{
+  memset(s, 0, sizeof(*s));
+  s->pgid = pgid;
+  s->start = start;
+  s->duration = duration;
+  strcpy(s->caption, caption);
+}
+
+
+/**
+ * @brief スレッドでスケジュールを追加する。
+ */
+static void* run_adder(void *arg)
+{
+  struct adder *a = arg;
+  a->status = tm_add(g_handle, &a->sched, 0, NULL);
+
+  return NULL;
+}
+
+
+int main()
+{
+  struct tm_handle *h;
+  CHECK(tm_open("9", &h) == TM_EINVAL);
+  CHECK(tm_open(NULL, &h) == TM_OK);
+  g_handle = h;
+
+  time_t begin = (time(NULL) / 60 + 20) * 60;
+  pid_t a = spawn_group();
+  pid_t b = spawn_group();
+
+  // 追加したスケジュールは、pgid値で取得できる。
+  struct tm_schedule s, got, conflict;
+  make_schedule(&s, a, begin, 600, "libtm a");
+  CHECK(tm_add(h, &s, 0, NULL) == TM_OK);
+  CHECK(tm_get(h, a, &got) == TM_OK);
+  CHECK(got.start == begin && got.duration == 600 && got.terminator == 0);
+  CHECK(strcmp(got.caption, "libtm a") == 0);
+  CHECK(tm_get(h, b, &got) == TM_NOT_FOUND);
+
+  // 重なる場合は、重なるスケジュールの1つを返す。
+  make_schedule(&s, b, begin + 300, 600, "libtm b");
+  CHECK(tm_add(h, &s, 0, &conflict) == TM_CONFLICT);
+  CHECK(conflict.pgid == a);
+
+  // 前後の空き時間と、最初の空き時間。
+  time_t earlier, later, start, end;
+  CHECK(tm_find_nearest(h, &s, 3600, &earlier, &later) == TM_OK);
+  CHECK(earlier == begin - 600 && later == begin + 600);
+  CHECK(tm_find_free(h, begin, begin + 3600, 600, NULL, 0, &start, &end)
+	== TM_OK);
+  CHECK(start == begin + 600 && end == begin + 3600);
+
+  // 空き時間に確保する。
+  CHECK(tm_reserve(h, &s, begin, begin + 3600, 0, &start, &end) == TM_OK);
+  CHECK(tm_get(h, b, &got) == TM_OK && got.start == begin + 600);
+
+  // 範囲の検索は、開始時刻の順に返す。
+  struct tm_schedule out[2];
+  size_t len;
+  CHECK(tm_query_range(h, begin, begin + 3600, out, 2, &len) == TM_OK);
+  CHECK(len == 2 && out[0].pgid == a && out[1].pgid == b);
+  CHECK(tm_query_range(h, begin, begin + 3600, out, 1, &len)
+	== TM_TRUNCATED);
+  CHECK(len == 2);
+
+  // 有効化は、終了機能のpid値を記録する。
+  CHECK(tm_activate(h, a, b) == TM_OK);
+  CHECK(tm_get(h, a, &got) == TM_OK && got.terminator == b);
+  CHECK(tm_activate(h, a, b) == TM_REFUSED);
+
+  // 予約したスケジュールは、IDで取得できる。有効にできるのは先頭だけ。
+  pid_t c = spawn_group();
+  struct tm_schedule head;
+  make_schedule(&s, c, begin + 1800, 300, "libtm c1");
+  CHECK(tm_add(h, &s, 0, NULL) == TM_OK);
+  make_schedule(&s, c, begin + 2400, 300, "libtm c2");
+  CHECK(tm_add(h, &s, TM_ADD_QUEUE, NULL) == TM_OK);
+  CHECK(tm_get(h, c, &head) == TM_OK && head.id != 0);
+  CHECK(tm_query_range(h, begin + 2400, begin + 2700, out, 2, &len) == TM_OK);
+  CHECK(len == 1 && out[0].pgid == c && out[0].id != head.id);
+  CHECK(tm_get_by_id(h, out[0].id, &got) == TM_OK);
+  CHECK(got.start == begin + 2400 && strcmp(got.caption, "libtm c2") == 0);
+  CHECK(tm_get_by_id(h, 0, &got) == TM_EINVAL);
+  CHECK(tm_activate_by_id(h, out[0].id, b) == TM_REFUSED);
+  CHECK(tm_activate_by_id(h, head.id, b) == TM_OK);
+  CHECK(tm_get_by_id(h, head.id, &got) == TM_OK && got.terminator == b);
+
+  // 同じ範囲に同時に追加しても、追加されるのは1つだけ。
+  begin += 3600;
+  struct adder adders[NUM_THREADS];
+  pthread_t threads[NUM_THREADS];
+  int i, added = 0;
+  for (i=0; i<NUM_THREADS; i++) {
+    make_schedule(&adders[i].sched, spawn_group(), begin, 600, "libtm thread");
+    CHECK(pthread_create(&threads[i], NULL, run_adder, &adders[i]) == 0);
+  }
+  for (i=0; i<NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+    CHECK(adders[i].status == TM_OK || adders[i].status == TM_CONFLICT);
+    added += (adders[i].status == TM_OK);
+  }
+  CHECK(added == 1);
+
+  CHECK(strlen(tm_strerror(TM_CONFLICT)) > 0);
+  tm_close(h);
+  cleanup();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,13 @@
+#!/bin/sh
+#
+# libtmのスモークテスト。make testでビルドしたtest/libtm_testを実行する。
+#
+
+. "$(dirname "$0")/common.sh"
+
+[ -x "$TOP_DIR/test/libtm_test" ] || fail "libtm_test is not built"
+
+reset_db
+"$TOP_DIR/test/libtm_test" || fail "libtm_test"
+
+exit 0
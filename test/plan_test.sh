@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# tm planのスモークテスト。
+#
+
+. "$(dirname "$0")/common.sh"
+
+reset_db
+
+# 空き時間に、互いに重ならないように配置する。出力は入力の順番。
+begin=$(( ($(date +%s) / 60 + 10) * 60 ))
+hold "$begin:600:busy"
+out=$(printf "%s\n%s\n" "$begin:$((begin + 3600)):300:0:A" \
+  "$begin:$((begin + 3600)):600:1:B" | "$TM" plan) || fail "plan"
+expect_eq "$out" "$((begin + 1200)):300:A
+$((begin + 600)):600:B" "placement"
+
+# 配置できないジョブは出力せず、3を返す。
+expect_status 3 sh -c 'echo "$1:$(($1 + 600)):60:0:X" | "$0" plan' "$TM" "$begin"
+out=$(printf "%s\n%s\n" "$begin:$((begin + 1200)):600:0:A" \
+  "$begin:$((begin + 1200)):600:0:B" | "$TM" plan 2>/dev/null)
+expect_eq "$out" "$((begin + 600)):600:A" "not placed"
+
+# 不正なジョブは2を返す。
+expect_status 2 sh -c 'echo "1:2:x" | "$0" plan' "$TM"
+
+# -cは、配置ごとに別のプロセスグループのスケジュールとして追加する。
+out=$(printf "%s\n%s\n" "$begin:$((begin + 3600)):300:0:A" \
+  "$begin:$((begin + 3600)):300:0:B" | "$TM" plan -c) || fail "plan -c"
+expect_eq "$out" "$((begin + 600)):300:A
+$((begin + 900)):300:B" "plan -c"
+a=$("$TM" schedule -A | grep ":A\$" | cut -d: -f1)
+b=$("$TM" schedule -A | grep ":B\$" | cut -d: -f1)
+[ -n "$a" ] && [ -n "$b" ] && [ "$a" != "$b" ] || fail "pgid: '$a' '$b'"
+HOLDERS="$HOLDERS $a $b"
+expect_status 4 sh -c 'echo "$1:60:x" | "$0" add' "$TM" $((begin + 600))
+
+# プロセスグループを終了させると、配置は取り消される。
+kill -TERM -"$a" || fail "kill $a"
+i=0
+while "$TM" schedule -a -r | grep -q ":A\$"; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "cancel"
+  sleep 0.1
+done
+"$TM" schedule -a -r | grep -q ":B\$" || fail "B removed"
+
+exit 0
@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# tm probeのスモークテスト。
+#
+
+. "$(dirname "$0")/common.sh"
+
+reset_db
+
+begin=$(( ($(date +%s) / 60 + 10) * 60 ))
+hold "$begin:600:busy"
+pgid=$HOLDER
+
+# 入力の順番に、重複するかを出力する。重複がある場合は3を返す。
+out=$(printf "%s\n%s\n%s\n" "$((begin - 60)):60" "$((begin + 300)):600" \
+  "$((begin + 600)):60" | "$TM" probe)
+status=$?
+expect_eq "$status" 3 "status"
+expect_eq "$out" "$((begin - 60)):60:free
+$((begin + 300)):600:conflict:$pgid:busy
+$((begin + 600)):60:free" "probe"
+
+# すべて空いている場合は0を返す。
+expect_status 0 sh -c 'echo "$1:60" | "$0" probe' "$TM" $((begin + 600))
+
+# 資源を共有しないスケジュールとは重複しない。
+reset_db
+hold "$begin:600:tuner" -R tuner
+out=$(echo "$begin:60" | "$TM" probe -R speaker) || fail "probe -R"
+expect_eq "$out" "$begin:60:free" "probe -R"
+expect_status 3 sh -c 'echo "$1:60" | "$0" probe -R tuner' "$TM" "$begin"
+
+# capacityが2の場合は、2つ重なるまで空いている。
+reset_db
+"$TM" capacity 2 || fail "capacity"
+hold "$begin:600:a"
+expect_status 0 sh -c 'echo "$1:60" | "$0" probe' "$TM" "$begin"
+hold "$begin:300:b"
+expect_status 3 sh -c 'echo "$1:60" | "$0" probe' "$TM" "$begin"
+expect_status 0 sh -c 'echo "$1:60" | "$0" probe' "$TM" $((begin + 300))
+
+# 不正な候補は2を返す。
+expect_status 2 sh -c 'echo "x" | "$0" probe' "$TM"
+
+exit 0
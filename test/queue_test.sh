@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# tm add -qとスケジュールIDのスモークテスト。
+#
+
+. "$(dirname "$0")/common.sh"
+
+trap cleanup EXIT
+
+# レコードのid属性の値を出力する。
+id_of()
+{
+  "$TM" schedule -A | grep ":$1\$" | sed -n 's/.*[:;]id=\([0-9]*\)[;:].*/\1/p'
+}
+
+reset_db
+begin=$(( ($(date +%s) / 60 + 10) * 60 ))
+
+# 予約したスケジュールは、同じプロセスグループの2つ目のレコードになる。
+setsid sh -c 'tm=$1; begin=$2
+  echo "$begin:600:first" | "$tm" add || exit 1
+  echo "$((begin + 900)):600:second" | "$tm" add -q || exit 1
+  exec sleep 600 >/dev/null 2>&1' sh "$TM" "$begin" &
+Q=$!
+HOLDERS="$HOLDERS $Q"
+i=0
+until "$TM" schedule -a -r | grep -q ":second\$"; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "add -q"
+  sleep 0.1
+done
+out=$("$TM" schedule -a -r | grep ":first\$\|:second\$" | cut -d: -f1,4)
+expect_eq "$out" "$(printf "%s\n%s" "$Q:$begin" "$Q:$((begin + 900))")" \
+  "queued records"
+
+# IDは重ならず、他の書き込みがあっても変わらない。
+first=$(id_of first)
+second=$(id_of second)
+[ -n "$first" ] && [ -n "$second" ] && [ "$first" != "$second" ] ||
+  fail "ids: $first $second"
+hold "$((begin + 3600)):60:other"
+expect_eq "$(id_of first):$(id_of second)" "$first:$second" "stable ids"
+
+# 予約は、最後のスケジュールの終了後に限る。
+expect_status 2 setsid sh -c 'echo "$1:60:x" | "$0" add &&
+  echo "$(($1 + 30)):60:y" | "$0" add -q' "$TM" $((begin + 7200))
+expect_status 2 setsid sh -c 'echo "$1:60:x" | "$0" add -q -c "0 * * * *"' \
+  "$TM" $((begin + 7200))
+
+# IDで指定して取り消すと、そのスケジュールだけを削除する。
+out=$(echo "cancel $second" | "$TM" batch) || fail "batch cancel"
+expect_eq "$out" "1:ok" "batch cancel"
+"$TM" schedule -a -r | grep -q ":second\$" && fail "cancelled"
+expect_eq "$(id_of first)" "$first" "remaining"
+out=$(echo "cancel $second" | "$TM" batch)
+expect_eq "$out" "1:notfound" "cancel twice"
+
+# 先頭のスケジュールが終わると、終了機能は次のスケジュールを有効にし、
+# プロセスグループを終了させない。
+reset_db
+now=$(date +%s)
+setsid sh -c 'tm=$1; now=$2; trap : TERM
+  echo "$now:2:head" | "$tm" add || exit 1
+  echo "$((now + 2)):600:next" | "$tm" add -q || exit 1
+  "$tm" activate >/dev/null || exit 1
+  exec sleep 600 >/dev/null 2>&1' sh "$TM" "$now" &
+Q=$!
+HOLDERS="$HOLDERS $Q"
+i=0
+until rec=$("$TM" schedule -A | grep ":next\$") &&
+    [ "$(echo "$rec" | cut -d: -f3)" != 0 ]; do
+  i=$((i + 1))
+  [ $i -lt 80 ] || fail "handover: $rec"
+  sleep 0.1
+done
+"$TM" schedule -a -r | grep -q ":head\$" && fail "head not removed"
+kill -0 -"$Q" 2>/dev/null || fail "group terminated"
+
+exit 0
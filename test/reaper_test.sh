@@ -0,0 +1,87 @@
+#!/bin/sh
+#
+# reaper(デーモンが終了したプロセスグループのスケジュールを取り除く機能)の
+# スモークテスト。
+#
+
+. "$(dirname "$0")/common.sh"
+
+SHM="/dev/shm/shm_timemanager$TM_DB_NUM"
+SOCK="/tmp/tmd-$(id -u)/timemanager$TM_DB_NUM"
+LOG="${TMPDIR:-/tmp}/tm_reaper_test.$$"
+
+# プロセスの開始時刻(/proc/[pid]/statの22番目の項目)。
+process_start()
+{
+  sed 's/.*) //' "/proc/$1/stat" | cut -d' ' -f20
+}
+
+# $1のcaptionのレコードのst属性を、同じ桁数の別の値に書き換える。
+# pgid値が再利用された場合と同じ状態になる。
+forge_start()
+{
+  st=$(grep -a ":$1\$" "$SHM" | sed -n 's/.*;st=\([0-9]*\):.*/\1/p')
+  [ -n "$st" ] || fail "st of $1"
+  sed -i "s/;st=$st:$1\$/;st=$(echo "$st" | tr 0-9 1-90):$1/" "$SHM" ||
+    fail "forge st of $1"
+}
+
+reset_db
+
+# レコードには、リーダーの開始時刻を記録する。
+begin=$(( ($(date +%s) / 60 + 10) * 60 ))
+hold "$begin:600:leader"
+rec=$("$TM" schedule -A | grep ":leader\$")
+case "$rec" in
+  *";st=$(process_start "$HOLDER"):leader") ;;
+  *) fail "st attribute: $rec" ;;
+esac
+
+# 開始時刻が違う場合は、pgid値が再利用された別のプロセスとみなす。
+forge_start leader
+"$TM" schedule -a -r | grep -q ":leader\$" && fail "reused pgid"
+
+# デーモンは、reaperとしてヘッダに記録する。
+"$TM" daemon -v 2>"$LOG" &
+DAEMON=$!
+trap 'kill -CONT $DAEMON 2>/dev/null; cleanup; kill -TERM $DAEMON 2>/dev/null; rm -f "$LOG"' EXIT
+i=0
+until [ -S "$SOCK" ] && grep -a -q "^#reaper:$DAEMON\$" "$SHM"; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "publish reaper"
+  sleep 0.1
+done
+
+# 開始時刻の違うレコードは、デーモンが取り除く。
+hold "$((begin + 600)):600:reused"
+forge_start reused
+hold "$((begin + 1200)):60:bump" -E 60:60
+i=0
+while "$TM" schedule -a -r | grep -q ":reused\$"; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "not reaped"
+  sleep 0.1
+done
+grep -q "DEBUG: jobs changed:[0-9]*, pruned:1\$" "$LOG" ||
+  fail "not pruned by daemon"
+
+# デーモンが取り除く前でも、終了したプロセスグループの範囲には追加できる。
+hold "$((begin + 1800)):600:dead"
+kill -STOP $DAEMON
+kill -KILL -"$HOLDER"
+i=0
+while kill -0 -"$HOLDER" 2>/dev/null; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "kill holder"
+  sleep 0.1
+done
+expect_status 0 setsid sh -c 'echo "$1:600:x" | "$0" add -E 600:600' \
+  "$TM" $((begin + 1800))
+kill -CONT $DAEMON
+
+# 終了すると、reaperの記録を消す。
+kill -TERM $DAEMON
+wait $DAEMON
+grep -a -q "^#reaper:0\$" "$SHM" || fail "reaper remains"
+
+exit 0
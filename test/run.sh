@@ -0,0 +1,18 @@
+#!/bin/sh
+#
+# test/*_test.shを順に実行する。失敗したテストの数を終了ステータスとする。
+#
+
+cd "$(dirname "$0")" || exit 1
+
+failed=0
+for t in *_test.sh; do
+  if sh "$t"; then
+    echo "PASS: $t"
+  else
+    echo "FAIL: $t"
+    failed=$((failed + 1))
+  fi
+done
+
+exit $failed
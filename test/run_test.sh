@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# tm runのスモークテスト。
+#
+
+. "$(dirname "$0")/common.sh"
+
+SOCK="/tmp/tmd-$(id -u)/timemanager$TM_DB_NUM"
+SPOOL_DIR="/tmp/tm_spool-$(id -u)"
+OUT=$(mktemp) || fail "mktemp"
+
+# captionのレコードのpgid値を出力する。
+pgid_of()
+{
+  "$TM" schedule -a -r | grep ":$1\$" | cut -d: -f1
+}
+
+reset_db
+
+# デーモンが動いていない場合は、予約しない。
+expect_status 1 sh -c 'echo "$(($(date +%s) + 60)):60:x" | "$0" run -- true' \
+  "$TM"
+
+"$TM" daemon 2>/dev/null &
+DAEMON=$!
+trap 'cleanup; kill -TERM $DAEMON 2>/dev/null; rm -f "$OUT"' EXIT
+i=0
+until [ -S "$SOCK" ]; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "socket"
+  sleep 0.1
+done
+
+# 起動するまでは、負のpgid値のレコードとスプールファイルだけを使う。
+now=$(date +%s)
+id=$(echo "$((now + 2)):3:job" |
+  "$TM" run -o "$OUT" -- sh -c 'echo started; exec sleep 60') || fail "run"
+case "$(pgid_of job)" in
+  -*) ;;
+  *) fail "pending pgid: $(pgid_of job)" ;;
+esac
+[ -f "$SPOOL_DIR/$TM_DB_NUM/$id" ] || fail "spool file"
+expect_eq "$(stat -c %a "$SPOOL_DIR")" 700 "spool directory mode"
+expect_eq "$(stat -c %a "$SPOOL_DIR/$TM_DB_NUM")" 700 "spool subdirectory mode"
+expect_status 3 sh -c 'echo "$1:60:x" | "$0" run -- true' "$TM" $((now + 3))
+
+# 開始時刻に新しいプロセスグループで起動し、終了時刻に終了させる。
+i=0
+until grep -q started "$OUT"; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "not started"
+  sleep 0.1
+done
+pgid=$(pgid_of job)
+[ "$pgid" -gt 0 ] && kill -0 -"$pgid" 2>/dev/null || fail "job group: $pgid"
+i=0
+while kill -0 -"$pgid" 2>/dev/null; do
+  i=$((i + 1))
+  [ $i -lt 80 ] || fail "not terminated"
+  sleep 0.1
+done
+[ -e "$SPOOL_DIR/$TM_DB_NUM/$id" ] && fail "spool file left"
+
+# 終了時刻の前に終わったジョブは、スケジュールを取り除く。
+now=$(date +%s)
+echo "$((now + 1)):600:short" | "$TM" run -- true >/dev/null || fail "run short"
+i=0
+until [ -z "$("$TM" schedule -a -r | grep ":short\$")" ]; do
+  i=$((i + 1))
+  [ $i -lt 50 ] || fail "finished job not removed"
+  sleep 0.1
+done
+hold "$((now + 60)):60:after short"
+
+# 他のユーザーが読み書きできるスプールディレクトリは使わない。
+chmod 755 "$SPOOL_DIR"
+expect_status 1 sh -c 'echo "$1:60:x" | "$0" run -- true' "$TM" $((now + 300))
+chmod 700 "$SPOOL_DIR"
+
+exit 0
@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# tm unoccupiedのスモークテスト。
+#
+
+. "$(dirname "$0")/common.sh"
+
+reset_db
+begin=$(( ($(date +%s) / 60 + 10) * 60 ))
+hold "$((begin + 600)):600:busy"
+
+# 継続時間が0の場合は、空き時間全体を使用する。
+out=$(echo "0:0:x" | "$TM" unoccupied -b "$begin" -r 3600) || fail "unoccupied"
+expect_eq "$out" "$begin:600:x" "unoccupied"
+
+# 収まる空き時間がない場合は、3を返す。
+expect_status 3 sh -c 'echo "0:700:x" | "$0" unoccupied -b "$1" -r 1200' \
+  "$TM" "$begin"
+
+# -eは、すべての行を順に空き時間に配置する。
+out=$(printf '0:300:a\n0:300:b\n0:600:c\n0:0:d\n' |
+  "$TM" unoccupied -e -b "$begin" -r 3600) || fail "unoccupied -e"
+expected="$begin:300:a
+$((begin + 300)):300:b
+$((begin + 1200)):600:c
+$((begin + 1800)):1800:d"
+expect_eq "$out" "$expected" "unoccupied -e"
+
+# -aは、すべての空き時間を出力する。-mより短い空き時間は除き、-nで数を制限する。
+out=$("$TM" unoccupied -a -b "$begin" -r 3600) || fail "unoccupied -a"
+expected="$begin:600:TimeManager.
+$((begin + 1200)):2400:TimeManager."
+expect_eq "$out" "$expected" "unoccupied -a"
+out=$("$TM" unoccupied -a -m 601 -b "$begin" -r 3600) || fail "-m"
+expect_eq "$out" "$((begin + 1200)):2400:TimeManager." "unoccupied -a -m"
+out=$("$TM" unoccupied -a -j -n 1 -b "$begin" -r 3600) || fail "-n"
+expect_eq "$out" \
+  "{\"start\":$begin,\"end\":$((begin + 600)),\"duration\":600}" \
+  "unoccupied -a -j -n"
+
+for value in -1 abc 10x 99999999999; do
+  expect_status 2 "$TM" unoccupied -a -m "$value"
+  expect_status 2 "$TM" unoccupied -a -n "$value"
+done
+
+# -kは、見つかった空き時間に自プロセスグループのスケジュールを追加する。
+for sched in 0:300:first 0:700:second; do
+  setsid sh -c 'echo "$1" | "$0" unoccupied -k -b "$2" -r 3600 >/dev/null &&
+    exec sleep 600 >/dev/null 2>&1' "$TM" "$sched" "$begin" &
+  HOLDERS="$HOLDERS $!"
+  i=0
+  until "$TM" schedule -a -r | grep -q ":${sched##*:}\$"; do
+    i=$((i + 1))
+    [ $i -lt 50 ] || fail "unoccupied -k $sched"
+    sleep 0.1
+  done
+done
+out=$("$TM" schedule -a -r | grep -E ":(first|second)\$" | cut -d: -f4-)
+expected="$begin:300:first
+$((begin + 1200)):700:second"
+expect_eq "$out" "$expected" "unoccupied -k"
+expect_status 2 "$TM" unoccupied -e -k
+
+exit 0